@@ -6,8 +6,10 @@
 struct MeshRenderableComponent;
 struct CameraComponent;
 struct RigidbodyComponent;
+struct RenderMeshComponent;
 
 #define FOREACH_CORE_COMPONENT_TYPE(ACTION) \
     ACTION(MeshRenderableComponent) \
     ACTION(CameraComponent) \
-    ACTION(RigidbodyComponent)
\ No newline at end of file
+    ACTION(RigidbodyComponent) \
+    ACTION(RenderMeshComponent)
\ No newline at end of file
@@ -13,13 +13,20 @@ class RenderingPipeline;
 
 struct RenderableObject
 {
-	Mesh* mesh;
-	Material* material;
 	glm::mat4 model_matrix;
 	geometry::Bounds aabb;
 	std::vector<glm::mat4> bones;
 };
 
+// Consecutive renderable objects that are drawn with the same mesh and material.
+struct RenderableBatch
+{
+	Mesh* mesh;
+	Material* material;
+	std::size_t first_object_index;
+	std::size_t object_count;
+};
+
 struct CameraParams {
 	glm::mat4 view_projection_matrix;
 	geometry::Rect viewport_rect;
@@ -28,6 +35,6 @@ struct CameraParams {
 class IRenderer {
 public:
 	virtual void PreloadRenderingPipeline(const std::shared_ptr<RenderingPipeline>& pipeline) = 0;
-	virtual void RenderFrame(const CameraParams& camera_params, const std::vector<RenderableObject>& renderable_objects) = 0;
+	virtual void RenderFrame(const CameraParams& camera_params, const std::vector<RenderableBatch>& renderable_batches, const std::vector<RenderableObject>& renderable_objects) = 0;
 	virtual void Cleanup() = 0;
 };
\ No newline at end of file
@@ -1,267 +1,997 @@
 #pragma once
 
+#include <cstring>
 #include <vector>
+#include <memory>
+#include <new>
 #include <unordered_map>
 #include <functional>
 #include <algorithm>
-
-#include <core/utils/type_id_mapper.h>
-
-#include "component_array.h"
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "change_filter.h"
+#include "chunk_pool.h"
+#include "component_column.h"
+#include "component_mask.h"
+#include "component_storage.h"
+#include "component_type.h"
 #include "entity.h"
+#include "entity_records.h"
+#include "shared_component.h"
 
 namespace ecs {
-	typedef uint32_t ComponentTypeID;
-	// Always in order Least->Greatest
-	typedef std::vector<ComponentTypeID> ComponentSetIDs;
-
+	/*
+	* Entities of an archetype are stored in fixed-size chunks taken from a
+	* ChunkPool. Each chunk holds the entity ids and every component column for
+	* up to ChunkCapacity() entities (SoA within the chunk). Entities are kept
+	* densely packed, so every chunk except for the last one is always full.
+	*
+	* Every column keeps the change version at which it was last written per
+	* chunk, so that iterations with Changed filters can skip whole chunks.
+	*
+	* Columns are type-erased ComponentColumns, so moving entities between
+	* archetypes relocates raw component memory through per-type functions,
+	* a run of rows at a time where possible.
+	*
+	* Shared components are not stored in the chunks. The archetype holds a
+	* single value of each, which is passed for every entity.
+	*
+	* The row of every entity is tracked in an EntityRecords table. Archetypes
+	* created by a Registry share the registry's table. A standalone archetype
+	* creates its own, which is shared with archetypes initialized from it.
+	*/
 	class Archetype
 	{
 	public:
 		Archetype() {
-			component_type_id_mapper_ = nullptr;
+			entity_records_ = nullptr;
+			chunk_pool_ = &ChunkPool::Shared();
+			static const ChangeVersion initial_change_version = 1;
+			change_version_ = &initial_change_version;
+			chunk_capacity_ = 0;
+			entity_count_ = 0;
 		};
 
 		~Archetype() {
-			for (ComponentArrayBase* component_array : component_arrays_) {
-				delete component_array;
+			for (ComponentColumn& column : columns_) {
+				column.DestroyRange(0, entity_count_);
+			}
+			for (unsigned char* chunk : chunks_) {
+				chunk_pool_->ReleaseChunk(chunk);
 			}
 		}
 
+		// The archetype owns its chunks, which its columns are bound to.
+		Archetype(const Archetype&) = delete;
+
+		Archetype& operator=(const Archetype&) = delete;
+
 		template<class... Ts>
-		void InitializeWithComponentSet(TypeIDMapper* component_type_id_mapper)
+		void InitializeWithComponentSet(EntityRecords* entity_records = nullptr)
 		{
-			// Sort component set ids and arrays from least -> greatest.
-			std::vector<ComponentTypeID> unsorted_component_set_ids = { ((std::uint64_t)component_type_id_mapper->GetTypeId<Ts>())... };
-			std::vector<ComponentArrayBase*> unsorted_component_arrays = { (new ComponentArray<Ts>())... };
-			std::vector<std::pair<ComponentTypeID, ComponentArrayBase*>> sorted_component_type_array_pairs;
-			sorted_component_type_array_pairs.reserve(unsorted_component_set_ids.size());
-			for (std::size_t index = 0; index < unsorted_component_set_ids.size(); ++index) {
-				sorted_component_type_array_pairs.push_back(std::make_pair(unsorted_component_set_ids[index], unsorted_component_arrays[index]));
-			}
-			std::sort(sorted_component_type_array_pairs.begin(), sorted_component_type_array_pairs.end());
+			// Sort component set ids from least -> greatest.
+			ecs::ComponentSetIDs component_set_ids = { ComponentTypeRegistry::TypeIDOf<Ts>()... };
+			std::sort(component_set_ids.begin(), component_set_ids.end());
 
 			// Set archetype component data.
-			component_type_id_mapper_ = component_type_id_mapper;
-			component_set_ids_.reserve(sorted_component_type_array_pairs.size());
-			component_arrays_.reserve(sorted_component_type_array_pairs.size());
-			for (std::size_t index = 0; index < sorted_component_type_array_pairs.size(); ++index) {
-				component_type_index_map_.insert(std::make_pair(sorted_component_type_array_pairs[index].first, index));
-				component_set_ids_.push_back(sorted_component_type_array_pairs[index].first);
-				component_arrays_.push_back(sorted_component_type_array_pairs[index].second);
+			if (entity_records) {
+				entity_records_ = entity_records;
+			}
+			else {
+				owned_entity_records_ = std::make_shared<EntityRecords>();
+				entity_records_ = owned_entity_records_.get();
 			}
+			InitializeColumns(component_set_ids);
 		}
 
 		template<class T>
-		void InitializeWithArchetypeAndAddedComponentType(TypeIDMapper* component_type_id_mapper, Archetype& source_archetype)
-		{
-			const ComponentTypeID added_component_type = component_type_id_mapper->GetTypeId<T>();
-
-			component_type_id_mapper_ = component_type_id_mapper;
-			component_set_ids_.reserve(source_archetype.component_set_ids_.size() + 1);
-			component_arrays_.reserve(source_archetype.component_arrays_.size() + 1);
-			auto insert_component_array = [this](ComponentArrayBase* comp_array, ComponentTypeID component_type) {
-				std::size_t index = component_set_ids_.size();
-				component_type_index_map_.insert(std::make_pair(component_type, index));
-				component_set_ids_.push_back(component_type);
-				component_arrays_.push_back(comp_array);
-			};
-
-			bool has_inserted_added_component = false;
-			for (std::size_t c_idx = 0; c_idx < source_archetype.component_set_ids_.size(); ++c_idx) {
-				if (added_component_type < source_archetype.component_set_ids_[c_idx] && !has_inserted_added_component) {
-					insert_component_array(new ComponentArray<T>(), added_component_type);
-					has_inserted_added_component = true;
-				}
-				insert_component_array(source_archetype.component_arrays_[c_idx]->Empty(), component_set_ids_[c_idx]);
-			}
-			if (!has_inserted_added_component) {
-				insert_component_array(new ComponentArray<T>(), added_component_type);
-			}
+		void InitializeWithArchetypeAndAddedComponentType(Archetype& source_archetype)
+		{
+			const ComponentTypeID added_component_type = ComponentTypeRegistry::TypeIDOf<T>();
+
+			entity_records_ = source_archetype.entity_records_;
+			owned_entity_records_ = source_archetype.owned_entity_records_;
+			chunk_pool_ = source_archetype.chunk_pool_;
+			change_version_ = source_archetype.change_version_;
+			ecs::ComponentSetIDs component_set_ids = source_archetype.component_set_ids_;
+			component_set_ids.insert(std::upper_bound(component_set_ids.begin(), component_set_ids.end(), added_component_type), added_component_type);
+			InitializeColumns(component_set_ids);
+		}
+
+		// Initializes the archetype with the component types of source_archetype,
+		// i.e. to hold different shared components.
+		void InitializeWithArchetypeComponentSet(Archetype& source_archetype)
+		{
+			entity_records_ = source_archetype.entity_records_;
+			owned_entity_records_ = source_archetype.owned_entity_records_;
+			chunk_pool_ = source_archetype.chunk_pool_;
+			change_version_ = source_archetype.change_version_;
+			InitializeColumns(source_archetype.component_set_ids_);
 		}
 
 		template<class T>
-		void InitializeWithArchetypeAndRemovedComponentType(TypeIDMapper* component_type_id_mapper, Archetype& source_archetype)
-		{
-			const ComponentTypeID removed_component_type = component_type_id_mapper->GetTypeId<T>();
-
-			component_type_id_mapper_ = component_type_id_mapper;
-			component_set_ids_.reserve(source_archetype.component_set_ids_.size() - 1);
-			component_arrays_.reserve(source_archetype.component_arrays_.size() - 1);
-			for (std::size_t c_idx = 0; c_idx < source_archetype.component_set_ids_.size(); ++c_idx) {
-				if (source_archetype.component_set_ids_[c_idx] != removed_component_type) {
-					component_type_index_map_.insert({ source_archetype.component_set_ids_[c_idx], component_set_ids_.size() });
-					component_set_ids_.push_back(source_archetype.component_set_ids_[c_idx]);
-					component_arrays_.push_back(source_archetype.component_arrays_[c_idx]->Empty());
-				}
-			}
+		void InitializeWithArchetypeAndRemovedComponentType(Archetype& source_archetype)
+		{
+			const ComponentTypeID removed_component_type = ComponentTypeRegistry::TypeIDOf<T>();
+
+			entity_records_ = source_archetype.entity_records_;
+			owned_entity_records_ = source_archetype.owned_entity_records_;
+			chunk_pool_ = source_archetype.chunk_pool_;
+			change_version_ = source_archetype.change_version_;
+			ecs::ComponentSetIDs component_set_ids = source_archetype.component_set_ids_;
+			component_set_ids.erase(std::remove(component_set_ids.begin(), component_set_ids.end(), removed_component_type), component_set_ids.end());
+			InitializeColumns(component_set_ids);
+		}
+
+		// Must be called before the archetype is initialized.
+		void SetChunkPool(ChunkPool* chunk_pool)
+		{
+			chunk_pool_ = chunk_pool;
+		}
+
+		ChunkPool* GetChunkPool() const
+		{
+			return chunk_pool_;
+		}
+
+		// Sets the counter that writes are stamped with, i.e. that of the registry
+		// that owns the archetype. Must be called before the archetype is initialized.
+		void SetChangeVersion(const ChangeVersion* change_version)
+		{
+			change_version_ = change_version;
+		}
+
+		// Sets the shared components, in order of their types, whose values must
+		// outlive the archetype. Must be called before the archetype is initialized.
+		void SetSharedComponents(const std::vector<SharedComponent>& shared_components)
+		{
+			shared_components_ = shared_components;
 		}
 
 		template<class T>
-		void MoveEntityToSuperArchetype(EntityID entity_id, Archetype& super_archetype, T added_component)
+		void MoveEntityToSuperArchetype(EntityID entity_id, Archetype& super_archetype, const T& added_component)
 		{
-			std::size_t index = entity_components_index_map_[entity_id.index];
-			ComponentTypeID added_component_type = component_type_id_mapper_->GetTypeId<T>();
-			for (std::size_t c_idx = 0; c_idx < super_archetype.component_set_ids_.size(); ++c_idx) {
-				if (super_archetype.component_set_ids_[c_idx] == added_component_type) {
-					ComponentArray<T>* casted_existing_component_array = static_cast<ComponentArray<T> *>(super_archetype.component_arrays_[c_idx]);
-					casted_existing_component_array->Append(added_component);
-				}
-				else if (super_archetype.component_set_ids_[c_idx] > added_component_type) {
-					super_archetype.component_arrays_[c_idx]->AppendComponentFromArrayAtIndex(component_arrays_[c_idx - 1], index);
-					component_arrays_[c_idx - 1]->RemoveWithSwapAtIndex(index);
-				}
-				else {
-					super_archetype.component_arrays_[c_idx]->AppendComponentFromArrayAtIndex(component_arrays_[c_idx], index);
-					component_arrays_[c_idx]->RemoveWithSwapAtIndex(index);
-				}
-			}
-			super_archetype.entity_components_index_map_.insert(std::make_pair(entity_id.index, super_archetype.entity_ids_.size()));
-			super_archetype.entity_ids_.push_back(entity_id);
-			entity_components_index_map_.erase(entity_id.index);
-			if (index < entity_ids_.size() - 1) {
-				entity_components_index_map_[entity_ids_.back().index] = index;
-				entity_ids_[index] = entity_ids_.back();
-			}
-			entity_ids_.pop_back();
+			MoveEntityToSuperArchetypeWithBlock<T>(entity_id, super_archetype, [&added_component](void* address) {
+				new (address) T(added_component);
+			});
+		}
+
+		template<class T>
+		void MoveEntityToSuperArchetype(EntityID entity_id, Archetype& super_archetype, T&& added_component)
+		{
+			MoveEntityToSuperArchetypeWithBlock<T>(entity_id, super_archetype, [&added_component](void* address) {
+				new (address) T(std::move(added_component));
+			});
 		}
 
 		template<class T>
 		void MoveEntityToSubArchetype(EntityID entity_id, Archetype& sub_archetype)
 		{
-			std::size_t index = entity_components_index_map_[entity_id.index];
-			ComponentTypeID removed_component_type = component_type_id_mapper_->GetTypeId<T>();
-			for (std::size_t c_idx = 0; c_idx < component_arrays_.size(); ++c_idx) {
+			const std::size_t index = (*entity_records_)[entity_id.index].row;
+			ComponentTypeID removed_component_type = ComponentTypeRegistry::TypeIDOf<T>();
+			sub_archetype.ReserveChunkForNextEntity();
+			for (std::size_t c_idx = 0; c_idx < columns_.size(); ++c_idx) {
 				if (component_set_ids_[c_idx] == removed_component_type) {
-					component_arrays_[c_idx]->RemoveWithSwapAtIndex(index);
+					columns_[c_idx].DestroyRange(index, 1);
 				}
 				else if (component_set_ids_[c_idx] > removed_component_type) {
-					sub_archetype.component_arrays_[c_idx - 1]->AppendComponentFromArrayAtIndex(component_arrays_[c_idx], index);
-					component_arrays_[c_idx]->RemoveWithSwapAtIndex(index);
+					columns_[c_idx].RelocateAtIndex(index, sub_archetype.columns_[c_idx - 1], sub_archetype.entity_count_);
 				}
 				else {
-					sub_archetype.component_arrays_[c_idx]->AppendComponentFromArrayAtIndex(component_arrays_[c_idx], index);
-					component_arrays_[c_idx]->RemoveWithSwapAtIndex(index);
+					columns_[c_idx].RelocateAtIndex(index, sub_archetype.columns_[c_idx], sub_archetype.entity_count_);
 				}
 			}
-			sub_archetype.entity_ids_.push_back(entity_ids_[index]);
-			entity_components_index_map_.erase(entity_id.index);
-			if (index < entity_ids_.size() - 1) {
-				entity_components_index_map_[entity_ids_.back().index] = index;
-				entity_ids_[index] = entity_ids_.back();
-			}
-			entity_ids_.pop_back();
+			FillRowWithLast(index);
+			RemoveEntityIDWithSwapAtIndex(index);
+			sub_archetype.AppendEntityID(entity_id);
+		}
+
+		/*
+		* Moves every entity in entity_ids, which must be distinct entities of
+		* this archetype, to super_archetype, which has the component type T in
+		* addition to the types of this archetype. construct_added(i, T* component)
+		* must construct the added component of entity_ids[i] in place, and must
+		* not throw. See MigrateEntities.
+		*/
+		template<class T, class F>
+		void MoveEntitiesToSuperArchetype(const EntityID* entity_ids, std::size_t count, Archetype& super_archetype, F&& construct_added)
+		{
+			MigrateEntities(entity_ids, count, &super_archetype, [&construct_added](std::size_t i, void* address) {
+				construct_added(i, static_cast<T*>(address));
+			});
+		}
+
+		// Moves every entity in entity_ids to sub_archetype, which lacks one of
+		// the component types of this archetype. See MigrateEntities.
+		void MoveEntitiesToSubArchetype(const EntityID* entity_ids, std::size_t count, Archetype& sub_archetype)
+		{
+			MigrateEntities(entity_ids, count, &sub_archetype, [](std::size_t i, void* address) {});
+		}
+
+		// Moves every entity in entity_ids to archetype, which has the same
+		// component types but other shared components. See MigrateEntities.
+		void MoveEntitiesToArchetype(const EntityID* entity_ids, std::size_t count, Archetype& archetype)
+		{
+			MigrateEntities(entity_ids, count, &archetype, [](std::size_t i, void* address) {});
 		}
 
 		template<class... Ts>
 		void AddEntity(EntityID entity_id, Ts ...components)
 		{
-			std::vector<ComponentTypeID> added_component_types = { ((std::uint32_t)component_type_id_mapper_->GetTypeId<Ts>())... };
-			std::sort(component_set_ids_.begin(), component_set_ids_.end());
-			if (component_set_ids_ != component_set_ids_) {
-				throw std::runtime_error("Number and order of specified components must match that of Archetype.");
-			}
+			CheckComponentSet<Ts...>();
+			ReserveChunkForNextEntity();
+			AddComponents<Ts...>(std::move(components)...);
+			AppendEntityID(entity_id);
+		}
 
-			AddComponents<Ts...>(components...);
-			entity_components_index_map_.insert(std::make_pair(entity_id.index, entity_ids_.size()));
-			entity_ids_.push_back(entity_id);
+		/*
+		* Adds count entities at once. Every component is default-constructed in
+		* place, after which init(i, Ts& ...components) is called for the i-th
+		* entity to set up its components. Chunks for every entity are reserved
+		* up front and filled one after the other. init must not throw.
+		*/
+		template<class... Ts, class F>
+		void AddEntities(const EntityID* entity_ids, std::size_t count, F&& init)
+		{
+			CheckComponentSet<Ts...>();
+			AppendEntitiesWithBlock<Ts...>(entity_ids, count, [&init](std::size_t i, Ts* ...components) {
+				const int expansion[] = { 0, (new (components) Ts(), 0)... };
+				(void)expansion;
+				init(i, *components...);
+			});
+		}
+
+		// Adds count entities whose components are copies of prototypes.
+		template<class... Ts>
+		void AddEntityCopies(const EntityID* entity_ids, std::size_t count, const Ts& ...prototypes)
+		{
+			CheckComponentSet<Ts...>();
+			AppendEntitiesWithBlock<Ts...>(entity_ids, count, [&](std::size_t i, Ts* ...components) {
+				const int expansion[] = { 0, (new (components) Ts(prototypes), 0)... };
+				(void)expansion;
+			});
 		}
 
 		void RemoveEntity(EntityID entity_id)
 		{
-			const std::size_t index = entity_components_index_map_[entity_id.index];
-			for (std::size_t c_idx = 0; c_idx < component_arrays_.size(); ++c_idx) {
-				component_arrays_[c_idx]->RemoveWithSwapAtIndex(index);
-			}
-			entity_components_index_map_.erase(entity_id.index);
-			if (index < entity_ids_.size() - 1) {
-				entity_components_index_map_[entity_ids_.back().index] = index;
-				entity_ids_[index] = entity_ids_.back();
+			const std::size_t index = (*entity_records_)[entity_id.index].row;
+			for (ComponentColumn& column : columns_) {
+				column.DestroyRange(index, 1);
 			}
-			entity_ids_.pop_back();
+			FillRowWithLast(index);
+			RemoveEntityIDWithSwapAtIndex(index);
 		}
 
-		const ComponentSetIDs& ComponentSetIDs() {
+		// Removes every entity in entity_ids, which must be distinct entities of this archetype.
+		void RemoveEntities(const EntityID* entity_ids, std::size_t count)
+		{
+			MigrateEntities(entity_ids, count, nullptr, [](std::size_t i, void* address) {});
+		}
+
+		// Types of the components stored in the chunks, which excludes the shared components.
+		const ecs::ComponentSetIDs& ComponentSetIDs() {
 			return component_set_ids_;
 		}
 
-		const std::vector<EntityID>& Entities() {
-			return entity_ids_;
+		// In order of their types.
+		const std::vector<SharedComponent>& SharedComponents() const {
+			return shared_components_;
+		}
+
+		// Value of the shared component of the type, or nullptr if there is none.
+		const void* FindSharedComponent(ComponentTypeID component_type) const {
+			for (const SharedComponent& shared_component : shared_components_) {
+				if (shared_component.component_type == component_type) {
+					return shared_component.value;
+				}
+			}
+			return nullptr;
+		}
+
+		template<class T>
+		const T* GetSharedComponent() const {
+			static_assert(IsSharedComponent<T>::value, "Component type is not shared.");
+			return static_cast<const T*>(FindSharedComponent(ComponentTypeRegistry::TypeIDOf<T>()));
+		}
+
+		const ComponentMask& GetComponentMask() const {
+			return component_mask_;
+		}
+
+		std::size_t EntityCount() const {
+			return entity_count_;
+		}
+
+		EntityID EntityAtIndex(std::size_t index) const {
+			return EntityIDsInChunk(index / chunk_capacity_)[index % chunk_capacity_];
+		}
+
+		std::vector<EntityID> Entities() const {
+			std::vector<EntityID> entity_ids;
+			entity_ids.reserve(entity_count_);
+			for (std::size_t chunk_index = 0; chunk_index < chunks_.size(); ++chunk_index) {
+				const EntityID* chunk_entity_ids = EntityIDsInChunk(chunk_index);
+				entity_ids.insert(entity_ids.end(), chunk_entity_ids, chunk_entity_ids + EntityCountInChunk(chunk_index));
+			}
+			return entity_ids;
+		}
+
+		// Maximum number of entities that fit in a single chunk of this archetype.
+		std::size_t ChunkCapacity() const {
+			return chunk_capacity_;
+		}
+
+		std::size_t ChunkCount() const {
+			return chunks_.size();
+		}
+
+		bool HasComponentType(ComponentTypeID component_type) const {
+			return std::binary_search(component_set_ids_.begin(), component_set_ids_.end(), component_type);
+		}
+
+		/*
+		* Archetypes form a graph whose edges are the archetypes reached by adding
+		* or removing a single component type. The edges are cached lazily by the
+		* registry the first time a transition is made. Returns nullptr if the
+		* transition has not been cached yet.
+		*/
+		Archetype* ArchetypeAfterAddingComponentType(ComponentTypeID component_type) const {
+			const std::unordered_map<ComponentTypeID, Archetype*>::const_iterator edge_iter = add_edges_.find(component_type);
+			return edge_iter != add_edges_.end() ? edge_iter->second : nullptr;
+		}
+
+		Archetype* ArchetypeAfterRemovingComponentType(ComponentTypeID component_type) const {
+			const std::unordered_map<ComponentTypeID, Archetype*>::const_iterator edge_iter = remove_edges_.find(component_type);
+			return edge_iter != remove_edges_.end() ? edge_iter->second : nullptr;
+		}
+
+		// Caches the edge to super_archetype, which has component_type in addition to
+		// this archetype's component types, along with the opposite edge back.
+		void LinkSuperArchetype(ComponentTypeID component_type, Archetype* super_archetype) {
+			add_edges_[component_type] = super_archetype;
+			super_archetype->remove_edges_[component_type] = this;
+		}
+
+		/*
+		* Moves chunks to fuller slabs of the chunk pool, so that the emptier
+		* slabs can be returned to the heap. Entities keep their rows. Returns
+		* the number of chunks moved.
+		*/
+		std::size_t DefragmentChunks() {
+			std::size_t moved_chunk_count = 0;
+			for (std::size_t chunk_index = 0; chunk_index < chunks_.size(); ++chunk_index) {
+				unsigned char* relocated_chunk = chunk_pool_->AllocateChunkForRelocation(chunks_[chunk_index]);
+				if (!relocated_chunk) {
+					continue;
+				}
+				const std::size_t chunk_entity_count = EntityCountInChunk(chunk_index);
+				std::memcpy(relocated_chunk, EntityIDsInChunk(chunk_index), chunk_entity_count * sizeof(EntityID));
+				for (ComponentColumn& column : columns_) {
+					column.RelocateChunk(chunk_index, relocated_chunk, chunk_entity_count);
+				}
+				chunk_pool_->ReleaseChunk(chunks_[chunk_index]);
+				chunks_[chunk_index] = relocated_chunk;
+				moved_chunk_count++;
+			}
+			return moved_chunk_count;
+		}
+
+		// Releases the spare capacity that the archetype keeps for later
+		// changes. Returns the number of bytes released.
+		std::size_t ShrinkToFit() {
+			std::size_t released_bytes = ShrinkVectorToFit(chunks_);
+			for (ComponentColumn& column : columns_) {
+				released_bytes += column.ShrinkToFit();
+			}
+			// The migration scratch space is refilled by every migration.
+			migration_rows_.clear();
+			migration_columns_.clear();
+			released_bytes += ShrinkVectorToFit(migration_rows_);
+			released_bytes += ShrinkVectorToFit(migration_columns_);
+			return released_bytes;
+		}
+
+		// Removes every cached edge to and from this archetype. Must be called
+		// before the archetype is destroyed.
+		void UnlinkArchetypeEdges() {
+			for (const std::pair<const ComponentTypeID, Archetype*>& edge : add_edges_) {
+				edge.second->remove_edges_.erase(edge.first);
+			}
+			for (const std::pair<const ComponentTypeID, Archetype*>& edge : remove_edges_) {
+				edge.second->add_edges_.erase(edge.first);
+			}
+			add_edges_.clear();
+			remove_edges_.clear();
 		}
 
 		template<class T>
 		bool GetComponentForEntity(EntityID entity_id, T*& component)
 		{
-			ComponentArray<T>* const component_array = FindComponentArray<T>();
-			if (!component_array) {
-				return false;
-			}
-			const std::size_t index = entity_components_index_map_[entity_id.index];
-			component = &component_array->ComponentAtIndex(index);
-			return true;
+			return GetComponentAtRow<T>((*entity_records_)[entity_id.index].row, component);
+		}
+
+		// Fetching a non-const component counts as writing it. Shared components
+		// can only be fetched as const.
+		template<class T>
+		bool GetComponentAtRow(std::size_t row, T*& component)
+		{
+			return GetComponentAtRow<T>(row, component, IsSharedComponent<typename std::remove_const<T>::type>());
 		}
 
 		template<class... Ts>
-		bool GetComponentSetForEntity(EntityID entity_id, Ts&... components)
+		bool GetComponentSetForEntity(EntityID entity_id, Ts*&... components)
 		{
-			const int num_components = sizeof(Ts);
-			bool found[num_components] = { GetComponentForEntity(components...) };
-			for (int i = 0; i < num_components; ++i) {
-				if (!found[i]) {
+			const bool found[] = { true, GetComponentForEntity<Ts>(entity_id, components)... };
+			for (bool component_found : found) {
+				if (!component_found) {
 					return false;
 				}
 			}
 			return true;
 		}
 
+		/*
+		* Calls f(entity_ids, count, Ts* ...columns) once per chunk, where
+		* columns[i] are the components of entity_ids[i]. Columns are plain
+		* arrays, so simple kernels over them can be vectorized by the compiler.
+		* Component types may be const-qualified for read-only access; columns
+		* of the other types are marked as written. Chunks that fail the Changed
+		* filters of Ts for changes after changed_since are skipped. Shared
+		* components, which must be const, are passed as a pointer to the
+		* single value rather than a column; see QueriedRow.
+		*/
+		template<class... Ts, class F>
+		void EachChunk(F&& f, ChangeVersion changed_since = 0)
+		{
+			EachChunkInRange<Ts...>(0, chunks_.size(), f, changed_since);
+		}
+
+		// Same as EachChunk, for the chunks in [chunk_begin, chunk_end).
+		template<class... Ts, class F>
+		void EachChunkInRange(std::size_t chunk_begin, std::size_t chunk_end, F&& f, ChangeVersion changed_since = 0)
+		{
+			[this, chunk_begin, chunk_end, changed_since, &f](typename ColumnOf<Ts>::type ...queried_columns) {
+				// Stream through the chunks one at a time so that every column is read linearly.
+				for (std::size_t chunk_index = chunk_begin; chunk_index < chunk_end; ++chunk_index) {
+					if (!PassesChangeFilters<Ts...>(chunk_index, changed_since, queried_columns...)) {
+						continue;
+					}
+					const int expansion[] = { 0, (MarkColumnWritten<QueriedComponent<Ts>>(queried_columns, chunk_index), 0)... };
+					(void)expansion;
+					f(EntityIDsInChunk(chunk_index), EntityCountInChunk(chunk_index), ComponentsInChunk<QueriedComponent<Ts>>(queried_columns, chunk_index)...);
+				}
+			}(QueriedColumn<Ts>(IsSharedComponent<StoredComponent<Ts>>())...);
+		}
+
+		// Calls f(entity_id, Ts& ...components) for every entity. f is inlined
+		// into the loop rather than called through std::function.
+		template<class... Ts, class F>
+		void Each(F&& f, ChangeVersion changed_since = 0)
+		{
+			EachChunk<Ts...>([&f](const EntityID* entity_ids, std::size_t count, QueriedComponent<Ts>* ...queried_components) {
+				for (std::size_t e_idx = 0; e_idx < count; ++e_idx) {
+					f(entity_ids[e_idx], queried_components[QueriedRow<Ts>(e_idx)]...);
+				}
+			}, changed_since);
+		}
+
 		template<class... Ts>
 		void EnumerateComponentsWithBlock(std::function<void(EntityID entity_id, Ts&...)> block)
 		{
-			[block](std::vector<EntityID>& entity_ids, ComponentArray<Ts>* ...queried_component_arrays) {
-				for (std::size_t e_idx = 0; e_idx < entity_ids.size(); ++e_idx) {
-					block(entity_ids[e_idx], queried_component_arrays->ComponentAtIndex(e_idx)...);
-				}
-			}(entity_ids_, FindComponentArray<Ts>()...);
+			Each<Ts...>(block);
 		}
 
 	private:
 		ecs::ComponentSetIDs component_set_ids_;
 
-		std::vector<ComponentArrayBase*> component_arrays_;
+		// Includes the types of the shared components.
+		ComponentMask component_mask_;
+
+		std::vector<SharedComponent> shared_components_;
+
+		// In the order of component_set_ids_.
+		std::vector<ComponentColumn> columns_;
+
+		std::vector<unsigned char*> chunks_;
+
+		std::size_t chunk_capacity_;
+
+		std::size_t entity_count_;
+
+		EntityRecords* entity_records_;
+
+		std::shared_ptr<EntityRecords> owned_entity_records_;
+
 
-		std::vector<EntityID> entity_ids_;
+		ChunkPool* chunk_pool_;
 
-		std::unordered_map<std::uint32_t, std::size_t> entity_components_index_map_;
+		const ChangeVersion* change_version_;
 
-		std::unordered_map<ComponentTypeID, std::size_t> component_type_index_map_;
+		std::unordered_map<ComponentTypeID, Archetype*> add_edges_;
 
-		TypeIDMapper* component_type_id_mapper_;
+		std::unordered_map<ComponentTypeID, Archetype*> remove_edges_;
 
+		// Rows of the entities being migrated, paired with their positions in
+		// the batch, and the destination column of every column. Kept to avoid
+		// allocating on every migration.
+		std::vector<std::pair<std::size_t, std::size_t>> migration_rows_;
+		std::vector<std::size_t> migration_columns_;
+
+		// Column parameter type for every component type of a pack. Shared
+		// components are passed as their value.
 		template<class T>
-		ComponentArray<T>* FindComponentArray()
+		struct ColumnOf {
+			typedef typename std::conditional<IsSharedComponent<StoredComponent<T>>::value, const void*, ComponentColumn*>::type type;
+		};
+
+		void InitializeColumns(const ecs::ComponentSetIDs& component_set_ids)
 		{
-			const ComponentTypeID component_type = component_type_id_mapper_->GetTypeId<T>();
-			const std::unordered_map<ComponentTypeID, std::size_t>::iterator component_array_index_iter = component_type_index_map_.find(component_type);
-			if (component_array_index_iter == component_type_index_map_.end()) {
-				return nullptr;
+			component_set_ids_ = component_set_ids;
+			columns_.reserve(component_set_ids.size());
+			for (ComponentTypeID component_type : component_set_ids) {
+				columns_.emplace_back(component_type);
+			}
+			component_mask_ = ComponentMask(component_set_ids_);
+			for (const SharedComponent& shared_component : shared_components_) {
+				component_mask_.Set(shared_component.component_type);
 			}
-			return static_cast<ComponentArray<T> *>(component_arrays_[component_array_index_iter->second]);
+			LayoutChunkColumns();
 		}
 
+		static std::size_t AlignedColumnOffset(std::size_t offset)
+		{
+			return (offset + ECS_CHUNK_ALIGNMENT - 1) & ~(std::size_t)(ECS_CHUNK_ALIGNMENT - 1);
+		}
+
+		/*
+		* Chooses the largest number of entities per chunk such that the entity id
+		* column followed by every component column, each starting on a cache line,
+		* fits in ECS_CHUNK_SIZE bytes.
+		*/
+		void LayoutChunkColumns()
+		{
+			std::size_t row_size = sizeof(EntityID);
+			for (const ComponentColumn& column : columns_) {
+				if (column.TypeInfo().alignment > ECS_CHUNK_ALIGNMENT) {
+					throw std::runtime_error("Component alignment exceeds archetype chunk alignment.");
+				}
+				row_size += column.TypeInfo().size;
+			}
+
+			std::size_t chunk_capacity = ECS_CHUNK_SIZE / row_size;
+			std::vector<std::size_t> column_offsets(columns_.size());
+			while (chunk_capacity > 0) {
+				std::size_t offset = sizeof(EntityID) * chunk_capacity;
+				for (std::size_t c_idx = 0; c_idx < columns_.size(); ++c_idx) {
+					column_offsets[c_idx] = AlignedColumnOffset(offset);
+					offset = column_offsets[c_idx] + columns_[c_idx].TypeInfo().size * chunk_capacity;
+				}
+				if (offset <= ECS_CHUNK_SIZE) {
+					break;
+				}
+				chunk_capacity--;
+			}
+			if (chunk_capacity == 0) {
+				throw std::runtime_error("Component set is too large to fit in an archetype chunk.");
+			}
+
+			chunk_capacity_ = chunk_capacity;
+			for (std::size_t c_idx = 0; c_idx < columns_.size(); ++c_idx) {
+				columns_[c_idx].BindToChunks(&chunks_, chunk_capacity_, column_offsets[c_idx]);
+			}
+		}
+
+		EntityID* EntityIDsInChunk(std::size_t chunk_index) const
+		{
+			// The entity id column is always at the start of a chunk.
+			return reinterpret_cast<EntityID*>(chunks_[chunk_index]);
+		}
+
+		std::size_t EntityCountInChunk(std::size_t chunk_index) const
+		{
+			return std::min(chunk_capacity_, entity_count_ - chunk_index * chunk_capacity_);
+		}
+
+		// Ensures that there is a chunk with room for one more entity.
+		void ReserveChunkForNextEntity()
+		{
+			if (entity_count_ == chunks_.size() * chunk_capacity_) {
+				AddChunk();
+			}
+		}
+
+		void AddChunk()
+		{
+			chunks_.push_back(chunk_pool_->AllocateChunk());
+			for (ComponentColumn& column : columns_) {
+				column.AddChunkVersion(*change_version_);
+			}
+		}
+
+		void ReleaseLastChunk()
+		{
+			chunk_pool_->ReleaseChunk(chunks_.back());
+			chunks_.pop_back();
+			for (ComponentColumn& column : columns_) {
+				column.RemoveLastChunkVersion();
+			}
+		}
+
+		// Marks every column of the chunk as written, i.e. after rows were added or moved.
+		void MarkChunkChanged(std::size_t chunk_index)
+		{
+			for (ComponentColumn& column : columns_) {
+				column.MarkChunkChanged(chunk_index, *change_version_);
+			}
+		}
+
+		template<class T>
+		void MarkColumnWritten(ComponentColumn* column, std::size_t chunk_index)
+		{
+			if (!std::is_const<T>::value) {
+				column->MarkChunkChanged(chunk_index, *change_version_);
+			}
+		}
+
+		// Shared components are read-only.
+		template<class T>
+		void MarkColumnWritten(const void* shared_component, std::size_t chunk_index)
+		{
+		}
+
+		template<class T>
+		ComponentColumn* QueriedColumn(std::false_type)
+		{
+			return FindColumn<StoredComponent<T>>();
+		}
+
+		template<class T>
+		const void* QueriedColumn(std::true_type)
+		{
+			static_assert(std::is_const<QueriedComponent<T>>::value, "Shared components are read-only, so they must be queried as const.");
+			static_assert(!QueriedComponentType<T>::is_change_filter, "Shared components do not support change filters.");
+			return FindSharedComponent(ComponentTypeRegistry::TypeIDOf<StoredComponent<T>>());
+		}
+
+		template<class T>
+		static T* ComponentsInChunk(ComponentColumn* column, std::size_t chunk_index)
+		{
+			return reinterpret_cast<T*>(column->ColumnInChunk(chunk_index));
+		}
+
+		template<class T>
+		static T* ComponentsInChunk(const void* shared_component, std::size_t chunk_index)
+		{
+			return static_cast<T*>(shared_component);
+		}
+
+		static ChangeVersion ChunkVersionOf(ComponentColumn* column, std::size_t chunk_index)
+		{
+			return column->ChunkVersion(chunk_index);
+		}
+
+		static ChangeVersion ChunkVersionOf(const void* shared_component, std::size_t chunk_index)
+		{
+			return 0;
+		}
+
+		template<class T>
+		bool GetComponentAtRow(std::size_t row, T*& component, std::false_type)
+		{
+			ComponentColumn* const column = FindColumn<typename std::remove_const<T>::type>();
+			if (!column) {
+				return false;
+			}
+			MarkColumnWritten<T>(column, row / chunk_capacity_);
+			component = &column->ComponentAtIndex<T>(row);
+			return true;
+		}
+
+		template<class T>
+		bool GetComponentAtRow(std::size_t row, T*& component, std::true_type)
+		{
+			static_assert(std::is_const<T>::value, "Shared components are read-only, so they must be fetched as const.");
+			component = static_cast<T*>(FindSharedComponent(ComponentTypeRegistry::TypeIDOf<typename std::remove_const<T>::type>()));
+			return component != nullptr;
+		}
+
+		// Whether the chunk passes the Changed filters among Ts. Passes if there are none.
 		template<class... Ts>
-		void AddComponents(Ts... components);
+		static bool PassesChangeFilters(std::size_t chunk_index, ChangeVersion changed_since, typename ColumnOf<Ts>::type ...columns)
+		{
+			bool has_change_filter = false;
+			bool has_changed = false;
+			const int expansion[] = { 0, (
+				QueriedComponentType<Ts>::is_change_filter
+					? (has_change_filter = true, has_changed = has_changed || ChunkVersionOf(columns, chunk_index) > changed_since, 0)
+					: 0
+			)... };
+			(void)expansion;
+			return !has_change_filter || has_changed;
+		}
 
-		template<>
-		void AddComponents() {}
+		template<class... Ts>
+		void CheckComponentSet()
+		{
+			std::vector<ComponentTypeID> added_component_types = { ComponentTypeRegistry::TypeIDOf<Ts>()... };
+			std::sort(added_component_types.begin(), added_component_types.end());
+			if (added_component_types != component_set_ids_) {
+				throw std::runtime_error("Number and order of specified components must match that of Archetype.");
+			}
+		}
 
-		template<class T, class... Ts>
-		void AddComponents(T component, Ts... components) {
-			ComponentArray<T>* component_array = FindComponentArray<T>();
-			component_array->Append(component);
-			AddComponents<Ts...>(components...);
+		// Moves the entity's components to super_archetype, where
+		// construct_added(void* address) constructs the added component of type T.
+		template<class T, class F>
+		void MoveEntityToSuperArchetypeWithBlock(EntityID entity_id, Archetype& super_archetype, F&& construct_added)
+		{
+			const std::size_t index = (*entity_records_)[entity_id.index].row;
+			ComponentTypeID added_component_type = ComponentTypeRegistry::TypeIDOf<T>();
+			super_archetype.ReserveChunkForNextEntity();
+			const std::size_t super_index = super_archetype.entity_count_;
+			for (std::size_t c_idx = 0; c_idx < super_archetype.component_set_ids_.size(); ++c_idx) {
+				if (super_archetype.component_set_ids_[c_idx] == added_component_type) {
+					construct_added(super_archetype.columns_[c_idx].AddressAtIndex(super_index));
+				}
+				else if (super_archetype.component_set_ids_[c_idx] > added_component_type) {
+					columns_[c_idx - 1].RelocateAtIndex(index, super_archetype.columns_[c_idx], super_index);
+				}
+				else {
+					columns_[c_idx].RelocateAtIndex(index, super_archetype.columns_[c_idx], super_index);
+				}
+			}
+			FillRowWithLast(index);
+			RemoveEntityIDWithSwapAtIndex(index);
+			super_archetype.AppendEntityID(entity_id);
 		}
-	};
 
-}
+		/*
+		* Moves the entities to the end of destination, or removes them if
+		* destination is nullptr. Components of types that destination lacks are
+		* destroyed, and construct_added(i, void* address) constructs the
+		* component of entity_ids[i] of the type that only destination has, if
+		* any. Runs of consecutive rows are moved with a single relocation per
+		* column. The rows left behind are then filled with the last entities of
+		* the archetype, again a run at a time.
+		*/
+		template<class F>
+		void MigrateEntities(const EntityID* entity_ids, std::size_t count, Archetype* destination, F&& construct_added)
+		{
+			if (count == 0) {
+				return;
+			}
+			std::vector<std::pair<std::size_t, std::size_t>>& rows = migration_rows_;
+			rows.clear();
+			for (std::size_t e_idx = 0; e_idx < count; ++e_idx) {
+				rows.push_back(std::make_pair((*entity_records_)[entity_ids[e_idx].index].row, e_idx));
+			}
+			std::sort(rows.begin(), rows.end());
+
+			// Column of destination that every column moves to, and the column that
+			// only destination has.
+			const std::size_t no_column = ~(std::size_t)0;
+			std::vector<std::size_t>& destination_columns = migration_columns_;
+			destination_columns.assign(columns_.size(), no_column);
+			std::size_t added_column = no_column;
+			std::size_t first_destination_row = 0;
+			if (destination) {
+				std::size_t d_idx = 0;
+				for (std::size_t c_idx = 0; c_idx < columns_.size(); ++c_idx) {
+					for (; d_idx < destination->columns_.size() && destination->component_set_ids_[d_idx] < component_set_ids_[c_idx]; ++d_idx) {
+						added_column = d_idx;
+					}
+					if (d_idx < destination->columns_.size() && destination->component_set_ids_[d_idx] == component_set_ids_[c_idx]) {
+						destination_columns[c_idx] = d_idx++;
+					}
+				}
+				if (d_idx < destination->columns_.size()) {
+					added_column = d_idx;
+				}
+				while (destination->chunks_.size() * destination->chunk_capacity_ < destination->entity_count_ + count) {
+					destination->AddChunk();
+				}
+				first_destination_row = destination->entity_count_;
+			}
+
+			std::size_t run_begin = 0;
+			while (run_begin < rows.size()) {
+				std::size_t run_end = run_begin + 1;
+				while (run_end < rows.size() && rows[run_end].first == rows[run_end - 1].first + 1) {
+					run_end++;
+				}
+				for (std::size_t c_idx = 0; c_idx < columns_.size(); ++c_idx) {
+					if (destination_columns[c_idx] != no_column) {
+						columns_[c_idx].RelocateRange(rows[run_begin].first, destination->columns_[destination_columns[c_idx]], first_destination_row + run_begin, run_end - run_begin);
+					}
+					else {
+						columns_[c_idx].DestroyRange(rows[run_begin].first, run_end - run_begin);
+					}
+				}
+				run_begin = run_end;
+			}
+
+			if (destination) {
+				for (std::size_t r_idx = 0; r_idx < rows.size(); ++r_idx) {
+					const std::size_t destination_row = first_destination_row + r_idx;
+					if (added_column != no_column) {
+						construct_added(rows[r_idx].second, destination->columns_[added_column].AddressAtIndex(destination_row));
+					}
+					const EntityID entity_id = entity_ids[rows[r_idx].second];
+					destination->EntityIDsInChunk(destination_row / destination->chunk_capacity_)[destination_row % destination->chunk_capacity_] = entity_id;
+					(*destination->entity_records_)[entity_id.index] = { destination, destination_row };
+				}
+				destination->entity_count_ += count;
+				for (std::size_t chunk_index = first_destination_row / destination->chunk_capacity_; chunk_index < destination->chunks_.size(); ++chunk_index) {
+					destination->MarkChunkChanged(chunk_index);
+				}
+			}
+			else {
+				for (std::size_t e_idx = 0; e_idx < count; ++e_idx) {
+					(*entity_records_)[entity_ids[e_idx].index] = { nullptr, 0 };
+				}
+			}
+			FillRowsWithLast(rows);
+		}
+
+		/*
+		* Fills the vacated rows, which are sorted, with the last entities of the
+		* archetype, and drops the vacated rows from the entity count.
+		*/
+		void FillRowsWithLast(const std::vector<std::pair<std::size_t, std::size_t>>& vacated_rows)
+		{
+			const std::size_t entity_count = entity_count_ - vacated_rows.size();
+			// Vacated rows at or past entity_count are skipped when picking the rows to fill with.
+			std::size_t tail_v_idx = std::lower_bound(vacated_rows.begin(), vacated_rows.end(), std::make_pair(entity_count, (std::size_t)0)) - vacated_rows.begin();
+			std::size_t source_row = entity_count;
+			std::size_t run_source_row = 0;
+			std::size_t run_destination_row = 0;
+			std::size_t run_length = 0;
+			std::size_t last_changed_chunk = chunks_.size();
+			for (std::size_t v_idx = 0; v_idx < vacated_rows.size() && vacated_rows[v_idx].first < entity_count; ++v_idx) {
+				while (tail_v_idx < vacated_rows.size() && vacated_rows[tail_v_idx].first == source_row) {
+					tail_v_idx++;
+					source_row++;
+				}
+				const std::size_t destination_row = vacated_rows[v_idx].first;
+				if (run_length > 0 && (source_row != run_source_row + run_length || destination_row != run_destination_row + run_length)) {
+					RelocateRowsWithinArchetype(run_source_row, run_destination_row, run_length);
+					run_length = 0;
+				}
+				if (run_length == 0) {
+					run_source_row = source_row;
+					run_destination_row = destination_row;
+				}
+				run_length++;
+
+				const EntityID entity_id = EntityAtIndex(source_row);
+				EntityIDsInChunk(destination_row / chunk_capacity_)[destination_row % chunk_capacity_] = entity_id;
+				(*entity_records_)[entity_id.index].row = destination_row;
+				if (destination_row / chunk_capacity_ != last_changed_chunk) {
+					last_changed_chunk = destination_row / chunk_capacity_;
+					MarkChunkChanged(last_changed_chunk);
+				}
+				source_row++;
+			}
+			if (run_length > 0) {
+				RelocateRowsWithinArchetype(run_source_row, run_destination_row, run_length);
+			}
+
+			entity_count_ = entity_count;
+			// Return the chunks that no longer hold any entities to the pool.
+			while (!chunks_.empty() && (chunks_.size() - 1) * chunk_capacity_ >= entity_count_) {
+				ReleaseLastChunk();
+			}
+		}
+
+		void RelocateRowsWithinArchetype(std::size_t source_row, std::size_t destination_row, std::size_t count)
+		{
+			for (ComponentColumn& column : columns_) {
+				column.RelocateRange(source_row, column, destination_row, count);
+			}
+		}
+
+		// Moves the components of the last entity into the vacated row at index, if
+		// it is not the last row. The entity id is moved by RemoveEntityIDWithSwapAtIndex.
+		void FillRowWithLast(std::size_t index)
+		{
+			if (index < entity_count_ - 1) {
+				for (ComponentColumn& column : columns_) {
+					column.RelocateAtIndex(entity_count_ - 1, column, index);
+				}
+			}
+		}
 
+		/*
+		* Appends count entities. construct(i, Ts* ...components) must construct
+		* the components of the i-th entity in place. Rows are filled a chunk at
+		* a time, so that columns are written linearly.
+		*/
+		template<class... Ts, class F>
+		void AppendEntitiesWithBlock(const EntityID* entity_ids, std::size_t count, F&& construct)
+		{
+			if (count == 0) {
+				return;
+			}
+			while (chunks_.size() * chunk_capacity_ < entity_count_ + count) {
+				AddChunk();
+			}
+			entity_records_->Reserve(std::max_element(entity_ids, entity_ids + count, [](const EntityID& a, const EntityID& b) {
+				return a.index < b.index;
+			})->index);
+
+			std::size_t e_idx = 0;
+			while (e_idx < count) {
+				const std::size_t chunk_index = entity_count_ / chunk_capacity_;
+				const std::size_t first_row = entity_count_ % chunk_capacity_;
+				const std::size_t row_count = std::min(count - e_idx, chunk_capacity_ - first_row);
+				[&](Ts* ...columns) {
+					for (std::size_t row = 0; row < row_count; ++row) {
+						construct(e_idx + row, (columns + row)...);
+					}
+				}(static_cast<Ts*>(FindColumn<Ts>()->AddressAtIndex(entity_count_))...);
+
+				MarkChunkChanged(chunk_index);
+				EntityID* chunk_entity_ids = EntityIDsInChunk(chunk_index);
+				for (std::size_t row = 0; row < row_count; ++row) {
+					const EntityID entity_id = entity_ids[e_idx + row];
+					chunk_entity_ids[first_row + row] = entity_id;
+					(*entity_records_)[entity_id.index] = { this, entity_count_ + row };
+				}
+				entity_count_ += row_count;
+				e_idx += row_count;
+			}
+		}
+
+		// Component data for the entity must have already been appended.
+		void AppendEntityID(EntityID entity_id)
+		{
+			EntityIDsInChunk(entity_count_ / chunk_capacity_)[entity_count_ % chunk_capacity_] = entity_id;
+			MarkChunkChanged(entity_count_ / chunk_capacity_);
+			entity_records_->Reserve(entity_id.index);
+			(*entity_records_)[entity_id.index] = { this, entity_count_ };
+			entity_count_++;
+		}
 
+		// Component data for the entity must have already been removed.
+		void RemoveEntityIDWithSwapAtIndex(std::size_t index)
+		{
+			const EntityID entity_id = EntityAtIndex(index);
+			const EntityID last_entity_id = EntityAtIndex(entity_count_ - 1);
+			(*entity_records_)[entity_id.index] = { nullptr, 0 };
+			if (index < entity_count_ - 1) {
+				(*entity_records_)[last_entity_id.index].row = index;
+				EntityIDsInChunk(index / chunk_capacity_)[index % chunk_capacity_] = last_entity_id;
+				MarkChunkChanged(index / chunk_capacity_);
+			}
+			entity_count_--;
+
+			// Return the last chunk to the pool once it no longer holds any entities.
+			if (entity_count_ == (chunks_.size() - 1) * chunk_capacity_) {
+				ReleaseLastChunk();
+			}
+		}
+
+		template<class T>
+		ComponentColumn* FindColumn()
+		{
+			// Component sets are small and sorted, so a binary search beats hashing here.
+			const ComponentTypeID component_type = ComponentTypeRegistry::TypeIDOf<T>();
+			const ecs::ComponentSetIDs::const_iterator component_type_iter = std::lower_bound(component_set_ids_.begin(), component_set_ids_.end(), component_type);
+			if (component_type_iter == component_set_ids_.end() || *component_type_iter != component_type) {
+				return nullptr;
+			}
+			return &columns_[component_type_iter - component_set_ids_.begin()];
+		}
+
+		// Constructs the components of the next entity, for which a chunk must be reserved.
+		template<class... Ts>
+		void AddComponents(Ts&&... components)
+		{
+			const int expansion[] = { 0, (new (FindColumn<Ts>()->AddressAtIndex(entity_count_)) Ts(std::move(components)), 0)... };
+			(void)expansion;
+		}
+	};
+
+}
@@ -0,0 +1,144 @@
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <core/utils/benchmark_helpers.h>
+#include "../archetype.h"
+
+using namespace ecs;
+
+struct Position
+{
+    float x, y, z;
+};
+
+struct Velocity
+{
+    float x, y, z;
+};
+
+struct Health
+{
+    int value;
+};
+
+// Replica of the previous archetype layout: one std::vector per component, and
+// an unordered_map from entity index to row. Kept here as the baseline that the
+// chunked layout is compared against.
+class VectorArchetype
+{
+public:
+    void AddEntity(EntityID entity_id, Position position, Velocity velocity, Health health)
+    {
+        entity_components_index_map_.insert(std::make_pair(entity_id.index, entity_ids_.size()));
+        entity_ids_.push_back(entity_id);
+        positions_.push_back(position);
+        velocities_.push_back(velocity);
+        healths_.push_back(health);
+    }
+
+    void EnumerateComponentsWithBlock(std::function<void(EntityID, Position&, Velocity&)> block)
+    {
+        for (std::size_t e_idx = 0; e_idx < entity_ids_.size(); ++e_idx) {
+            block(entity_ids_[e_idx], positions_[e_idx], velocities_[e_idx]);
+        }
+    }
+
+private:
+    std::vector<EntityID> entity_ids_;
+    std::vector<Position> positions_;
+    std::vector<Velocity> velocities_;
+    std::vector<Health> healths_;
+    std::unordered_map<std::uint32_t, std::size_t> entity_components_index_map_;
+};
+
+static std::unique_ptr<Archetype> CreateChunkedArchetype()
+{
+    std::unique_ptr<Archetype> archetype(new Archetype());
+    archetype->InitializeWithComponentSet<Position, Velocity, Health>();
+    return archetype;
+}
+
+static void IntegratePosition(EntityID entity_id, Position& position, Velocity& velocity)
+{
+    position.x += velocity.x * 0.016f;
+    position.y += velocity.y * 0.016f;
+    position.z += velocity.z * 0.016f;
+}
+
+BENCHMARK_CASE(archetype_storage, vector_layout_insertion, 10000, 100000, 1000000)
+{
+    std::unique_ptr<VectorArchetype> archetype;
+    state.Measure([&]() {
+        for (std::size_t i = 0; i < state.N(); ++i) {
+            archetype->AddEntity({ 0, (EntityIndex)i }, { 0, 0, 0 }, { 1, 1, 1 }, { 100 });
+        }
+    }, [&]() {
+        archetype.reset(new VectorArchetype());
+    });
+}
+
+BENCHMARK_CASE(archetype_storage, chunked_layout_insertion, 10000, 100000, 1000000)
+{
+    std::unique_ptr<Archetype> archetype;
+    state.Measure([&]() {
+        for (std::size_t i = 0; i < state.N(); ++i) {
+            archetype->AddEntity<Position, Velocity, Health>({ 0, (EntityIndex)i }, { 0, 0, 0 }, { 1, 1, 1 }, { 100 });
+        }
+    }, [&]() {
+        archetype.reset();
+        archetype = CreateChunkedArchetype();
+    });
+}
+
+BENCHMARK_CASE(archetype_storage, vector_layout_iteration, 10000, 100000, 1000000)
+{
+    VectorArchetype archetype;
+    for (std::size_t i = 0; i < state.N(); ++i) {
+        archetype.AddEntity({ 0, (EntityIndex)i }, { 0, 0, 0 }, { 1, 1, 1 }, { 100 });
+    }
+    state.Measure([&]() {
+        archetype.EnumerateComponentsWithBlock(&IntegratePosition);
+    });
+}
+
+BENCHMARK_CASE(archetype_storage, chunked_layout_iteration, 10000, 100000, 1000000)
+{
+    std::unique_ptr<Archetype> archetype = CreateChunkedArchetype();
+    for (std::size_t i = 0; i < state.N(); ++i) {
+        archetype->AddEntity<Position, Velocity, Health>({ 0, (EntityIndex)i }, { 0, 0, 0 }, { 1, 1, 1 }, { 100 });
+    }
+    std::function<void(EntityID, Position&, Velocity&)> block = &IntegratePosition;
+    state.Measure([&]() {
+        archetype->EnumerateComponentsWithBlock<Position, Velocity>(block);
+    });
+}
+
+BENCHMARK_CASE(archetype_storage, chunked_layout_each, 10000, 100000, 1000000)
+{
+    std::unique_ptr<Archetype> archetype = CreateChunkedArchetype();
+    for (std::size_t i = 0; i < state.N(); ++i) {
+        archetype->AddEntity<Position, Velocity, Health>({ 0, (EntityIndex)i }, { 0, 0, 0 }, { 1, 1, 1 }, { 100 });
+    }
+    state.Measure([&]() {
+        archetype->Each<Position, Velocity>(&IntegratePosition);
+    });
+}
+
+BENCHMARK_CASE(archetype_storage, chunked_layout_each_chunk, 10000, 100000, 1000000)
+{
+    std::unique_ptr<Archetype> archetype = CreateChunkedArchetype();
+    for (std::size_t i = 0; i < state.N(); ++i) {
+        archetype->AddEntity<Position, Velocity, Health>({ 0, (EntityIndex)i }, { 0, 0, 0 }, { 1, 1, 1 }, { 100 });
+    }
+    state.Measure([&]() {
+        archetype->EachChunk<Position, Velocity>([](const EntityID* entity_ids, std::size_t count, Position* positions, Velocity* velocities) {
+            for (std::size_t i = 0; i < count; ++i) {
+                positions[i].x += velocities[i].x;
+                positions[i].y += velocities[i].y;
+                positions[i].z += velocities[i].z;
+            }
+        });
+    });
+}
@@ -0,0 +1,5 @@
+#include <core/utils/benchmark_helpers.h>
+
+int main(int argc, char** argv) {
+    return benchmark_helpers::BenchmarkRegistry::GetInstance().RunAll(argc, argv);
+}
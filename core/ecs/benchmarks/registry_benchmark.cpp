@@ -0,0 +1,488 @@
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include <core/utils/benchmark_helpers.h>
+#include "../command_buffer.h"
+#include "../query.h"
+#include "../registry.h"
+
+struct Position
+{
+    float x, y, z;
+};
+
+struct Velocity
+{
+    float x, y, z;
+};
+
+// Entity indices in a fixed pseudo-random order, so that runs are comparable.
+static std::vector<ecs::EntityIndex> ShuffledEntityIndices(std::size_t n)
+{
+    std::vector<ecs::EntityIndex> entity_indices(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        entity_indices[i] = (ecs::EntityIndex)i;
+    }
+    std::mt19937 generator(42);
+    std::shuffle(entity_indices.begin(), entity_indices.end(), generator);
+    return entity_indices;
+}
+
+BENCHMARK_CASE(registry, random_get_component_hashed_rows, 1000000)
+{
+    // Baseline: the previous per-archetype unordered_map from entity index to row.
+    std::unordered_map<std::uint32_t, std::size_t> entity_components_index_map;
+    std::vector<Position> positions(state.N());
+    for (std::size_t i = 0; i < state.N(); ++i) {
+        entity_components_index_map.insert(std::make_pair((std::uint32_t)i, i));
+        positions[i] = { (float)i, 0, 0 };
+    }
+    const std::vector<ecs::EntityIndex> entity_indices = ShuffledEntityIndices(state.N());
+    state.Measure([&]() {
+        float sum = 0.0f;
+        for (ecs::EntityIndex entity_index : entity_indices) {
+            sum += positions[entity_components_index_map[entity_index]].x;
+        }
+        benchmark_helpers::DoNotOptimize(sum);
+    });
+}
+
+BENCHMARK_CASE(registry, random_get_component, 1000000)
+{
+    ecs::Registry registry;
+    for (std::size_t i = 0; i < state.N(); ++i) {
+        const ecs::EntityID entity_id = { 0, (ecs::EntityIndex)i };
+        registry.RegisterEntity(entity_id);
+        registry.AddComponent<Position>(entity_id, { (float)i, 0, 0 });
+        registry.AddComponent<Velocity>(entity_id, { 1, 1, 1 });
+    }
+    const std::vector<ecs::EntityIndex> entity_indices = ShuffledEntityIndices(state.N());
+    state.Measure([&]() {
+        float sum = 0.0f;
+        Position* position = nullptr;
+        for (ecs::EntityIndex entity_index : entity_indices) {
+            if (registry.GetComponent<Position>({ 0, entity_index }, position)) {
+                sum += position->x;
+            }
+        }
+        benchmark_helpers::DoNotOptimize(sum);
+    });
+}
+
+BENCHMARK_CASE(registry, toggle_component, 10000, 100000)
+{
+    ecs::Registry registry;
+    for (std::size_t i = 0; i < state.N(); ++i) {
+        const ecs::EntityID entity_id = { 0, (ecs::EntityIndex)i };
+        registry.RegisterEntity(entity_id);
+        registry.AddComponent<Position>(entity_id, { (float)i, 0, 0 });
+    }
+    state.Measure([&]() {
+        for (std::size_t i = 0; i < state.N(); ++i) {
+            registry.AddComponent<Velocity>({ 0, (ecs::EntityIndex)i }, { 1, 1, 1 });
+        }
+        for (std::size_t i = 0; i < state.N(); ++i) {
+            registry.RemoveComponent<Velocity>({ 0, (ecs::EntityIndex)i });
+        }
+    });
+}
+
+struct Selected
+{
+    int value;
+};
+
+ECS_SPARSE_SET_COMPONENT(Selected)
+
+BENCHMARK_CASE(registry, toggle_sparse_set_component, 10000, 100000)
+{
+    ecs::Registry registry;
+    for (std::size_t i = 0; i < state.N(); ++i) {
+        const ecs::EntityID entity_id = { 0, (ecs::EntityIndex)i };
+        registry.RegisterEntity(entity_id);
+        registry.AddComponent<Position>(entity_id, { (float)i, 0, 0 });
+    }
+    state.Measure([&]() {
+        for (std::size_t i = 0; i < state.N(); ++i) {
+            registry.AddComponent<Selected>({ 0, (ecs::EntityIndex)i }, { 1 });
+        }
+        for (std::size_t i = 0; i < state.N(); ++i) {
+            registry.RemoveComponent<Selected>({ 0, (ecs::EntityIndex)i });
+        }
+    });
+}
+
+template<int I>
+struct Tag
+{
+    int value;
+};
+
+// A registry with 8 archetypes that all contain Position, 8 entities each.
+static void PopulateTaggedArchetypes(ecs::Registry& registry)
+{
+    for (ecs::EntityIndex i = 0; i < 64; ++i) {
+        const ecs::EntityID entity_id = { 0, i };
+        registry.RegisterEntity(entity_id);
+        registry.AddComponent<Position>(entity_id, { (float)i, 0, 0 });
+        registry.AddComponent<Velocity>(entity_id, { 1, 1, 1 });
+        if (i & 1) registry.AddComponent<Tag<0>>(entity_id, { 0 });
+        if (i & 2) registry.AddComponent<Tag<1>>(entity_id, { 0 });
+        if (i & 4) registry.AddComponent<Tag<2>>(entity_id, { 0 });
+    }
+}
+
+// N enumerations of a small registry; measures the per-call overhead of
+// finding the matching archetypes.
+BENCHMARK_CASE(registry, enumerate_components_per_call, 10000)
+{
+    ecs::Registry registry;
+    PopulateTaggedArchetypes(registry);
+    std::function<void(ecs::EntityID, Position&, Velocity&)> block = [](ecs::EntityID entity_id, Position& position, Velocity& velocity) {
+        position.x += velocity.x;
+    };
+    state.Measure([&]() {
+        for (std::size_t i = 0; i < state.N(); ++i) {
+            registry.EnumerateComponentsWithBlock<Position, Velocity>(block);
+        }
+    });
+}
+
+BENCHMARK_CASE(registry, query_enumerate_components_per_call, 10000)
+{
+    ecs::Registry registry;
+    PopulateTaggedArchetypes(registry);
+    ecs::Query<Position, Velocity> query;
+    registry.AddQuery(&query);
+    std::function<void(ecs::EntityID, Position&, Velocity&)> block = [](ecs::EntityID entity_id, Position& position, Velocity& velocity) {
+        position.x += velocity.x;
+    };
+    state.Measure([&]() {
+        for (std::size_t i = 0; i < state.N(); ++i) {
+            query.EnumerateComponentsWithBlock(block);
+        }
+    });
+    registry.RemoveQuery(&query);
+}
+
+static void IntegrateChunk(const ecs::EntityID* entity_ids, std::size_t count, Position* positions, const Velocity* velocities)
+{
+    for (std::size_t i = 0; i < count; ++i) {
+        // Enough work per entity for threading to matter.
+        for (int step = 0; step < 16; ++step) {
+            positions[i].x += velocities[i].x * 0.001f;
+            positions[i].y += velocities[i].y * 0.001f;
+            positions[i].z += velocities[i].z * 0.001f;
+        }
+    }
+}
+
+BENCHMARK_CASE(registry, query_each_chunk, 200000, 1000000)
+{
+    ecs::Registry registry;
+    ecs::Query<Position, const Velocity> query;
+    registry.AddQuery(&query);
+    for (std::size_t i = 0; i < state.N(); ++i) {
+        const ecs::EntityID entity_id = { 0, (ecs::EntityIndex)i };
+        registry.RegisterEntity(entity_id);
+        registry.AddComponent<Position>(entity_id, { (float)i, 0, 0 });
+        registry.AddComponent<Velocity>(entity_id, { 1, 1, 1 });
+    }
+    state.Measure([&]() {
+        query.EachChunk(&IntegrateChunk);
+    });
+    registry.RemoveQuery(&query);
+}
+
+BENCHMARK_CASE(registry, query_parallel_each_chunk, 200000, 1000000)
+{
+    ecs::Registry registry;
+    ecs::Query<Position, const Velocity> query;
+    registry.AddQuery(&query);
+    for (std::size_t i = 0; i < state.N(); ++i) {
+        const ecs::EntityID entity_id = { 0, (ecs::EntityIndex)i };
+        registry.RegisterEntity(entity_id);
+        registry.AddComponent<Position>(entity_id, { (float)i, 0, 0 });
+        registry.AddComponent<Velocity>(entity_id, { 1, 1, 1 });
+    }
+    state.Measure([&]() {
+        query.ParallelEachChunk(&IntegrateChunk);
+    });
+    registry.RemoveQuery(&query);
+}
+
+BENCHMARK_CASE(registry, toggle_component_with_command_buffer, 10000, 100000)
+{
+    ecs::Registry registry;
+    ecs::CommandBuffer command_buffer;
+    for (std::size_t i = 0; i < state.N(); ++i) {
+        const ecs::EntityID entity_id = { 0, (ecs::EntityIndex)i };
+        registry.RegisterEntity(entity_id);
+        registry.AddComponent<Position>(entity_id, { (float)i, 0, 0 });
+    }
+    state.Measure([&]() {
+        for (std::size_t i = 0; i < state.N(); ++i) {
+            command_buffer.AddComponent<Velocity>({ 0, (ecs::EntityIndex)i }, { 1, 1, 1 });
+        }
+        command_buffer.Playback(registry);
+        for (std::size_t i = 0; i < state.N(); ++i) {
+            command_buffer.RemoveComponent<Velocity>({ 0, (ecs::EntityIndex)i });
+        }
+        command_buffer.Playback(registry);
+    });
+}
+
+struct Health
+{
+    float value;
+};
+
+struct Mass
+{
+    float value;
+};
+
+struct Flags
+{
+    std::uint32_t value;
+};
+
+static std::vector<ecs::EntityID> RegisterEntities(ecs::Registry& registry, std::size_t n)
+{
+    std::vector<ecs::EntityID> entity_ids(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        entity_ids[i] = { 0, (ecs::EntityIndex)i };
+        registry.RegisterEntity(entity_ids[i]);
+    }
+    return entity_ids;
+}
+
+BENCHMARK_CASE(registry, spawn_with_add_component, 100000)
+{
+    std::unique_ptr<ecs::Registry> registry;
+    std::vector<ecs::EntityID> entity_ids;
+    state.Measure([&]() {
+        for (ecs::EntityID entity_id : entity_ids) {
+            registry->AddComponent<Position>(entity_id, { 0, 0, 0 });
+            registry->AddComponent<Velocity>(entity_id, { 1, 1, 1 });
+            registry->AddComponent<Health>(entity_id, { 100 });
+            registry->AddComponent<Mass>(entity_id, { 1 });
+            registry->AddComponent<Flags>(entity_id, { 0 });
+        }
+    }, [&]() {
+        registry.reset(new ecs::Registry());
+        entity_ids = RegisterEntities(*registry, state.N());
+    });
+}
+
+BENCHMARK_CASE(registry, spawn_batch, 100000)
+{
+    std::unique_ptr<ecs::Registry> registry;
+    std::vector<ecs::EntityID> entity_ids;
+    state.Measure([&]() {
+        registry->SpawnBatch<Position, Velocity, Health, Mass, Flags>(entity_ids.data(), entity_ids.size(),
+            [](std::size_t i, Position& position, Velocity& velocity, Health& health, Mass& mass, Flags& flags) {
+            position = { (float)i, 0, 0 };
+            velocity = { 1, 1, 1 };
+            health.value = 100;
+            mass.value = 1;
+        });
+    }, [&]() {
+        registry.reset(new ecs::Registry());
+        entity_ids = RegisterEntities(*registry, state.N());
+    });
+}
+
+BENCHMARK_CASE(registry, instantiate_prefab, 100000)
+{
+    const ecs::Prefab<Position, Velocity, Health, Mass, Flags> prefab({ 0, 0, 0 }, { 1, 1, 1 }, { 100 }, { 1 }, { 0 });
+    std::unique_ptr<ecs::Registry> registry;
+    std::vector<ecs::EntityID> entity_ids;
+    state.Measure([&]() {
+        registry->Instantiate(prefab, entity_ids.data(), entity_ids.size());
+    }, [&]() {
+        registry.reset(new ecs::Registry());
+        entity_ids = RegisterEntities(*registry, state.N());
+    });
+}
+
+struct Orientation
+{
+    float x, y, z, w;
+};
+
+struct Scale
+{
+    float x, y, z;
+};
+
+// Stand in for components like MeshRenderableComponent that hold reference
+// counted resources.
+struct MeshResource
+{
+    std::shared_ptr<int> mesh;
+};
+
+struct MaterialResources
+{
+    std::shared_ptr<int> shader;
+    std::shared_ptr<int> texture;
+};
+
+// Moves N entities with four components to another archetype and back.
+template<class C0, class C1, class C2, class C3>
+static void MeasureMigration(benchmark_helpers::BenchmarkState& state, const C0& c0, const C1& c1, const C2& c2, const C3& c3)
+{
+    ecs::Registry registry;
+    const std::vector<ecs::EntityID> entity_ids = RegisterEntities(registry, state.N());
+    registry.Instantiate(ecs::Prefab<C0, C1, C2, C3>(c0, c1, c2, c3), entity_ids.data(), entity_ids.size());
+    state.Measure([&]() {
+        for (ecs::EntityID entity_id : entity_ids) {
+            registry.AddComponent<Flags>(entity_id, { 0 });
+        }
+        for (ecs::EntityID entity_id : entity_ids) {
+            registry.RemoveComponent<Flags>(entity_id);
+        }
+    });
+}
+
+BENCHMARK_CASE(registry, migrate_pod_components, 10000, 100000)
+{
+    MeasureMigration(state, Position{ 0, 0, 0 }, Velocity{ 1, 1, 1 }, Orientation{ 0, 0, 0, 1 }, Scale{ 1, 1, 1 });
+}
+
+BENCHMARK_CASE(registry, migrate_shared_ptr_components, 10000, 100000)
+{
+    const std::shared_ptr<int> resource = std::make_shared<int>(0);
+    MeasureMigration(state, MeshResource{ resource }, MaterialResources{ resource, resource }, Position{ 0, 0, 0 }, Scale{ 1, 1, 1 });
+}
+
+// Same as migrate_pod_components, but every entity is moved with one batch
+// call, which relocates runs of entities a column at a time.
+BENCHMARK_CASE(registry, migrate_pod_components_batch, 10000, 100000)
+{
+    ecs::Registry registry;
+    const std::vector<ecs::EntityID> entity_ids = RegisterEntities(registry, state.N());
+    registry.Instantiate(ecs::Prefab<Position, Velocity, Orientation, Scale>({ 0, 0, 0 }, { 1, 1, 1 }, { 0, 0, 0, 1 }, { 1, 1, 1 }), entity_ids.data(), entity_ids.size());
+    const Flags flags = { 0 };
+    const std::vector<const Flags*> added_flags(entity_ids.size(), &flags);
+    state.Measure([&]() {
+        registry.AddComponentBatch<Flags>(entity_ids.data(), added_flags.data(), entity_ids.size());
+        registry.RemoveComponentBatch<Flags>(entity_ids.data(), entity_ids.size());
+    });
+}
+
+// Same work as query_each_chunk, but only the velocities of 1% of the entities,
+// which share a few chunks, change between iterations. Unchanged chunks are skipped.
+BENCHMARK_CASE(registry, query_changed_each_chunk, 200000, 1000000)
+{
+    ecs::Registry registry;
+    ecs::Query<Position, ecs::Changed<const Velocity>> query;
+    registry.AddQuery(&query);
+    for (std::size_t i = 0; i < state.N(); ++i) {
+        const ecs::EntityID entity_id = { 0, (ecs::EntityIndex)i };
+        registry.RegisterEntity(entity_id);
+        registry.AddComponent<Position>(entity_id, { (float)i, 0, 0 });
+        registry.AddComponent<Velocity>(entity_id, { 1, 1, 1 });
+    }
+    query.EachChunk(&IntegrateChunk);
+    state.Measure([&]() {
+        query.EachChunk(&IntegrateChunk);
+    }, [&]() {
+        Velocity* velocity = nullptr;
+        for (std::size_t i = 0; i < state.N() / 100; ++i) {
+            if (registry.GetComponent<Velocity>({ 0, (ecs::EntityIndex)i }, velocity)) {
+                velocity->x = 2;
+            }
+        }
+    });
+    registry.RemoveQuery(&query);
+}
+
+// Stands in for the mesh and material references of a renderable.
+struct RenderKey
+{
+    std::shared_ptr<int> mesh;
+    std::shared_ptr<int> material;
+
+    bool operator==(const RenderKey& other) const
+    {
+        return mesh == other.mesh && material == other.material;
+    }
+};
+
+struct SharedRenderKey : RenderKey {};
+
+ECS_SHARED_COMPONENT(SharedRenderKey)
+
+static const std::size_t kRenderKeyCount = 64;
+
+static std::vector<RenderKey> RenderKeys()
+{
+    std::vector<RenderKey> render_keys;
+    for (std::size_t i = 0; i < kRenderKeyCount; ++i) {
+        render_keys.push_back({ std::make_shared<int>((int)i), std::make_shared<int>((int)i) });
+    }
+    return render_keys;
+}
+
+// Groups N renderables into batches of equal render keys, stored in every
+// entity, by looking up each entity's batch in an ordered map.
+BENCHMARK_CASE(registry, batch_by_per_entity_component, 100000, 1000000)
+{
+    ecs::Registry registry;
+    ecs::Query<const Position, const RenderKey> query;
+    registry.AddQuery(&query);
+    const std::vector<RenderKey> render_keys = RenderKeys();
+    for (std::size_t i = 0; i < state.N(); ++i) {
+        const ecs::EntityID entity_id = { 0, (ecs::EntityIndex)i };
+        registry.RegisterEntity(entity_id);
+        registry.AddComponent<Position>(entity_id, { (float)i, 0, 0 });
+        registry.AddComponent<RenderKey>(entity_id, render_keys[i % kRenderKeyCount]);
+    }
+    std::map<std::pair<int*, int*>, std::vector<Position>> batches;
+    state.Measure([&]() {
+        query.Each([&batches](ecs::EntityID entity_id, const Position& position, const RenderKey& render_key) {
+            batches[std::make_pair(render_key.mesh.get(), render_key.material.get())].push_back(position);
+        });
+    }, [&]() {
+        batches.clear();
+    });
+    registry.RemoveQuery(&query);
+}
+
+// Same batches, read from the chunks of the archetypes of a shared render key.
+BENCHMARK_CASE(registry, batch_by_shared_component, 100000, 1000000)
+{
+    ecs::Registry registry;
+    ecs::Query<const Position, const SharedRenderKey> query;
+    registry.AddQuery(&query);
+    const std::vector<RenderKey> render_keys = RenderKeys();
+    std::vector<ecs::EntityID> entity_ids(state.N() / kRenderKeyCount);
+    for (std::size_t k_idx = 0; k_idx < kRenderKeyCount; ++k_idx) {
+        for (std::size_t i = 0; i < entity_ids.size(); ++i) {
+            entity_ids[i] = { 0, (ecs::EntityIndex)(i * kRenderKeyCount + k_idx) };
+            registry.RegisterEntity(entity_ids[i]);
+            registry.AddComponent<Position>(entity_ids[i], { (float)entity_ids[i].index, 0, 0 });
+        }
+        SharedRenderKey render_key;
+        static_cast<RenderKey&>(render_key) = render_keys[k_idx];
+        registry.SetSharedComponentBatch<SharedRenderKey>(entity_ids.data(), entity_ids.size(), render_key);
+    }
+    std::vector<std::pair<const SharedRenderKey*, std::vector<Position>>> batches;
+    state.Measure([&]() {
+        query.EachChunk([&batches](const ecs::EntityID* entity_ids, std::size_t count, const Position* positions, const SharedRenderKey* render_key) {
+            if (batches.empty() || batches.back().first != render_key) {
+                batches.emplace_back(render_key, std::vector<Position>());
+            }
+            batches.back().second.insert(batches.back().second.end(), positions, positions + count);
+        });
+    }, [&]() {
+        batches.clear();
+    });
+    registry.RemoveQuery(&query);
+}
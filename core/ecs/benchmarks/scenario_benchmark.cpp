@@ -0,0 +1,299 @@
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <core/utils/benchmark_helpers.h>
+#include "../entity_allocator.h"
+#include "../query.h"
+#include "../registry.h"
+
+/*
+* Scenarios that track the cost of whole workloads across versions, rather
+* than of a single code path. Random choices are made with fixed seeds, so
+* every run performs the same operations.
+*/
+
+namespace {
+    struct Position
+    {
+        float x, y, z;
+    };
+
+    struct Velocity
+    {
+        float x, y, z;
+    };
+
+    struct Health
+    {
+        float value;
+    };
+
+    struct Mass
+    {
+        float value;
+    };
+
+    template<int I>
+    struct Tag
+    {
+        int value;
+    };
+
+    const int kTagCount = 12;
+
+    // Adds Tag<I> for every set bit I of tag_bits, for I in [FirstTag, kTagCount).
+    template<int FirstTag>
+    struct TagAdder
+    {
+        static void AddTags(ecs::Registry& registry, ecs::EntityID entity_id, unsigned tag_bits)
+        {
+            if (tag_bits & (1u << FirstTag)) {
+                registry.AddComponent<Tag<FirstTag>>(entity_id, { FirstTag });
+            }
+            TagAdder<FirstTag + 1>::AddTags(registry, entity_id, tag_bits);
+        }
+    };
+
+    template<>
+    struct TagAdder<kTagCount>
+    {
+        static void AddTags(ecs::Registry& registry, ecs::EntityID entity_id, unsigned tag_bits) {}
+    };
+
+    // Registers n entities with a Position and Velocity each.
+    std::vector<ecs::EntityID> CreateMovingEntities(ecs::Registry& registry, std::size_t n)
+    {
+        std::vector<ecs::EntityID> entity_ids(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            entity_ids[i] = { 0, (ecs::EntityIndex)i };
+            registry.RegisterEntity(entity_ids[i]);
+        }
+        registry.SpawnBatch<Position, Velocity>(entity_ids.data(), n, [](std::size_t i, Position& position, Velocity& velocity) {
+            position = { (float)i, 0, 0 };
+            velocity = { 1, 1, 1 };
+        });
+        return entity_ids;
+    }
+
+    class CountingListener : public ecs::IComponentSetEventsListener
+    {
+    public:
+        std::size_t event_count = 0;
+
+        void OnEnterComponentSupersetOf(ecs::EntityID entity_id, const ecs::ComponentSetIDs& component_set_ids) override
+        {
+            event_count++;
+        }
+
+        void OnExitComponentSupersetOf(ecs::EntityID entity_id, const ecs::ComponentSetIDs& component_set_ids) override
+        {
+            event_count++;
+        }
+    };
+}
+
+// Allocating ids, spawning the entities with two components, then
+// unregistering them and freeing their ids.
+BENCHMARK_CASE(scenario, create_destroy, 10000, 100000)
+{
+    ecs::Registry registry;
+    ecs::EntityAllocator entity_allocator;
+    std::vector<ecs::EntityID> entity_ids(state.N());
+    state.Measure([&]() {
+        entity_allocator.AllocateBatch(entity_ids.data(), entity_ids.size());
+        for (ecs::EntityID entity_id : entity_ids) {
+            registry.RegisterEntity(entity_id);
+        }
+        registry.SpawnBatch<Position, Velocity>(entity_ids.data(), entity_ids.size(), [](std::size_t i, Position& position, Velocity& velocity) {
+            position = { (float)i, 0, 0 };
+            velocity = { 1, 1, 1 };
+        });
+        registry.UnregisterEntityBatch(entity_ids.data(), entity_ids.size());
+        entity_allocator.FreeBatch(entity_ids.data(), entity_ids.size());
+    });
+}
+
+// N random toggles of two components on 10000 entities, so that entities
+// keep moving between four archetypes.
+BENCHMARK_CASE(scenario, add_remove_churn, 10000, 100000)
+{
+    const std::size_t entity_count = 10000;
+    std::unique_ptr<ecs::Registry> registry;
+    std::vector<unsigned char> component_bits;
+    std::vector<std::size_t> toggled_entities(state.N());
+    std::vector<unsigned char> toggled_components(state.N());
+    // mt19937 produces the same sequence everywhere, unlike the standard distributions.
+    std::mt19937 generator(42);
+    for (std::size_t i = 0; i < state.N(); ++i) {
+        toggled_entities[i] = generator() % entity_count;
+        toggled_components[i] = (unsigned char)(generator() & 1);
+    }
+    state.Measure([&]() {
+        for (std::size_t i = 0; i < state.N(); ++i) {
+            const ecs::EntityID entity_id = { 0, (ecs::EntityIndex)toggled_entities[i] };
+            unsigned char& bits = component_bits[toggled_entities[i]];
+            const unsigned char bit = (unsigned char)(1 << toggled_components[i]);
+            if (toggled_components[i] == 0) {
+                if (bits & bit) registry->RemoveComponent<Health>(entity_id);
+                else registry->AddComponent<Health>(entity_id, { 100 });
+            }
+            else {
+                if (bits & bit) registry->RemoveComponent<Mass>(entity_id);
+                else registry->AddComponent<Mass>(entity_id, { 1 });
+            }
+            bits ^= bit;
+        }
+    }, [&]() {
+        registry.reset(new ecs::Registry());
+        CreateMovingEntities(*registry, entity_count);
+        component_bits.assign(entity_count, 0);
+    });
+}
+
+BENCHMARK_CASE(scenario, each_single_component, 100000, 1000000)
+{
+    ecs::Registry registry;
+    CreateMovingEntities(registry, state.N());
+    ecs::Query<const Position> query;
+    registry.AddQuery(&query);
+    state.Measure([&]() {
+        float sum = 0.0f;
+        query.Each([&sum](ecs::EntityID entity_id, const Position& position) {
+            sum += position.x;
+        });
+        benchmark_helpers::DoNotOptimize(sum);
+    });
+    registry.RemoveQuery(&query);
+}
+
+BENCHMARK_CASE(scenario, each_multi_component, 100000, 1000000)
+{
+    ecs::Registry registry;
+    const std::vector<ecs::EntityID> entity_ids = CreateMovingEntities(registry, state.N());
+    for (ecs::EntityID entity_id : entity_ids) {
+        registry.AddComponent<Health>(entity_id, { 100 });
+        registry.AddComponent<Mass>(entity_id, { 1 });
+    }
+    ecs::Query<Position, const Velocity, const Mass, Health> query;
+    registry.AddQuery(&query);
+    state.Measure([&]() {
+        query.Each([](ecs::EntityID entity_id, Position& position, const Velocity& velocity, const Mass& mass, Health& health) {
+            position.x += velocity.x / mass.value;
+            position.y += velocity.y / mass.value;
+            position.z += velocity.z / mass.value;
+            health.value -= 0.01f;
+        });
+    });
+    registry.RemoveQuery(&query);
+}
+
+// Random lookups of entities spread over 256 archetypes.
+BENCHMARK_CASE(scenario, random_get_component, 100000, 1000000)
+{
+    ecs::Registry registry;
+    const std::vector<ecs::EntityID> entity_ids = CreateMovingEntities(registry, state.N());
+    for (std::size_t i = 0; i < entity_ids.size(); ++i) {
+        TagAdder<0>::AddTags(registry, entity_ids[i], (unsigned)(i % 256));
+    }
+    std::vector<ecs::EntityID> lookups = entity_ids;
+    std::mt19937 generator(42);
+    std::shuffle(lookups.begin(), lookups.end(), generator);
+    state.Measure([&]() {
+        float sum = 0.0f;
+        const Position* position = nullptr;
+        for (ecs::EntityID entity_id : lookups) {
+            registry.GetComponent(entity_id, position);
+            sum += position->x;
+        }
+        benchmark_helpers::DoNotOptimize(sum);
+    });
+}
+
+// Adding and removing a component on N entities, with 64 listeners spread
+// over 16 component sets that the change enters and exits.
+BENCHMARK_CASE(scenario, listener_fan_out, 10000, 100000)
+{
+    ecs::Registry registry;
+    const std::vector<ecs::EntityID> entity_ids = CreateMovingEntities(registry, state.N());
+    std::vector<CountingListener> listeners(64);
+    std::vector<ecs::ComponentSetIDs> listened_component_sets;
+    for (std::size_t l_idx = 0; l_idx < listeners.size(); ++l_idx) {
+        CountingListener* listener = &listeners[l_idx];
+        switch (l_idx % 16) {
+        case 0: listened_component_sets.push_back(registry.AddComponentSetEventsListener<Health>(listener)); break;
+        case 1: listened_component_sets.push_back(registry.AddComponentSetEventsListener<Health, Position>(listener)); break;
+        case 2: listened_component_sets.push_back(registry.AddComponentSetEventsListener<Health, Velocity>(listener)); break;
+        case 3: listened_component_sets.push_back(registry.AddComponentSetEventsListener<Health, Position, Velocity>(listener)); break;
+        case 4: listened_component_sets.push_back(registry.AddComponentSetEventsListener<Health, Tag<0>>(listener)); break;
+        case 5: listened_component_sets.push_back(registry.AddComponentSetEventsListener<Health, Tag<1>>(listener)); break;
+        case 6: listened_component_sets.push_back(registry.AddComponentSetEventsListener<Health, Tag<2>>(listener)); break;
+        case 7: listened_component_sets.push_back(registry.AddComponentSetEventsListener<Health, Tag<3>>(listener)); break;
+        case 8: listened_component_sets.push_back(registry.AddComponentSetEventsListener<Health, Position, Tag<0>>(listener)); break;
+        case 9: listened_component_sets.push_back(registry.AddComponentSetEventsListener<Health, Position, Tag<1>>(listener)); break;
+        case 10: listened_component_sets.push_back(registry.AddComponentSetEventsListener<Health, Position, Tag<2>>(listener)); break;
+        case 11: listened_component_sets.push_back(registry.AddComponentSetEventsListener<Health, Position, Tag<3>>(listener)); break;
+        case 12: listened_component_sets.push_back(registry.AddComponentSetEventsListener<Health, Velocity, Tag<0>>(listener)); break;
+        case 13: listened_component_sets.push_back(registry.AddComponentSetEventsListener<Health, Velocity, Tag<1>>(listener)); break;
+        case 14: listened_component_sets.push_back(registry.AddComponentSetEventsListener<Health, Velocity, Tag<2>>(listener)); break;
+        default: listened_component_sets.push_back(registry.AddComponentSetEventsListener<Health, Velocity, Tag<3>>(listener)); break;
+        }
+    }
+    for (std::size_t i = 0; i < entity_ids.size(); ++i) {
+        TagAdder<0>::AddTags(registry, entity_ids[i], (unsigned)(i % 16));
+    }
+    state.Measure([&]() {
+        for (ecs::EntityID entity_id : entity_ids) {
+            registry.AddComponent<Health>(entity_id, { 100 });
+        }
+        for (ecs::EntityID entity_id : entity_ids) {
+            registry.RemoveComponent<Health>(entity_id);
+        }
+    });
+    std::size_t event_count = 0;
+    for (std::size_t l_idx = 0; l_idx < listeners.size(); ++l_idx) {
+        event_count += listeners[l_idx].event_count;
+        registry.RemoveComponentSetEventsListener(listened_component_sets[l_idx], &listeners[l_idx]);
+    }
+    benchmark_helpers::DoNotOptimize(event_count);
+}
+
+// Builds N distinct archetypes, one entity each, out of Position and
+// subsets of 12 tags.
+BENCHMARK_CASE(scenario, archetype_explosion_create, 1000, 4000)
+{
+    std::unique_ptr<ecs::Registry> registry;
+    state.Measure([&]() {
+        for (std::size_t i = 0; i < state.N(); ++i) {
+            const ecs::EntityID entity_id = { 0, (ecs::EntityIndex)i };
+            registry->RegisterEntity(entity_id);
+            registry->AddComponent<Position>(entity_id, { (float)i, 0, 0 });
+            TagAdder<0>::AddTags(*registry, entity_id, (unsigned)i);
+        }
+    }, [&]() {
+        registry.reset(new ecs::Registry());
+    });
+}
+
+// Matching a new query against N archetypes, and iterating it.
+BENCHMARK_CASE(scenario, archetype_explosion_query, 1000, 4000)
+{
+    ecs::Registry registry;
+    for (std::size_t i = 0; i < state.N(); ++i) {
+        const ecs::EntityID entity_id = { 0, (ecs::EntityIndex)i };
+        registry.RegisterEntity(entity_id);
+        registry.AddComponent<Position>(entity_id, { (float)i, 0, 0 });
+        TagAdder<0>::AddTags(registry, entity_id, (unsigned)i);
+    }
+    state.Measure([&]() {
+        ecs::Query<const Position, const Tag<0>> query;
+        registry.AddQuery(&query);
+        float sum = 0.0f;
+        query.Each([&sum](ecs::EntityID entity_id, const Position& position, const Tag<0>& tag) {
+            sum += position.x;
+        });
+        registry.RemoveQuery(&query);
+        benchmark_helpers::DoNotOptimize(sum);
+    });
+}
@@ -0,0 +1,77 @@
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <core/utils/benchmark_helpers.h>
+#include <core/utils/set_trie.h>
+
+// N distinct sorted key sets of 2 to 8 keys out of 128, like the component sets
+// of the archetypes of a large scene.
+static std::vector<std::vector<std::uint32_t>> RandomKeySets(std::size_t n)
+{
+    std::mt19937 generator(7);
+    std::vector<std::vector<std::uint32_t>> key_sets;
+    while (key_sets.size() < n) {
+        std::vector<std::uint32_t> key_set(2 + generator() % 7);
+        for (std::uint32_t& key : key_set) {
+            key = generator() % 128;
+        }
+        std::sort(key_set.begin(), key_set.end());
+        key_set.erase(std::unique(key_set.begin(), key_set.end()), key_set.end());
+        key_sets.push_back(key_set);
+    }
+    std::sort(key_sets.begin(), key_sets.end());
+    key_sets.erase(std::unique(key_sets.begin(), key_sets.end()), key_sets.end());
+    return key_sets;
+}
+
+template<class TSetTrie>
+static void MeasureSupersetSearches(benchmark_helpers::BenchmarkState& state)
+{
+    TSetTrie set_trie;
+    const std::vector<std::vector<std::uint32_t>> key_sets = RandomKeySets(state.N());
+    for (std::size_t i = 0; i < key_sets.size(); ++i) {
+        set_trie.InsertValueForKeySet(key_sets[i], (int)i);
+    }
+    // Queries of one or two keys, like those of systems.
+    std::vector<std::vector<std::uint32_t>> queries;
+    for (std::uint32_t key = 0; key < 128; ++key) {
+        queries.push_back({ key });
+        queries.push_back({ key, (key * 7 + 3) % 128 });
+        std::sort(queries.back().begin(), queries.back().end());
+        queries.back().erase(std::unique(queries.back().begin(), queries.back().end()), queries.back().end());
+    }
+    std::vector<int*> supersets;
+    state.Measure([&]() {
+        std::size_t superset_count = 0;
+        for (const std::vector<std::uint32_t>& query : queries) {
+            set_trie.FindSuperKeySetValues(query, supersets);
+            superset_count += supersets.size();
+        }
+        benchmark_helpers::DoNotOptimize(superset_count);
+    });
+}
+
+BENCHMARK_CASE(set_trie, find_super_key_sets, 1000, 4000, 16000)
+{
+    MeasureSupersetSearches<SetTrie<std::uint32_t, int>>(state);
+}
+
+BENCHMARK_CASE(set_trie, find_super_key_sets_with_signatures, 1000, 4000, 16000)
+{
+    MeasureSupersetSearches<SetTrie<std::uint32_t, int, 256>>(state);
+}
+
+BENCHMARK_CASE(set_trie, insert_and_remove, 1000, 4000, 16000)
+{
+    const std::vector<std::vector<std::uint32_t>> key_sets = RandomKeySets(state.N());
+    SetTrie<std::uint32_t, int> set_trie;
+    state.Measure([&]() {
+        for (std::size_t i = 0; i < key_sets.size(); ++i) {
+            set_trie.InsertValueForKeySet(key_sets[i], (int)i);
+        }
+        for (const std::vector<std::uint32_t>& key_set : key_sets) {
+            set_trie.RemoveValueForKeySet(key_set);
+        }
+    });
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+namespace ecs {
+	/*
+	* Registries count up a change version. Every chunk column remembers the
+	* version at which it was last written, that is, iterated with mutable
+	* access, fetched with GetComponent or touched by a structural change.
+	*/
+	typedef std::uint64_t ChangeVersion;
+
+	/*
+	* Wrapping a component type of a Query in Changed<T> skips the chunks whose
+	* column of T has not been written since the query last iterated. The
+	* component is passed to the callback as T, so Changed<const T> filters on
+	* changes without writing T itself. Changes made by the query's own
+	* iteration are not reported to it. With several Changed types, a chunk
+	* passes if any of them has changed.
+	*/
+	template<class T>
+	struct Changed {};
+
+	// Component type passed to iteration callbacks for a queried type.
+	template<class T>
+	struct QueriedComponentType {
+		typedef T type;
+		static const bool is_change_filter = false;
+	};
+
+	template<class T>
+	struct QueriedComponentType<Changed<T>> {
+		typedef T type;
+		static const bool is_change_filter = true;
+	};
+
+	template<class T>
+	using QueriedComponent = typename QueriedComponentType<T>::type;
+
+	// Component type stored in archetypes for a queried type.
+	template<class T>
+	using StoredComponent = typename std::remove_const<QueriedComponent<T>>::type;
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Size of a single archetype chunk, in bytes.
+#define ECS_CHUNK_SIZE (16 * 1024)
+// Chunks, and every component column inside of them, start on a cache line.
+#define ECS_CHUNK_ALIGNMENT 64
+// Number of chunks that are reserved from the heap at once.
+#define ECS_CHUNKS_PER_SLAB 64
+
+namespace ecs {
+	/*
+	* Hands out fixed-size, cache-aligned blocks of memory that archetypes store
+	* their entities in. Chunks are carved out of large slabs, so released
+	* chunks are simply recycled by the next archetype that needs one. Slabs
+	* are only returned to the heap by ReleaseEmptySlabs, which compaction
+	* calls after moving chunks out of sparsely used slabs.
+	*/
+	class ChunkPool
+	{
+	public:
+		ChunkPool() : allocated_chunk_count_(0) {}
+
+		ChunkPool(const ChunkPool&) = delete;
+
+		ChunkPool& operator=(const ChunkPool&) = delete;
+
+		// Pool shared by every archetype that is not given one explicitly.
+		static ChunkPool& Shared()
+		{
+			static ChunkPool shared_chunk_pool;
+			return shared_chunk_pool;
+		}
+
+		unsigned char* AllocateChunk()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (free_chunks_.empty()) {
+				AllocateSlab();
+			}
+			unsigned char* chunk = free_chunks_.back();
+			free_chunks_.pop_back();
+			SlabOfChunk(chunk).allocated_chunk_count++;
+			allocated_chunk_count_++;
+			return chunk;
+		}
+
+		void ReleaseChunk(unsigned char* chunk)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			free_chunks_.push_back(chunk);
+			SlabOfChunk(chunk).allocated_chunk_count--;
+			allocated_chunk_count_--;
+		}
+
+		/*
+		* Allocates a chunk to move the contents of chunk to, in the fullest slab
+		* that has room and is at least as full as the slab of chunk, preferring
+		* lower addresses among equally full slabs. Returns nullptr if there is
+		* none, in which case chunk is best left where it is. Every such move
+		* makes the fuller slab fuller, so moving chunks this way empties the
+		* least used slabs.
+		*/
+		unsigned char* AllocateChunkForRelocation(const unsigned char* chunk)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			const Slab& chunk_slab = SlabOfChunk(chunk);
+			Slab* target_slab = nullptr;
+			for (Slab& slab : slabs_) {
+				const bool is_fuller = slab.allocated_chunk_count > chunk_slab.allocated_chunk_count
+					|| (slab.allocated_chunk_count == chunk_slab.allocated_chunk_count && slab.first_chunk < chunk_slab.first_chunk);
+				if (is_fuller && slab.allocated_chunk_count < ECS_CHUNKS_PER_SLAB
+					&& (!target_slab || slab.allocated_chunk_count > target_slab->allocated_chunk_count)) {
+					target_slab = &slab;
+				}
+			}
+			if (!target_slab) {
+				return nullptr;
+			}
+			std::vector<unsigned char*>::iterator free_chunk_iter = std::find_if(free_chunks_.begin(), free_chunks_.end(), [target_slab](const unsigned char* free_chunk) {
+				return free_chunk >= target_slab->first_chunk && free_chunk < target_slab->first_chunk + ECS_CHUNK_SIZE * ECS_CHUNKS_PER_SLAB;
+			});
+			unsigned char* relocated_chunk = *free_chunk_iter;
+			free_chunks_.erase(free_chunk_iter);
+			target_slab->allocated_chunk_count++;
+			allocated_chunk_count_++;
+			return relocated_chunk;
+		}
+
+		// Returns the slabs without chunks in use to the heap. Returns the number of bytes freed.
+		std::size_t ReleaseEmptySlabs()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			std::size_t released_bytes = 0;
+			for (std::size_t s_idx = slabs_.size(); s_idx > 0; --s_idx) {
+				Slab& slab = slabs_[s_idx - 1];
+				if (slab.allocated_chunk_count > 0) {
+					continue;
+				}
+				const unsigned char* first_chunk = slab.first_chunk;
+				free_chunks_.erase(std::remove_if(free_chunks_.begin(), free_chunks_.end(), [first_chunk](const unsigned char* free_chunk) {
+					return free_chunk >= first_chunk && free_chunk < first_chunk + ECS_CHUNK_SIZE * ECS_CHUNKS_PER_SLAB;
+				}), free_chunks_.end());
+				released_bytes += kSlabSize;
+				slabs_.erase(slabs_.begin() + (s_idx - 1));
+			}
+			return released_bytes;
+		}
+
+		// Number of chunks currently in use by archetypes.
+		std::size_t AllocatedChunkCount()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			return allocated_chunk_count_;
+		}
+
+		// Number of chunks reserved from the heap, whether in use or not.
+		std::size_t ReservedChunkCount()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			return slabs_.size() * ECS_CHUNKS_PER_SLAB;
+		}
+
+	private:
+		static const std::size_t kSlabSize = ECS_CHUNK_SIZE * ECS_CHUNKS_PER_SLAB + ECS_CHUNK_ALIGNMENT;
+
+		struct Slab {
+			std::unique_ptr<unsigned char[]> memory;
+			unsigned char* first_chunk;
+			std::size_t allocated_chunk_count;
+		};
+
+		std::mutex mutex_;
+		// In the order of their addresses.
+		std::vector<Slab> slabs_;
+		std::vector<unsigned char*> free_chunks_;
+		std::size_t allocated_chunk_count_;
+
+		void AllocateSlab()
+		{
+			std::unique_ptr<unsigned char[]> memory(new unsigned char[kSlabSize]);
+			const std::uintptr_t slab_address = reinterpret_cast<std::uintptr_t>(memory.get());
+			const std::uintptr_t aligned_slab_address = (slab_address + ECS_CHUNK_ALIGNMENT - 1) & ~(std::uintptr_t)(ECS_CHUNK_ALIGNMENT - 1);
+			unsigned char* first_chunk = memory.get() + (aligned_slab_address - slab_address);
+			// Push chunks in reverse so that they are handed out in ascending address order.
+			for (std::size_t i = ECS_CHUNKS_PER_SLAB; i > 0; --i) {
+				free_chunks_.push_back(first_chunk + (i - 1) * ECS_CHUNK_SIZE);
+			}
+			Slab slab = { std::move(memory), first_chunk, 0 };
+			slabs_.insert(std::upper_bound(slabs_.begin(), slabs_.end(), first_chunk, [](const unsigned char* chunk, const Slab& other_slab) {
+				return chunk < other_slab.first_chunk;
+			}), std::move(slab));
+		}
+
+		Slab& SlabOfChunk(const unsigned char* chunk)
+		{
+			// The last slab that starts at or before chunk.
+			std::vector<Slab>::iterator slab_iter = std::upper_bound(slabs_.begin(), slabs_.end(), chunk, [](const unsigned char* other_chunk, const Slab& slab) {
+				return other_chunk < slab.first_chunk;
+			});
+			return *(slab_iter - 1);
+		}
+	};
+}
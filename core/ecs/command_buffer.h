@@ -0,0 +1,336 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "chunk_pool.h"
+#include "entity.h"
+#include "entity_allocator.h"
+#include "registry.h"
+
+// Number of independently locked lanes that threads record commands into.
+#define ECS_COMMAND_BUFFER_LANE_COUNT 32
+
+namespace ecs {
+	/*
+	* Records structural changes (registering and unregistering entities, and
+	* adding and removing components) to apply to a Registry later, i.e. while
+	* the registry is being iterated, possibly in parallel. Every thread
+	* records into its own lane, so commands can be recorded concurrently.
+	*
+	* Playback applies the commands of every entity in the order that they were
+	* recorded by its thread. Commands of different threads for the same entity
+	* are applied in lane order. Changes of the same kind are grouped by
+	* component type and source archetype, so every group moves its entities to
+	* the target archetype with a single batch call to the registry.
+	*/
+	class CommandBuffer
+	{
+	public:
+		CommandBuffer() : lanes_(ECS_COMMAND_BUFFER_LANE_COUNT) {}
+
+		~CommandBuffer()
+		{
+			Clear();
+		}
+
+		CommandBuffer(const CommandBuffer&) = delete;
+
+		CommandBuffer& operator=(const CommandBuffer&) = delete;
+
+		void RegisterEntity(EntityID entity_id)
+		{
+			Record({ entity_id, kRegisterEntity, nullptr, 0, nullptr });
+		}
+
+		// Reserves a new id in entity_allocator and records registering it. The
+		// id becomes valid when the buffer is played back with entity_allocator.
+		EntityID RegisterNewEntity(EntityAllocator& entity_allocator)
+		{
+			const EntityID entity_id = entity_allocator.Reserve();
+			RegisterEntity(entity_id);
+			return entity_id;
+		}
+
+		void UnregisterEntity(EntityID entity_id)
+		{
+			Record({ entity_id, kUnregisterEntity, nullptr, 0, nullptr });
+		}
+
+		template<typename T>
+		void AddComponent(EntityID entity_id, T component)
+		{
+			static_assert(sizeof(T) <= ECS_CHUNK_SIZE, "Component is too large for a command buffer.");
+			Lane& lane = CurrentLane();
+			std::lock_guard<std::mutex> lock(lane.mutex);
+			void* component_data = lane.AllocateComponent(sizeof(T), alignof(T));
+			new (component_data) T(std::move(component));
+			lane.commands.push_back({ entity_id, kAddComponent, ComponentCommandFunctionsFor<T>(), ComponentTypeRegistry::TypeIDOf<T>(), component_data });
+		}
+
+		template<typename T>
+		void RemoveComponent(EntityID entity_id)
+		{
+			Record({ entity_id, kRemoveComponent, ComponentCommandFunctionsFor<T>(), ComponentTypeRegistry::TypeIDOf<T>(), nullptr });
+		}
+
+		// Number of recorded commands. Must not be called while recording.
+		std::size_t CommandCount() const
+		{
+			std::size_t command_count = 0;
+			for (const Lane& lane : lanes_) {
+				command_count += lane.commands.size();
+			}
+			return command_count;
+		}
+
+		/*
+		* Applies the recorded commands to registry and clears the buffer, then
+		* flushes the registry's component set events. Must not be called while
+		* other threads are recording. If a command fails, the remaining
+		* commands are discarded and the exception is rethrown.
+		*/
+		void Playback(Registry& registry)
+		{
+			try {
+				PlaybackCommands(registry);
+			}
+			catch (...) {
+				Clear();
+				throw;
+			}
+			Clear();
+			registry.FlushComponentSetEvents();
+		}
+
+		// Makes the ids reserved in entity_allocator alive, then plays back the
+		// commands. See RegisterNewEntity.
+		void Playback(Registry& registry, EntityAllocator& entity_allocator)
+		{
+			entity_allocator.CommitReserved();
+			Playback(registry);
+		}
+
+		// Discards the recorded commands.
+		void Clear()
+		{
+			for (Lane& lane : lanes_) {
+				for (Command& command : lane.commands) {
+					if (command.component_data) {
+						command.functions->destroy(command.component_data);
+					}
+				}
+				lane.commands.clear();
+				lane.ReleaseComponentChunks();
+			}
+		}
+
+	private:
+		enum CommandKind {
+			kRegisterEntity,
+			kRemoveComponent,
+			kAddComponent,
+			kUnregisterEntity
+		};
+
+		// Operations on a component type that has been recorded.
+		struct ComponentCommandFunctions {
+			void (*add_batch)(Registry& registry, const EntityID* entity_ids, void* const* components, std::size_t count);
+			void (*remove_batch)(Registry& registry, const EntityID* entity_ids, std::size_t count);
+			void (*destroy)(void* component);
+		};
+
+		struct Command {
+			EntityID entity_id;
+			CommandKind kind;
+			const ComponentCommandFunctions* functions;
+			ComponentTypeID component_type;
+			// Component to add, stored in the lane's chunks.
+			void* component_data;
+		};
+
+		struct Lane {
+			std::mutex mutex;
+			std::vector<Command> commands;
+			std::vector<unsigned char*> component_chunks;
+			std::size_t chunk_offset = ECS_CHUNK_SIZE;
+
+			void* AllocateComponent(std::size_t size, std::size_t alignment)
+			{
+				std::size_t offset = (chunk_offset + alignment - 1) / alignment * alignment;
+				if (offset + size > ECS_CHUNK_SIZE) {
+					component_chunks.push_back(ChunkPool::Shared().AllocateChunk());
+					offset = 0;
+				}
+				chunk_offset = offset + size;
+				return component_chunks.back() + offset;
+			}
+
+			void ReleaseComponentChunks()
+			{
+				for (unsigned char* chunk : component_chunks) {
+					ChunkPool::Shared().ReleaseChunk(chunk);
+				}
+				component_chunks.clear();
+				chunk_offset = ECS_CHUNK_SIZE;
+			}
+		};
+
+		// Commands of a single kind and component type, for entities that are in
+		// the same archetype.
+		struct CommandBatch {
+			CommandKind kind;
+			const ComponentCommandFunctions* functions;
+			std::vector<EntityID> entity_ids;
+			std::vector<void*> components;
+		};
+
+		struct CommandBatchKey {
+			CommandKind kind;
+			ComponentTypeID component_type;
+			const Archetype* archetype;
+
+			bool operator==(const CommandBatchKey& other) const
+			{
+				return kind == other.kind && component_type == other.component_type && archetype == other.archetype;
+			}
+		};
+
+		struct CommandBatchKeyHash {
+			std::size_t operator()(const CommandBatchKey& key) const
+			{
+				return std::hash<const Archetype*>()(key.archetype) ^ ((std::size_t)key.component_type << 3) ^ (std::size_t)key.kind;
+			}
+		};
+
+		std::vector<Lane> lanes_;
+
+		template<typename T>
+		static void AddComponentBatch(Registry& registry, const EntityID* entity_ids, void* const* components, std::size_t count)
+		{
+			// The recorded components are moved, since they are destroyed after playback.
+			std::vector<T*> typed_components(count);
+			for (std::size_t c_idx = 0; c_idx < count; ++c_idx) {
+				typed_components[c_idx] = static_cast<T*>(components[c_idx]);
+			}
+			registry.AddComponentBatch<T>(entity_ids, typed_components.data(), count);
+		}
+
+		template<typename T>
+		static void RemoveComponentBatch(Registry& registry, const EntityID* entity_ids, std::size_t count)
+		{
+			registry.RemoveComponentBatch<T>(entity_ids, count);
+		}
+
+		template<typename T>
+		static void DestroyComponent(void* component)
+		{
+			static_cast<T*>(component)->~T();
+		}
+
+		template<typename T>
+		static const ComponentCommandFunctions* ComponentCommandFunctionsFor()
+		{
+			static const ComponentCommandFunctions functions = { &AddComponentBatch<T>, &RemoveComponentBatch<T>, &DestroyComponent<T> };
+			return &functions;
+		}
+
+		// Every thread is assigned a lane the first time it records a command.
+		Lane& CurrentLane()
+		{
+			static std::atomic<std::size_t> next_lane_index(0);
+			static thread_local std::size_t lane_index = next_lane_index++ % ECS_COMMAND_BUFFER_LANE_COUNT;
+			return lanes_[lane_index];
+		}
+
+		void Record(const Command& command)
+		{
+			Lane& lane = CurrentLane();
+			std::lock_guard<std::mutex> lock(lane.mutex);
+			lane.commands.push_back(command);
+		}
+
+		void PlaybackCommands(Registry& registry)
+		{
+			// Gather the commands of every lane and sort them by entity, keeping the
+			// recorded order of the commands of each entity.
+			std::vector<Command*> commands;
+			commands.reserve(CommandCount());
+			for (Lane& lane : lanes_) {
+				for (Command& command : lane.commands) {
+					commands.push_back(&command);
+				}
+			}
+			std::stable_sort(commands.begin(), commands.end(), [](const Command* a, const Command* b) {
+				return a->entity_id.index < b->entity_id.index;
+			});
+
+			// Commands are played back in rounds, where every round applies the
+			// next command of every entity that has one left.
+			std::vector<std::size_t> entity_command_begins;
+			for (std::size_t c_idx = 0; c_idx < commands.size(); ++c_idx) {
+				if (c_idx == 0 || commands[c_idx]->entity_id.index != commands[c_idx - 1]->entity_id.index) {
+					entity_command_begins.push_back(c_idx);
+				}
+			}
+			entity_command_begins.push_back(commands.size());
+
+			std::vector<CommandBatch> batches;
+			std::unordered_map<CommandBatchKey, std::size_t, CommandBatchKeyHash> batch_indices;
+			for (std::size_t round = 0; ; ++round) {
+				batches.clear();
+				batch_indices.clear();
+				for (std::size_t e_idx = 0; e_idx + 1 < entity_command_begins.size(); ++e_idx) {
+					const std::size_t c_idx = entity_command_begins[e_idx] + round;
+					if (c_idx >= entity_command_begins[e_idx + 1]) {
+						continue;
+					}
+					Command* command = commands[c_idx];
+					const Archetype* archetype = command->kind == kRegisterEntity ? nullptr : registry.ArchetypeOfEntity(command->entity_id);
+					const CommandBatchKey key = { command->kind, command->component_type, archetype };
+					std::unordered_map<CommandBatchKey, std::size_t, CommandBatchKeyHash>::iterator batch_index_iter = batch_indices.find(key);
+					if (batch_index_iter == batch_indices.end()) {
+						batch_index_iter = batch_indices.insert(std::make_pair(key, batches.size())).first;
+						batches.push_back({ command->kind, command->functions, {}, {} });
+					}
+					CommandBatch& batch = batches[batch_index_iter->second];
+					batch.entity_ids.push_back(command->entity_id);
+					batch.components.push_back(command->component_data);
+				}
+				if (batches.empty()) {
+					break;
+				}
+
+				// Registering entities comes first and unregistering them last, so
+				// that entities exist while components are changed.
+				std::stable_sort(batches.begin(), batches.end(), [](const CommandBatch& a, const CommandBatch& b) {
+					return a.kind < b.kind;
+				});
+				for (CommandBatch& batch : batches) {
+					switch (batch.kind) {
+					case kRegisterEntity:
+						for (EntityID entity_id : batch.entity_ids) {
+							registry.RegisterEntity(entity_id);
+						}
+						break;
+					case kRemoveComponent:
+						batch.functions->remove_batch(registry, batch.entity_ids.data(), batch.entity_ids.size());
+						break;
+					case kAddComponent:
+						batch.functions->add_batch(registry, batch.entity_ids.data(), batch.components.data(), batch.entity_ids.size());
+						break;
+					case kUnregisterEntity:
+						registry.UnregisterEntityBatch(batch.entity_ids.data(), batch.entity_ids.size());
+						break;
+					}
+				}
+			}
+		}
+	};
+}
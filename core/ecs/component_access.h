@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+
+#include "archetype.h"
+#include "change_filter.h"
+
+// Checks the declared component access of parallel iterations for conflicts.
+// Enabled in debug builds by default.
+#ifndef ECS_CHECK_COMPONENT_ACCESS
+#ifdef NDEBUG
+#define ECS_CHECK_COMPONENT_ACCESS 0
+#else
+#define ECS_CHECK_COMPONENT_ACCESS 1
+#endif
+#endif
+
+namespace ecs {
+	/*
+	* Component types read and written by an iteration. Iterating over a
+	* const-qualified component type declares read-only access to it, which
+	* includes Changed<const T>.
+	*/
+	struct ComponentAccess {
+		ComponentSetIDs read_component_set_ids;
+		ComponentSetIDs write_component_set_ids;
+	};
+
+	template<class... Ts>
+	ComponentAccess ComponentAccessOf()
+	{
+		ComponentAccess access;
+		const int expansion[] = { 0, (
+			(std::is_const<QueriedComponent<Ts>>::value ? access.read_component_set_ids : access.write_component_set_ids)
+				.push_back(ComponentTypeRegistry::TypeIDOf<StoredComponent<Ts>>()),
+			0
+		)... };
+		(void)expansion;
+		std::sort(access.read_component_set_ids.begin(), access.read_component_set_ids.end());
+		std::sort(access.write_component_set_ids.begin(), access.write_component_set_ids.end());
+		return access;
+	}
+
+	/*
+	* Keeps track of the component access of the parallel iterations that are
+	* running, and throws when two of them conflict: a component type that is
+	* written by one iteration must not be read or written by another. Structural
+	* changes (adding or removing components and entities) conflict with every
+	* running parallel iteration.
+	*/
+	class ComponentAccessTracker
+	{
+	public:
+		void BeginAccess(const ComponentAccess& access)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			for (ComponentTypeID component_type : access.write_component_set_ids) {
+				const AccessCount& count = access_counts_[component_type];
+				if (count.readers > 0 || count.writers > 0) {
+					throw std::runtime_error("Data race: component type is written while it is accessed by another parallel iteration.");
+				}
+			}
+			for (ComponentTypeID component_type : access.read_component_set_ids) {
+				if (access_counts_[component_type].writers > 0) {
+					throw std::runtime_error("Data race: component type is read while it is written by another parallel iteration.");
+				}
+			}
+			for (ComponentTypeID component_type : access.write_component_set_ids) {
+				access_counts_[component_type].writers++;
+			}
+			for (ComponentTypeID component_type : access.read_component_set_ids) {
+				access_counts_[component_type].readers++;
+			}
+			active_access_count_++;
+		}
+
+		void EndAccess(const ComponentAccess& access)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			for (ComponentTypeID component_type : access.write_component_set_ids) {
+				access_counts_[component_type].writers--;
+			}
+			for (ComponentTypeID component_type : access.read_component_set_ids) {
+				access_counts_[component_type].readers--;
+			}
+			active_access_count_--;
+		}
+
+		void CheckStructuralChange()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (active_access_count_ > 0) {
+				throw std::runtime_error("Data race: entities cannot change components during a parallel iteration.");
+			}
+		}
+
+	private:
+		struct AccessCount {
+			std::size_t readers;
+			std::size_t writers;
+		};
+
+		std::mutex mutex_;
+		std::unordered_map<ComponentTypeID, AccessCount> access_counts_;
+		std::size_t active_access_count_ = 0;
+	};
+
+	// Declares access for the lifetime of the scope when access checks are enabled.
+	class ScopedComponentAccess
+	{
+	public:
+		ScopedComponentAccess(ComponentAccessTracker* tracker, const ComponentAccess& access) : tracker_(tracker), access_(access)
+		{
+#if ECS_CHECK_COMPONENT_ACCESS
+			if (tracker_) {
+				tracker_->BeginAccess(access_);
+			}
+#endif
+		}
+
+		~ScopedComponentAccess()
+		{
+#if ECS_CHECK_COMPONENT_ACCESS
+			if (tracker_) {
+				tracker_->EndAccess(access_);
+			}
+#endif
+		}
+
+		ScopedComponentAccess(const ScopedComponentAccess&) = delete;
+
+		ScopedComponentAccess& operator=(const ScopedComponentAccess&) = delete;
+
+	private:
+		ComponentAccessTracker* tracker_;
+		const ComponentAccess& access_;
+	};
+}
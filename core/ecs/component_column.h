@@ -0,0 +1,167 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "change_filter.h"
+#include "component_type.h"
+
+namespace ecs {
+	// Releases the unused capacity of vector. Returns the number of bytes released.
+	template<class T>
+	std::size_t ShrinkVectorToFit(std::vector<T>& vector)
+	{
+		const std::size_t capacity = vector.capacity();
+		vector.shrink_to_fit();
+		return (capacity - vector.capacity()) * sizeof(T);
+	}
+
+	/*
+	* Column of one component type in the chunks of an archetype. Columns do
+	* not own their components; every chunk holds chunk_capacity components of
+	* the column, starting at column_offset bytes into the chunk, and the
+	* archetype tracks how many of them are alive. Components are moved and
+	* destroyed through the ComponentTypeInfo of their type, so columns of every
+	* type are handled by the same non-virtual code, and typed access is a cast.
+	*/
+	class ComponentColumn
+	{
+	public:
+		explicit ComponentColumn(ComponentTypeID component_type)
+		{
+			component_type_ = component_type;
+			type_info_ = &ComponentTypeRegistry::Shared().TypeInfo(component_type);
+			chunks_ = nullptr;
+			chunk_capacity_ = 0;
+			column_offset_ = 0;
+		}
+
+		void BindToChunks(const std::vector<unsigned char*>* chunks, std::size_t chunk_capacity, std::size_t column_offset)
+		{
+			chunks_ = chunks;
+			chunk_capacity_ = chunk_capacity;
+			column_offset_ = column_offset;
+		}
+
+		ComponentTypeID ComponentType() const
+		{
+			return component_type_;
+		}
+
+		const ComponentTypeInfo& TypeInfo() const
+		{
+			return *type_info_;
+		}
+
+		// Start of the column in the chunk at chunk_index.
+		unsigned char* ColumnInChunk(std::size_t chunk_index) const
+		{
+			return (*chunks_)[chunk_index] + column_offset_;
+		}
+
+		void* AddressAtIndex(std::size_t index) const
+		{
+			return ColumnInChunk(index / chunk_capacity_) + (index % chunk_capacity_) * type_info_->size;
+		}
+
+		// T must be the component type of the column.
+		template<class T>
+		T& ComponentAtIndex(std::size_t index) const
+		{
+			return *static_cast<T*>(AddressAtIndex(index));
+		}
+
+		/*
+		* Moves the count components starting at index into uninitialized memory
+		* of destination, a column of the same type, starting at
+		* destination_index. The ranges must not overlap. Every stretch of the
+		* ranges that lies within one chunk on both sides is moved with a single
+		* relocation, which is a memcpy for trivially relocatable types.
+		*/
+		void RelocateRange(std::size_t index, ComponentColumn& destination, std::size_t destination_index, std::size_t count)
+		{
+			while (count > 0) {
+				const std::size_t stretch = std::min(count, std::min(
+					chunk_capacity_ - index % chunk_capacity_,
+					destination.chunk_capacity_ - destination_index % destination.chunk_capacity_
+				));
+				Relocate(destination.AddressAtIndex(destination_index), AddressAtIndex(index), stretch);
+				index += stretch;
+				destination_index += stretch;
+				count -= stretch;
+			}
+		}
+
+		// Moves the component at index into uninitialized memory at destination_index of destination.
+		void RelocateAtIndex(std::size_t index, ComponentColumn& destination, std::size_t destination_index)
+		{
+			Relocate(destination.AddressAtIndex(destination_index), AddressAtIndex(index), 1);
+		}
+
+		// Moves the first count components in the chunk at chunk_index into
+		// uninitialized memory of destination_chunk, at the same offset.
+		void RelocateChunk(std::size_t chunk_index, unsigned char* destination_chunk, std::size_t count)
+		{
+			Relocate(destination_chunk + column_offset_, ColumnInChunk(chunk_index), count);
+		}
+
+		// Destroys the count components starting at index.
+		void DestroyRange(std::size_t index, std::size_t count)
+		{
+			while (count > 0) {
+				const std::size_t stretch = std::min(count, chunk_capacity_ - index % chunk_capacity_);
+				type_info_->destroy(AddressAtIndex(index), stretch);
+				index += stretch;
+				count -= stretch;
+			}
+		}
+
+		// Change version at which the column in the chunk at chunk_index was last written.
+		ChangeVersion ChunkVersion(std::size_t chunk_index) const
+		{
+			return chunk_versions_[chunk_index];
+		}
+
+		void MarkChunkChanged(std::size_t chunk_index, ChangeVersion version)
+		{
+			chunk_versions_[chunk_index] = version;
+		}
+
+		// Keeps a change version for every chunk; called by the owning archetype
+		// as chunks are added and released.
+		void AddChunkVersion(ChangeVersion version)
+		{
+			chunk_versions_.push_back(version);
+		}
+
+		void RemoveLastChunkVersion()
+		{
+			chunk_versions_.pop_back();
+		}
+
+		// Returns the number of bytes released.
+		std::size_t ShrinkToFit()
+		{
+			return ShrinkVectorToFit(chunk_versions_);
+		}
+
+	private:
+		ComponentTypeID component_type_;
+		const ComponentTypeInfo* type_info_;
+		const std::vector<unsigned char*>* chunks_;
+		std::size_t chunk_capacity_;
+		std::size_t column_offset_;
+		std::vector<ChangeVersion> chunk_versions_;
+
+		void Relocate(void* destination, void* source, std::size_t count) const
+		{
+			if (type_info_->is_trivially_relocatable) {
+				std::memcpy(destination, source, count * type_info_->size);
+			}
+			else {
+				type_info_->relocate(destination, source, count);
+			}
+		}
+	};
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "component_type.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define ECS_COMPONENT_MASK_AVX2 1
+#elif defined(__SSE4_1__) || defined(__AVX__)
+#include <smmintrin.h>
+#define ECS_COMPONENT_MASK_SSE4_1 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ECS_COMPONENT_MASK_SSE2 1
+#endif
+
+// Number of component types that component masks can hold. Must be a multiple of 256.
+#ifndef ECS_COMPONENT_MASK_BITS
+#define ECS_COMPONENT_MASK_BITS ECS_MAX_COMPONENT_TYPES
+#endif
+
+namespace ecs {
+	// Always in order Least->Greatest
+	typedef std::vector<ComponentTypeID> ComponentSetIDs;
+
+	/*
+	* Fixed-size bitset of component types, with bit i set if the set holds the
+	* component type with id i. Testing whether one set is a superset of
+	* another takes a few SIMD instructions, rather than a walk over two
+	* ComponentSetIDs.
+	*/
+	class ComponentMask
+	{
+	public:
+		static_assert(ECS_COMPONENT_MASK_BITS % 256 == 0, "ECS_COMPONENT_MASK_BITS must be a multiple of 256.");
+
+		ComponentMask()
+		{
+			std::memset(words_, 0, sizeof(words_));
+		}
+
+		explicit ComponentMask(const ComponentSetIDs& component_set_ids) : ComponentMask()
+		{
+			for (ComponentTypeID component_type : component_set_ids) {
+				Set(component_type);
+			}
+		}
+
+		void Set(ComponentTypeID component_type)
+		{
+			if (component_type >= ECS_COMPONENT_MASK_BITS) {
+				throw std::runtime_error("Component type id exceeds ECS_COMPONENT_MASK_BITS. Increase it to use more component types.");
+			}
+			words_[component_type / 64] |= (std::uint64_t)1 << (component_type % 64);
+		}
+
+		bool Test(ComponentTypeID component_type) const
+		{
+			return component_type < ECS_COMPONENT_MASK_BITS && (words_[component_type / 64] >> (component_type % 64)) & 1;
+		}
+
+		// Whether every component type of subset is also in this set.
+		bool Includes(const ComponentMask& subset) const
+		{
+#if ECS_COMPONENT_MASK_AVX2
+			for (std::size_t w_idx = 0; w_idx < kWordCount; w_idx += 4) {
+				const __m256i words = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words_ + w_idx));
+				const __m256i subset_words = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(subset.words_ + w_idx));
+				// Tests that (~words & subset_words) == 0.
+				if (!_mm256_testc_si256(words, subset_words)) {
+					return false;
+				}
+			}
+			return true;
+#elif ECS_COMPONENT_MASK_SSE4_1
+			for (std::size_t w_idx = 0; w_idx < kWordCount; w_idx += 2) {
+				const __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(words_ + w_idx));
+				const __m128i subset_words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(subset.words_ + w_idx));
+				if (!_mm_testc_si128(words, subset_words)) {
+					return false;
+				}
+			}
+			return true;
+#elif ECS_COMPONENT_MASK_SSE2
+			for (std::size_t w_idx = 0; w_idx < kWordCount; w_idx += 2) {
+				const __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(words_ + w_idx));
+				const __m128i subset_words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(subset.words_ + w_idx));
+				const __m128i missing_words = _mm_andnot_si128(words, subset_words);
+				if (_mm_movemask_epi8(_mm_cmpeq_epi8(missing_words, _mm_setzero_si128())) != 0xFFFF) {
+					return false;
+				}
+			}
+			return true;
+#else
+			for (std::size_t w_idx = 0; w_idx < kWordCount; ++w_idx) {
+				if (subset.words_[w_idx] & ~words_[w_idx]) {
+					return false;
+				}
+			}
+			return true;
+#endif
+		}
+
+		bool operator==(const ComponentMask& other) const
+		{
+			return std::memcmp(words_, other.words_, sizeof(words_)) == 0;
+		}
+
+		bool operator!=(const ComponentMask& other) const
+		{
+			return !(*this == other);
+		}
+
+	private:
+		static const std::size_t kWordCount = ECS_COMPONENT_MASK_BITS / 64;
+
+		std::uint64_t words_[kWordCount];
+	};
+}
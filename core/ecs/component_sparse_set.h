@@ -0,0 +1,309 @@
+#pragma once
+
+#include <algorithm>
+#include <assert.h>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "archetype.h"
+#include "change_filter.h"
+#include "chunk_pool.h"
+#include "component_column.h"
+#include "component_storage.h"
+#include "component_type.h"
+#include "entity.h"
+#include "entity_records.h"
+
+// Number of entity indices covered by one page of a sparse set's index.
+#ifndef ECS_SPARSE_SET_PAGE_SIZE
+#define ECS_SPARSE_SET_PAGE_SIZE 4096
+#endif
+
+namespace ecs {
+	/*
+	* Components of a single type, keyed by entity. The components and the
+	* ids of their entities are kept densely packed, in chunks of the
+	* ChunkPool, so every operation takes constant time: removing a component
+	* moves the last one into its place. The index from entity to dense
+	* position is split into pages that are only allocated for the entity
+	* indices in use.
+	*/
+	class ComponentSparseSet
+	{
+	public:
+		explicit ComponentSparseSet(ComponentTypeID component_type) : column_(component_type)
+		{
+			if (column_.TypeInfo().size > ECS_CHUNK_SIZE) {
+				throw std::runtime_error("Component is too large for a sparse set.");
+			}
+			chunk_capacity_ = ECS_CHUNK_SIZE / column_.TypeInfo().size;
+			column_.BindToChunks(&chunks_, chunk_capacity_, 0);
+		}
+
+		~ComponentSparseSet()
+		{
+			column_.DestroyRange(0, entity_ids_.size());
+			for (unsigned char* chunk : chunks_) {
+				ChunkPool::Shared().ReleaseChunk(chunk);
+			}
+		}
+
+		ComponentSparseSet(const ComponentSparseSet&) = delete;
+
+		ComponentSparseSet& operator=(const ComponentSparseSet&) = delete;
+
+		std::size_t Size() const
+		{
+			return entity_ids_.size();
+		}
+
+		// Entities that have a component, in the order of the components.
+		const EntityID* EntityIDs() const
+		{
+			return entity_ids_.data();
+		}
+
+		bool Contains(EntityID entity_id) const
+		{
+			return DenseIndexOf(entity_id) != kNoDenseIndex;
+		}
+
+		// Component of entity_id, or nullptr if it has none.
+		void* Find(EntityID entity_id) const
+		{
+			const std::uint32_t dense_index = DenseIndexOf(entity_id);
+			return dense_index != kNoDenseIndex ? column_.AddressAtIndex(dense_index) : nullptr;
+		}
+
+		/*
+		* Returns uninitialized memory for the component of entity_id, in which
+		* the caller constructs it. The entity must not have a component yet.
+		*/
+		void* Emplace(EntityID entity_id)
+		{
+			assert(!Contains(entity_id));
+			const std::size_t dense_index = entity_ids_.size();
+			if (dense_index == chunks_.size() * chunk_capacity_) {
+				chunks_.push_back(ChunkPool::Shared().AllocateChunk());
+			}
+			DenseIndexSlot(entity_id.index) = (std::uint32_t)dense_index;
+			entity_ids_.push_back(entity_id);
+			return column_.AddressAtIndex(dense_index);
+		}
+
+		// Destroys the component of entity_id. Returns false if it has none.
+		bool Remove(EntityID entity_id)
+		{
+			const std::uint32_t dense_index = DenseIndexOf(entity_id);
+			if (dense_index == kNoDenseIndex) {
+				return false;
+			}
+			const std::size_t last_dense_index = entity_ids_.size() - 1;
+			column_.DestroyRange(dense_index, 1);
+			if (dense_index != last_dense_index) {
+				column_.RelocateAtIndex(last_dense_index, column_, dense_index);
+				entity_ids_[dense_index] = entity_ids_[last_dense_index];
+				DenseIndexSlot(entity_ids_[dense_index].index) = dense_index;
+			}
+			DenseIndexSlot(entity_id.index) = kNoDenseIndex;
+			entity_ids_.pop_back();
+			if (entity_ids_.size() == (chunks_.size() - 1) * chunk_capacity_) {
+				ChunkPool::Shared().ReleaseChunk(chunks_.back());
+				chunks_.pop_back();
+			}
+			return true;
+		}
+
+		// Moves chunks to fuller slabs of the ChunkPool. See Archetype::DefragmentChunks.
+		std::size_t DefragmentChunks()
+		{
+			std::size_t moved_chunk_count = 0;
+			for (std::size_t chunk_index = 0; chunk_index < chunks_.size(); ++chunk_index) {
+				unsigned char* relocated_chunk = ChunkPool::Shared().AllocateChunkForRelocation(chunks_[chunk_index]);
+				if (!relocated_chunk) {
+					continue;
+				}
+				column_.RelocateChunk(chunk_index, relocated_chunk, std::min(chunk_capacity_, entity_ids_.size() - chunk_index * chunk_capacity_));
+				ChunkPool::Shared().ReleaseChunk(chunks_[chunk_index]);
+				chunks_[chunk_index] = relocated_chunk;
+				moved_chunk_count++;
+			}
+			return moved_chunk_count;
+		}
+
+		// Returns the number of bytes released.
+		std::size_t ShrinkToFit()
+		{
+			return ShrinkVectorToFit(chunks_) + ShrinkVectorToFit(entity_ids_);
+		}
+
+	private:
+		static const std::uint32_t kNoDenseIndex = ~(std::uint32_t)0;
+
+		ComponentColumn column_;
+
+		std::vector<unsigned char*> chunks_;
+
+		std::size_t chunk_capacity_;
+
+		// In the order of the components.
+		std::vector<EntityID> entity_ids_;
+
+		// Dense index of the component of every entity index, or kNoDenseIndex.
+		std::vector<std::unique_ptr<std::uint32_t[]>> pages_;
+
+		std::uint32_t DenseIndexOf(EntityID entity_id) const
+		{
+			const std::size_t page_index = entity_id.index / ECS_SPARSE_SET_PAGE_SIZE;
+			if (page_index >= pages_.size() || !pages_[page_index]) {
+				return kNoDenseIndex;
+			}
+			const std::uint32_t dense_index = pages_[page_index][entity_id.index % ECS_SPARSE_SET_PAGE_SIZE];
+			// The version check rejects stale ids of an entity index that was reused.
+			if (dense_index == kNoDenseIndex || entity_ids_[dense_index] != entity_id) {
+				return kNoDenseIndex;
+			}
+			return dense_index;
+		}
+
+		std::uint32_t& DenseIndexSlot(EntityIndex entity_index)
+		{
+			const std::size_t page_index = entity_index / ECS_SPARSE_SET_PAGE_SIZE;
+			if (page_index >= pages_.size()) {
+				pages_.resize(page_index + 1);
+			}
+			if (!pages_[page_index]) {
+				pages_[page_index].reset(new std::uint32_t[ECS_SPARSE_SET_PAGE_SIZE]);
+				for (std::size_t s_idx = 0; s_idx < ECS_SPARSE_SET_PAGE_SIZE; ++s_idx) {
+					pages_[page_index][s_idx] = kNoDenseIndex;
+				}
+			}
+			return pages_[page_index][entity_index % ECS_SPARSE_SET_PAGE_SIZE];
+		}
+	};
+
+	// The sparse sets of a registry, one per component type that has been added.
+	class ComponentSparseSets
+	{
+	public:
+		// Sparse set of component_type, or nullptr if it has never been added.
+		ComponentSparseSet* Find(ComponentTypeID component_type) const
+		{
+			return component_type < sparse_sets_.size() ? sparse_sets_[component_type].get() : nullptr;
+		}
+
+		ComponentSparseSet& SparseSetFor(ComponentTypeID component_type)
+		{
+			if (component_type >= sparse_sets_.size()) {
+				sparse_sets_.resize(component_type + 1);
+			}
+			if (!sparse_sets_[component_type]) {
+				sparse_sets_[component_type].reset(new ComponentSparseSet(component_type));
+				existing_sparse_sets_.push_back(sparse_sets_[component_type].get());
+			}
+			return *sparse_sets_[component_type];
+		}
+
+		// Removes the components of entity_id from every sparse set.
+		void RemoveEntity(EntityID entity_id)
+		{
+			for (ComponentSparseSet* sparse_set : existing_sparse_sets_) {
+				sparse_set->Remove(entity_id);
+			}
+		}
+
+		std::size_t DefragmentChunks()
+		{
+			std::size_t moved_chunk_count = 0;
+			for (ComponentSparseSet* sparse_set : existing_sparse_sets_) {
+				moved_chunk_count += sparse_set->DefragmentChunks();
+			}
+			return moved_chunk_count;
+		}
+
+		std::size_t ShrinkToFit()
+		{
+			std::size_t released_bytes = 0;
+			for (ComponentSparseSet* sparse_set : existing_sparse_sets_) {
+				released_bytes += sparse_set->ShrinkToFit();
+			}
+			return released_bytes;
+		}
+
+		/*
+		* Calls f(entity_id, Ts& ...components) for every entity that has the
+		* components Ts, of which at least one is stored in a sparse set. The
+		* entities of the smallest of those sparse sets are visited, and their
+		* other components are looked up through entity_records. f must not
+		* add or remove components.
+		*/
+		template<class... Ts, class F>
+		void EachJoined(EntityRecords& entity_records, F&& f)
+		{
+			static_assert(HasSparseSetComponent<Ts...>(), "Joins visit the entities of a sparse set.");
+			[this, &entity_records, &f](typename SparseSetOf<Ts>::type ...component_sparse_sets) {
+				const bool is_sparse_set[] = { IsSparseSetComponent<StoredComponent<Ts>>::value... };
+				ComponentSparseSet* const candidate_sparse_sets[] = { component_sparse_sets... };
+				ComponentSparseSet* driving_sparse_set = nullptr;
+				for (std::size_t c_idx = 0; c_idx < sizeof...(Ts); ++c_idx) {
+					if (!is_sparse_set[c_idx]) {
+						continue;
+					}
+					if (!candidate_sparse_sets[c_idx]) {
+						// No entity has this component.
+						return;
+					}
+					if (!driving_sparse_set || candidate_sparse_sets[c_idx]->Size() < driving_sparse_set->Size()) {
+						driving_sparse_set = candidate_sparse_sets[c_idx];
+					}
+				}
+				const EntityID* entity_ids = driving_sparse_set->EntityIDs();
+				for (std::size_t e_idx = 0; e_idx < driving_sparse_set->Size(); ++e_idx) {
+					const EntityID entity_id = entity_ids[e_idx];
+					[entity_id, &f](QueriedComponent<Ts>* ...components) {
+						const bool found[] = { true, (components != nullptr)... };
+						for (bool component_found : found) {
+							if (!component_found) {
+								return;
+							}
+						}
+						f(entity_id, *components...);
+					}(JoinedComponent<Ts>(entity_id, entity_records, component_sparse_sets)...);
+				}
+			}(Find(IsSparseSetComponent<StoredComponent<Ts>>::value ? ComponentTypeRegistry::TypeIDOf<StoredComponent<Ts>>() : kNoComponentTypeID)...);
+		}
+
+	private:
+		// Indexed by component type.
+		std::vector<std::unique_ptr<ComponentSparseSet>> sparse_sets_;
+
+		std::vector<ComponentSparseSet*> existing_sparse_sets_;
+
+		// Sparse set parameter type for every component type of a pack.
+		template<class T>
+		struct SparseSetOf {
+			typedef ComponentSparseSet* type;
+		};
+
+		// Fetching a non-const component of an archetype counts as writing it.
+		template<class T>
+		static QueriedComponent<T>* JoinedComponent(EntityID entity_id, EntityRecords& entity_records, ComponentSparseSet* sparse_set)
+		{
+			static_assert(!QueriedComponentType<T>::is_change_filter, "Joins with sparse set components do not support change filters.");
+			QueriedComponent<T>* component = nullptr;
+			if (IsSparseSetComponent<StoredComponent<T>>::value) {
+				component = static_cast<QueriedComponent<T>*>(sparse_set->Find(entity_id));
+			}
+			else {
+				const EntityRecord& record = entity_records[entity_id.index];
+				if (record.archetype) {
+					record.archetype->GetComponentAtRow<QueriedComponent<T>>(record.row, component);
+				}
+			}
+			return component;
+		}
+	};
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+
+#include "change_filter.h"
+
+namespace ecs {
+	enum ComponentStorage {
+		// Stored in the chunks of the entity's archetype. Adding or removing the
+		// component moves the entity to another archetype.
+		kArchetypeStorage,
+		// Stored in a sparse set of its own type, outside of the archetypes.
+		// Adding or removing the component takes constant time and moves no
+		// other components, but it cannot be iterated by chunk.
+		kSparseSetStorage,
+		// Stored once per archetype and shared by all of its entities. Equal
+		// values are stored once per registry, and entities with different
+		// values are kept in different archetypes, so the entities sharing a
+		// value are stored contiguously. Shared components are read-only.
+		kSharedStorage
+	};
+
+	// Storage of a component type. Use ECS_SPARSE_SET_COMPONENT or
+	// ECS_SHARED_COMPONENT to change it.
+	template<class T>
+	struct ComponentStorageOf {
+		static const ComponentStorage storage = kArchetypeStorage;
+	};
+
+	template<class T>
+	struct IsSparseSetComponent : std::integral_constant<bool, ComponentStorageOf<T>::storage == kSparseSetStorage> {};
+
+	template<class T>
+	struct IsSharedComponent : std::integral_constant<bool, ComponentStorageOf<T>::storage == kSharedStorage> {};
+
+	// Whether any of the queried types Ts is stored in a sparse set.
+	template<class... Ts>
+	constexpr bool HasSparseSetComponent()
+	{
+		const bool is_sparse_set[] = { false, IsSparseSetComponent<StoredComponent<Ts>>::value... };
+		for (bool component_is_sparse_set : is_sparse_set) {
+			if (component_is_sparse_set) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Whether any of the queried types Ts is a shared component.
+	template<class... Ts>
+	constexpr bool HasSharedComponent()
+	{
+		const bool is_shared[] = { false, IsSharedComponent<StoredComponent<Ts>>::value... };
+		for (bool component_is_shared : is_shared) {
+			if (component_is_shared) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Row of the component that is passed for a row of a chunk to iteration
+	// callbacks. Chunk columns of shared components hold a single component,
+	// which is passed for every row.
+	template<class T>
+	constexpr std::size_t QueriedRow(std::size_t row)
+	{
+		return IsSharedComponent<StoredComponent<T>>::value ? 0 : row;
+	}
+}
+
+// Stores the components of type T in sparse sets. Must be used in the global
+// namespace, next to the definition of T.
+#define ECS_SPARSE_SET_COMPONENT(T) \
+	namespace ecs { \
+		template<> \
+		struct ComponentStorageOf<T> { \
+			static const ComponentStorage storage = kSparseSetStorage; \
+		}; \
+	}
+
+// Makes T a shared component, which must be copy-constructible and equality
+// comparable. Must be used in the global namespace, next to the definition of T.
+#define ECS_SHARED_COMPONENT(T) \
+	namespace ecs { \
+		template<> \
+		struct ComponentStorageOf<T> { \
+			static const ComponentStorage storage = kSharedStorage; \
+		}; \
+	}
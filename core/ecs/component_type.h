@@ -0,0 +1,215 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include <config/core_components.h>
+
+// Number of component types that can be registered.
+#ifndef ECS_MAX_COMPONENT_TYPES
+#define ECS_MAX_COMPONENT_TYPES 256
+#endif
+
+namespace ecs {
+	typedef std::uint32_t ComponentTypeID;
+
+	static const ComponentTypeID kNoComponentTypeID = ~(ComponentTypeID)0;
+
+	/*
+	* Layout of a component type, and functions that handle arrays of it
+	* without knowing the type.
+	*/
+	struct ComponentTypeInfo {
+		std::size_t size;
+		std::size_t alignment;
+		// Whether components can be moved to other memory with memcpy, after
+		// which the source memory is considered uninitialized.
+		bool is_trivially_relocatable;
+		// Move-constructs count components into uninitialized memory at destination,
+		// and destroys the components at source.
+		void (*relocate)(void* destination, void* source, std::size_t count);
+		// Move-constructs count components into uninitialized memory at destination.
+		void (*move_construct)(void* destination, void* source, std::size_t count);
+		void (*destroy)(void* components, std::size_t count);
+	};
+
+	/*
+	* Process-wide table of component types. Every type is assigned the next
+	* dense id the first time that it is seen, which is during static
+	* initialization for the types used by ComponentTypeRegistry::TypeIDOf.
+	* The core component types are assigned the first ids, in the order of
+	* FOREACH_CORE_COMPONENT_TYPE, so that their ids are the same in every
+	* build.
+	*
+	* Looking up the id or the info of a type that is already registered does
+	* not lock.
+	*/
+	class ComponentTypeRegistry
+	{
+	public:
+		ComponentTypeRegistry(const ComponentTypeRegistry&) = delete;
+
+		ComponentTypeRegistry& operator=(const ComponentTypeRegistry&) = delete;
+
+		static ComponentTypeRegistry& Shared()
+		{
+			static ComponentTypeRegistry shared_component_type_registry;
+			return shared_component_type_registry;
+		}
+
+		template<typename T>
+		static ComponentTypeID TypeIDOf()
+		{
+			static_assert(!std::is_const<T>::value && !std::is_reference<T>::value, "Component types must not be const or references.");
+			// Registers T during static initialization.
+			(void)TypeSlot<T>::registered_at_startup;
+			const ComponentTypeID component_type = TypeSlot<T>::id.load(std::memory_order_acquire);
+			if (component_type != kNoComponentTypeID) {
+				return component_type;
+			}
+			return Shared().RegisterType<T>();
+		}
+
+		const ComponentTypeInfo& TypeInfo(ComponentTypeID component_type) const
+		{
+			return type_infos_[component_type];
+		}
+
+		template<typename T>
+		static const ComponentTypeInfo& TypeInfoOf()
+		{
+			return Shared().TypeInfo(TypeIDOf<T>());
+		}
+
+		// Number of ids assigned, including reserved ids of types that are not registered yet.
+		std::size_t TypeCount() const
+		{
+			return type_count_.load(std::memory_order_acquire);
+		}
+
+	private:
+		template<typename T>
+		struct TypeSlot {
+			// Set once the info of T is filled in.
+			static std::atomic<ComponentTypeID> id;
+			// Id reserved before T is complete. Guarded by the registry's mutex.
+			static ComponentTypeID reserved_id;
+			static const bool registered_at_startup;
+		};
+
+		ComponentTypeInfo type_infos_[ECS_MAX_COMPONENT_TYPES];
+
+		std::atomic<std::size_t> type_count_;
+
+		std::mutex mutex_;
+
+#define ECS_RESERVE_CORE_COMPONENT_TYPE_ID(name) ReserveTypeID<name>();
+
+		ComponentTypeRegistry() : type_count_(0)
+		{
+			std::memset(type_infos_, 0, sizeof(type_infos_));
+			FOREACH_CORE_COMPONENT_TYPE(ECS_RESERVE_CORE_COMPONENT_TYPE_ID)
+		}
+
+#undef ECS_RESERVE_CORE_COMPONENT_TYPE_ID
+
+		// T may be incomplete.
+		template<typename T>
+		void ReserveTypeID()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (TypeSlot<T>::reserved_id == kNoComponentTypeID) {
+				TypeSlot<T>::reserved_id = NextTypeID();
+			}
+		}
+
+		template<typename T>
+		ComponentTypeID RegisterType()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			// Another thread may have registered T in the meantime.
+			ComponentTypeID component_type = TypeSlot<T>::id.load(std::memory_order_relaxed);
+			if (component_type != kNoComponentTypeID) {
+				return component_type;
+			}
+			if (TypeSlot<T>::reserved_id == kNoComponentTypeID) {
+				TypeSlot<T>::reserved_id = NextTypeID();
+			}
+			component_type = TypeSlot<T>::reserved_id;
+			type_infos_[component_type] = {
+				sizeof(T),
+				alignof(T),
+				std::is_trivially_copyable<T>::value,
+				&Relocate<T>,
+				&MoveConstruct<T>,
+				&Destroy<T>
+			};
+			// Publishes the info to the lock-free readers.
+			TypeSlot<T>::id.store(component_type, std::memory_order_release);
+			return component_type;
+		}
+
+		ComponentTypeID NextTypeID()
+		{
+			const std::size_t type_count = type_count_.load(std::memory_order_relaxed);
+			if (type_count >= ECS_MAX_COMPONENT_TYPES) {
+				throw std::runtime_error("Too many component types. Increase ECS_MAX_COMPONENT_TYPES.");
+			}
+			type_count_.store(type_count + 1, std::memory_order_release);
+			return (ComponentTypeID)type_count;
+		}
+
+		template<typename T>
+		static void Relocate(void* destination, void* source, std::size_t count)
+		{
+			RelocateComponents<T>(destination, source, count, std::integral_constant<bool, std::is_trivially_copyable<T>::value>());
+		}
+
+		template<typename T>
+		static void RelocateComponents(void* destination, void* source, std::size_t count, std::true_type)
+		{
+			std::memcpy(destination, source, count * sizeof(T));
+		}
+
+		template<typename T>
+		static void RelocateComponents(void* destination, void* source, std::size_t count, std::false_type)
+		{
+			MoveConstruct<T>(destination, source, count);
+			Destroy<T>(source, count);
+		}
+
+		template<typename T>
+		static void MoveConstruct(void* destination, void* source, std::size_t count)
+		{
+			T* destination_components = static_cast<T*>(destination);
+			T* source_components = static_cast<T*>(source);
+			for (std::size_t c_idx = 0; c_idx < count; ++c_idx) {
+				new (destination_components + c_idx) T(std::move(source_components[c_idx]));
+			}
+		}
+
+		template<typename T>
+		static void Destroy(void* components, std::size_t count)
+		{
+			T* typed_components = static_cast<T*>(components);
+			for (std::size_t c_idx = 0; c_idx < count; ++c_idx) {
+				typed_components[c_idx].~T();
+			}
+		}
+	};
+
+	template<typename T>
+	std::atomic<ComponentTypeID> ComponentTypeRegistry::TypeSlot<T>::id(kNoComponentTypeID);
+
+	template<typename T>
+	ComponentTypeID ComponentTypeRegistry::TypeSlot<T>::reserved_id = kNoComponentTypeID;
+
+	template<typename T>
+	const bool ComponentTypeRegistry::TypeSlot<T>::registered_at_startup = (ComponentTypeRegistry::TypeIDOf<T>(), true);
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <assert.h>
+#include <atomic>
+#include <vector>
+
+#include "entity.h"
+
+namespace ecs {
+	/*
+	* Hands out entity ids and recycles the indices of freed ones. There is an
+	* entry for every index that was ever handed out. The entry of an alive
+	* entity is its id; the entry of a freed index holds the version to hand
+	* out next, and the index of the next free entry in place of its own, so
+	* the free list needs no storage of its own. Versions are increased when
+	* an id is freed, so stale ids are never alive again.
+	*
+	* Allocating and freeing are not thread-safe. Reserve can be called from
+	* any number of threads at once, as long as nothing else is done with the
+	* allocator; reserved ids become alive at CommitReserved, which is called
+	* when the commands that use them are played back.
+	*/
+	class EntityAllocator
+	{
+	public:
+		EntityAllocator() : reserved_free_head_(kNoFreeIndex), reserved_end_count_(0)
+		{
+			free_head_ = kNoFreeIndex;
+		}
+
+		EntityAllocator(const EntityAllocator&) = delete;
+
+		EntityAllocator& operator=(const EntityAllocator&) = delete;
+
+		EntityID Allocate()
+		{
+			EntityID entity_id;
+			AllocateBatch(&entity_id, 1);
+			return entity_id;
+		}
+
+		// Writes count new ids to entity_ids, reusing freed indices first.
+		void AllocateBatch(EntityID* entity_ids, std::size_t count)
+		{
+			assert(!HasPendingReservations());
+			std::size_t e_idx = 0;
+			for (; e_idx < count && free_head_ != kNoFreeIndex; ++e_idx) {
+				EntityID& entry = entries_[free_head_];
+				const EntityIndex entity_index = free_head_;
+				free_head_ = entry.index;
+				entry.index = entity_index;
+				entity_ids[e_idx] = entry;
+			}
+			if (e_idx < count) {
+				const std::size_t first_new_index = entries_.size();
+				entries_.resize(first_new_index + count - e_idx);
+				for (std::size_t n_idx = first_new_index; e_idx < count; ++e_idx, ++n_idx) {
+					entries_[n_idx] = { 0, (EntityIndex)n_idx };
+					entity_ids[e_idx] = entries_[n_idx];
+				}
+			}
+			reserved_free_head_.store(free_head_, std::memory_order_relaxed);
+		}
+
+		void Free(EntityID entity_id)
+		{
+			FreeBatch(&entity_id, 1);
+		}
+
+		// Every id in entity_ids must be alive and appear only once.
+		void FreeBatch(const EntityID* entity_ids, std::size_t count)
+		{
+			assert(!HasPendingReservations());
+			for (std::size_t e_idx = 0; e_idx < count; ++e_idx) {
+				assert(IsAlive(entity_ids[e_idx]));
+				EntityID& entry = entries_[entity_ids[e_idx].index];
+				entry.version++;
+				entry.index = free_head_;
+				free_head_ = entity_ids[e_idx].index;
+			}
+			reserved_free_head_.store(free_head_, std::memory_order_relaxed);
+		}
+
+		bool IsAlive(EntityID entity_id) const
+		{
+			return entity_id.index < entries_.size() && entries_[entity_id.index] == entity_id;
+		}
+
+		/*
+		* Returns an id that becomes alive at the next CommitReserved. Thread-safe
+		* with respect to other calls of Reserve. While reserving, the free list
+		* only shrinks and its links are not written, so popping it with a
+		* compare-exchange of the head cannot suffer from ABA.
+		*/
+		EntityID Reserve()
+		{
+			EntityIndex entity_index = reserved_free_head_.load(std::memory_order_acquire);
+			while (entity_index != kNoFreeIndex) {
+				const EntityID& entry = entries_[entity_index];
+				if (reserved_free_head_.compare_exchange_weak(entity_index, entry.index, std::memory_order_acq_rel, std::memory_order_acquire)) {
+					return { entry.version, entity_index };
+				}
+			}
+			return { 0, (EntityIndex)(entries_.size() + reserved_end_count_.fetch_add(1, std::memory_order_relaxed)) };
+		}
+
+		// Makes the ids returned by Reserve since the last commit alive. Must not
+		// be called while other threads are reserving.
+		void CommitReserved()
+		{
+			const EntityIndex reserved_free_head = reserved_free_head_.load(std::memory_order_acquire);
+			while (free_head_ != reserved_free_head) {
+				EntityID& entry = entries_[free_head_];
+				const EntityIndex entity_index = free_head_;
+				free_head_ = entry.index;
+				entry.index = entity_index;
+			}
+			const std::size_t reserved_end_count = reserved_end_count_.exchange(0, std::memory_order_relaxed);
+			const std::size_t first_new_index = entries_.size();
+			entries_.resize(first_new_index + reserved_end_count);
+			for (std::size_t n_idx = first_new_index; n_idx < entries_.size(); ++n_idx) {
+				entries_[n_idx] = { 0, (EntityIndex)n_idx };
+			}
+		}
+
+		bool HasPendingReservations() const
+		{
+			return reserved_free_head_.load(std::memory_order_acquire) != free_head_ || reserved_end_count_.load(std::memory_order_acquire) > 0;
+		}
+
+		// Number of indices handed out so far; every alive id has a smaller index.
+		std::size_t Capacity() const
+		{
+			return entries_.size();
+		}
+
+	private:
+		static const EntityIndex kNoFreeIndex = ~(EntityIndex)0;
+
+		std::vector<EntityID> entries_;
+		// First entry of the free list.
+		EntityIndex free_head_;
+		// First entry of the free list that has not been reserved. Equal to
+		// free_head_ when there are no pending reservations.
+		std::atomic<EntityIndex> reserved_free_head_;
+		// Number of ids reserved past the end of entries_.
+		std::atomic<std::size_t> reserved_end_count_;
+	};
+}
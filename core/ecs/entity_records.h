@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+
+#include "entity.h"
+
+namespace ecs {
+	class Archetype;
+
+	// Location of an entity's component data.
+	struct EntityRecord {
+		// Archetype the entity belongs to, or nullptr if it has no components.
+		Archetype* archetype;
+		// Row of the entity within the archetype.
+		std::size_t row;
+	};
+
+	/*
+	* Dense table of entity records indexed by EntityID.index. Archetypes keep
+	* the records of their entities up to date as rows are added, moved and
+	* removed, so finding an entity's component data never requires hashing.
+	*/
+	class EntityRecords
+	{
+	public:
+		EntityRecord& operator[](EntityIndex entity_index)
+		{
+			return records_[entity_index];
+		}
+
+		const EntityRecord& operator[](EntityIndex entity_index) const
+		{
+			return records_[entity_index];
+		}
+
+		// Ensures that there is a record for entity_index.
+		void Reserve(EntityIndex entity_index)
+		{
+			if (entity_index >= records_.size()) {
+				records_.resize((std::size_t)entity_index + 1, { nullptr, 0 });
+			}
+		}
+
+		std::size_t Size() const
+		{
+			return records_.size();
+		}
+
+	private:
+		std::vector<EntityRecord> records_;
+	};
+}
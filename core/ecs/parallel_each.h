@@ -0,0 +1,70 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include <core/utils/thread_pool.h>
+
+#include "archetype.h"
+#include "change_filter.h"
+#include "component_storage.h"
+
+namespace ecs {
+	// Chunks [chunk_begin, chunk_end) of an archetype.
+	struct ArchetypeChunkRange {
+		Archetype* archetype;
+		std::size_t chunk_begin;
+		std::size_t chunk_end;
+	};
+
+	/*
+	* Splits the chunks of archetypes into about range_count_hint ranges of
+	* equal size. Ranges never span archetypes, and hold at least one chunk.
+	*/
+	inline void SplitIntoChunkRanges(const std::vector<Archetype*>& archetypes, std::size_t range_count_hint, std::vector<ArchetypeChunkRange>& ranges)
+	{
+		ranges.clear();
+		std::size_t total_chunk_count = 0;
+		for (Archetype* archetype : archetypes) {
+			total_chunk_count += archetype->ChunkCount();
+		}
+		const std::size_t chunks_per_range = std::max<std::size_t>(total_chunk_count / std::max<std::size_t>(range_count_hint, 1), 1);
+		for (Archetype* archetype : archetypes) {
+			const std::size_t chunk_count = archetype->ChunkCount();
+			for (std::size_t chunk_begin = 0; chunk_begin < chunk_count; chunk_begin += chunks_per_range) {
+				ranges.push_back({ archetype, chunk_begin, std::min(chunk_begin + chunks_per_range, chunk_count) });
+			}
+		}
+	}
+
+	/*
+	* Calls f(entity_ids, count, Ts* ...columns) for every chunk of archetypes,
+	* spreading the chunks over the threads of thread_pool. f is called
+	* concurrently for different chunks. See Archetype::EachChunk for
+	* changed_since.
+	*/
+	template<class... Ts, class F>
+	void ParallelEachChunkInArchetypes(const std::vector<Archetype*>& archetypes, ThreadPool& thread_pool, F& f, ChangeVersion changed_since = 0)
+	{
+		// A few ranges per thread, so that threads that finish early can steal.
+		std::vector<ArchetypeChunkRange> ranges;
+		SplitIntoChunkRanges(archetypes, (thread_pool.WorkerCount() + 1) * 4, ranges);
+		thread_pool.ParallelFor(ranges.size(), [&ranges, &f, changed_since](std::size_t range_index) {
+			const ArchetypeChunkRange& range = ranges[range_index];
+			range.archetype->EachChunkInRange<Ts...>(range.chunk_begin, range.chunk_end, f, changed_since);
+		});
+	}
+
+	// Calls f(entity_id, Ts& ...components) for every entity of archetypes,
+	// concurrently for entities in different chunks.
+	template<class... Ts, class F>
+	void ParallelEachInArchetypes(const std::vector<Archetype*>& archetypes, ThreadPool& thread_pool, F& f, ChangeVersion changed_since = 0)
+	{
+		auto chunk_f = [&f](const EntityID* entity_ids, std::size_t count, QueriedComponent<Ts>* ...queried_components) {
+			for (std::size_t e_idx = 0; e_idx < count; ++e_idx) {
+				f(entity_ids[e_idx], queried_components[QueriedRow<Ts>(e_idx)]...);
+			}
+		};
+		ParallelEachChunkInArchetypes<Ts...>(archetypes, thread_pool, chunk_f, changed_since);
+	}
+}
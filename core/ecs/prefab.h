@@ -0,0 +1,31 @@
+#pragma once
+
+#include <tuple>
+
+namespace ecs {
+	/*
+	* A set of component values that entities can be instantiated from with
+	* Registry::Instantiate. Every instance gets copies of the components.
+	*/
+	template<class... Ts>
+	class Prefab
+	{
+	public:
+		explicit Prefab(Ts... components) : components_(components...) {}
+
+		template<class T>
+		T& GetComponent()
+		{
+			return std::get<T>(components_);
+		}
+
+		template<class T>
+		const T& GetComponent() const
+		{
+			return std::get<T>(components_);
+		}
+
+	private:
+		std::tuple<Ts...> components_;
+	};
+}
@@ -0,0 +1,256 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include <core/utils/thread_pool.h>
+
+#include "archetype.h"
+#include "change_filter.h"
+#include "component_access.h"
+#include "component_mask.h"
+#include "component_sparse_set.h"
+#include "entity.h"
+#include "entity_records.h"
+#include "parallel_each.h"
+
+namespace ecs {
+	class QueryBase
+	{
+	public:
+		virtual ~QueryBase() {}
+
+		const ecs::ComponentSetIDs& ComponentSetIDs() const
+		{
+			return component_set_ids_;
+		}
+
+		// Archetypes whose component set is a superset of the query's component set.
+		const std::vector<Archetype*>& MatchedArchetypes() const
+		{
+			return matched_archetypes_;
+		}
+
+	protected:
+		ecs::ComponentSetIDs component_set_ids_;
+
+		ComponentMask component_mask_;
+
+		std::vector<Archetype*> matched_archetypes_;
+
+		// Looked up by joins with components stored in sparse sets.
+		EntityRecords* entity_records_ = nullptr;
+
+		ComponentSparseSets* component_sparse_sets_ = nullptr;
+
+		// Component types read and written when iterating the query.
+		ComponentAccess component_access_;
+
+		ComponentAccessTracker* component_access_tracker_ = nullptr;
+
+		// Change version of the registry, and its value at the previous iteration.
+		ChangeVersion* change_version_ = nullptr;
+
+		ChangeVersion last_change_version_ = 0;
+
+		/*
+		* Lasts for one iteration of the query. Changed filters pass the chunks
+		* written after the previous iteration began. The registry's change
+		* version is advanced at the end, so that later writes are newer than
+		* the ones made by this iteration.
+		*/
+		class IterationScope
+		{
+		public:
+			explicit IterationScope(QueryBase& query) : query_(query), changed_since_(query.last_change_version_)
+			{
+				if (query_.change_version_) {
+					query_.last_change_version_ = *query_.change_version_;
+				}
+			}
+
+			~IterationScope()
+			{
+				if (query_.change_version_) {
+					++*query_.change_version_;
+				}
+			}
+
+			IterationScope(const IterationScope&) = delete;
+
+			IterationScope& operator=(const IterationScope&) = delete;
+
+			ChangeVersion ChangedSince() const
+			{
+				return changed_since_;
+			}
+
+		private:
+			QueryBase& query_;
+			const ChangeVersion changed_since_;
+		};
+
+	private:
+		virtual void InitializeComponentSetIDs() = 0;
+
+		// Adds archetype to the matched archetypes if its component set is a
+		// superset of the query's.
+		void MatchArchetype(Archetype* archetype, const ComponentMask& archetype_component_mask)
+		{
+			if (archetype_component_mask.Includes(component_mask_)) {
+				matched_archetypes_.push_back(archetype);
+			}
+		}
+
+		void UnmatchArchetype(Archetype* archetype)
+		{
+			matched_archetypes_.erase(std::remove(matched_archetypes_.begin(), matched_archetypes_.end(), archetype), matched_archetypes_.end());
+		}
+
+		friend class Registry;
+	};
+
+	/*
+	* A persistent query over every entity that has at least the components Ts.
+	* Component types may be const-qualified to declare read-only access, which
+	* lets parallel iterations that only read a component type run together.
+	* Wrapping a type in Changed<T> only visits the chunks in which T was
+	* written since the query's previous iteration.
+	* Queries are meant to be created once, i.e. as a member of a system, and
+	* added to a registry with Registry::AddQuery. The registry keeps the list
+	* of matched archetypes up to date as archetypes are created and destroyed,
+	* so enumerating a query does not need to search for archetypes. A query
+	* must be removed from its registry before it is destroyed.
+	*
+	* Component types stored in sparse sets are joined with the others per
+	* entity, see ComponentSparseSets::EachJoined. Such queries only match
+	* archetypes on their other types, and can only be iterated with Each.
+	* Shared components must be queried as const, and chunk iterations pass
+	* them as a pointer to the value shared by the whole chunk.
+	*/
+	template<class... Ts>
+	class Query : public QueryBase
+	{
+	public:
+		Query() = default;
+
+		Query(const Query&) = delete;
+
+		Query& operator=(const Query&) = delete;
+
+		// Calls f(entity_id, Ts& ...components) for every matched entity.
+		template<class F>
+		void Each(F&& f)
+		{
+			const IterationScope iteration(*this);
+			EachJoined(f, iteration, std::integral_constant<bool, has_sparse_set_component>());
+		}
+
+		// Calls f(entity_ids, count, Ts* ...columns) for every chunk of the
+		// matched archetypes. See Archetype::EachChunk.
+		template<class F>
+		void EachChunk(F&& f)
+		{
+			static_assert(!has_sparse_set_component, "Components stored in sparse sets cannot be iterated by chunk.");
+			const IterationScope iteration(*this);
+			for (Archetype* archetype : matched_archetypes_) {
+				archetype->EachChunk<Ts...>(f, iteration.ChangedSince());
+			}
+		}
+
+		/*
+		* Calls f(entity_id, Ts& ...components) for every matched entity, using
+		* the threads of thread_pool. f is called concurrently for entities in
+		* different chunks, so it must only touch the components it is passed
+		* and other thread-safe state. When ECS_CHECK_COMPONENT_ACCESS is
+		* enabled, conflicting parallel iterations and structural changes during
+		* the iteration throw.
+		*/
+		template<class F>
+		void ParallelEach(F&& f, ThreadPool& thread_pool = ThreadPool::Shared())
+		{
+			static_assert(!has_sparse_set_component, "Components stored in sparse sets cannot be iterated in parallel.");
+			ScopedComponentAccess scoped_access(component_access_tracker_, component_access_);
+			const IterationScope iteration(*this);
+			ParallelEachInArchetypes<Ts...>(matched_archetypes_, thread_pool, f, iteration.ChangedSince());
+		}
+
+		// Parallel version of EachChunk. See ParallelEach.
+		template<class F>
+		void ParallelEachChunk(F&& f, ThreadPool& thread_pool = ThreadPool::Shared())
+		{
+			static_assert(!has_sparse_set_component, "Components stored in sparse sets cannot be iterated in parallel.");
+			ScopedComponentAccess scoped_access(component_access_tracker_, component_access_);
+			const IterationScope iteration(*this);
+			ParallelEachChunkInArchetypes<Ts...>(matched_archetypes_, thread_pool, f, iteration.ChangedSince());
+		}
+
+		void EnumerateComponentsWithBlock(std::function<void(EntityID entity_id, QueriedComponent<Ts>&...)> block)
+		{
+			if (!block) {
+				return;
+			}
+			Each(block);
+		}
+
+		std::size_t EntityCount() const
+		{
+			return EntityCount(std::integral_constant<bool, has_sparse_set_component>());
+		}
+
+	private:
+		static const bool has_sparse_set_component = HasSparseSetComponent<Ts...>();
+
+		// Joins are counted by visiting them, without writing any component.
+		std::size_t EntityCount(std::true_type) const
+		{
+			std::size_t entity_count = 0;
+			if (component_sparse_sets_) {
+				component_sparse_sets_->EachJoined<const StoredComponent<Ts>...>(*entity_records_, [&entity_count](EntityID entity_id, const StoredComponent<Ts>&...) {
+					entity_count++;
+				});
+			}
+			return entity_count;
+		}
+
+		std::size_t EntityCount(std::false_type) const
+		{
+			std::size_t entity_count = 0;
+			for (Archetype* archetype : matched_archetypes_) {
+				entity_count += archetype->EntityCount();
+			}
+			return entity_count;
+		}
+
+		template<class F>
+		void EachJoined(F& f, const IterationScope& iteration, std::true_type)
+		{
+			if (component_sparse_sets_) {
+				component_sparse_sets_->EachJoined<Ts...>(*entity_records_, f);
+			}
+		}
+
+		template<class F>
+		void EachJoined(F& f, const IterationScope& iteration, std::false_type)
+		{
+			for (Archetype* archetype : matched_archetypes_) {
+				archetype->Each<Ts...>(f, iteration.ChangedSince());
+			}
+		}
+
+		void InitializeComponentSetIDs() override
+		{
+			// Archetypes are matched on the types that they store.
+			component_set_ids_.clear();
+			const int expansion[] = { 0, (
+				IsSparseSetComponent<StoredComponent<Ts>>::value ? 0 : (component_set_ids_.push_back(ComponentTypeRegistry::TypeIDOf<StoredComponent<Ts>>()), 0)
+			)... };
+			(void)expansion;
+			// Sort component set ids from least -> greatest.
+			std::sort(component_set_ids_.begin(), component_set_ids_.end());
+			component_mask_ = ComponentMask(component_set_ids_);
+			component_access_ = ComponentAccessOf<Ts...>();
+		}
+	};
+}
@@ -1,221 +1,343 @@
 #pragma once
 
+#include <algorithm>
 #include <assert.h>
 #include <iostream>
 #include <cstring>
 #include <unordered_map>
 #include <functional>
+#include <utility>
 
 #include <core/utils/event_announcer.h>
 #include <core/utils/set_trie.h>
-#include <core/utils/type_id_mapper.h>
-
-#include <config/core_components.h>
 
 #include "entity.h"
 #include "archetype.h"
+#include "change_filter.h"
+#include "component_access.h"
+#include "component_sparse_set.h"
+#include "component_storage.h"
+#include "entity_records.h"
+#include "parallel_each.h"
+#include "prefab.h"
+#include "query.h"
+#include "shared_component.h"
 
-#define REGISTER_COMPONENT_TYPE(name) component_type_id_mapper_.GetTypeId<##name>();
+// Component types below this id are tracked in the bitset signatures that
+// speed up searching for the archetypes of a component set.
+#ifndef ECS_ARCHETYPE_SIGNATURE_BITS
+#define ECS_ARCHETYPE_SIGNATURE_BITS 256
+#endif
 
 namespace ecs {
 	class IComponentSetEventsListener {
 	public:
-		virtual void OnEnterComponentSupersetOf(ecs::EntityID entity_id, const ecs::ComponentSetIDs component_set_ids) = 0;
-		virtual void OnExitComponentSupersetOf(ecs::EntityID entity_id, const ecs::ComponentSetIDs component_set_ids) = 0;
+		virtual void OnEnterComponentSupersetOf(ecs::EntityID entity_id, const ecs::ComponentSetIDs& component_set_ids) = 0;
+		virtual void OnExitComponentSupersetOf(ecs::EntityID entity_id, const ecs::ComponentSetIDs& component_set_ids) = 0;
+	};
+
+	/*
+	* Receives the entities that entered or exited a component superset since
+	* the last Registry::FlushComponentSetEvents, as one span per kind and
+	* component set. Entities are in order of their index. Changes that cancel
+	* out before the flush, such as adding and then removing a component, are
+	* not reported.
+	*/
+	class IComponentSetBatchEventsListener {
+	public:
+		virtual void OnEnterComponentSupersetOf(const ecs::EntityID* entity_ids, std::size_t count, const ecs::ComponentSetIDs& component_set_ids) = 0;
+		virtual void OnExitComponentSupersetOf(const ecs::EntityID* entity_ids, std::size_t count, const ecs::ComponentSetIDs& component_set_ids) = 0;
+	};
+
+	/*
+	* How long a registry keeps archetypes alive after their last entity left,
+	* so that entities returning to the same component set do not recreate
+	* the archetype along with its columns, edges and listener entries.
+	*/
+	struct ArchetypeRetentionPolicy {
+		// Number of empty archetypes kept at most. Beyond it, the archetype that
+		// has been empty the longest is destroyed. With 0, archetypes are
+		// destroyed as soon as they are emptied.
+		std::size_t max_empty_archetype_count = 0;
+		// Registry::Compact destroys the archetypes that were already empty at
+		// this many previous compactions.
+		std::size_t max_idle_compaction_count = 1;
+	};
+
+	// Outcome of Registry::Compact.
+	struct CompactionReport {
+		std::size_t destroyed_archetype_count = 0;
+		// Chunks moved to fuller slabs of the chunk pool.
+		std::size_t moved_chunk_count = 0;
+		// Bytes returned to the heap by releasing the registry's spare vector capacity.
+		std::size_t reclaimed_bytes = 0;
+		// Bytes of empty slabs released by the chunk pools that the registry uses. The pools
+		// may be shared, so this includes slabs emptied by other users of them.
+		std::size_t released_slab_bytes = 0;
 	};
 
 	class Registry {
 	
 	public:
-		Registry() 
+		template<typename T>
+		void AddComponent(EntityID entity_id, T component)
 		{
-			// This maintains the type ids of components consistent across different compilations.
-			FOREACH_CORE_COMPONENT_TYPE(REGISTER_COMPONENT_TYPE)
+			T* component_ptr = &component;
+			AddComponentBatch<T>(&entity_id, &component_ptr, 1);
 		}
 
+		/*
+		* Adds components[i] to entity_ids[i] for i in [0, count). Entities must
+		* be distinct. Consecutive entities in the same archetype are moved as
+		* one run, which looks up the target archetype and computes the events
+		* to announce once. Archetypes emptied by the batch are destroyed at the
+		* end of it.
+		*/
 		template<typename T>
-		void AddComponent(EntityID entity_id, T component)
+		void AddComponentBatch(const EntityID* entity_ids, const T* const* components, std::size_t count)
 		{
-			assert(entity_id.index < entity_archetype_map_.size());
-			ComponentTypeID added_component_type = component_type_id_mapper_.GetTypeId<T>();
-			if (entity_archetype_map_[entity_id.index] != nullptr) {
-				// The entity currently belongs to an archetype. This archetype will be
-				// referred to as the "previous_archetype"
-				Archetype *previous_archetype = entity_archetype_map_[entity_id.index];
-				if (std::find(previous_archetype->ComponentSetIDs().begin(),
-					previous_archetype->ComponentSetIDs().end(),
-					added_component_type) != previous_archetype->ComponentSetIDs().end())
-				{
-					throw std::runtime_error("Cannot have multiple components of same type on entity");
-				}
+			AddComponentBatchFrom<T>(entity_ids, components, count, IsSparseSetComponent<T>());
+		}
 
-				// Determine the entity's new archetype id.
-				const std::vector<ComponentTypeID>& previous_component_types = previous_archetype->ComponentSetIDs();
-				std::vector<ComponentTypeID> new_component_types;
-				for (std::size_t c_idx = 0; c_idx < previous_component_types.size(); ++c_idx) {
-					if (added_component_type < previous_component_types[c_idx]) {
-						new_component_types.push_back(added_component_type);
-					}
-					new_component_types.push_back(previous_component_types[c_idx]);
-				}
-				if (new_component_types.size() == previous_component_types.size()) {
-					new_component_types.push_back(added_component_type);
-				}
+		// Like the above, but moves the components out of components.
+		template<typename T>
+		void AddComponentBatch(const EntityID* entity_ids, T* const* components, std::size_t count)
+		{
+			AddComponentBatchFrom<T>(entity_ids, components, count, IsSparseSetComponent<T>());
+		}
 
-				Archetype* next_archetype;
-				if (!archetype_set_trie_.TryGetValueForKeySet(new_component_types, next_archetype)) {
-					// No archetype exists for the entity's new set of component types. Create
-					// new archetype.
-					next_archetype = CreateArchetype(new_component_types);
-					next_archetype->InitializeWithArchetypeAndAddedComponentType<T>(&component_type_id_mapper_, *previous_archetype);
-				}
+		/*
+		* Gives the components Ts to count registered entities without any
+		* components. Every component is default-constructed in place in the
+		* archetype of Ts, after which init(i, Ts& ...components) is called for
+		* entity_ids[i]. Unlike adding the components one at a time, entities
+		* never pass through intermediate archetypes.
+		*/
+		template<class... Ts, class F>
+		void SpawnBatch(const EntityID* entity_ids, std::size_t count, F&& init)
+		{
+			Archetype* archetype = ArchetypeForSpawn<Ts...>(entity_ids, count);
+			archetype->AddEntities<Ts...>(entity_ids, count, init);
+			AnnounceComponentSetChangeForEntities(entity_ids, count, nullptr, archetype);
+		}
 
-				// Move over the entity's component data from the previous archetype to
-				// the existing one and insert new component data.
-				previous_archetype->MoveEntityToSuperArchetype<T>(entity_id, *next_archetype, component);
-				if (previous_archetype->Entities().size() == 0) {
-					// previous archetype no longer has any entities. Delete it.
-					DestroyArchetype(previous_archetype);
-				}
-				entity_archetype_map_[entity_id.index] = next_archetype;
-				AnnounceComponentSetChangeForEntity(entity_id, previous_archetype, next_archetype);
-			}
-			else {
-				// This entity will be added to an archetype for the first time. This also
-				// means that the component to be added will be this entity's first component.
-				Archetype* archetype;
-				if (!archetype_set_trie_.TryGetValueForKeySet({ added_component_type }, archetype)) {
-					// Create new archetype for entity.
-					archetype = CreateArchetype({ added_component_type });
-					archetype->InitializeWithComponentSet<T>(&component_type_id_mapper_);
-				}
-				archetype->AddEntity<T>(entity_id, component);
-				entity_archetype_map_[entity_id.index] = archetype;
-				AnnounceComponentSetChangeForEntity(entity_id, nullptr, archetype);
-			}
+		// Gives copies of the components of prefab to count registered entities
+		// without any components. See SpawnBatch.
+		template<class... Ts>
+		void Instantiate(const Prefab<Ts...>& prefab, const EntityID* entity_ids, std::size_t count)
+		{
+			Archetype* archetype = ArchetypeForSpawn<Ts...>(entity_ids, count);
+			archetype->AddEntityCopies<Ts...>(entity_ids, count, prefab.template GetComponent<Ts>()...);
+			AnnounceComponentSetChangeForEntities(entity_ids, count, nullptr, archetype);
 		}
 
 		template<typename T>
 		void RemoveComponent(EntityID entity_id)
 		{
-			ComponentTypeID removed_component_type = component_type_id_mapper_.GetTypeId<T>();
-			assert(entity_id.index < entity_archetype_map_.size());
-			if (entity_archetype_map_[entity_id.index] == nullptr) {
-				throw std::runtime_error("Attempting to remove component from entity that does not belong to an archetype.");
-			}
+			RemoveComponentBatch<T>(&entity_id, 1);
+		}
 
-			// The entity currently belongs to an archetype. This archetype will be
-			// referred to as the "previous_archetype"
-			Archetype* previous_archetype = entity_archetype_map_[entity_id.index];
-			if (std::find(previous_archetype->ComponentTypes().begin(),
-				previous_archetype->ComponentTypes().end(),
-				removed_component_type) == previous_archetype->ComponentTypes().end())
-			{
-				throw std::runtime_error("Attempting to remove component that cannot be found on entity.");
-			}
+		// Removes the component T from every entity in entity_ids. See AddComponentBatch.
+		template<typename T>
+		void RemoveComponentBatch(const EntityID* entity_ids, std::size_t count)
+		{
+			RemoveComponentBatch<T>(entity_ids, count, IsSparseSetComponent<T>());
+		}
 
-			// Determine the entity's new archetype id.
-			const std::vector<ComponentTypeID> previous_component_types = previous_archetype->ComponentTypes();
-			std::vector<ComponentTypeID> new_component_types;
-			for (std::size_t c_idx = 0; c_idx < previous_component_types.size(); ++c_idx) {
-				if (removed_component_type != previous_component_types[c_idx]) {
-					new_component_types.push_back(previous_component_types[c_idx]);
-				}
-			}
+		/*
+		* Gives every entity in entity_ids the shared component value, replacing
+		* their current value of type T, if any. The entities move to the
+		* archetype of their component types with value, so entities that share
+		* a value are stored together, and their value is stored once. See
+		* AddComponentBatch.
+		*/
+		template<typename T>
+		void SetSharedComponentBatch(const EntityID* entity_ids, std::size_t count, const T& value)
+		{
+			static_assert(IsSharedComponent<T>::value, "Component type is not shared. Use ECS_SHARED_COMPONENT to share it.");
+			const ComponentTypeID shared_component_type = ComponentTypeRegistry::TypeIDOf<T>();
+			const SharedComponentID shared_component_id = shared_component_store_.Acquire(value);
+			const SharedComponent shared_component = { shared_component_type, shared_component_id, shared_component_store_.Value(shared_component_id) };
+			ChangeSharedComponentBatch(entity_ids, count, shared_component_type, &shared_component);
+			// The archetypes with the value hold references of their own.
+			shared_component_store_.Release(shared_component_id);
+		}
 
-			if (new_component_types.size() > 0) {
-				Archetype* next_archetype;
-				if (!archetype_set_trie_.TryGetValueForKeySet(new_component_types, next_archetype)) {
-					// No archetype exists for the entity's new set of component types. Create
-					// new archetype.
-					next_archetype = CreateArchetype(new_component_types);
-					next_archetype->InitializeWithArchetypeAndRemovedComponentType<T>(&component_type_id_mapper_, *previous_archetype);
-				}
+		template<typename T>
+		void SetSharedComponent(EntityID entity_id, const T& value)
+		{
+			SetSharedComponentBatch<T>(&entity_id, 1, value);
+		}
 
-				// Move over the entity's component data from the previous archetype to
-				// the existing one, except that of the component to be removed.
-				previous_archetype->MoveEntityToSubArchetype<T>(entity_id, *next_archetype);
-				if (previous_archetype->Entities().size() == 0) {
-					DestroyArchetype(previous_archetype);
-				}
-				entity_archetype_map_[entity_id.index] = &existing_archetype;
-				AnnounceComponentSetChangeForEntity(entity_id, previous_archetype, next_archetype);
-			}
-			else {
-				// The entity will now have no components. It is no longer assigned to an archetype.
-				previous_archetype->RemoveEntity(entity_id);
-				if (previous_archetype->Entities().size() == 0) {
-					DestroyArchetype(previous_archetype);
-					entity_archetype_map_[entity_id.index] = nullptr;
-				}
-				AnnounceComponentSetChangeForEntity(entity_id, previous_archetype, nullptr);
-			}
+		// Removes the shared component of type T from every entity in entity_ids.
+		template<typename T>
+		void RemoveSharedComponentBatch(const EntityID* entity_ids, std::size_t count)
+		{
+			static_assert(IsSharedComponent<T>::value, "Component type is not shared.");
+			ChangeSharedComponentBatch(entity_ids, count, ComponentTypeRegistry::TypeIDOf<T>(), nullptr);
 		}
 
+		template<typename T>
+		void RemoveSharedComponent(EntityID entity_id)
+		{
+			RemoveSharedComponentBatch<T>(&entity_id, 1);
+		}
+
+		// Number of distinct shared component values in use.
+		std::size_t SharedComponentValueCount() const
+		{
+			return shared_component_store_.ValueCount();
+		}
+
+		// Archetype that entity_id belongs to, or nullptr if it has no components.
+		Archetype* ArchetypeOfEntity(EntityID entity_id) const
+		{
+			return entity_id.index < entity_records_.Size() ? entity_records_[entity_id.index].archetype : nullptr;
+		}
+
+		// Fetching a non-const T marks the component as changed. Use GetComponent
+		// with a const T to read it without doing so. Shared components can only
+		// be fetched as const.
 		template<typename T>
 		bool GetComponent(EntityID entity_id, T*& component)
 		{
-			Archetype *archetype = entity_archetype_map_[entity_id.index];
-			if (!archetype) {
+			if (IsSparseSetComponent<typename std::remove_const<T>::type>::value) {
+				ComponentSparseSet* sparse_set = component_sparse_sets_.Find(ComponentTypeRegistry::TypeIDOf<typename std::remove_const<T>::type>());
+				component = sparse_set ? static_cast<T*>(sparse_set->Find(entity_id)) : nullptr;
+				return component != nullptr;
+			}
+			const EntityRecord& record = entity_records_[entity_id.index];
+			if (!record.archetype) {
 				return false;
 			}
-			return archetype->GetComponentForEntity<T>(entity_id, component);
+			return record.archetype->GetComponentAtRow<T>(record.row, component);
 		}
 
 		template<class... Ts>
 		bool GetComponentSet(EntityID entity_id, Ts*&... components)
 		{
-			Archetype* archetype = entity_archetype_map_[entity_id.index];
-			if (!archetype) {
-				return false;
+			const bool found[] = { true, GetComponent<Ts>(entity_id, components)... };
+			for (bool component_found : found) {
+				if (!component_found) {
+					return false;
+				}
 			}
-			return archetype->GetComponentSetForEntity(entity_id, components...);
+			return true;
+		}
+
+		/*
+		* Calls f(entity_id, Ts& ...components) for every entity that has the
+		* components Ts. Systems that iterate every frame should hold a Query
+		* instead, which does not need to search for archetypes at all. If any
+		* of Ts is stored in a sparse set, see ComponentSparseSets::EachJoined.
+		*/
+		template<class... Ts, class F>
+		void Each(F&& f)
+		{
+			EachJoined<Ts...>(f, std::integral_constant<bool, HasSparseSetComponent<Ts...>()>());
+		}
+
+		// Calls f(entity_ids, count, Ts* ...columns) for every chunk of every
+		// archetype with the components Ts. See Archetype::EachChunk.
+		template<class... Ts, class F>
+		void EachChunk(F&& f)
+		{
+			static_assert(!HasSparseSetComponent<Ts...>(), "Components stored in sparse sets cannot be iterated by chunk.");
+			ForEachArchetypeWithComponents<Ts...>([&f](Archetype* archetype) {
+				archetype->EachChunk<Ts...>(f);
+			});
+		}
+
+		/*
+		* Calls f(entity_id, Ts& ...components) for every entity that has the
+		* components Ts, using the threads of thread_pool. See Query::ParallelEach.
+		*/
+		template<class... Ts, class F>
+		void ParallelEach(F&& f, ThreadPool& thread_pool = ThreadPool::Shared())
+		{
+			static_assert(!HasSparseSetComponent<Ts...>(), "Components stored in sparse sets cannot be iterated in parallel.");
+			const ComponentAccess component_access = ComponentAccessOf<Ts...>();
+			ScopedComponentAccess scoped_access(&component_access_tracker_, component_access);
+			std::vector<Archetype*> archetypes;
+			ForEachArchetypeWithComponents<Ts...>([&archetypes](Archetype* archetype) {
+				archetypes.push_back(archetype);
+			});
+			ParallelEachInArchetypes<Ts...>(archetypes, thread_pool, f);
 		}
 
 		template<class... Ts>
 		void EnumerateComponentsWithBlock(std::function<void(EntityID entity_id, Ts&...)> block)
 		{
-			const ComponentSetIDs component_set_ids = GetComponentSetIDs<Ts...>();
-			
-			// Search for an existing component set in component_set_listener_group_trie_.
-			// If found, we can simply enumerate the cached archetypes, which is faster
-			// than doing a superset search in archetype_set_trie_.
-			ComponentSetListenerGroup* group;
-			std::vector<Archetype*> archetypes;
-			if (component_set_listener_group_trie_.TryGetValueForKeySet(component_set_ids, group)) {
-				// Faster
-				archetypes = group->archetypes;
-			} else {
-				// Slower
-				archetypes = archetype_set_trie_.FindSuperKeySetValues(component_set_ids);
+			if (!block) {
+				return;
 			}
+			Each<Ts...>(block);
+		}
 
-			for (Archetype* archetype : archetypes) {
-				archetype->EnumerateComponentsWithBlock<Ts...>(block);
-			}
+		/*
+		* Matches query against the existing archetypes. The registry keeps the
+		* query's matched archetypes up to date until it is removed with
+		* RemoveQuery.
+		*/
+		void AddQuery(QueryBase* query)
+		{
+			query->InitializeComponentSetIDs();
+			query->component_access_tracker_ = &component_access_tracker_;
+			query->change_version_ = &change_version_;
+			query->last_change_version_ = 0;
+			query->entity_records_ = &entity_records_;
+			query->component_sparse_sets_ = &component_sparse_sets_;
+			archetype_set_trie_.FindSuperKeySetValues(query->ComponentSetIDs(), query->matched_archetypes_);
+			queries_.push_back(query);
+		}
+
+		void RemoveQuery(QueryBase* query)
+		{
+			queries_.erase(std::remove(queries_.begin(), queries_.end(), query), queries_.end());
+			query->matched_archetypes_.clear();
+			query->component_access_tracker_ = nullptr;
+			query->change_version_ = nullptr;
+			query->entity_records_ = nullptr;
+			query->component_sparse_sets_ = nullptr;
 		}
 
 		void RegisterEntity(EntityID entity_id)
 		{
-			const std::size_t n = (std::size_t)entity_id.index + 1 - entity_archetype_map_.size();
-			if (n > 0) {
-				entity_archetype_map_.insert(entity_archetype_map_.end(), n, nullptr);
-			}
+			entity_records_.Reserve(entity_id.index);
 		}
 
 		void UnregisterEntity(EntityID entity_id)
 		{
-			assert(entity_id.index < entity_archetype_map_.size());
-			if (entity_archetype_map_[entity_id.index] != nullptr) {
-				Archetype* archetype = entity_archetype_map_[entity_id.index];
-				archetype->RemoveEntity(entity_id);
-				AnnounceComponentSetChangeForEntity(entity_id, archetype, nullptr);
+			UnregisterEntityBatch(&entity_id, 1);
+		}
 
-				if (archetype->Entities().size() == 0) {
-					DestroyArchetype(archetype);
+		// Removes every entity in entity_ids from its archetype, and destroys its
+		// components in sparse sets. See AddComponentBatch.
+		void UnregisterEntityBatch(const EntityID* entity_ids, std::size_t count)
+		{
+#if ECS_CHECK_COMPONENT_ACCESS
+			component_access_tracker_.CheckStructuralChange();
+#endif
+			for (std::size_t e_idx = 0; e_idx < count; ++e_idx) {
+				component_sparse_sets_.RemoveEntity(entity_ids[e_idx]);
+			}
+			std::vector<Archetype*> emptied_archetypes;
+			std::size_t run_begin = 0;
+			while (run_begin < count) {
+				assert(entity_ids[run_begin].index < entity_records_.Size());
+				Archetype* archetype = entity_records_[entity_ids[run_begin].index].archetype;
+				const std::size_t run_end = EndOfArchetypeRun(entity_ids, run_begin, count);
+				if (archetype != nullptr) {
+					archetype->RemoveEntities(entity_ids + run_begin, run_end - run_begin);
+					AnnounceComponentSetChangeForEntities(entity_ids + run_begin, run_end - run_begin, archetype, nullptr);
+					if (archetype->EntityCount() == 0
+						&& std::find(emptied_archetypes.begin(), emptied_archetypes.end(), archetype) == emptied_archetypes.end()) {
+						emptied_archetypes.push_back(archetype);
+					}
 				}
-				entity_archetype_map_[entity_id.index] = nullptr;
+				run_begin = run_end;
 			}
+			DestroyArchetypesIfEmpty(emptied_archetypes);
 		}
 
 		/*
@@ -225,15 +347,7 @@ namespace ecs {
 		template<class... Ts>
 		ecs::ComponentSetIDs AddComponentSetEventsListener(IComponentSetEventsListener* listener) {
 			const ComponentSetIDs component_set_ids = GetComponentSetIDs<Ts...>();
-			ComponentSetListenerGroup* group;
-			if (!component_set_listener_group_trie_.TryGetValueForKeySet(component_set_ids, group)) {
-				// A group does not currently exist with this component set.
-				// Create one.
-				group = component_set_listener_group_trie_.InsertValueForKeySet(component_set_ids, ComponentSetListenerGroup());
-				group->component_set_ids = component_set_ids;
-				group->archetypes = archetype_set_trie_.FindSuperKeySetValues(component_set_ids);
-			}
-			group->component_set_events_announcer.AddListener(listener);
+			ListenerGroupForComponentSet(component_set_ids)->component_set_events_announcer.AddListener(listener);
 			return component_set_ids;
 		}
 
@@ -241,102 +355,806 @@ namespace ecs {
 			ComponentSetListenerGroup* group;
 			if (component_set_listener_group_trie_.TryGetValueForKeySet(component_set_ids, group)) {
 				group->component_set_events_announcer.RemoveListener(listener);
-				if (group->component_set_events_announcer.ListenerCount() == 0) {
-					// There are no more remaining listeners for this component set.
-					// Delete this component set listener group.
-					component_set_listener_group_trie_.RemoveValueForKeySet(component_set_ids);
+				RemoveListenerGroupIfUnused(group);
+			}
+		}
+
+		/*
+		* Like AddComponentSetEventsListener, but the events are collected and
+		* delivered in batches by FlushComponentSetEvents.
+		*/
+		template<class... Ts>
+		ecs::ComponentSetIDs AddComponentSetBatchEventsListener(IComponentSetBatchEventsListener* listener) {
+			const ComponentSetIDs component_set_ids = GetComponentSetIDs<Ts...>();
+			ListenerGroupForComponentSet(component_set_ids)->component_set_batch_events_announcer.AddListener(listener);
+			return component_set_ids;
+		}
+
+		// Events that have not been flushed yet are dropped if no batch listeners remain.
+		void RemoveComponentSetBatchEventsListener(ecs::ComponentSetIDs component_set_ids, IComponentSetBatchEventsListener* listener) {
+			ComponentSetListenerGroup* group;
+			if (component_set_listener_group_trie_.TryGetValueForKeySet(component_set_ids, group)) {
+				group->component_set_batch_events_announcer.RemoveListener(listener);
+				if (group->component_set_batch_events_announcer.ListenerCount() == 0) {
+					group->pending_events.clear();
+				}
+				RemoveListenerGroupIfUnused(group);
+			}
+		}
+
+		// Applies to archetypes emptied from now on. Empty archetypes beyond the
+		// new maximum are destroyed.
+		void SetArchetypeRetentionPolicy(const ArchetypeRetentionPolicy& retention_policy)
+		{
+			archetype_retention_policy_ = retention_policy;
+			while (empty_archetypes_.size() > retention_policy.max_empty_archetype_count) {
+				DestroyOldestEmptyArchetype();
+			}
+		}
+
+		const ArchetypeRetentionPolicy& GetArchetypeRetentionPolicy() const
+		{
+			return archetype_retention_policy_;
+		}
+
+		/*
+		* Reclaims memory while the registry is idle, i.e. between frames or on
+		* a loading screen: destroys the archetypes that outlived the retention
+		* policy, releases spare capacity, moves chunks out of sparsely used
+		* slabs of the chunk pools in use and returns the emptied slabs to the
+		* heap. Entities keep their archetypes and rows.
+		*/
+		CompactionReport Compact()
+		{
+#if ECS_CHECK_COMPONENT_ACCESS
+			component_access_tracker_.CheckStructuralChange();
+#endif
+			CompactionReport report;
+			std::vector<EmptyArchetype> retained_empty_archetypes;
+			for (EmptyArchetype& empty_archetype : empty_archetypes_) {
+				if (empty_archetype.archetype->EntityCount() > 0) {
+					// The archetype is in use again.
+					continue;
+				}
+				if (empty_archetype.idle_compaction_count >= archetype_retention_policy_.max_idle_compaction_count) {
+					DestroyArchetype(empty_archetype.archetype);
+					report.destroyed_archetype_count++;
+					continue;
+				}
+				empty_archetype.idle_compaction_count++;
+				retained_empty_archetypes.push_back(empty_archetype);
+			}
+			empty_archetypes_.swap(retained_empty_archetypes);
+
+			// Sparse sets always use the shared pool.
+			std::vector<ChunkPool*> chunk_pools = { &ChunkPool::Shared() };
+			std::vector<Archetype*> archetypes;
+			archetype_set_trie_.GetValuesInOrder(archetypes);
+			for (Archetype* archetype : archetypes) {
+				report.reclaimed_bytes += archetype->ShrinkToFit();
+				report.moved_chunk_count += archetype->DefragmentChunks();
+				if (std::find(chunk_pools.begin(), chunk_pools.end(), archetype->GetChunkPool()) == chunk_pools.end()) {
+					chunk_pools.push_back(archetype->GetChunkPool());
+				}
+			}
+			report.reclaimed_bytes += component_sparse_sets_.ShrinkToFit();
+			report.moved_chunk_count += component_sparse_sets_.DefragmentChunks();
+			for (ComponentSetListenerGroup* group : component_set_listener_groups_) {
+				report.reclaimed_bytes += ShrinkVectorToFit(group->archetypes);
+				report.reclaimed_bytes += ShrinkVectorToFit(group->pending_events);
+			}
+			for (QueryBase* query : queries_) {
+				report.reclaimed_bytes += ShrinkVectorToFit(query->matched_archetypes_);
+			}
+			report.reclaimed_bytes += ShrinkVectorToFit(empty_archetypes_);
+			for (ChunkPool* chunk_pool : chunk_pools) {
+				report.released_slab_bytes += chunk_pool->ReleaseEmptySlabs();
+			}
+			return report;
+		}
+
+		/*
+		* Delivers the enter and exit events collected for batch listeners since
+		* the last flush. Every entity is reported at most once per component
+		* set, and only if it is in a different state than at the last flush.
+		* Exits are delivered before enters. Changes made by the listeners are
+		* delivered by the next flush.
+		*/
+		void FlushComponentSetEvents() {
+			std::vector<PendingComponentSetEvent> events;
+			std::vector<EntityID> entered_entity_ids;
+			std::vector<EntityID> exited_entity_ids;
+			for (std::size_t g_idx = 0; g_idx < component_set_listener_groups_.size(); ++g_idx) {
+				ComponentSetListenerGroup* group = component_set_listener_groups_[g_idx];
+				if (group->pending_events.empty()) {
+					continue;
+				}
+				// The group keeps collecting into the (cleared) buffer of the previous group.
+				events.clear();
+				events.swap(group->pending_events);
+				CoalesceComponentSetEvents(events, entered_entity_ids, exited_entity_ids);
+				if (!exited_entity_ids.empty()) {
+					group->component_set_batch_events_announcer.Announce(&IComponentSetBatchEventsListener::OnExitComponentSupersetOf, exited_entity_ids.data(), exited_entity_ids.size(), group->component_set_ids);
+				}
+				// The listeners may have removed the group.
+				if (!entered_entity_ids.empty() && g_idx < component_set_listener_groups_.size() && component_set_listener_groups_[g_idx] == group) {
+					group->component_set_batch_events_announcer.Announce(&IComponentSetBatchEventsListener::OnEnterComponentSupersetOf, entered_entity_ids.data(), entered_entity_ids.size(), group->component_set_ids);
 				}
 			}
 		}
 
 	private:
-		SetTrie<ComponentTypeID, Archetype> archetype_set_trie_;
+		// Copies the components if C is const, and moves them otherwise.
+		template<typename T, typename C>
+		void AddComponentBatchFrom(const EntityID* entity_ids, C* const* components, std::size_t count, std::true_type)
+		{
+#if ECS_CHECK_COMPONENT_ACCESS
+			component_access_tracker_.CheckStructuralChange();
+#endif
+			ComponentSparseSet& sparse_set = component_sparse_sets_.SparseSetFor(ComponentTypeRegistry::TypeIDOf<T>());
+			for (std::size_t e_idx = 0; e_idx < count; ++e_idx) {
+				assert(entity_ids[e_idx].index < entity_records_.Size());
+				if (sparse_set.Contains(entity_ids[e_idx])) {
+					throw std::runtime_error("Cannot have multiple components of same type on entity");
+				}
+				new (sparse_set.Emplace(entity_ids[e_idx])) T(ForwardComponent(*components[e_idx]));
+			}
+		}
+
+		template<typename T, typename C>
+		void AddComponentBatchFrom(const EntityID* entity_ids, C* const* components, std::size_t count, std::false_type)
+		{
+			static_assert(!IsSharedComponent<T>::value, "Shared components are added with SetSharedComponent.");
+#if ECS_CHECK_COMPONENT_ACCESS
+			component_access_tracker_.CheckStructuralChange();
+#endif
+			const ComponentTypeID added_component_type = ComponentTypeRegistry::TypeIDOf<T>();
+			std::vector<Archetype*> emptied_archetypes;
+			std::size_t run_begin = 0;
+			while (run_begin < count) {
+				assert(entity_ids[run_begin].index < entity_records_.Size());
+				// The archetype that the run of entities currently belongs to will be
+				// referred to as the "previous_archetype". It is nullptr for entities
+				// without components.
+				Archetype* previous_archetype = entity_records_[entity_ids[run_begin].index].archetype;
+				const std::size_t run_end = EndOfArchetypeRun(entity_ids, run_begin, count);
+				Archetype* next_archetype = ArchetypeAfterAddingComponent<T>(previous_archetype, added_component_type);
+				if (previous_archetype && run_end - run_begin == 1) {
+					// A single entity skips the bookkeeping of moving runs of entities.
+					previous_archetype->MoveEntityToSuperArchetype<T>(entity_ids[run_begin], *next_archetype, ForwardComponent(*components[run_begin]));
+				}
+				else if (previous_archetype) {
+					// Move over the entities' component data from the previous archetype to
+					// the next one and insert new component data. This also updates the
+					// entities' records.
+					previous_archetype->MoveEntitiesToSuperArchetype<T>(entity_ids + run_begin, run_end - run_begin, *next_archetype, [components, run_begin](std::size_t i, T* component) {
+						new (component) T(ForwardComponent(*components[run_begin + i]));
+					});
+				}
+				else {
+					for (std::size_t e_idx = run_begin; e_idx < run_end; ++e_idx) {
+						// This entity will be added to an archetype for the first time.
+						next_archetype->AddEntity<T>(entity_ids[e_idx], ForwardComponent(*components[e_idx]));
+					}
+				}
+				AnnounceComponentSetChangeForEntities(entity_ids + run_begin, run_end - run_begin, previous_archetype, next_archetype);
+				if (previous_archetype && previous_archetype->EntityCount() == 0
+					&& std::find(emptied_archetypes.begin(), emptied_archetypes.end(), previous_archetype) == emptied_archetypes.end()) {
+					emptied_archetypes.push_back(previous_archetype);
+				}
+				run_begin = run_end;
+			}
+			DestroyArchetypesIfEmpty(emptied_archetypes);
+		}
+
+		template<typename T>
+		void RemoveComponentBatch(const EntityID* entity_ids, std::size_t count, std::true_type)
+		{
+#if ECS_CHECK_COMPONENT_ACCESS
+			component_access_tracker_.CheckStructuralChange();
+#endif
+			ComponentSparseSet* sparse_set = component_sparse_sets_.Find(ComponentTypeRegistry::TypeIDOf<T>());
+			for (std::size_t e_idx = 0; e_idx < count; ++e_idx) {
+				if (!sparse_set || !sparse_set->Remove(entity_ids[e_idx])) {
+					throw std::runtime_error("Attempting to remove component that cannot be found on entity.");
+				}
+			}
+		}
+
+		template<typename T>
+		void RemoveComponentBatch(const EntityID* entity_ids, std::size_t count, std::false_type)
+		{
+			static_assert(!IsSharedComponent<T>::value, "Shared components are removed with RemoveSharedComponent.");
+#if ECS_CHECK_COMPONENT_ACCESS
+			component_access_tracker_.CheckStructuralChange();
+#endif
+			const ComponentTypeID removed_component_type = ComponentTypeRegistry::TypeIDOf<T>();
+			std::vector<Archetype*> emptied_archetypes;
+			std::size_t run_begin = 0;
+			while (run_begin < count) {
+				assert(entity_ids[run_begin].index < entity_records_.Size());
+				Archetype* previous_archetype = entity_records_[entity_ids[run_begin].index].archetype;
+				if (previous_archetype == nullptr) {
+					throw std::runtime_error("Attempting to remove component from entity that does not belong to an archetype.");
+				}
+				const std::size_t run_end = EndOfArchetypeRun(entity_ids, run_begin, count);
+				Archetype* next_archetype = ArchetypeAfterRemovingComponent<T>(previous_archetype, removed_component_type);
+				if (next_archetype && run_end - run_begin == 1) {
+					// A single entity skips the bookkeeping of moving runs of entities.
+					previous_archetype->MoveEntityToSubArchetype<T>(entity_ids[run_begin], *next_archetype);
+				}
+				else if (next_archetype) {
+					// Move over the entities' component data from the previous archetype to
+					// the next one, except that of the component to be removed.
+					previous_archetype->MoveEntitiesToSubArchetype(entity_ids + run_begin, run_end - run_begin, *next_archetype);
+				}
+				else {
+					// The entities will now have no components. They are no longer assigned to an archetype.
+					previous_archetype->RemoveEntities(entity_ids + run_begin, run_end - run_begin);
+				}
+				AnnounceComponentSetChangeForEntities(entity_ids + run_begin, run_end - run_begin, previous_archetype, next_archetype);
+				if (previous_archetype->EntityCount() == 0
+					&& std::find(emptied_archetypes.begin(), emptied_archetypes.end(), previous_archetype) == emptied_archetypes.end()) {
+					emptied_archetypes.push_back(previous_archetype);
+				}
+				run_begin = run_end;
+			}
+			DestroyArchetypesIfEmpty(emptied_archetypes);
+		}
 
-		std::vector<Archetype*> entity_archetype_map_;
+		/*
+		* Moves the entities to the archetypes with shared_component in place of
+		* their shared component of shared_component_type, or without it if
+		* shared_component is nullptr.
+		*/
+		void ChangeSharedComponentBatch(const EntityID* entity_ids, std::size_t count, ComponentTypeID shared_component_type, const SharedComponent* shared_component)
+		{
+#if ECS_CHECK_COMPONENT_ACCESS
+			component_access_tracker_.CheckStructuralChange();
+#endif
+			std::vector<Archetype*> emptied_archetypes;
+			std::size_t run_begin = 0;
+			while (run_begin < count) {
+				assert(entity_ids[run_begin].index < entity_records_.Size());
+				Archetype* previous_archetype = entity_records_[entity_ids[run_begin].index].archetype;
+				const std::size_t run_end = EndOfArchetypeRun(entity_ids, run_begin, count);
+				Archetype* next_archetype = ArchetypeAfterChangingSharedComponent(previous_archetype, shared_component_type, shared_component);
+				if (next_archetype == previous_archetype) {
+					// The entities already have the value, or lack the removed type.
+					run_begin = run_end;
+					continue;
+				}
+				if (previous_archetype && next_archetype) {
+					previous_archetype->MoveEntitiesToArchetype(entity_ids + run_begin, run_end - run_begin, *next_archetype);
+				}
+				else if (previous_archetype) {
+					// The entities will now have no components.
+					previous_archetype->RemoveEntities(entity_ids + run_begin, run_end - run_begin);
+				}
+				else {
+					// The entities had no components, and only have the shared component now.
+					next_archetype->AddEntities<>(entity_ids + run_begin, run_end - run_begin, [](std::size_t i) {});
+				}
+				AnnounceComponentSetChangeForEntities(entity_ids + run_begin, run_end - run_begin, previous_archetype, next_archetype);
+				if (previous_archetype && previous_archetype->EntityCount() == 0
+					&& std::find(emptied_archetypes.begin(), emptied_archetypes.end(), previous_archetype) == emptied_archetypes.end()) {
+					emptied_archetypes.push_back(previous_archetype);
+				}
+				run_begin = run_end;
+			}
+			DestroyArchetypesIfEmpty(emptied_archetypes);
+		}
+
+		template<class... Ts, class F>
+		void EachJoined(F& f, std::true_type)
+		{
+			component_sparse_sets_.EachJoined<Ts...>(entity_records_, f);
+		}
+
+		template<class... Ts, class F>
+		void EachJoined(F& f, std::false_type)
+		{
+			ForEachArchetypeWithComponents<Ts...>([&f](Archetype* archetype) {
+				archetype->Each<Ts...>(f);
+			});
+		}
+
+		template<typename T>
+		static const T& ForwardComponent(const T& component)
+		{
+			return component;
+		}
+
+		template<typename T>
+		static T&& ForwardComponent(T& component)
+		{
+			return std::move(component);
+		}
+
+		// Keyed by ArchetypeKey.
+		SetTrie<ComponentTypeID, Archetype, ECS_ARCHETYPE_SIGNATURE_BITS> archetype_set_trie_;
+
+		// Values of the shared components of the archetypes.
+		SharedComponentStore shared_component_store_;
+
+		EntityRecords entity_records_;
+
+		// Components whose types are stored in sparse sets rather than archetypes.
+		ComponentSparseSets component_sparse_sets_;
+
+		// Archetypes with a single component type, keyed by that type. These are
+		// the targets of adding a component to an entity without any.
+		std::unordered_map<ComponentTypeID, Archetype*> root_archetype_edges_;
+
+		// An entity entering or exiting the component set of a listener group.
+		struct PendingComponentSetEvent {
+			EntityID entity_id;
+			bool entered;
+		};
 
 		struct ComponentSetListenerGroup {
 			ComponentSetIDs component_set_ids;
+			ComponentMask component_mask;
 			EventAnnouncer<IComponentSetEventsListener> component_set_events_announcer;
+			EventAnnouncer<IComponentSetBatchEventsListener> component_set_batch_events_announcer;
+			// Collected for the batch listeners, in the order that they happened.
+			std::vector<PendingComponentSetEvent> pending_events;
 			std::vector<Archetype*> archetypes;
 		};
 		SetTrie<ComponentTypeID, ComponentSetListenerGroup> component_set_listener_group_trie_;
 
-		TypeIDMapper component_type_id_mapper_;
+		// The groups of component_set_listener_group_trie_ in the order of their
+		// component sets. Walked by index, since listeners may add and remove
+		// groups while events are announced.
+		std::vector<ComponentSetListenerGroup*> component_set_listener_groups_;
+
+		std::vector<QueryBase*> queries_;
+
+		ComponentAccessTracker component_access_tracker_;
+
+		// Stamped on the chunk columns that are written. Advanced by every query iteration.
+		ChangeVersion change_version_ = 1;
+
+		ArchetypeRetentionPolicy archetype_retention_policy_;
+
+		// An archetype kept alive after it was emptied.
+		struct EmptyArchetype {
+			Archetype* archetype;
+			// Number of compactions that found the archetype empty.
+			std::size_t idle_compaction_count;
+		};
+
+		// In the order that the archetypes were emptied. Archetypes that have
+		// been reused since are removed by the next compaction.
+		std::vector<EmptyArchetype> empty_archetypes_;
 
 		template<class... Ts>
 		const ComponentSetIDs GetComponentSetIDs()
 		{
-			ComponentSetIDs component_set_ids = { ((std::uint32_t)component_type_id_mapper_.GetTypeId<Ts>())... };
+			static_assert(!HasSparseSetComponent<Ts...>(), "Components stored in sparse sets are not part of archetypes or component set events.");
+			ComponentSetIDs component_set_ids = { ComponentTypeRegistry::TypeIDOf<StoredComponent<Ts>>()... };
 			// Sort component set ids from least -> greatest.
 			std::sort(component_set_ids.begin(), component_set_ids.end());
 			return component_set_ids;
 		}
 
-		Archetype* CreateArchetype(ecs::ComponentSetIDs component_set_ids) {
-			Archetype* archetype = archetype_set_trie_.InsertValueForKeySet(component_set_ids, Archetype());
-			std::vector<ComponentSetListenerGroup*> groups = component_set_listener_group_trie_.GetValuesInOrder();
-			for (ComponentSetListenerGroup* group : groups) {
+		ComponentSetListenerGroup* ListenerGroupForComponentSet(const ComponentSetIDs& component_set_ids) {
+			ComponentSetListenerGroup* group;
+			if (!component_set_listener_group_trie_.TryGetValueForKeySet(component_set_ids, group)) {
+				// A group does not currently exist with this component set.
+				// Create one.
+				group = component_set_listener_group_trie_.InsertValueForKeySet(component_set_ids, ComponentSetListenerGroup());
+				group->component_set_ids = component_set_ids;
+				group->component_mask = ComponentMask(component_set_ids);
+				archetype_set_trie_.FindSuperKeySetValues(component_set_ids, group->archetypes);
+				component_set_listener_groups_.insert(
+					std::lower_bound(component_set_listener_groups_.begin(), component_set_listener_groups_.end(), group, [](const ComponentSetListenerGroup* a, const ComponentSetListenerGroup* b) {
+						return a->component_set_ids < b->component_set_ids;
+					}),
+					group
+				);
+			}
+			return group;
+		}
+
+		void RemoveListenerGroupIfUnused(ComponentSetListenerGroup* group) {
+			if (group->component_set_events_announcer.ListenerCount() == 0 && group->component_set_batch_events_announcer.ListenerCount() == 0) {
+				// There are no more remaining listeners for this component set.
+				// Delete this component set listener group.
+				const ComponentSetIDs component_set_ids = group->component_set_ids;
+				component_set_listener_groups_.erase(std::remove(component_set_listener_groups_.begin(), component_set_listener_groups_.end(), group), component_set_listener_groups_.end());
+				component_set_listener_group_trie_.RemoveValueForKeySet(component_set_ids);
+			}
+		}
+
+		template<class... Ts, class F>
+		void ForEachArchetypeWithComponents(F&& f)
+		{
+			const ComponentSetIDs component_set_ids = GetComponentSetIDs<Ts...>();
+
+			// Search for an existing component set in component_set_listener_group_trie_.
+			// If found, we can simply enumerate the cached archetypes, which is faster
+			// than doing a superset search in archetype_set_trie_.
+			ComponentSetListenerGroup* group;
+			if (component_set_listener_group_trie_.TryGetValueForKeySet(component_set_ids, group)) {
+				// Faster
+				for (Archetype* archetype : group->archetypes) {
+					f(archetype);
+				}
+			} else {
+				// Slower
+				const std::vector<Archetype*> archetypes = archetype_set_trie_.FindSuperKeySetValues(component_set_ids);
+				for (Archetype* archetype : archetypes) {
+					f(archetype);
+				}
+			}
+		}
+
+		/*
+		* Key of the archetype with the component types and shared components:
+		* the component types and the types of the shared components, followed
+		* by the keys of the shared values. See ArchetypeKeyOfSharedComponent.
+		*/
+		static ComponentSetIDs ArchetypeKey(const ComponentSetIDs& component_set_ids, const std::vector<SharedComponent>& shared_components)
+		{
+			ComponentSetIDs archetype_key = component_set_ids;
+			for (const SharedComponent& shared_component : shared_components) {
+				archetype_key.push_back(shared_component.component_type);
+				archetype_key.push_back(ArchetypeKeyOfSharedComponent(shared_component.shared_component_id));
+			}
+			std::sort(archetype_key.begin(), archetype_key.end());
+			return archetype_key;
+		}
+
+		// The shared components must be in order of their types.
+		Archetype* CreateArchetype(const ComponentSetIDs& archetype_key, const std::vector<SharedComponent>& shared_components = std::vector<SharedComponent>()) {
+			Archetype* archetype = archetype_set_trie_.EmplaceValueForKeySet(archetype_key);
+			archetype->SetChangeVersion(&change_version_);
+			archetype->SetSharedComponents(shared_components);
+			for (const SharedComponent& shared_component : shared_components) {
+				shared_component_store_.AddReference(shared_component.shared_component_id);
+			}
+			// The archetype is initialized by the caller, so its mask is not set yet.
+			ComponentMask component_mask;
+			for (ComponentTypeID key : archetype_key) {
+				if (key < ECS_MAX_COMPONENT_TYPES) {
+					component_mask.Set(key);
+				}
+			}
+			for (std::size_t g_idx = 0; g_idx < component_set_listener_groups_.size(); ++g_idx) {
+				ComponentSetListenerGroup* group = component_set_listener_groups_[g_idx];
 				// If archetype's component set is a superset of the group's component set,
-				// add the archetype from the group.
-				if (std::includes(
-					component_set_ids.begin(),
-					component_set_ids.end(),
-					group->component_set_ids.begin(),
-					group->component_set_ids.end()
-				)) {
+				// add the archetype to the group.
+				if (component_mask.Includes(group->component_mask)) {
 					group->archetypes.push_back(archetype);
 				}
 			}
+			for (QueryBase* query : queries_) {
+				query->MatchArchetype(archetype, component_mask);
+			}
 			return archetype;
 		}
 
 		void DestroyArchetype(Archetype* archetype) 
 		{
-			ComponentSetIDs component_set_ids = archetype
-				? archetype->ComponentSetIDs()
-				: std::vector<ComponentTypeID>();
-			std::vector<ComponentSetListenerGroup*> groups = component_set_listener_group_trie_.GetValuesInOrder();
-			for (ComponentSetListenerGroup* group : groups) {
+			const ComponentSetIDs& component_set_ids = archetype->ComponentSetIDs();
+			for (std::size_t g_idx = 0; g_idx < component_set_listener_groups_.size(); ++g_idx) {
+				ComponentSetListenerGroup* group = component_set_listener_groups_[g_idx];
 				// If archetype's component set is a superset of the group's component set,
 				// remove the archetype from the group.
-				if (std::includes(
-					component_set_ids.begin(),
-					component_set_ids.end(),
-					group->component_set_ids.begin(),
-					group->component_set_ids.end()
-				)) {
+				if (archetype->GetComponentMask().Includes(group->component_mask)) {
 					group->archetypes.erase(std::remove(group->archetypes.begin(), group->archetypes.end(), archetype), group->archetypes.end());
 				}
 			}
-			archetype_set_trie_.RemoveValueForKeySet(archetype->ComponentSetIDs());
+			for (QueryBase* query : queries_) {
+				query->UnmatchArchetype(archetype);
+			}
+			archetype->UnlinkArchetypeEdges();
+			const std::vector<SharedComponent> shared_components = archetype->SharedComponents();
+			if (component_set_ids.size() == 1 && shared_components.empty()) {
+				root_archetype_edges_.erase(component_set_ids[0]);
+			}
+			// Destroys the archetype, so this comes after every use of it.
+			archetype_set_trie_.RemoveValueForKeySet(ArchetypeKey(component_set_ids, shared_components));
+			for (const SharedComponent& shared_component : shared_components) {
+				shared_component_store_.Release(shared_component.shared_component_id);
+			}
 		}
 
-		void AnnounceComponentSetChangeForEntity(ecs::EntityID entity_id, Archetype* from_archetype, Archetype* to_archetype) {
-			ComponentSetIDs from_archetype_component_set_ids = from_archetype
-				? from_archetype->ComponentSetIDs()
-				: std::vector<ComponentTypeID>();
-			ComponentSetIDs next_archetype_component_set_ids = to_archetype
-				? to_archetype->ComponentSetIDs()
-				: std::vector<ComponentTypeID>();
-			std::vector<ComponentSetListenerGroup*> groups = component_set_listener_group_trie_.GetValuesInOrder();
-			for (ComponentSetListenerGroup* group : groups) {
-				const bool prev = std::includes(
-					from_archetype_component_set_ids.begin(),
-					from_archetype_component_set_ids.end(),
-					group->component_set_ids.begin(),
-					group->component_set_ids.end()
-				);
-				const bool next = std::includes(
-					next_archetype_component_set_ids.begin(),
-					next_archetype_component_set_ids.end(),
-					group->component_set_ids.begin(),
-					group->component_set_ids.end()
-				);
-				if (!prev && next) {
-					group->component_set_events_announcer.Announce(&IComponentSetEventsListener::OnEnterComponentSupersetOf, entity_id, next_archetype_component_set_ids);
-				} else if (prev && !next) {
-					group->component_set_events_announcer.Announce(&IComponentSetEventsListener::OnExitComponentSupersetOf, entity_id, next_archetype_component_set_ids);
+		// Archetype with exactly the components Ts, which is created if it does
+		// not exist yet. Checks that the entities can be spawned into it.
+		template<class... Ts>
+		Archetype* ArchetypeForSpawn(const EntityID* entity_ids, std::size_t count)
+		{
+			static_assert(!HasSharedComponent<Ts...>(), "Shared components are set with SetSharedComponentBatch after spawning.");
+#if ECS_CHECK_COMPONENT_ACCESS
+			component_access_tracker_.CheckStructuralChange();
+#endif
+			for (std::size_t e_idx = 0; e_idx < count; ++e_idx) {
+				assert(entity_ids[e_idx].index < entity_records_.Size());
+				if (entity_records_[entity_ids[e_idx].index].archetype != nullptr) {
+					throw std::runtime_error("Cannot spawn components for entity that already has components.");
+				}
+			}
+
+			const ComponentSetIDs component_set_ids = GetComponentSetIDs<Ts...>();
+			if (std::adjacent_find(component_set_ids.begin(), component_set_ids.end()) != component_set_ids.end()) {
+				throw std::runtime_error("Cannot have multiple components of same type on entity");
+			}
+			Archetype* archetype;
+			if (!archetype_set_trie_.TryGetValueForKeySet(component_set_ids, archetype)) {
+				archetype = CreateArchetype(component_set_ids);
+				archetype->InitializeWithComponentSet<Ts...>(&entity_records_);
+			}
+			if (component_set_ids.size() == 1) {
+				root_archetype_edges_[component_set_ids[0]] = archetype;
+			}
+			return archetype;
+		}
+
+		// Returns the end of the run of entities starting at run_begin that
+		// belong to the same archetype.
+		std::size_t EndOfArchetypeRun(const EntityID* entity_ids, std::size_t run_begin, std::size_t count) const
+		{
+			const Archetype* archetype = entity_records_[entity_ids[run_begin].index].archetype;
+			std::size_t run_end = run_begin + 1;
+			while (run_end < count && entity_records_[entity_ids[run_end].index].archetype == archetype) {
+				run_end++;
+			}
+			return run_end;
+		}
+
+		// Archetype of an entity in previous_archetype after adding a component
+		// of type T to it. The archetype is created if it does not exist yet.
+		template<typename T>
+		Archetype* ArchetypeAfterAddingComponent(Archetype* previous_archetype, ComponentTypeID added_component_type)
+		{
+			Archetype* next_archetype;
+			if (previous_archetype == nullptr) {
+				const std::unordered_map<ComponentTypeID, Archetype*>::iterator root_edge_iter = root_archetype_edges_.find(added_component_type);
+				if (root_edge_iter != root_archetype_edges_.end()) {
+					return root_edge_iter->second;
+				}
+				if (!archetype_set_trie_.TryGetValueForKeySet({ added_component_type }, next_archetype)) {
+					// Create new archetype for entity.
+					next_archetype = CreateArchetype({ added_component_type });
+					next_archetype->InitializeWithComponentSet<T>(&entity_records_);
+				}
+				root_archetype_edges_[added_component_type] = next_archetype;
+				return next_archetype;
+			}
+
+			// Follow the cached transition, if this one has been made before.
+			next_archetype = previous_archetype->ArchetypeAfterAddingComponentType(added_component_type);
+			if (next_archetype) {
+				return next_archetype;
+			}
+			if (previous_archetype->HasComponentType(added_component_type)) {
+				throw std::runtime_error("Cannot have multiple components of same type on entity");
+			}
+
+			// Determine the entity's new archetype id.
+			const std::vector<ComponentTypeID>& previous_component_types = previous_archetype->ComponentSetIDs();
+			std::vector<ComponentTypeID> new_component_types;
+			for (std::size_t c_idx = 0; c_idx < previous_component_types.size(); ++c_idx) {
+				if (added_component_type < previous_component_types[c_idx] && new_component_types.size() == c_idx) {
+					new_component_types.push_back(added_component_type);
+				}
+				new_component_types.push_back(previous_component_types[c_idx]);
+			}
+			if (new_component_types.size() == previous_component_types.size()) {
+				new_component_types.push_back(added_component_type);
+			}
+
+			const ComponentSetIDs archetype_key = ArchetypeKey(new_component_types, previous_archetype->SharedComponents());
+			if (!archetype_set_trie_.TryGetValueForKeySet(archetype_key, next_archetype)) {
+				// No archetype exists for the entity's new set of component types. Create
+				// new archetype.
+				next_archetype = CreateArchetype(archetype_key, previous_archetype->SharedComponents());
+				next_archetype->InitializeWithArchetypeAndAddedComponentType<T>(*previous_archetype);
+			}
+			previous_archetype->LinkSuperArchetype(added_component_type, next_archetype);
+			return next_archetype;
+		}
+
+		// Archetype of an entity in previous_archetype after removing its
+		// component of type T, or nullptr if it would have no components left.
+		template<typename T>
+		Archetype* ArchetypeAfterRemovingComponent(Archetype* previous_archetype, ComponentTypeID removed_component_type)
+		{
+			if (!previous_archetype->HasComponentType(removed_component_type))
+			{
+				throw std::runtime_error("Attempting to remove component that cannot be found on entity.");
+			}
+			if (previous_archetype->ComponentSetIDs().size() == 1 && previous_archetype->SharedComponents().empty()) {
+				return nullptr;
+			}
+
+			// Follow the cached transition, if this one has been made before.
+			Archetype* next_archetype = previous_archetype->ArchetypeAfterRemovingComponentType(removed_component_type);
+			if (next_archetype) {
+				return next_archetype;
+			}
+
+			// Determine the entity's new archetype id.
+			const std::vector<ComponentTypeID>& previous_component_types = previous_archetype->ComponentSetIDs();
+			std::vector<ComponentTypeID> new_component_types;
+			for (std::size_t c_idx = 0; c_idx < previous_component_types.size(); ++c_idx) {
+				if (removed_component_type != previous_component_types[c_idx]) {
+					new_component_types.push_back(previous_component_types[c_idx]);
+				}
+			}
+
+			const ComponentSetIDs archetype_key = ArchetypeKey(new_component_types, previous_archetype->SharedComponents());
+			if (!archetype_set_trie_.TryGetValueForKeySet(archetype_key, next_archetype)) {
+				// No archetype exists for the entity's new set of component types. Create
+				// new archetype.
+				next_archetype = CreateArchetype(archetype_key, previous_archetype->SharedComponents());
+				next_archetype->InitializeWithArchetypeAndRemovedComponentType<T>(*previous_archetype);
+			}
+			next_archetype->LinkSuperArchetype(removed_component_type, previous_archetype);
+			return next_archetype;
+		}
+
+		/*
+		* Archetype of an entity in previous_archetype after replacing its shared
+		* component of shared_component_type with shared_component, or removing
+		* it if shared_component is nullptr. Returns nullptr if the entity would
+		* have no components left. The archetype is created if it does not exist
+		* yet. Unlike component types, these transitions are not cached as
+		* edges, since shared components have many values.
+		*/
+		Archetype* ArchetypeAfterChangingSharedComponent(Archetype* previous_archetype, ComponentTypeID shared_component_type, const SharedComponent* shared_component)
+		{
+			static const ComponentSetIDs empty_component_set_ids;
+			std::vector<SharedComponent> shared_components;
+			if (previous_archetype) {
+				shared_components = previous_archetype->SharedComponents();
+			}
+			const std::vector<SharedComponent>::iterator shared_component_iter = std::lower_bound(shared_components.begin(), shared_components.end(), shared_component_type, [](const SharedComponent& a, ComponentTypeID component_type) {
+				return a.component_type < component_type;
+			});
+			const bool has_shared_component_type = shared_component_iter != shared_components.end() && shared_component_iter->component_type == shared_component_type;
+			if (!shared_component) {
+				if (!has_shared_component_type) {
+					return previous_archetype;
+				}
+				shared_components.erase(shared_component_iter);
+			}
+			else if (has_shared_component_type) {
+				if (shared_component_iter->shared_component_id == shared_component->shared_component_id) {
+					return previous_archetype;
+				}
+				*shared_component_iter = *shared_component;
+			}
+			else {
+				shared_components.insert(shared_component_iter, *shared_component);
+			}
+
+			const ComponentSetIDs& component_set_ids = previous_archetype ? previous_archetype->ComponentSetIDs() : empty_component_set_ids;
+			if (component_set_ids.empty() && shared_components.empty()) {
+				return nullptr;
+			}
+			const ComponentSetIDs archetype_key = ArchetypeKey(component_set_ids, shared_components);
+			Archetype* next_archetype;
+			if (!archetype_set_trie_.TryGetValueForKeySet(archetype_key, next_archetype)) {
+				next_archetype = CreateArchetype(archetype_key, shared_components);
+				if (previous_archetype) {
+					next_archetype->InitializeWithArchetypeComponentSet(*previous_archetype);
+				}
+				else {
+					next_archetype->InitializeWithComponentSet<>(&entity_records_);
+				}
+			}
+			return next_archetype;
+		}
+
+		void DestroyArchetypesIfEmpty(const std::vector<Archetype*>& archetypes)
+		{
+			for (Archetype* archetype : archetypes) {
+				if (archetype->EntityCount() > 0) {
+					continue;
+				}
+				if (archetype_retention_policy_.max_empty_archetype_count == 0) {
+					// Archetype no longer has any entities. Delete it.
+					DestroyArchetype(archetype);
+				}
+				else {
+					RetainEmptyArchetype(archetype);
+				}
+			}
+		}
+
+		void RetainEmptyArchetype(Archetype* archetype)
+		{
+			const std::vector<EmptyArchetype>::iterator empty_archetype_iter = std::find_if(empty_archetypes_.begin(), empty_archetypes_.end(), [archetype](const EmptyArchetype& empty_archetype) {
+				return empty_archetype.archetype == archetype;
+			});
+			if (empty_archetype_iter != empty_archetypes_.end()) {
+				// Emptied again after being reused.
+				empty_archetypes_.erase(empty_archetype_iter);
+			}
+			else if (empty_archetypes_.size() == archetype_retention_policy_.max_empty_archetype_count) {
+				DestroyOldestEmptyArchetype();
+			}
+			empty_archetypes_.push_back({ archetype, 0 });
+		}
+
+		// Destroys the archetype that has been empty the longest, unless it has been reused since.
+		void DestroyOldestEmptyArchetype()
+		{
+			Archetype* archetype = empty_archetypes_.front().archetype;
+			empty_archetypes_.erase(empty_archetypes_.begin());
+			if (archetype->EntityCount() == 0) {
+				DestroyArchetype(archetype);
+			}
+		}
+
+		/*
+		* Announces that the entities moved from from_archetype to to_archetype.
+		* Which listener groups are entered or exited is determined once for
+		* all of the entities.
+		*/
+		void AnnounceComponentSetChangeForEntities(const ecs::EntityID* entity_ids, std::size_t count, Archetype* from_archetype, Archetype* to_archetype) {
+			static const ComponentMask empty_component_mask;
+			static const ComponentSetIDs empty_component_set_ids;
+			const ComponentMask& from_component_mask = from_archetype ? from_archetype->GetComponentMask() : empty_component_mask;
+			const ComponentMask& to_component_mask = to_archetype ? to_archetype->GetComponentMask() : empty_component_mask;
+			const ComponentSetIDs& next_archetype_component_set_ids = to_archetype ? to_archetype->ComponentSetIDs() : empty_component_set_ids;
+			for (std::size_t g_idx = 0; g_idx < component_set_listener_groups_.size(); ++g_idx) {
+				ComponentSetListenerGroup* group = component_set_listener_groups_[g_idx];
+				const bool prev = from_component_mask.Includes(group->component_mask);
+				const bool next = to_component_mask.Includes(group->component_mask);
+				if (prev == next) {
+					continue;
+				}
+				if (group->component_set_batch_events_announcer.ListenerCount() > 0) {
+					for (std::size_t e_idx = 0; e_idx < count; ++e_idx) {
+						group->pending_events.push_back({ entity_ids[e_idx], next });
+					}
+				}
+				if (group->component_set_events_announcer.ListenerCount() == 0) {
+					continue;
+				}
+				if (next) {
+					for (std::size_t e_idx = 0; e_idx < count; ++e_idx) {
+						group->component_set_events_announcer.Announce(&IComponentSetEventsListener::OnEnterComponentSupersetOf, entity_ids[e_idx], next_archetype_component_set_ids);
+					}
+				} else {
+					for (std::size_t e_idx = 0; e_idx < count; ++e_idx) {
+						group->component_set_events_announcer.Announce(&IComponentSetEventsListener::OnExitComponentSupersetOf, entity_ids[e_idx], next_archetype_component_set_ids);
+					}
+				}
+			}
+		}
+
+		/*
+		* Sorts events by entity and splits them into the entities that entered
+		* and exited. An entity whose first and last events leave it where it
+		* started is left out.
+		*/
+		static void CoalesceComponentSetEvents(std::vector<PendingComponentSetEvent>& events, std::vector<EntityID>& entered_entity_ids, std::vector<EntityID>& exited_entity_ids) {
+			entered_entity_ids.clear();
+			exited_entity_ids.clear();
+			std::stable_sort(events.begin(), events.end(), [](const PendingComponentSetEvent& a, const PendingComponentSetEvent& b) {
+				return a.entity_id.index < b.entity_id.index || (a.entity_id.index == b.entity_id.index && a.entity_id.version < b.entity_id.version);
+			});
+			std::size_t run_begin = 0;
+			while (run_begin < events.size()) {
+				std::size_t run_end = run_begin + 1;
+				while (run_end < events.size() && events[run_end].entity_id == events[run_begin].entity_id) {
+					++run_end;
+				}
+				// Entering first means that the entity was outside at the last flush.
+				const bool was_inside = !events[run_begin].entered;
+				const bool is_inside = events[run_end - 1].entered;
+				if (!was_inside && is_inside) {
+					entered_entity_ids.push_back(events[run_begin].entity_id);
+				}
+				else if (was_inside && !is_inside) {
+					exited_entity_ids.push_back(events[run_begin].entity_id);
 				}
+				run_begin = run_end;
 			}
 		}
 	};
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <algorithm>
+#include <assert.h>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "component_type.h"
+
+namespace ecs {
+	typedef std::uint32_t SharedComponentID;
+
+	// Shared component of an archetype.
+	struct SharedComponent {
+		ComponentTypeID component_type;
+		SharedComponentID shared_component_id;
+		const void* value;
+	};
+
+	/*
+	* Archetypes are keyed by their component types, followed by the keys of
+	* their shared component values. The latter come after every component
+	* type id, so that searching for the archetypes with a superset of some
+	* component types finds those with any shared values.
+	*/
+	inline ComponentTypeID ArchetypeKeyOfSharedComponent(SharedComponentID shared_component_id)
+	{
+		return (ComponentTypeID)ECS_MAX_COMPONENT_TYPES + shared_component_id;
+	}
+
+	/*
+	* Values of shared components, of which every distinct value is stored
+	* once. Equal values of a type are found by comparing with the values of
+	* that type in use, so shared components are meant for types with few
+	* distinct values at a time, such as references to meshes and materials.
+	* Values are reference counted by the archetypes that use them.
+	*/
+	class SharedComponentStore
+	{
+	public:
+		SharedComponentStore() = default;
+
+		SharedComponentStore(const SharedComponentStore&) = delete;
+
+		SharedComponentStore& operator=(const SharedComponentStore&) = delete;
+
+		// Returns the id of the value equal to value, which is added if there
+		// is none, and adds a reference to it.
+		template<class T>
+		SharedComponentID Acquire(const T& value)
+		{
+			const ComponentTypeID component_type = ComponentTypeRegistry::TypeIDOf<T>();
+			if (component_type >= ids_by_type_.size()) {
+				ids_by_type_.resize(component_type + 1);
+			}
+			for (SharedComponentID shared_component_id : ids_by_type_[component_type]) {
+				if (static_cast<const SharedValue<T>*>(values_[shared_component_id].get())->value == value) {
+					reference_counts_[shared_component_id]++;
+					return shared_component_id;
+				}
+			}
+
+			SharedComponentID shared_component_id;
+			if (!free_ids_.empty()) {
+				shared_component_id = free_ids_.back();
+				free_ids_.pop_back();
+			}
+			else {
+				shared_component_id = (SharedComponentID)values_.size();
+				values_.emplace_back();
+				reference_counts_.push_back(0);
+			}
+			values_[shared_component_id].reset(new SharedValue<T>(component_type, value));
+			reference_counts_[shared_component_id] = 1;
+			ids_by_type_[component_type].push_back(shared_component_id);
+			return shared_component_id;
+		}
+
+		void AddReference(SharedComponentID shared_component_id)
+		{
+			assert(reference_counts_[shared_component_id] > 0);
+			reference_counts_[shared_component_id]++;
+		}
+
+		// Destroys the value once its last reference is released.
+		void Release(SharedComponentID shared_component_id)
+		{
+			assert(reference_counts_[shared_component_id] > 0);
+			if (--reference_counts_[shared_component_id] > 0) {
+				return;
+			}
+			std::vector<SharedComponentID>& type_ids = ids_by_type_[values_[shared_component_id]->component_type];
+			type_ids.erase(std::find(type_ids.begin(), type_ids.end(), shared_component_id));
+			values_[shared_component_id].reset();
+			free_ids_.push_back(shared_component_id);
+		}
+
+		// The address of a value does not change while it is referenced.
+		const void* Value(SharedComponentID shared_component_id) const
+		{
+			return values_[shared_component_id]->Address();
+		}
+
+		// Number of distinct values that are referenced.
+		std::size_t ValueCount() const
+		{
+			return values_.size() - free_ids_.size();
+		}
+
+	private:
+		struct SharedValueBase {
+			explicit SharedValueBase(ComponentTypeID component_type) : component_type(component_type) {}
+
+			virtual ~SharedValueBase() {}
+
+			virtual const void* Address() const = 0;
+
+			const ComponentTypeID component_type;
+		};
+
+		template<class T>
+		struct SharedValue : SharedValueBase {
+			SharedValue(ComponentTypeID component_type, const T& value) : SharedValueBase(component_type), value(value) {}
+
+			const void* Address() const override
+			{
+				return &value;
+			}
+
+			const T value;
+		};
+
+		// Indexed by shared component id. Freed ids are null until reused.
+		std::vector<std::unique_ptr<SharedValueBase>> values_;
+
+		std::vector<std::size_t> reference_counts_;
+
+		std::vector<SharedComponentID> free_ids_;
+
+		// Ids of the values of every component type, indexed by component type.
+		std::vector<std::vector<SharedComponentID>> ids_by_type_;
+	};
+}
@@ -5,7 +5,6 @@
 #include <iostream>
 
 #include <core/utils/gtest_helpers.h>
-#include <core/utils/type_id_mapper.h>
 #include "../../archetype.h"
 
 using namespace ecs;
@@ -51,13 +50,8 @@ struct C
 
 TEST(archetype_test_suite, adding_entity_test)
 {
-    TypeIDMapper component_type_id_mapper;
-    component_type_id_mapper.GetTypeId<A>();
-    component_type_id_mapper.GetTypeId<B>();
-    component_type_id_mapper.GetTypeId<C>();
- 
     Archetype archetype;
-    archetype.InitializeWithComponentSet<A, B, C>(&component_type_id_mapper);
+    archetype.InitializeWithComponentSet<A, B, C>();
     archetype.AddEntity<B, C, A>({ 0, 1 }, { b_name_0 }, { c_name_0 }, { a_name_0 });
     B* b;
     ASSERT_TRUE(archetype.GetComponentForEntity({ 0, 1 }, b));
@@ -70,13 +64,8 @@ TEST(archetype_test_suite, adding_entity_test)
 
 TEST(archetype_test_suite, removing_entity_test)
 {
-    TypeIDMapper component_type_id_mapper;
-    component_type_id_mapper.GetTypeId<A>();
-    component_type_id_mapper.GetTypeId<B>();
-    component_type_id_mapper.GetTypeId<C>();
-
     Archetype archetype;
-    archetype.InitializeWithComponentSet<A, B, C>(&component_type_id_mapper);
+    archetype.InitializeWithComponentSet<A, B, C>();
     archetype.AddEntity<B, C, A>({ 0, 1 }, { b_name_0 }, { c_name_0 }, { a_name_0 });
     archetype.AddEntity<B, C, A>({ 0, 2 }, { b_name_1 }, { c_name_1 }, { a_name_1 });
 
@@ -113,19 +102,13 @@ struct D
 TEST(archetype_test_suite, creating_archetype_with_added_component_type)
 {
 
-    TypeIDMapper component_type_id_mapper;
-    component_type_id_mapper.GetTypeId<A>();
-    component_type_id_mapper.GetTypeId<B>();
-    component_type_id_mapper.GetTypeId<C>();
-    component_type_id_mapper.GetTypeId<D>();
-
     Archetype archetype_abc;
-    archetype_abc.InitializeWithComponentSet<A, B, C>(&component_type_id_mapper);
+    archetype_abc.InitializeWithComponentSet<A, B, C>();
     archetype_abc.AddEntity<B, C, A>({ 0, 1 }, { b_name_0 }, { c_name_0 }, { a_name_0 });
     archetype_abc.AddEntity<B, C, A>({ 0, 2 }, { b_name_1 }, { c_name_1 }, { a_name_1 });
 
     Archetype archetype_abcd;
-    archetype_abcd.InitializeWithArchetypeAndAddedComponentType<D>(&component_type_id_mapper, archetype_abc);
+    archetype_abcd.InitializeWithArchetypeAndAddedComponentType<D>(archetype_abc);
     archetype_abcd.AddEntity<D, B, C, A>({ 0, 3 }, { d_name_2 }, { b_name_2 }, { c_name_2 }, { a_name_2 });
 
     std::vector<EntityID> expected_entities = { { 0, 3 } };
@@ -150,19 +133,13 @@ TEST(archetype_test_suite, creating_archetype_with_added_component_type)
 
 TEST(archetype_test_suite, creating_archetype_with_removed_component_type)
 {
-    TypeIDMapper component_type_id_mapper;
-    component_type_id_mapper.GetTypeId<A>();
-    component_type_id_mapper.GetTypeId<B>();
-    component_type_id_mapper.GetTypeId<C>();
-    component_type_id_mapper.GetTypeId<D>();
-
     Archetype archetype_abcd;
-    archetype_abcd.InitializeWithComponentSet<A, B, C, D>(&component_type_id_mapper);
+    archetype_abcd.InitializeWithComponentSet<A, B, C, D>();
     archetype_abcd.AddEntity<D, B, C, A>({ 0, 1 }, { d_name_0 }, { b_name_0 }, { c_name_0 }, { a_name_0 });
     archetype_abcd.AddEntity<D, B, C, A>({ 0, 2 }, { d_name_1 }, { b_name_1 }, { c_name_1 }, { a_name_1 });
 
     Archetype archetype_acd;
-    archetype_acd.InitializeWithArchetypeAndRemovedComponentType<B>(&component_type_id_mapper, archetype_abcd);
+    archetype_acd.InitializeWithArchetypeAndRemovedComponentType<B>(archetype_abcd);
     archetype_acd.AddEntity<D, C, A>({ 0, 3 }, { d_name_2 }, { c_name_2 }, { a_name_2 });
 
     std::vector<EntityID> expected_entities = { { 0, 3 } };
@@ -188,19 +165,13 @@ TEST(archetype_test_suite, creating_archetype_with_removed_component_type)
 
 TEST(archetype_test_suite, moving_entity_to_super_archetype)
 {
-    TypeIDMapper component_type_id_mapper;
-    component_type_id_mapper.GetTypeId<A>();
-    component_type_id_mapper.GetTypeId<B>();
-    component_type_id_mapper.GetTypeId<C>();
-    component_type_id_mapper.GetTypeId<D>();
-
     Archetype archetype_abc;
-    archetype_abc.InitializeWithComponentSet<A, B, C>(&component_type_id_mapper);
+    archetype_abc.InitializeWithComponentSet<A, B, C>();
     archetype_abc.AddEntity<A, B, C>({ 0, 1 }, { a_name_0 }, { b_name_0 }, { c_name_0 });
     archetype_abc.AddEntity<A, B, C>({ 0, 2 }, { a_name_1 }, { b_name_1 }, { c_name_1 });
 
     Archetype archetype_abcd;
-    archetype_abcd.InitializeWithComponentSet<A, B, C, D>(&component_type_id_mapper);
+    archetype_abcd.InitializeWithComponentSet<A, B, C, D>();
     archetype_abcd.AddEntity<D, B, C, A>({ 0, 3 }, { d_name_2 }, { b_name_2 }, { c_name_2 }, { a_name_2 });
     archetype_abcd.AddEntity<D, B, C, A>({ 0, 4 }, { d_name_3 }, { b_name_3 }, { c_name_3 }, { a_name_3 });
 
@@ -240,19 +211,13 @@ TEST(archetype_test_suite, moving_entity_to_super_archetype)
 
 TEST(archetype_test_suite, moving_entity_to_sub_archetype)
 {
-    TypeIDMapper component_type_id_mapper;
-    component_type_id_mapper.GetTypeId<A>();
-    component_type_id_mapper.GetTypeId<B>();
-    component_type_id_mapper.GetTypeId<C>();
-    component_type_id_mapper.GetTypeId<D>();
-
     Archetype archetype_abc;
-    archetype_abc.InitializeWithComponentSet<A, B, C>(&component_type_id_mapper);
+    archetype_abc.InitializeWithComponentSet<A, B, C>();
     archetype_abc.AddEntity<A, B, C>({ 0, 1 }, { a_name_0 }, { b_name_0 }, { c_name_0 });
     archetype_abc.AddEntity<A, B, C>({ 0, 2 }, { a_name_1 }, { b_name_1 }, { c_name_1 });
 
     Archetype archetype_abcd;
-    archetype_abcd.InitializeWithComponentSet<A, B, C, D>(&component_type_id_mapper);
+    archetype_abcd.InitializeWithComponentSet<A, B, C, D>();
     archetype_abcd.AddEntity<D, B, C, A>({ 0, 3 }, { d_name_2 }, { b_name_2 }, { c_name_2 }, { a_name_2 });
     archetype_abcd.AddEntity<D, B, C, A>({ 0, 4 }, { d_name_3 }, { b_name_3 }, { c_name_3 }, { a_name_3 });
     archetype_abcd.AddEntity<D, B, C, A>({ 0, 5 }, { d_name_4 }, { b_name_4 }, { c_name_4 }, { a_name_4 });
@@ -289,4 +254,130 @@ TEST(archetype_test_suite, moving_entity_to_sub_archetype)
         index++;
     };
     archetype_abcd.EnumerateComponentsWithBlock<A, B, C, D>(abcd_test_block);
-}
\ No newline at end of file
+}
+TEST(archetype_test_suite, entities_span_multiple_chunks_test)
+{
+    Archetype archetype;
+    archetype.InitializeWithComponentSet<A, B>();
+    const std::size_t entity_count = archetype.ChunkCapacity() * 3 + 1;
+    for (std::size_t i = 0; i < entity_count; ++i) {
+        archetype.AddEntity<A, B>({ 0, (EntityIndex)i }, { std::to_string(i) }, { std::to_string(i) });
+    }
+    ASSERT_EQ(archetype.ChunkCount(), 4);
+
+    // Removing the first entity swaps the last entity into its slot and frees the last chunk.
+    archetype.RemoveEntity({ 0, 0 });
+    ASSERT_EQ(archetype.ChunkCount(), 3);
+    ASSERT_EQ(archetype.EntityAtIndex(0), EntityID({ 0, (EntityIndex)(entity_count - 1) }));
+
+    std::size_t enumerated_count = 0;
+    std::function<void(EntityID, A&, B&)> test_block =
+        [&](EntityID entity_id, A& a, B& b) {
+        ASSERT_EQ(a.name, std::to_string(entity_id.index));
+        ASSERT_EQ(b.name, std::to_string(entity_id.index));
+        enumerated_count++;
+    };
+    archetype.EnumerateComponentsWithBlock<A, B>(test_block);
+    ASSERT_EQ(enumerated_count, entity_count - 1);
+}
+
+TEST(archetype_test_suite, each_chunk_test)
+{
+    Archetype archetype;
+    archetype.InitializeWithComponentSet<A, B>();
+    const std::size_t entity_count = archetype.ChunkCapacity() * 2 + 1;
+    for (std::size_t i = 0; i < entity_count; ++i) {
+        archetype.AddEntity<A, B>({ 0, (EntityIndex)i }, { std::to_string(i) }, { std::to_string(i) });
+    }
+
+    std::size_t chunk_count = 0;
+    std::size_t enumerated_count = 0;
+    archetype.EachChunk<B, A>([&](const EntityID* entity_ids, std::size_t count, B* bs, A* as) {
+        ASSERT_LE(count, archetype.ChunkCapacity());
+        for (std::size_t i = 0; i < count; ++i) {
+            ASSERT_EQ(as[i].name, std::to_string(entity_ids[i].index));
+            ASSERT_EQ(bs[i].name, std::to_string(entity_ids[i].index));
+        }
+        chunk_count++;
+        enumerated_count += count;
+    });
+    ASSERT_EQ(chunk_count, 3);
+    ASSERT_EQ(enumerated_count, entity_count);
+
+    enumerated_count = 0;
+    archetype.Each<A>([&](EntityID entity_id, A& a) {
+        ASSERT_EQ(a.name, std::to_string(entity_id.index));
+        enumerated_count++;
+    });
+    ASSERT_EQ(enumerated_count, entity_count);
+}
+
+static std::string LongName(std::size_t i)
+{
+    // Too long for the small string buffer, so that leaked or doubly destroyed names are caught.
+    return std::string(24, 'x') + std::to_string(i);
+}
+
+TEST(archetype_test_suite, moving_entities_in_bulk_test)
+{
+    Archetype archetype_ab;
+    archetype_ab.InitializeWithComponentSet<A, B>();
+    Archetype archetype_abc;
+    archetype_abc.InitializeWithArchetypeAndAddedComponentType<C>(archetype_ab);
+    const std::size_t entity_count = archetype_ab.ChunkCapacity() * 3 + 5;
+    for (std::size_t i = 0; i < entity_count; ++i) {
+        archetype_ab.AddEntity<A, B>({ 0, (EntityIndex)i }, { LongName(i) }, { LongName(i) });
+    }
+
+    // Every third entity, and a run that crosses a chunk boundary.
+    std::vector<EntityID> moved_entities;
+    for (std::size_t i = 0; i < entity_count; ++i) {
+        if (i % 3 == 0 || (i > archetype_ab.ChunkCapacity() - 10 && i < archetype_ab.ChunkCapacity() + 10)) {
+            moved_entities.push_back({ 0, (EntityIndex)i });
+        }
+    }
+    archetype_ab.MoveEntitiesToSuperArchetype<C>(moved_entities.data(), moved_entities.size(), archetype_abc, [&](std::size_t i, C* c) {
+        new (c) C{ LongName(moved_entities[i].index) };
+    });
+    ASSERT_EQ(archetype_ab.EntityCount(), entity_count - moved_entities.size());
+    ASSERT_EQ(archetype_abc.EntityCount(), moved_entities.size());
+    ASSERT_EQ(archetype_ab.ChunkCount(), (archetype_ab.EntityCount() + archetype_ab.ChunkCapacity() - 1) / archetype_ab.ChunkCapacity());
+
+    std::size_t enumerated_count = 0;
+    archetype_ab.Each<A, B>([&](EntityID entity_id, A& a, B& b) {
+        ASSERT_EQ(a.name, LongName(entity_id.index));
+        ASSERT_EQ(b.name, LongName(entity_id.index));
+        enumerated_count++;
+    });
+    archetype_abc.Each<A, B, C>([&](EntityID entity_id, A& a, B& b, C& c) {
+        ASSERT_EQ(a.name, LongName(entity_id.index));
+        ASSERT_EQ(b.name, LongName(entity_id.index));
+        ASSERT_EQ(c.name, LongName(entity_id.index));
+        enumerated_count++;
+    });
+    ASSERT_EQ(enumerated_count, entity_count);
+    for (std::size_t i = 0; i < entity_count; ++i) {
+        A* a;
+        Archetype& archetype = std::find(moved_entities.begin(), moved_entities.end(), EntityID({ 0, (EntityIndex)i })) != moved_entities.end() ? archetype_abc : archetype_ab;
+        ASSERT_TRUE(archetype.GetComponentForEntity({ 0, (EntityIndex)i }, a));
+        ASSERT_EQ(a->name, LongName(i));
+    }
+
+    // Move half of them back, and remove the other half.
+    const std::size_t half = moved_entities.size() / 2;
+    archetype_abc.MoveEntitiesToSubArchetype(moved_entities.data(), half, archetype_ab);
+    archetype_abc.RemoveEntities(moved_entities.data() + half, moved_entities.size() - half);
+    ASSERT_EQ(archetype_abc.EntityCount(), 0);
+    ASSERT_EQ(archetype_abc.ChunkCount(), 0);
+    ASSERT_EQ(archetype_ab.EntityCount(), entity_count - (moved_entities.size() - half));
+    enumerated_count = 0;
+    archetype_ab.Each<A, B>([&](EntityID entity_id, A& a, B& b) {
+        ASSERT_EQ(a.name, LongName(entity_id.index));
+        ASSERT_EQ(b.name, LongName(entity_id.index));
+        B* b_of_entity;
+        ASSERT_TRUE(archetype_ab.GetComponentForEntity(entity_id, b_of_entity));
+        ASSERT_EQ(b_of_entity, &b);
+        enumerated_count++;
+    });
+    ASSERT_EQ(enumerated_count, archetype_ab.EntityCount());
+}
@@ -3,8 +3,13 @@
 #include <string>
 #include <vector>
 #include <iostream>
+#include <atomic>
+#include <memory>
 
 #include <core/utils/gtest_helpers.h>
+#include "../../command_buffer.h"
+#include "../../entity_allocator.h"
+#include "../../query.h"
 #include "../../registry.h"
 
 static const std::string a_name_0 = "A0";
@@ -68,4 +73,831 @@ TEST(ecs_test_suite, adding_component_test)
     registry.AddComponent<B>(entity_id, { b_name_0 });
 
     registry.EnumerateComponentsWithBlock<A, B>({});
-}
\ No newline at end of file
+}
+TEST(ecs_test_suite, getting_component_after_archetype_moves_test)
+{
+    ecs::Registry registry;
+    const ecs::EntityID entity_id_0 = { 0, 1 };
+    const ecs::EntityID entity_id_1 = { 0, 2 };
+    const ecs::EntityID entity_id_2 = { 0, 3 };
+    registry.RegisterEntity(entity_id_0);
+    registry.RegisterEntity(entity_id_1);
+    registry.RegisterEntity(entity_id_2);
+    registry.AddComponent<A>(entity_id_0, { a_name_0 });
+    registry.AddComponent<A>(entity_id_1, { a_name_1 });
+    registry.AddComponent<A>(entity_id_2, { a_name_2 });
+
+    // Moving the first entity to the {A, B} archetype swaps the last entity into its row.
+    registry.AddComponent<B>(entity_id_0, { b_name_0 });
+
+    A* a;
+    B* b;
+    ASSERT_TRUE(registry.GetComponent(entity_id_0, a));
+    ASSERT_EQ(a->name, a_name_0);
+    ASSERT_TRUE(registry.GetComponent(entity_id_0, b));
+    ASSERT_EQ(b->name, b_name_0);
+    ASSERT_TRUE(registry.GetComponent(entity_id_2, a));
+    ASSERT_EQ(a->name, a_name_2);
+    ASSERT_FALSE(registry.GetComponent(entity_id_2, b));
+
+    registry.RemoveComponent<A>(entity_id_0);
+    ASSERT_FALSE(registry.GetComponent(entity_id_0, a));
+    ASSERT_TRUE(registry.GetComponent(entity_id_0, b));
+    ASSERT_EQ(b->name, b_name_0);
+
+    registry.UnregisterEntity(entity_id_1);
+    ASSERT_FALSE(registry.GetComponent(entity_id_1, a));
+    ASSERT_TRUE(registry.GetComponent(entity_id_2, a));
+    ASSERT_EQ(a->name, a_name_2);
+}
+
+TEST(ecs_test_suite, toggling_component_test)
+{
+    ecs::Registry registry;
+    const ecs::EntityID entity_id_0 = { 0, 1 };
+    const ecs::EntityID entity_id_1 = { 0, 2 };
+    registry.RegisterEntity(entity_id_0);
+    registry.RegisterEntity(entity_id_1);
+    registry.AddComponent<A>(entity_id_0, { a_name_0 });
+    registry.AddComponent<A>(entity_id_1, { a_name_1 });
+
+    // Toggling B moves entities back and forth between the {A} and {A, B} archetypes,
+    // which are destroyed and recreated whenever they become empty.
+    for (std::size_t i = 0; i < 3; ++i) {
+        registry.AddComponent<B>(entity_id_0, { b_name_0 });
+        registry.AddComponent<B>(entity_id_1, { b_name_1 });
+        ASSERT_THROW(registry.AddComponent<B>(entity_id_1, { b_name_1 }), std::runtime_error);
+        registry.RemoveComponent<B>(entity_id_0);
+
+        A* a;
+        B* b;
+        ASSERT_TRUE(registry.GetComponent(entity_id_0, a));
+        ASSERT_EQ(a->name, a_name_0);
+        ASSERT_FALSE(registry.GetComponent(entity_id_0, b));
+        ASSERT_TRUE(registry.GetComponent(entity_id_1, b));
+        ASSERT_EQ(b->name, b_name_1);
+
+        registry.RemoveComponent<B>(entity_id_1);
+        ASSERT_THROW(registry.RemoveComponent<B>(entity_id_1), std::runtime_error);
+        ASSERT_TRUE(registry.GetComponent(entity_id_1, a));
+        ASSERT_EQ(a->name, a_name_1);
+    }
+
+    registry.RemoveComponent<A>(entity_id_0);
+    registry.RemoveComponent<A>(entity_id_1);
+    registry.AddComponent<B>(entity_id_0, { b_name_0 });
+    B* b;
+    ASSERT_TRUE(registry.GetComponent(entity_id_0, b));
+    ASSERT_EQ(b->name, b_name_0);
+}
+
+TEST(ecs_test_suite, query_test)
+{
+    ecs::Registry registry;
+    ecs::Query<A, B> query;
+    const ecs::EntityID entity_id_0 = { 0, 1 };
+    const ecs::EntityID entity_id_1 = { 0, 2 };
+    const ecs::EntityID entity_id_2 = { 0, 3 };
+    registry.RegisterEntity(entity_id_0);
+    registry.RegisterEntity(entity_id_1);
+    registry.RegisterEntity(entity_id_2);
+    registry.AddComponent<A>(entity_id_0, { a_name_0 });
+    registry.AddComponent<B>(entity_id_0, { b_name_0 });
+
+    // Archetypes that exist before the query is added are matched.
+    registry.AddQuery(&query);
+    ASSERT_EQ(query.MatchedArchetypes().size(), 1);
+
+    // Archetypes created afterwards are matched incrementally.
+    registry.AddComponent<A>(entity_id_1, { a_name_1 });
+    registry.AddComponent<B>(entity_id_1, { b_name_1 });
+    registry.AddComponent<C>(entity_id_1, { c_name_1 });
+    registry.AddComponent<A>(entity_id_2, { a_name_2 });
+    ASSERT_EQ(query.MatchedArchetypes().size(), 2);
+    ASSERT_EQ(query.EntityCount(), 2);
+
+    std::vector<std::string> a_names;
+    query.EnumerateComponentsWithBlock([&a_names](ecs::EntityID entity_id, A& a, B& b) {
+        a_names.push_back(a.name);
+    });
+    std::sort(a_names.begin(), a_names.end());
+    ASSERT_EQ(a_names, std::vector<std::string>({ a_name_0, a_name_1 }));
+
+    // Destroyed archetypes are unmatched.
+    registry.RemoveComponent<C>(entity_id_1);
+    ASSERT_EQ(query.MatchedArchetypes().size(), 1);
+    ASSERT_EQ(query.EntityCount(), 2);
+
+    registry.RemoveQuery(&query);
+    ASSERT_EQ(query.MatchedArchetypes().size(), 0);
+    registry.AddComponent<B>(entity_id_2, { b_name_2 });
+    ASSERT_EQ(query.MatchedArchetypes().size(), 0);
+}
+
+TEST(ecs_test_suite, parallel_each_test)
+{
+    ecs::Registry registry;
+    ecs::Query<const A, B> query;
+    registry.AddQuery(&query);
+    const std::size_t entity_count = 5000;
+    for (std::size_t i = 0; i < entity_count; ++i) {
+        const ecs::EntityID entity_id = { 0, (ecs::EntityIndex)i };
+        registry.RegisterEntity(entity_id);
+        registry.AddComponent<A>(entity_id, { std::to_string(i) });
+        registry.AddComponent<B>(entity_id, { "" });
+        if (i % 2 == 0) {
+            registry.AddComponent<C>(entity_id, { c_name_0 });
+        }
+    }
+
+    ThreadPool thread_pool(3);
+    query.ParallelEach([](ecs::EntityID entity_id, const A& a, B& b) {
+        b.name = a.name;
+    }, thread_pool);
+    std::size_t enumerated_count = 0;
+    query.Each([&enumerated_count](ecs::EntityID entity_id, const A& a, B& b) {
+        ASSERT_EQ(b.name, std::to_string(entity_id.index));
+        enumerated_count++;
+    });
+    ASSERT_EQ(enumerated_count, entity_count);
+
+    std::atomic<std::size_t> parallel_count(0);
+    registry.ParallelEach<const A, const C>([&parallel_count](ecs::EntityID entity_id, const A& a, const C& c) {
+        parallel_count++;
+    }, thread_pool);
+    ASSERT_EQ(parallel_count.load(), entity_count / 2);
+
+#if ECS_CHECK_COMPONENT_ACCESS
+    // Reading A alongside the query is fine, but writing B or changing
+    // components is a data race.
+    query.ParallelEachChunk([&registry](const ecs::EntityID* entity_ids, std::size_t count, const A* as, B* bs) {
+        registry.ParallelEach<const A>([](ecs::EntityID entity_id, const A& a) {});
+        ASSERT_THROW(registry.ParallelEach<B>([](ecs::EntityID entity_id, B& b) {}), std::runtime_error);
+        ASSERT_THROW(registry.ParallelEach<const B>([](ecs::EntityID entity_id, const B& b) {}), std::runtime_error);
+        ASSERT_THROW(registry.RemoveComponent<C>(entity_ids[0]), std::runtime_error);
+    }, thread_pool);
+#endif
+
+    registry.RemoveQuery(&query);
+}
+
+TEST(ecs_test_suite, command_buffer_test)
+{
+    ecs::Registry registry;
+    ecs::CommandBuffer command_buffer;
+    const std::size_t entity_count = 1000;
+    for (std::size_t i = 0; i < entity_count; ++i) {
+        const ecs::EntityID entity_id = { 0, (ecs::EntityIndex)i };
+        command_buffer.RegisterEntity(entity_id);
+        command_buffer.AddComponent<A>(entity_id, { std::to_string(i) });
+        if (i % 2 == 0) {
+            command_buffer.AddComponent<B>(entity_id, { std::to_string(i) });
+        }
+    }
+    ASSERT_EQ(command_buffer.CommandCount(), entity_count * 2 + entity_count / 2);
+    command_buffer.Playback(registry);
+    ASSERT_EQ(command_buffer.CommandCount(), 0);
+
+    A* a;
+    B* b;
+    for (std::size_t i = 0; i < entity_count; ++i) {
+        const ecs::EntityID entity_id = { 0, (ecs::EntityIndex)i };
+        ASSERT_TRUE(registry.GetComponent(entity_id, a));
+        ASSERT_EQ(a->name, std::to_string(i));
+        ASSERT_EQ(registry.GetComponent(entity_id, b), i % 2 == 0);
+    }
+
+    // Commands recorded from worker threads during a parallel iteration.
+    ThreadPool thread_pool(3);
+    ecs::Query<const A> query;
+    registry.AddQuery(&query);
+    query.ParallelEach([&command_buffer](ecs::EntityID entity_id, const A& a) {
+        if (entity_id.index % 2 == 0) {
+            command_buffer.RemoveComponent<B>(entity_id);
+            command_buffer.AddComponent<C>(entity_id, { a.name });
+        }
+        else if (entity_id.index % 3 == 0) {
+            command_buffer.UnregisterEntity(entity_id);
+        }
+    }, thread_pool);
+    command_buffer.Playback(registry);
+    registry.RemoveQuery(&query);
+
+    C* c;
+    for (std::size_t i = 0; i < entity_count; ++i) {
+        const ecs::EntityID entity_id = { 0, (ecs::EntityIndex)i };
+        ASSERT_FALSE(registry.GetComponent(entity_id, b));
+        ASSERT_EQ(registry.GetComponent(entity_id, c), i % 2 == 0);
+        ASSERT_EQ(registry.GetComponent(entity_id, a), i % 2 == 0 || i % 3 != 0);
+    }
+
+    // A failing command discards the rest of the buffer.
+    command_buffer.AddComponent<C>({ 0, 0 }, { c_name_0 });
+    ASSERT_THROW(command_buffer.Playback(registry), std::runtime_error);
+    ASSERT_EQ(command_buffer.CommandCount(), 0);
+}
+
+TEST(ecs_test_suite, spawn_batch_test)
+{
+    ecs::Registry registry;
+    std::vector<ecs::EntityID> entity_ids;
+    for (std::size_t i = 0; i < 2000; ++i) {
+        entity_ids.push_back({ 0, (ecs::EntityIndex)i });
+        registry.RegisterEntity(entity_ids.back());
+    }
+    registry.AddComponent<A>(entity_ids[0], { a_name_0 });
+
+    // Entities spawned into an existing archetype.
+    registry.SpawnBatch<B, A>(entity_ids.data() + 1, 999, [](std::size_t i, B& b, A& a) {
+        a.name = std::to_string(i + 1);
+        b.name = std::to_string(i + 1);
+    });
+    ASSERT_THROW(registry.SpawnBatch<A>(entity_ids.data(), 1, [](std::size_t i, A& a) {}), std::runtime_error);
+
+    // Entities instantiated from a prefab.
+    const ecs::Prefab<A, B, C> prefab({ a_name_1 }, { b_name_1 }, { c_name_1 });
+    registry.Instantiate(prefab, entity_ids.data() + 1000, 1000);
+
+    A* a;
+    B* b;
+    C* c;
+    ASSERT_FALSE(registry.GetComponent(entity_ids[0], b));
+    for (std::size_t i = 1; i < 1000; ++i) {
+        ASSERT_TRUE(registry.GetComponentSet(entity_ids[i], a, b));
+        ASSERT_EQ(a->name, std::to_string(i));
+        ASSERT_EQ(b->name, std::to_string(i));
+        ASSERT_FALSE(registry.GetComponent(entity_ids[i], c));
+    }
+    for (std::size_t i = 1000; i < 2000; ++i) {
+        ASSERT_TRUE(registry.GetComponentSet(entity_ids[i], a, b, c));
+        ASSERT_EQ(a->name, a_name_1);
+        ASSERT_EQ(b->name, b_name_1);
+        ASSERT_EQ(c->name, c_name_1);
+    }
+
+    // Spawned entities move between archetypes like any other.
+    registry.RemoveComponent<B>(entity_ids[1]);
+    registry.UnregisterEntity(entity_ids[1999]);
+    ASSERT_TRUE(registry.GetComponent(entity_ids[1], a));
+    ASSERT_EQ(a->name, std::to_string(1));
+    ASSERT_TRUE(registry.GetComponent(entity_ids[1998], c));
+    ASSERT_FALSE(registry.GetComponent(entity_ids[1999], c));
+}
+
+struct UniqueResource
+{
+    std::unique_ptr<int> value;
+};
+
+TEST(ecs_test_suite, moving_components_test)
+{
+    ecs::Registry registry;
+    const std::shared_ptr<int> shared_value = std::make_shared<int>(1);
+    for (ecs::EntityIndex i = 0; i < 1000; ++i) {
+        const ecs::EntityID entity_id = { 0, i };
+        registry.RegisterEntity(entity_id);
+        registry.AddComponent<UniqueResource>(entity_id, { std::unique_ptr<int>(new int(i)) });
+        registry.AddComponent<std::shared_ptr<int>>(entity_id, shared_value);
+    }
+    ASSERT_EQ(shared_value.use_count(), 1001);
+
+    // Components of move-only types move along with their entities, and moving
+    // does not copy the components that are left in place.
+    for (ecs::EntityIndex i = 0; i < 1000; i += 2) {
+        registry.AddComponent<A>({ 0, i }, { a_name_0 });
+    }
+    for (ecs::EntityIndex i = 0; i < 1000; i += 4) {
+        registry.RemoveComponent<A>({ 0, i });
+        registry.RemoveComponent<std::shared_ptr<int>>({ 0, i });
+    }
+    ASSERT_EQ(shared_value.use_count(), 751);
+    UniqueResource* unique_resource;
+    for (ecs::EntityIndex i = 0; i < 1000; ++i) {
+        ASSERT_TRUE(registry.GetComponent<UniqueResource>({ 0, i }, unique_resource));
+        ASSERT_EQ(*unique_resource->value, i);
+    }
+
+    for (ecs::EntityIndex i = 0; i < 1000; ++i) {
+        registry.UnregisterEntity({ 0, i });
+    }
+    ASSERT_EQ(shared_value.use_count(), 1);
+}
+
+TEST(ecs_test_suite, change_filter_test)
+{
+    ecs::Registry registry;
+    for (ecs::EntityIndex i = 0; i < 1000; ++i) {
+        const ecs::EntityID entity_id = { 0, i };
+        registry.RegisterEntity(entity_id);
+        registry.AddComponent<A>(entity_id, { a_name_0 });
+        registry.AddComponent<B>(entity_id, { b_name_0 });
+    }
+    ecs::Query<ecs::Changed<const A>, const B> changed_a_query;
+    ecs::Query<ecs::Changed<B>> changed_b_query;
+    ecs::Query<A> a_query;
+    registry.AddQuery(&changed_a_query);
+    registry.AddQuery(&changed_b_query);
+    registry.AddQuery(&a_query);
+
+    std::vector<ecs::EntityID> visited_entity_ids;
+    auto visit_changed_a = [&]() {
+        visited_entity_ids.clear();
+        changed_a_query.Each([&](ecs::EntityID entity_id, const A& a, const B& b) {
+            visited_entity_ids.push_back(entity_id);
+        });
+    };
+
+    // Everything is new to the first iteration, and nothing changed after it.
+    visit_changed_a();
+    ASSERT_EQ(visited_entity_ids.size(), 1000);
+    visit_changed_a();
+    ASSERT_EQ(visited_entity_ids.size(), 0);
+
+    // Only the chunk of a written component passes, and only once.
+    A* a;
+    const A* const_a;
+    ASSERT_TRUE(registry.GetComponent<const A>({ 0, 500 }, const_a));
+    visit_changed_a();
+    ASSERT_EQ(visited_entity_ids.size(), 0);
+    ASSERT_TRUE(registry.GetComponent({ 0, 500 }, a));
+    a->name = a_name_1;
+    visit_changed_a();
+    ASSERT_GT(visited_entity_ids.size(), 0);
+    ASSERT_LT(visited_entity_ids.size(), 1000);
+    ASSERT_NE(std::find(visited_entity_ids.begin(), visited_entity_ids.end(), ecs::EntityID{ 0, 500 }), visited_entity_ids.end());
+    visit_changed_a();
+    ASSERT_EQ(visited_entity_ids.size(), 0);
+
+    // Iterating with mutable access writes every chunk.
+    a_query.Each([](ecs::EntityID entity_id, A& a) {});
+    visit_changed_a();
+    ASSERT_EQ(visited_entity_ids.size(), 1000);
+
+    // A query does not see its own writes.
+    std::size_t changed_b_count = 0;
+    changed_b_query.EachChunk([&](const ecs::EntityID* entity_ids, std::size_t count, B* bs) {
+        changed_b_count += count;
+    });
+    ASSERT_EQ(changed_b_count, 1000);
+    changed_b_count = 0;
+    changed_b_query.EachChunk([&](const ecs::EntityID* entity_ids, std::size_t count, B* bs) {
+        changed_b_count += count;
+    });
+    ASSERT_EQ(changed_b_count, 0);
+
+    // Entities that move between archetypes count as changed.
+    registry.AddComponent<C>({ 0, 10 }, { c_name_0 });
+    visit_changed_a();
+    ASSERT_NE(std::find(visited_entity_ids.begin(), visited_entity_ids.end(), ecs::EntityID{ 0, 10 }), visited_entity_ids.end());
+
+    registry.RemoveQuery(&changed_a_query);
+    registry.RemoveQuery(&changed_b_query);
+    registry.RemoveQuery(&a_query);
+}
+
+TEST(ecs_test_suite, component_mask_test)
+{
+    ecs::ComponentMask mask_ab({ 1, 2 });
+    ecs::ComponentMask mask_abc({ 1, 2, 200 });
+    ASSERT_TRUE(mask_abc.Includes(mask_ab));
+    ASSERT_FALSE(mask_ab.Includes(mask_abc));
+    ASSERT_TRUE(mask_ab.Includes(ecs::ComponentMask()));
+    ASSERT_TRUE(mask_abc.Test(200));
+    ASSERT_FALSE(mask_abc.Test(3));
+    ASSERT_THROW(mask_ab.Set(ECS_COMPONENT_MASK_BITS), std::runtime_error);
+}
+
+class RecordingComponentSetEventsListener : public ecs::IComponentSetEventsListener
+{
+public:
+    std::vector<ecs::EntityID> entered_entity_ids;
+    std::vector<ecs::EntityID> exited_entity_ids;
+
+    void OnEnterComponentSupersetOf(ecs::EntityID entity_id, const ecs::ComponentSetIDs& component_set_ids) override
+    {
+        entered_entity_ids.push_back(entity_id);
+    }
+
+    void OnExitComponentSupersetOf(ecs::EntityID entity_id, const ecs::ComponentSetIDs& component_set_ids) override
+    {
+        exited_entity_ids.push_back(entity_id);
+    }
+};
+
+TEST(ecs_test_suite, component_set_events_test)
+{
+    ecs::Registry registry;
+    RecordingComponentSetEventsListener listener;
+    const ecs::ComponentSetIDs component_set_ids = registry.AddComponentSetEventsListener<A, B>(&listener);
+    for (ecs::EntityIndex i = 0; i < 3; ++i) {
+        registry.RegisterEntity({ 0, i });
+        registry.AddComponent<A>({ 0, i }, { a_name_0 });
+    }
+    ASSERT_TRUE(listener.entered_entity_ids.empty());
+
+    registry.AddComponent<B>({ 0, 0 }, { b_name_0 });
+    registry.AddComponent<B>({ 0, 1 }, { b_name_1 });
+    // Moving between archetypes that both have A and B is neither entering nor exiting.
+    registry.AddComponent<C>({ 0, 1 }, { c_name_1 });
+    const std::vector<ecs::EntityID> expected_entered_entity_ids = { { 0, 0 }, { 0, 1 } };
+    ASSERT_EQ(listener.entered_entity_ids, expected_entered_entity_ids);
+
+    registry.RemoveComponent<A>({ 0, 1 });
+    registry.UnregisterEntity({ 0, 0 });
+    const std::vector<ecs::EntityID> expected_exited_entity_ids = { { 0, 1 }, { 0, 0 } };
+    ASSERT_EQ(listener.exited_entity_ids, expected_exited_entity_ids);
+
+    registry.RemoveComponentSetEventsListener(component_set_ids, &listener);
+    registry.AddComponent<B>({ 0, 2 }, { b_name_2 });
+    ASSERT_EQ(listener.entered_entity_ids.size(), 2);
+}
+
+class RecordingComponentSetBatchEventsListener : public ecs::IComponentSetBatchEventsListener
+{
+public:
+    std::vector<std::vector<ecs::EntityID>> entered_batches;
+    std::vector<std::vector<ecs::EntityID>> exited_batches;
+
+    void OnEnterComponentSupersetOf(const ecs::EntityID* entity_ids, std::size_t count, const ecs::ComponentSetIDs& component_set_ids) override
+    {
+        entered_batches.emplace_back(entity_ids, entity_ids + count);
+    }
+
+    void OnExitComponentSupersetOf(const ecs::EntityID* entity_ids, std::size_t count, const ecs::ComponentSetIDs& component_set_ids) override
+    {
+        exited_batches.emplace_back(entity_ids, entity_ids + count);
+    }
+};
+
+TEST(ecs_test_suite, component_set_batch_events_test)
+{
+    ecs::Registry registry;
+    RecordingComponentSetBatchEventsListener listener;
+    const ecs::ComponentSetIDs component_set_ids = registry.AddComponentSetBatchEventsListener<A>(&listener);
+    std::vector<ecs::EntityID> entity_ids;
+    for (ecs::EntityIndex i = 0; i < 4; ++i) {
+        entity_ids.push_back({ 0, 3 - i });
+        registry.RegisterEntity(entity_ids.back());
+    }
+    registry.SpawnBatch<A>(entity_ids.data(), 3, [](std::size_t i, A& a) {});
+    // Adding and then removing within the same flush cancels out.
+    registry.AddComponent<A>({ 0, 0 }, { a_name_0 });
+    registry.UnregisterEntity({ 0, 0 });
+    ASSERT_TRUE(listener.entered_batches.empty());
+
+    registry.FlushComponentSetEvents();
+    const std::vector<std::vector<ecs::EntityID>> expected_entered_batches = { { { 0, 1 }, { 0, 2 }, { 0, 3 } } };
+    ASSERT_EQ(listener.entered_batches, expected_entered_batches);
+    ASSERT_TRUE(listener.exited_batches.empty());
+
+    // Removing and adding back is not reported either.
+    registry.RemoveComponent<A>({ 0, 1 });
+    registry.AddComponent<A>({ 0, 1 }, { a_name_1 });
+    registry.UnregisterEntity({ 0, 3 });
+    registry.FlushComponentSetEvents();
+    const std::vector<std::vector<ecs::EntityID>> expected_exited_batches = { { { 0, 3 } } };
+    ASSERT_EQ(listener.exited_batches, expected_exited_batches);
+    ASSERT_EQ(listener.entered_batches.size(), 1);
+
+    // Command buffer playback flushes the events.
+    ecs::CommandBuffer command_buffer;
+    command_buffer.UnregisterEntity({ 0, 1 });
+    command_buffer.UnregisterEntity({ 0, 2 });
+    command_buffer.Playback(registry);
+    ASSERT_EQ(listener.exited_batches.size(), 2);
+    ASSERT_EQ(listener.exited_batches[1].size(), 2);
+
+    registry.RemoveComponentSetBatchEventsListener(component_set_ids, &listener);
+    registry.RegisterEntity({ 1, 0 });
+    registry.AddComponent<A>({ 1, 0 }, { a_name_0 });
+    registry.FlushComponentSetEvents();
+    ASSERT_EQ(listener.entered_batches.size(), 1);
+}
+
+struct RegisteredLate
+{
+    std::string name;
+};
+
+TEST(ecs_test_suite, component_type_registry_test)
+{
+    ecs::ComponentTypeRegistry& component_type_registry = ecs::ComponentTypeRegistry::Shared();
+    // The ids of the core component types are reserved first.
+    ASSERT_GE(ecs::ComponentTypeRegistry::TypeIDOf<A>(), 3);
+
+    // Ids are dense, and the same on every thread.
+    std::vector<ecs::ComponentTypeID> thread_component_types(8, ecs::kNoComponentTypeID);
+    ThreadPool thread_pool(3);
+    thread_pool.ParallelFor(thread_component_types.size(), [&thread_component_types](std::size_t i) {
+        thread_component_types[i] = ecs::ComponentTypeRegistry::TypeIDOf<RegisteredLate>();
+    });
+    const ecs::ComponentTypeID component_type = ecs::ComponentTypeRegistry::TypeIDOf<RegisteredLate>();
+    ASSERT_LT(component_type, component_type_registry.TypeCount());
+    for (ecs::ComponentTypeID thread_component_type : thread_component_types) {
+        ASSERT_EQ(thread_component_type, component_type);
+    }
+    ASSERT_NE(ecs::ComponentTypeRegistry::TypeIDOf<A>(), component_type);
+
+    const ecs::ComponentTypeInfo& info = component_type_registry.TypeInfo(component_type);
+    ASSERT_EQ(info.size, sizeof(RegisteredLate));
+    ASSERT_EQ(info.alignment, alignof(RegisteredLate));
+    ASSERT_FALSE(info.is_trivially_relocatable);
+    ASSERT_TRUE(ecs::ComponentTypeRegistry::TypeInfoOf<float>().is_trivially_relocatable);
+
+    // Relocating moves the components and destroys the sources.
+    alignas(RegisteredLate) unsigned char source[2 * sizeof(RegisteredLate)];
+    alignas(RegisteredLate) unsigned char destination[2 * sizeof(RegisteredLate)];
+    RegisteredLate* source_components = reinterpret_cast<RegisteredLate*>(source);
+    new (source_components) RegisteredLate{ a_name_0 };
+    new (source_components + 1) RegisteredLate{ a_name_1 };
+    info.relocate(destination, source, 2);
+    RegisteredLate* destination_components = reinterpret_cast<RegisteredLate*>(destination);
+    ASSERT_EQ(destination_components[0].name, a_name_0);
+    ASSERT_EQ(destination_components[1].name, a_name_1);
+    info.destroy(destination, 2);
+}
+
+TEST(ecs_test_suite, entity_allocator_test)
+{
+    ecs::EntityAllocator entity_allocator;
+    std::vector<ecs::EntityID> entity_ids(100);
+    entity_allocator.AllocateBatch(entity_ids.data(), entity_ids.size());
+    for (std::size_t i = 0; i < entity_ids.size(); ++i) {
+        ASSERT_EQ(entity_ids[i].index, i);
+        ASSERT_EQ(entity_ids[i].version, 0);
+        ASSERT_TRUE(entity_allocator.IsAlive(entity_ids[i]));
+    }
+
+    // Freed indices are reused with a new version, so stale ids stay dead.
+    entity_allocator.FreeBatch(entity_ids.data() + 10, 20);
+    entity_allocator.Free(entity_ids[50]);
+    ASSERT_FALSE(entity_allocator.IsAlive(entity_ids[10]));
+    ASSERT_FALSE(entity_allocator.IsAlive(entity_ids[50]));
+    ASSERT_TRUE(entity_allocator.IsAlive(entity_ids[30]));
+    std::vector<ecs::EntityID> reused_entity_ids(25);
+    entity_allocator.AllocateBatch(reused_entity_ids.data(), reused_entity_ids.size());
+    ASSERT_EQ(entity_allocator.Capacity(), 104);
+    for (const ecs::EntityID& entity_id : reused_entity_ids) {
+        ASSERT_TRUE(entity_allocator.IsAlive(entity_id));
+        if (entity_id.index < entity_ids.size()) {
+            ASSERT_EQ(entity_id.version, 1);
+            ASSERT_FALSE(entity_allocator.IsAlive(entity_ids[entity_id.index]));
+        }
+    }
+    ASSERT_EQ(reused_entity_ids[0], (ecs::EntityID{ 1, 50 }));
+
+    // Worker threads reserve ids that become alive at playback.
+    entity_allocator.FreeBatch(reused_entity_ids.data(), 10);
+    ecs::Registry registry;
+    ecs::CommandBuffer command_buffer;
+    const std::size_t reserved_count = 1000;
+    std::vector<ecs::EntityID> reserved_entity_ids(reserved_count);
+    ThreadPool thread_pool(3);
+    thread_pool.ParallelFor(reserved_count, [&](std::size_t i) {
+        reserved_entity_ids[i] = command_buffer.RegisterNewEntity(entity_allocator);
+        command_buffer.AddComponent<A>(reserved_entity_ids[i], { std::to_string(i) });
+    });
+    ASSERT_TRUE(entity_allocator.HasPendingReservations());
+    for (const ecs::EntityID& entity_id : reserved_entity_ids) {
+        ASSERT_FALSE(entity_allocator.IsAlive(entity_id));
+    }
+    command_buffer.Playback(registry, entity_allocator);
+    ASSERT_FALSE(entity_allocator.HasPendingReservations());
+    ASSERT_EQ(entity_allocator.Capacity(), 104 + reserved_count - 10);
+
+    std::vector<ecs::EntityIndex> reserved_indices;
+    A* a;
+    for (std::size_t i = 0; i < reserved_count; ++i) {
+        ASSERT_TRUE(entity_allocator.IsAlive(reserved_entity_ids[i]));
+        ASSERT_TRUE(registry.GetComponent(reserved_entity_ids[i], a));
+        ASSERT_EQ(a->name, std::to_string(i));
+        reserved_indices.push_back(reserved_entity_ids[i].index);
+    }
+    std::sort(reserved_indices.begin(), reserved_indices.end());
+    ASSERT_TRUE(std::unique(reserved_indices.begin(), reserved_indices.end()) == reserved_indices.end());
+}
+
+struct Disabled
+{
+    std::string reason;
+};
+
+ECS_SPARSE_SET_COMPONENT(Disabled)
+
+TEST(ecs_test_suite, sparse_set_component_test)
+{
+    ecs::Registry registry;
+    ecs::Query<const A, Disabled> disabled_query;
+    registry.AddQuery(&disabled_query);
+    const std::size_t entity_count = 10000;
+    for (std::size_t i = 0; i < entity_count; ++i) {
+        const ecs::EntityID entity_id = { 0, (ecs::EntityIndex)i };
+        registry.RegisterEntity(entity_id);
+        registry.AddComponent<A>(entity_id, { std::to_string(i) });
+    }
+    ecs::Archetype* archetype = registry.ArchetypeOfEntity({ 0, 0 });
+
+    // Toggling a sparse set component leaves the entity in its archetype.
+    for (std::size_t i = 0; i < entity_count; i += 3) {
+        registry.AddComponent<Disabled>({ 0, (ecs::EntityIndex)i }, { std::to_string(i) });
+    }
+    ASSERT_THROW(registry.AddComponent<Disabled>({ 0, 0 }, { "" }), std::runtime_error);
+    registry.RemoveComponent<Disabled>({ 0, 3 });
+    ASSERT_THROW(registry.RemoveComponent<Disabled>({ 0, 3 }), std::runtime_error);
+    ASSERT_EQ(registry.ArchetypeOfEntity({ 0, 0 }), archetype);
+    ASSERT_EQ(archetype->EntityCount(), entity_count);
+    ASSERT_EQ(archetype->ComponentSetIDs().size(), 1);
+
+    Disabled* disabled;
+    A* a;
+    ASSERT_TRUE(registry.GetComponent({ 0, 6 }, disabled));
+    ASSERT_EQ(disabled->reason, "6");
+    ASSERT_FALSE(registry.GetComponent({ 0, 3 }, disabled));
+    ASSERT_FALSE(registry.GetComponent({ 1, 6 }, disabled));
+    ASSERT_TRUE(registry.GetComponentSet({ 0, 9 }, a, disabled));
+    ASSERT_EQ(a->name, disabled->reason);
+
+    // Queries join the sparse set with the archetype components.
+    std::size_t joined_count = 0;
+    disabled_query.Each([&joined_count](ecs::EntityID entity_id, const A& a, Disabled& disabled) {
+        ASSERT_EQ(a.name, disabled.reason);
+        ASSERT_EQ(entity_id.index % 3, 0);
+        disabled.reason = "joined";
+        joined_count++;
+    });
+    ASSERT_EQ(joined_count, (entity_count + 2) / 3 - 1);
+    ASSERT_EQ(disabled_query.EntityCount(), joined_count);
+    std::size_t registry_joined_count = 0;
+    registry.Each<const Disabled, const A>([&registry_joined_count](ecs::EntityID entity_id, const Disabled& disabled, const A& a) {
+        ASSERT_EQ(disabled.reason, "joined");
+        registry_joined_count++;
+    });
+    ASSERT_EQ(registry_joined_count, joined_count);
+
+    // Entities with only sparse set components have no archetype, and
+    // unregistering an entity destroys its sparse set components.
+    const ecs::EntityID lone_entity_id = { 0, (ecs::EntityIndex)entity_count };
+    registry.RegisterEntity(lone_entity_id);
+    registry.AddComponent<Disabled>(lone_entity_id, { "lone" });
+    ASSERT_EQ(registry.ArchetypeOfEntity(lone_entity_id), nullptr);
+    ASSERT_EQ(disabled_query.EntityCount(), joined_count);
+    registry.UnregisterEntity({ 0, 6 });
+    registry.UnregisterEntity(lone_entity_id);
+    ASSERT_FALSE(registry.GetComponent({ 0, 6 }, disabled));
+    ASSERT_EQ(disabled_query.EntityCount(), joined_count - 1);
+
+    registry.RemoveQuery(&disabled_query);
+}
+
+struct SharedMaterial
+{
+    std::string name;
+
+    bool operator==(const SharedMaterial& other) const
+    {
+        return name == other.name;
+    }
+};
+
+ECS_SHARED_COMPONENT(SharedMaterial)
+
+TEST(ecs_test_suite, shared_component_test)
+{
+    ecs::Registry registry;
+    ecs::Query<A, const SharedMaterial> query;
+    registry.AddQuery(&query);
+    const std::size_t entity_count = 300;
+    std::vector<ecs::EntityID> entity_ids;
+    for (std::size_t i = 0; i < entity_count; ++i) {
+        const ecs::EntityID entity_id = { 0, (ecs::EntityIndex)i };
+        registry.RegisterEntity(entity_id);
+        registry.AddComponent<A>(entity_id, { std::to_string(i) });
+        entity_ids.push_back(entity_id);
+    }
+
+    // Equal values are stored once, and the entities sharing a value share an archetype.
+    for (std::size_t i = 0; i < entity_count; ++i) {
+        registry.SetSharedComponent<SharedMaterial>(entity_ids[i], { i % 3 == 0 ? "wood" : "stone" });
+    }
+    ASSERT_EQ(registry.SharedComponentValueCount(), 2);
+    ASSERT_EQ(query.MatchedArchetypes().size(), 2);
+    for (ecs::Archetype* archetype : query.MatchedArchetypes()) {
+        ASSERT_EQ(archetype->ComponentSetIDs().size(), 1);
+        ASSERT_EQ(archetype->EntityCount(), archetype->GetSharedComponent<SharedMaterial>()->name == "wood" ? 100 : 200);
+    }
+    const SharedMaterial* material = nullptr;
+    A* a = nullptr;
+    ASSERT_TRUE(registry.GetComponentSet({ 0, 3 }, a, material));
+    ASSERT_EQ(a->name, "3");
+    ASSERT_EQ(material->name, "wood");
+
+    // Iterations pass the value for every entity, and a pointer to it for every chunk.
+    std::size_t enumerated_count = 0;
+    query.Each([&enumerated_count](ecs::EntityID entity_id, A& a, const SharedMaterial& material) {
+        ASSERT_EQ(a.name, std::to_string(entity_id.index));
+        ASSERT_EQ(material.name, entity_id.index % 3 == 0 ? "wood" : "stone");
+        enumerated_count++;
+    });
+    ASSERT_EQ(enumerated_count, entity_count);
+    query.EachChunk([](const ecs::EntityID* entity_ids, std::size_t count, A* a, const SharedMaterial* material) {
+        for (std::size_t i = 0; i < count; ++i) {
+            ASSERT_EQ(material->name, entity_ids[i].index % 3 == 0 ? "wood" : "stone");
+        }
+    });
+
+    // Adding and removing components keeps the shared components, even once
+    // no other components are left.
+    registry.AddComponent<B>({ 0, 0 }, { b_name_0 });
+    ASSERT_EQ(query.MatchedArchetypes().size(), 3);
+    registry.RemoveComponent<A>({ 0, 0 });
+    registry.RemoveComponent<B>({ 0, 0 });
+    ASSERT_NE(registry.ArchetypeOfEntity({ 0, 0 }), nullptr);
+    ASSERT_TRUE(registry.GetComponent({ 0, 0 }, material));
+    ASSERT_EQ(material->name, "wood");
+    registry.RemoveSharedComponent<SharedMaterial>({ 0, 0 });
+    ASSERT_EQ(registry.ArchetypeOfEntity({ 0, 0 }), nullptr);
+
+    // Values are destroyed along with the last archetype that uses them.
+    registry.SetSharedComponentBatch<SharedMaterial>(entity_ids.data() + 1, entity_count - 1, { "glass" });
+    ASSERT_EQ(registry.SharedComponentValueCount(), 1);
+    ASSERT_EQ(query.MatchedArchetypes().size(), 1);
+    ASSERT_EQ(query.EntityCount(), entity_count - 1);
+    registry.RemoveSharedComponentBatch<SharedMaterial>(entity_ids.data() + 1, entity_count - 1);
+    ASSERT_EQ(registry.SharedComponentValueCount(), 0);
+    ASSERT_EQ(query.MatchedArchetypes().size(), 0);
+    ASSERT_TRUE(registry.GetComponent({ 0, 1 }, a));
+    ASSERT_EQ(a->name, "1");
+
+    registry.RemoveQuery(&query);
+}
+
+TEST(ecs_test_suite, compaction_test)
+{
+    ecs::Registry registry;
+    ecs::ArchetypeRetentionPolicy retention_policy;
+    retention_policy.max_empty_archetype_count = 4;
+    retention_policy.max_idle_compaction_count = 1;
+    registry.SetArchetypeRetentionPolicy(retention_policy);
+    ecs::Query<const A> query;
+    registry.AddQuery(&query);
+
+    // Empty archetypes are kept and reused.
+    const ecs::EntityID entity_id = { 0, 0 };
+    registry.RegisterEntity(entity_id);
+    registry.AddComponent<A>(entity_id, { a_name_0 });
+    ecs::Archetype* archetype_a = registry.ArchetypeOfEntity(entity_id);
+    registry.AddComponent<B>(entity_id, { b_name_0 });
+    ASSERT_EQ(archetype_a->EntityCount(), 0);
+    ASSERT_EQ(query.MatchedArchetypes().size(), 2);
+    registry.RemoveComponent<B>(entity_id);
+    ASSERT_EQ(registry.ArchetypeOfEntity(entity_id), archetype_a);
+
+    // Archetypes outliving the retention policy are destroyed by compaction.
+    registry.UnregisterEntity(entity_id);
+    ASSERT_EQ(registry.Compact().destroyed_archetype_count, 0);
+    ASSERT_EQ(query.MatchedArchetypes().size(), 2);
+    ASSERT_EQ(registry.Compact().destroyed_archetype_count, 2);
+    ASSERT_EQ(query.MatchedArchetypes().size(), 0);
+
+    // Interleave the chunks of three archetypes over several slabs, then
+    // empty two of them, so that the chunks of the third are scattered.
+    ecs::ChunkPool& chunk_pool = ecs::ChunkPool::Shared();
+    std::vector<ecs::EntityID> removed_entity_ids;
+    std::size_t entity_count = 0;
+    while (chunk_pool.AllocatedChunkCount() < 3 * ECS_CHUNKS_PER_SLAB) {
+        for (std::size_t i = 0; i < 64; ++i, ++entity_count) {
+            const ecs::EntityID interleaved_entity_id = { 0, (ecs::EntityIndex)entity_count };
+            registry.RegisterEntity(interleaved_entity_id);
+            registry.AddComponent<A>(interleaved_entity_id, { std::to_string(entity_count) });
+            if (entity_count % 3 == 1) {
+                registry.AddComponent<B>(interleaved_entity_id, { "" });
+            }
+            else if (entity_count % 3 == 2) {
+                registry.AddComponent<C>(interleaved_entity_id, { "" });
+            }
+            if (entity_count % 3 != 0) {
+                removed_entity_ids.push_back(interleaved_entity_id);
+            }
+        }
+    }
+    registry.UnregisterEntityBatch(removed_entity_ids.data(), removed_entity_ids.size());
+    const std::size_t reserved_chunk_count = chunk_pool.ReservedChunkCount();
+    const ecs::CompactionReport report = registry.Compact();
+    ASSERT_GT(report.moved_chunk_count, 0);
+    ASSERT_GE(report.released_slab_bytes, ECS_CHUNK_SIZE * ECS_CHUNKS_PER_SLAB);
+    ASSERT_LT(chunk_pool.ReservedChunkCount(), reserved_chunk_count);
+    ASSERT_LT(chunk_pool.ReservedChunkCount(), chunk_pool.AllocatedChunkCount() + 2 * ECS_CHUNKS_PER_SLAB);
+
+    // The moved components are intact.
+    std::size_t enumerated_count = 0;
+    query.Each([&enumerated_count](ecs::EntityID entity_id, const A& a) {
+        ASSERT_EQ(a.name, std::to_string(entity_id.index));
+        enumerated_count++;
+    });
+    ASSERT_EQ(enumerated_count, (entity_count + 2) / 3);
+    A* a;
+    ASSERT_TRUE(registry.GetComponent({ 0, 3 }, a));
+    ASSERT_EQ(a->name, "3");
+
+    registry.RemoveQuery(&query);
+}
@@ -2,20 +2,14 @@
 
 #include <core/geometry/bounds.h>
 
-#include "../mesh.h"
-#include "../material.h"
+#include "render_mesh_component.h"
 
+// Entities are drawn with the mesh and material of their RenderMeshComponent.
 struct MeshRenderableComponent
 {
 	bool disabled;
 
-	// Mesh that is potentially shared by several MeshRenderables
-	std::shared_ptr<Mesh> mesh;
-
-	// Material that is potentially shared by several MeshRenderables
-	std::shared_ptr<Material> material;
-
-	const geometry::Bounds& WorldMeshBounds() {
+	const geometry::Bounds& WorldMeshBounds() const {
 		return world_mesh_bounds_;
 	}
 
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <memory>
+
+#include <core/ecs/component_storage.h>
+
+#include "../mesh.h"
+#include "../material.h"
+
+/*
+* Mesh and material that a MeshRenderableComponent is drawn with. Shared, so
+* every distinct pair is stored once, and the entities drawn with the same
+* pair are stored together in ECS storage, where renderers find them as
+* ready-made batches.
+*/
+struct RenderMeshComponent
+{
+	std::shared_ptr<Mesh> mesh;
+
+	std::shared_ptr<Material> material;
+
+	bool operator==(const RenderMeshComponent& other) const {
+		return mesh == other.mesh && material == other.material;
+	}
+};
+
+ECS_SHARED_COMPONENT(RenderMeshComponent)
@@ -1,8 +1,8 @@
 
 #include "opengl_renderer.h"
 
+#include <algorithm>
 #include <string>
-#include <map>
 
 #include <glm/gtc/type_ptr.hpp>
 
@@ -32,7 +32,7 @@ void OpenGLRenderer::PreloadRenderingPipeline(const std::shared_ptr<RenderingPip
 	pipeline->AddLifecycleEventsListener(this);
 }
 
-void OpenGLRenderer::RenderFrame(const CameraParams& camera_params, const std::vector<RenderableObject>& renderable_objects) {
+void OpenGLRenderer::RenderFrame(const CameraParams& camera_params, const std::vector<RenderableBatch>& renderable_batches, const std::vector<RenderableObject>& renderable_objects) {
 	// TODO: using camera viewport rect value to set this.
 	glViewport(
 		(GLint)camera_params.viewport_rect.origin.x,
@@ -42,50 +42,45 @@ void OpenGLRenderer::RenderFrame(const CameraParams& camera_params, const std::v
 	);
 	glClear(GL_COLOR_BUFFER_BIT);
 
-	std::map<RenderableObjectBatchKey, RenderableObjectBatch> sorted_renderable_batches;
-	for (RenderableObject renderable_object : renderable_objects) {
-		const std::shared_ptr<RenderingPipeline>& pipeline = renderable_object.mesh->GetPipeline();
+	// The objects come batched by mesh and material, so only the batches are
+	// sorted to minimize state changes.
+	sorted_renderable_batches_.clear();
+	for (const RenderableBatch& renderable_batch : renderable_batches) {
+		const std::shared_ptr<RenderingPipeline>& pipeline = renderable_batch.mesh->GetPipeline();
 
 		if (pipeline_state_map_.find(pipeline.get()) == pipeline_state_map_.end()) {
 			pipeline_state_map_[pipeline.get()] = CreatePipelineState(pipeline);
 			pipeline->AddLifecycleEventsListener(this);
 		}
 
-		if (mesh_state_map_.find(renderable_object.mesh) == mesh_state_map_.end()) {
-			mesh_state_map_[renderable_object.mesh] = CreateMeshState(renderable_object.mesh);
-			renderable_object.mesh->AddLifecycleEventsListener(this);
+		if (mesh_state_map_.find(renderable_batch.mesh) == mesh_state_map_.end()) {
+			mesh_state_map_[renderable_batch.mesh] = CreateMeshState(renderable_batch.mesh);
+			renderable_batch.mesh->AddLifecycleEventsListener(this);
 		}
 
-		if (material_state_map_.find(renderable_object.material) == material_state_map_.end()) {
-			material_state_map_[renderable_object.material] = CreateMaterialState(renderable_object.material);
-			renderable_object.material->AddLifecycleEventsListener(this);
+		if (material_state_map_.find(renderable_batch.material) == material_state_map_.end()) {
+			material_state_map_[renderable_batch.material] = CreateMaterialState(renderable_batch.material);
+			renderable_batch.material->AddLifecycleEventsListener(this);
 		}
 
 		const RenderableObjectBatchKey batch_key = {
 			pipeline.get(),
-			renderable_object.mesh,
-			renderable_object.material
+			renderable_batch.mesh,
+			renderable_batch.material
 		};
-
-		std::map<RenderableObjectBatchKey, RenderableObjectBatch>::iterator it = sorted_renderable_batches.find(batch_key);
-		if (it == sorted_renderable_batches.end()) {
-			const RenderableObjectBatch batch = { renderable_object.mesh, renderable_object.material, { {renderable_object.model_matrix, renderable_object.bones} } };
-			sorted_renderable_batches.insert({ batch_key, batch });
-		}
-		else {
-			it->second.instances.push_back({ renderable_object.model_matrix, renderable_object.bones });
-		}
+		sorted_renderable_batches_.push_back({ batch_key, &renderable_batch });
 	}
+	std::sort(sorted_renderable_batches_.begin(), sorted_renderable_batches_.end(), [](const SortedRenderableBatch& a, const SortedRenderableBatch& b) {
+		return a.key < b.key;
+	});
 
 	const glm::mat4 vp = camera_params.view_projection_matrix;
 	GLint mvp_location = 0;
 	GLuint index_buffer = 0;
 	RenderableObjectBatchKey previous_batch_key = { 0, 0, 0 };
-	for (std::map<RenderableObjectBatchKey, RenderableObjectBatch>::iterator it = sorted_renderable_batches.begin();
-		it != sorted_renderable_batches.end();
-		it++) {
-		RenderableObjectBatchKey current_batch_key = it->first;
-		RenderableObjectBatch batch = it->second;
+	for (const SortedRenderableBatch& sorted_batch : sorted_renderable_batches_) {
+		const RenderableObjectBatchKey& current_batch_key = sorted_batch.key;
+		const RenderableBatch& batch = *sorted_batch.batch;
 		//GLint bones_location;
 		if (current_batch_key.pipeline_handle != previous_batch_key.pipeline_handle) {
 			// Switch rendering pipeline configuration
@@ -114,8 +109,9 @@ void OpenGLRenderer::RenderFrame(const CameraParams& camera_params, const std::v
 		}
 
 		// Iterate over instances of mesh and draw each after transforming (and optionally setting bones).
-		for (RenderableObjectInstance& renderable_object_instance : batch.instances) {
-			const glm::mat4 mvp = vp * renderable_object_instance.model_transform;
+		for (std::size_t o_idx = batch.first_object_index; o_idx < batch.first_object_index + batch.object_count; ++o_idx) {
+			const RenderableObject& renderable_object = renderable_objects[o_idx];
+			const glm::mat4 mvp = vp * renderable_object.model_matrix;
 			// Set MVP matrix in shader.
 			glUniformMatrix4fv(mvp_location, 1, GL_FALSE, glm::value_ptr(mvp));
 			/*
@@ -123,9 +119,9 @@ void OpenGLRenderer::RenderFrame(const CameraParams& camera_params, const std::v
 				// Set bones array in shader.
 				glUniformMatrix4fv(
 					bones_location,
-					renderable_object_instance.bone_transforms.size(),
+					renderable_object.bones.size(),
 					GL_FALSE,
-					reinterpret_cast<const GLfloat*>(renderable_object_instance.bone_transforms.data())
+					reinterpret_cast<const GLfloat*>(renderable_object.bones.data())
 				);
 			}
 			*/
@@ -28,7 +28,7 @@ public:
 
 	void PreloadRenderingPipeline(const std::shared_ptr<RenderingPipeline>& pipeline) override;
 
-	void RenderFrame(const CameraParams& camera_params, const std::vector<RenderableObject>& renderable_objects) override;
+	void RenderFrame(const CameraParams& camera_params, const std::vector<RenderableBatch>& renderable_batches, const std::vector<RenderableObject>& renderable_objects) override;
 
 	void Cleanup() override;
 
@@ -51,15 +51,9 @@ private:
 		}
 	};
 
-	struct RenderableObjectInstance {
-		glm::mat4 model_transform;
-		std::vector<glm::mat4> bone_transforms;
-	};
-
-	struct RenderableObjectBatch {
-		Mesh* mesh;
-		Material* material;
-		std::vector<RenderableObjectInstance> instances;
+	struct SortedRenderableBatch {
+		RenderableObjectBatchKey key;
+		const RenderableBatch* batch;
 	};
 
 	struct PipelineState {
@@ -93,7 +87,10 @@ private:
 
 	std::unordered_map<PipelineHandle, PipelineState> pipeline_state_map_;
 	std::unordered_map<MeshHandle, MeshState> mesh_state_map_;
-	std::unordered_map<MaterialHandle, MaterialState> material_state_map_;	
+	std::unordered_map<MaterialHandle, MaterialState> material_state_map_;
+
+	// Reused every frame to sort the batches by pipeline, mesh and material.
+	std::vector<SortedRenderableBatch> sorted_renderable_batches_;
 
 
 	// PipelineLifecycleEventsListener
@@ -1,10 +1,14 @@
 
 #include "mesh_transformation_system.h"
 
+#include <algorithm>
+#include <functional>
+
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/string_cast.hpp>
 
 #include <core/transform/transform.h>
+#include <core/utils/thread_pool.h>
 
 #include "../rendering_pipeline.h"
 
@@ -17,21 +21,23 @@ void MeshTransformationSystem::Initialize(ServiceContainer service_container) {
 		// TODO: Throw error.
 	}
 
-	mesh_transform_component_set_ = component_registry_->AddComponentSetEventsListener<MeshRenderableComponent>(this);
+	mesh_transform_component_set_ = component_registry_->AddComponentSetBatchEventsListener<MeshRenderableComponent>(this);
+	component_registry_->AddQuery(&mesh_renderables_query_);
 }
 
 void MeshTransformationSystem::Cleanup(ServiceContainer service_container) {
-	component_registry_->RemoveComponentSetEventsListener(mesh_transform_component_set_, this);
+	component_registry_->RemoveComponentSetBatchEventsListener(mesh_transform_component_set_, this);
+	component_registry_->RemoveQuery(&mesh_renderables_query_);
 }
 
 void MeshTransformationSystem::OnFrameUpdate(double delta_time, double alpha)
 {
-	// Iterate through mesh renderables and calculate world mesh bounds
-	std::function<void(ecs::EntityID, MeshRenderableComponent&)> mesh_renderables_block =
-		[this](ecs::EntityID entity_id, MeshRenderableComponent& mesh_rend) {
+	// Iterate through mesh renderables and find the ones with stale world mesh
+	// bounds. This updates the shared mesh -> entities mapping, so it is serial.
+	stale_mesh_bounds_.clear();
+	mesh_renderables_query_.Each([this](ecs::EntityID entity_id, MeshRenderableComponent& mesh_rend, const RenderMeshComponent& render_mesh) {
 		if (!mesh_rend.disabled) {
-			std::shared_ptr<Mesh> mesh = mesh_rend.mesh;
-			Mesh* mesh_handle = mesh.get();
+			Mesh* mesh_handle = render_mesh.mesh.get();
 
 			std::unordered_map<ecs::EntityIndex, MeshTransformationState>::iterator mesh_trans_state_iter = entity_mesh_trans_state_map_.find(entity_id.index);
 			if (mesh_trans_state_iter == entity_mesh_trans_state_map_.end()) {
@@ -40,59 +46,84 @@ void MeshTransformationSystem::OnFrameUpdate(double delta_time, double alpha)
 			}
 
 			Mesh* previous_mesh_handle = mesh_trans_state_iter->second.mesh_handle;
+			bool is_stale = mesh_trans_state_iter->second.is_stale;
 			if (mesh_handle != previous_mesh_handle) {
 				// This entity has changed meshes since the last update
 
-				// Remove entity from previous mesh -> entities mapping.
-				RemoveEntityFromMesh2EntitiesMapping(entity_id, previous_mesh_handle);
+				if (previous_mesh_handle) {
+					// Remove entity from previous mesh -> entities mapping.
+					RemoveEntityFromMesh2EntitiesMapping(entity_id, previous_mesh_handle);
+				}
 
 				if (mesh_handle) {
 					// Add entity to new mesh -> entities mapping.
 					AddEntityToMesh2EntitiesMapping(entity_id, mesh_handle);
-
-					// Calculate the mesh bounds in world space
-					if (mesh_rend.mesh->GetVertexPositions().size() > 0) {
-						RecalculateMeshBounds(entity_id, mesh_rend);
-					}
 				}
+				is_stale = true;
 			}
 
-			entity_mesh_trans_state_map_[entity_id.index] = { mesh_handle, false };
-		}
-	};
+			if (is_stale && mesh_handle && mesh_handle->GetVertexPositions().size() > 0) {
+				stale_mesh_bounds_.push_back({ entity_id, &mesh_rend, mesh_handle });
+			}
 
-	component_registry_->EnumerateComponentsWithBlock<MeshRenderableComponent>(mesh_renderables_block);
+			mesh_trans_state_iter->second = { mesh_handle, false };
+		}
+	});
+
+	// Calculate the mesh bounds in world space. Every entity only writes its own
+	// component and reads world transforms, so this runs in parallel.
+	const std::size_t entities_per_task = 64;
+	const std::size_t task_count = (stale_mesh_bounds_.size() + entities_per_task - 1) / entities_per_task;
+	ThreadPool::Shared().ParallelFor(task_count, [this, entities_per_task](std::size_t task_index) {
+		const std::size_t end = std::min((task_index + 1) * entities_per_task, stale_mesh_bounds_.size());
+		for (std::size_t i = task_index * entities_per_task; i < end; ++i) {
+			RecalculateMeshBounds(stale_mesh_bounds_[i].entity_id, *stale_mesh_bounds_[i].mesh_rend, *stale_mesh_bounds_[i].mesh);
+		}
+	});
 }
 
-#pragma region ecs::IComponentSetEventsListener
+#pragma region ecs::IComponentSetBatchEventsListener
 
-void MeshTransformationSystem::OnEnterComponentSupersetOf(ecs::EntityID entity_id, const ecs::ComponentSetIDs component_set_ids) {
-	MeshRenderableComponent* mesh_rend;
-	if (!component_registry_->GetComponent<MeshRenderableComponent>(entity_id, mesh_rend)) {
-		return;
+void MeshTransformationSystem::OnEnterComponentSupersetOf(const ecs::EntityID* entity_ids, std::size_t count, const ecs::ComponentSetIDs& component_set_ids) {
+	// Entered entities start without a mesh, so the next frame update adds them
+	// to the mesh -> entities mapping and calculates their bounds in parallel.
+	entity_mesh_trans_state_map_.reserve(entity_mesh_trans_state_map_.size() + count);
+	for (std::size_t i = 0; i < count; ++i) {
+		entity_mesh_trans_state_map_[entity_ids[i].index] = { nullptr, true };
 	}
+}
 
-	Mesh* mesh_handle = mesh_rend->mesh.get();
-	if (mesh_handle) {
-		AddEntityToMesh2EntitiesMapping(entity_id, mesh_handle);
-		if (mesh_rend->mesh->GetVertexPositions().size() > 0) {
-			RecalculateMeshBounds(entity_id, *mesh_rend);
+void MeshTransformationSystem::OnExitComponentSupersetOf(const ecs::EntityID* entity_ids, std::size_t count, const ecs::ComponentSetIDs& component_set_ids) {
+	std::vector<MeshEntity> exited_mesh_entities;
+	exited_mesh_entities.reserve(count);
+	for (std::size_t i = 0; i < count; ++i) {
+		std::unordered_map<ecs::EntityIndex, MeshTransformationState>::iterator mesh_trans_state_iter = entity_mesh_trans_state_map_.find(entity_ids[i].index);
+		if (mesh_trans_state_iter == entity_mesh_trans_state_map_.end()) {
+			continue;
+		}
+		if (mesh_trans_state_iter->second.mesh_handle) {
+			exited_mesh_entities.push_back({ mesh_trans_state_iter->second.mesh_handle, entity_ids[i] });
 		}
+		entity_mesh_trans_state_map_.erase(mesh_trans_state_iter);
 	}
 
-	entity_mesh_trans_state_map_[entity_id.index] = { mesh_handle, false };
-}
-
-void MeshTransformationSystem::OnExitComponentSupersetOf(ecs::EntityID entity_id, const ecs::ComponentSetIDs component_set_ids) {
-	MeshRenderableComponent* _;
-	if (!component_registry_->GetComponent<MeshRenderableComponent>(entity_id, _)) {
-		return;
+	// Remove the exited entities of every mesh in a single pass over its entities.
+	// Entities arrive in order, and the stable sort keeps them in order per mesh.
+	std::stable_sort(exited_mesh_entities.begin(), exited_mesh_entities.end(), [](const MeshEntity& a, const MeshEntity& b) {
+		return std::less<Mesh*>()(a.mesh_handle, b.mesh_handle);
+	});
+	std::vector<ecs::EntityID> removed_entity_ids;
+	std::size_t run_begin = 0;
+	while (run_begin < exited_mesh_entities.size()) {
+		Mesh* mesh_handle = exited_mesh_entities[run_begin].mesh_handle;
+		removed_entity_ids.clear();
+		std::size_t run_end = run_begin;
+		for (; run_end < exited_mesh_entities.size() && exited_mesh_entities[run_end].mesh_handle == mesh_handle; ++run_end) {
+			removed_entity_ids.push_back(exited_mesh_entities[run_end].entity_id);
+		}
+		RemoveEntitiesFromMesh2EntitiesMapping(removed_entity_ids, mesh_handle);
+		run_begin = run_end;
 	}
-
-	Mesh* mesh_handle = entity_mesh_trans_state_map_[entity_id.index].mesh_handle;
-	entity_mesh_trans_state_map_.erase(entity_id.index);
-
-	RemoveEntityFromMesh2EntitiesMapping(entity_id, mesh_handle);
 }
 
 #pragma endregion
@@ -143,13 +174,23 @@ void MeshTransformationSystem::AddEntityToMesh2EntitiesMapping(ecs::EntityID ent
 #pragma endregion
 
 void MeshTransformationSystem::RemoveEntityFromMesh2EntitiesMapping(ecs::EntityID entity_id, Mesh* mesh_handle) {
+	RemoveEntitiesFromMesh2EntitiesMapping({ entity_id }, mesh_handle);
+}
+
+static bool EntityIDLess(ecs::EntityID a, ecs::EntityID b) {
+	return a.index < b.index || (a.index == b.index && a.version < b.version);
+}
+
+void MeshTransformationSystem::RemoveEntitiesFromMesh2EntitiesMapping(const std::vector<ecs::EntityID>& sorted_entity_ids, Mesh* mesh_handle) {
 	auto mesh_to_entities_iter = mesh_to_entities_map_.find(mesh_handle);
 	if (mesh_to_entities_iter != mesh_to_entities_map_.end()) {
 		std::vector<ecs::EntityID>& entities_with_same_mesh = mesh_to_entities_iter->second;
 
-		// Erase entity_id from vector
+		// Erase sorted_entity_ids from vector
 		entities_with_same_mesh.erase(
-			std::remove(entities_with_same_mesh.begin(), entities_with_same_mesh.end(), entity_id),
+			std::remove_if(entities_with_same_mesh.begin(), entities_with_same_mesh.end(), [&sorted_entity_ids](ecs::EntityID entity_id) {
+				return std::binary_search(sorted_entity_ids.begin(), sorted_entity_ids.end(), entity_id, EntityIDLess);
+			}),
 			entities_with_same_mesh.end()
 		);
 
@@ -161,8 +202,8 @@ void MeshTransformationSystem::RemoveEntityFromMesh2EntitiesMapping(ecs::EntityI
 	}
 }
 
-void MeshTransformationSystem::RecalculateMeshBounds(ecs::EntityID entity_id, MeshRenderableComponent& mesh_rend) {
-	const std::vector<glm::vec3>& local_vert_positions = mesh_rend.mesh->GetVertexPositions();
+void MeshTransformationSystem::RecalculateMeshBounds(ecs::EntityID entity_id, MeshRenderableComponent& mesh_rend, Mesh& mesh) {
+	const std::vector<glm::vec3>& local_vert_positions = mesh.GetVertexPositions();
 	glm::mat4 entity_transform = transform_service_->GetWorldTransform(entity_id);
 	glm::vec3 min_p = transform::TransformedPoint(entity_transform, local_vert_positions[0]);
 	glm::vec3 max_p = min_p;
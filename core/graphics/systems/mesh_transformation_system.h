@@ -6,6 +6,7 @@
 #include <glm/mat4x4.hpp>
 
 #include <core/ecs/system.h>
+#include <core/ecs/query.h>
 #include <core/ecs/registry.h>
 #include <core/scene/scene.h>
 #include <core/scene/scene_graph.h>
@@ -17,7 +18,7 @@ class MeshTransformationSystem :
 	public ISystem,
 	private MeshLifecycleEventsListener,
 	private EntityTransformEventsListener,
-	private ecs::IComponentSetEventsListener
+	private ecs::IComponentSetBatchEventsListener
 {
 public:
 	MeshTransformationSystem() = default;
@@ -27,8 +28,8 @@ public:
 	void OnFixedUpdate(double fixed_delta_time) {}
 	void OnFrameUpdate(double delta_time, double alpha) override;
 
-	void OnEnterComponentSupersetOf(ecs::EntityID entity_id, const ecs::ComponentSetIDs component_set_ids) override;
-	void OnExitComponentSupersetOf(ecs::EntityID entity_id, const ecs::ComponentSetIDs component_set_ids)  override;
+	void OnEnterComponentSupersetOf(const ecs::EntityID* entity_ids, std::size_t count, const ecs::ComponentSetIDs& component_set_ids) override;
+	void OnExitComponentSupersetOf(const ecs::EntityID* entity_ids, std::size_t count, const ecs::ComponentSetIDs& component_set_ids) override;
 
 private:
 	struct MeshTransformationState {
@@ -39,6 +40,20 @@ private:
 	std::unordered_map<ecs::EntityIndex, MeshTransformationState> entity_mesh_trans_state_map_;
 	std::unordered_map<Mesh*, std::vector<ecs::EntityID>> mesh_to_entities_map_;
 
+	struct StaleMeshBounds {
+		ecs::EntityID entity_id;
+		MeshRenderableComponent* mesh_rend;
+		Mesh* mesh;
+	};
+
+	struct MeshEntity {
+		Mesh* mesh_handle;
+		ecs::EntityID entity_id;
+	};
+
+	// Reused every frame for the entities whose world mesh bounds are recalculated.
+	std::vector<StaleMeshBounds> stale_mesh_bounds_;
+
 	// MeshLifecycleEventsListener
 	void MeshVertexAttributeDidChange(Mesh* mesh, std::size_t attribute_index) override;
 	void MeshDidDestroy(Mesh* mesh) override;
@@ -49,9 +64,11 @@ private:
 	// Helpers
 	void AddEntityToMesh2EntitiesMapping(ecs::EntityID entity_id, Mesh* mesh_handle);
 	void RemoveEntityFromMesh2EntitiesMapping(ecs::EntityID entity_id, Mesh* mesh_handle);
-	void RecalculateMeshBounds(ecs::EntityID entity_id, MeshRenderableComponent& mesh_rend);
+	void RemoveEntitiesFromMesh2EntitiesMapping(const std::vector<ecs::EntityID>& sorted_entity_ids, Mesh* mesh_handle);
+	void RecalculateMeshBounds(ecs::EntityID entity_id, MeshRenderableComponent& mesh_rend, Mesh& mesh);
 
 	ecs::Registry* component_registry_;
 	ITransformService* transform_service_;
 	ecs::ComponentSetIDs mesh_transform_component_set_;
+	ecs::Query<MeshRenderableComponent, const RenderMeshComponent> mesh_renderables_query_;
 };
@@ -28,33 +28,51 @@ void RenderingSystem::Initialize(ServiceContainer service_container) {
 	if (!service_container.TryGetService(renderer_)) {
 		// TODO: Throw error.
 	}
+
+	component_registry_->AddQuery(&mesh_renderables_query_);
+	component_registry_->AddQuery(&cameras_query_);
 }
 
-void RenderingSystem::Cleanup(ServiceContainer service_container) {}
+void RenderingSystem::Cleanup(ServiceContainer service_container) {
+	component_registry_->RemoveQuery(&mesh_renderables_query_);
+	component_registry_->RemoveQuery(&cameras_query_);
+}
 
 void RenderingSystem::OnFrameUpdate(double delta_time, double alpha)
 {
 	renderable_objects_.clear();
-	// Iterate through mesh renderables.
-	std::function<void(ecs::EntityID, MeshRenderableComponent&)> mesh_renderables_block =
-		[this](ecs::EntityID entity_id, MeshRenderableComponent& mesh_rend) {
-		if (!mesh_rend.disabled) {
-			assert(mesh_rend.mesh->GetPipeline() == mesh_rend.material->GetPipeline());
-			renderable_objects_.push_back({
-				mesh_rend.mesh.get(),
-				mesh_rend.material.get(),
-				transform_service_->GetWorldTransform(entity_id),
-				mesh_rend.WorldMeshBounds(),
-				{}
-			});
+	renderable_batches_.clear();
+	// Iterate through mesh renderables. Entities with the same render mesh are
+	// stored together, so every chunk belongs to a single batch.
+	mesh_renderables_query_.EachChunk([this](const ecs::EntityID* entity_ids, std::size_t count, const MeshRenderableComponent* mesh_rends, const RenderMeshComponent* render_mesh) {
+		assert(render_mesh->mesh->GetPipeline() == render_mesh->material->GetPipeline());
+		std::size_t first_enabled = 0;
+		while (first_enabled < count && mesh_rends[first_enabled].disabled) {
+			++first_enabled;
+		}
+		if (first_enabled == count) {
+			// No batch for chunks without enabled renderables.
+			return;
+		}
+		if (renderable_batches_.empty() || renderable_batches_.back().mesh != render_mesh->mesh.get() || renderable_batches_.back().material != render_mesh->material.get()) {
+			renderable_batches_.push_back({ render_mesh->mesh.get(), render_mesh->material.get(), renderable_objects_.size(), 0 });
+		}
+		for (std::size_t i = first_enabled; i < count; ++i) {
+			if (!mesh_rends[i].disabled) {
+				renderable_objects_.push_back({
+					transform_service_->GetWorldTransform(entity_ids[i]),
+					mesh_rends[i].WorldMeshBounds(),
+					{}
+				});
+				renderable_batches_.back().object_count++;
+			}
 		}
-	};
-	component_registry_->EnumerateComponentsWithBlock<MeshRenderableComponent>(mesh_renderables_block);
+	});
 
-	non_culled_renderable_objects_.clear();
-	std::function<void(ecs::EntityID, CameraComponent&)> cameras_block =
-		[this](ecs::EntityID entity_id, CameraComponent& camera_component) {
+	cameras_query_.Each([this](ecs::EntityID entity_id, CameraComponent& camera_component) {
 		if (!camera_component.disabled) {
+			non_culled_renderable_objects_.clear();
+			non_culled_renderable_batches_.clear();
 			const glm::mat4 camera_transform = transform_service_->GetWorldTransform(entity_id);
 			const glm::mat4 camera_view_matrix = glm::inverse(camera_transform);
 			glm::mat4 projection_matrix;
@@ -136,37 +154,46 @@ void RenderingSystem::OnFrameUpdate(double delta_time, double alpha)
 
 			// For each renderable object, transform its AABB points into camera space
 			// and create a new bounding box (AABB') encapsulating its transformed points.
-			// Then, perform an intersection test between AABB' and the view bounds/frustum
-			for (RenderableObject renderable_object : renderable_objects_) {
-				const geometry::Bounds& aabb = renderable_object.aabb;
-				const glm::vec3 renderable_aabb_points[8] = {
-					aabb.min,
-					glm::vec3(aabb.max.x, aabb.min.y, aabb.min.z),
-					glm::vec3(aabb.max.x, aabb.max.y, aabb.min.z),
-					glm::vec3(aabb.min.x, aabb.max.y, aabb.min.z),
-					glm::vec3(aabb.min.x, aabb.max.y, aabb.max.z),
-					aabb.max,
-					glm::vec3(aabb.max.x, aabb.min.y, aabb.max.z),
-					glm::vec3(aabb.min.x, aabb.min.y, aabb.max.z),
-				};
-
-				glm::vec3 min_cam_space_p = transform::TransformedPoint(
-					camera_view_matrix,
-					renderable_aabb_points[0]
-				);
-				glm::vec3 max_cam_space_p = min_cam_space_p;
-				for (std::size_t i = 1; i < 8; i++) {
-					glm::vec3 renderable_cam_space_aabb_point = transform::TransformedPoint(
+			// Then, perform an intersection test between AABB' and the view bounds/frustum.
+			// Culling keeps the order of the objects, so every batch stays contiguous.
+			for (const RenderableBatch& renderable_batch : renderable_batches_) {
+				RenderableBatch non_culled_batch = { renderable_batch.mesh, renderable_batch.material, non_culled_renderable_objects_.size(), 0 };
+				for (std::size_t o_idx = renderable_batch.first_object_index; o_idx < renderable_batch.first_object_index + renderable_batch.object_count; ++o_idx) {
+					const RenderableObject& renderable_object = renderable_objects_[o_idx];
+					const geometry::Bounds& aabb = renderable_object.aabb;
+					const glm::vec3 renderable_aabb_points[8] = {
+						aabb.min,
+						glm::vec3(aabb.max.x, aabb.min.y, aabb.min.z),
+						glm::vec3(aabb.max.x, aabb.max.y, aabb.min.z),
+						glm::vec3(aabb.min.x, aabb.max.y, aabb.min.z),
+						glm::vec3(aabb.min.x, aabb.max.y, aabb.max.z),
+						aabb.max,
+						glm::vec3(aabb.max.x, aabb.min.y, aabb.max.z),
+						glm::vec3(aabb.min.x, aabb.min.y, aabb.max.z),
+					};
+
+					glm::vec3 min_cam_space_p = transform::TransformedPoint(
 						camera_view_matrix,
-						renderable_aabb_points[i]
+						renderable_aabb_points[0]
 					);
-					min_cam_space_p = glm::min(min_cam_space_p, renderable_cam_space_aabb_point);
-					max_cam_space_p = glm::max(max_cam_space_p, renderable_cam_space_aabb_point);
+					glm::vec3 max_cam_space_p = min_cam_space_p;
+					for (std::size_t i = 1; i < 8; i++) {
+						glm::vec3 renderable_cam_space_aabb_point = transform::TransformedPoint(
+							camera_view_matrix,
+							renderable_aabb_points[i]
+						);
+						min_cam_space_p = glm::min(min_cam_space_p, renderable_cam_space_aabb_point);
+						max_cam_space_p = glm::max(max_cam_space_p, renderable_cam_space_aabb_point);
+					}
+
+					geometry::Bounds renderable_camera_space_aabb(min_cam_space_p, max_cam_space_p);
+					if (intersects_view(renderable_camera_space_aabb)) {
+						non_culled_renderable_objects_.push_back(renderable_object);
+						non_culled_batch.object_count++;
+					}
 				}
-
-				geometry::Bounds renderable_camera_space_aabb(min_cam_space_p, max_cam_space_p);
-				if (intersects_view(renderable_camera_space_aabb)) {
-					non_culled_renderable_objects_.push_back(renderable_object);
+				if (non_culled_batch.object_count > 0) {
+					non_culled_renderable_batches_.push_back(non_culled_batch);
 				}
 			}
 
@@ -174,8 +201,7 @@ void RenderingSystem::OnFrameUpdate(double delta_time, double alpha)
 			std::cout << "total renderables: " << renderable_objects_.size() << std::endl;
 			std::cout << "culled: " << renderable_objects_.size() - non_culled_renderable_objects_.size() << std::endl;
 			auto a = projection_matrix * camera_view_matrix;
-			renderer_->RenderFrame(cam_params, non_culled_renderable_objects_);
+			renderer_->RenderFrame(cam_params, non_culled_renderable_batches_, non_culled_renderable_objects_);
 		}
-	};
-	component_registry_->EnumerateComponentsWithBlock<CameraComponent>(cameras_block);
+	});
 }
\ No newline at end of file
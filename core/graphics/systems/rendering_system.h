@@ -1,11 +1,16 @@
 #pragma once
 
+#include <core/ecs/query.h>
 #include <core/ecs/system.h>
 #include <core/scene/scene.h>
 #include <core/scene/scene_graph.h>
 #include <core/definitions/transform/transform_service.h>
 #include <core/definitions/graphics/renderer.h>
 
+#include "../components/camera_component.h"
+#include "../components/mesh_renderable_component.h"
+#include "../components/render_mesh_component.h"
+
 class RenderingSystem : public ISystem
 {
 public:
@@ -19,6 +24,10 @@ private:
 	ecs::Registry* component_registry_;
 	ITransformService* transform_service_;
 	IRenderer* renderer_;
+	ecs::Query<const MeshRenderableComponent, const RenderMeshComponent> mesh_renderables_query_;
+	ecs::Query<CameraComponent> cameras_query_;
 	std::vector<RenderableObject> renderable_objects_;
+	std::vector<RenderableBatch> renderable_batches_;
 	std::vector<RenderableObject> non_culled_renderable_objects_;
+	std::vector<RenderableBatch> non_culled_renderable_batches_;
 };
\ No newline at end of file
@@ -27,7 +27,8 @@ class SceneBase : public IScene, public ISceneEntityInstantiator
 public:
 	SceneBase() = delete;
 
-	SceneBase(const char* name) : name_(name) {}
+	SceneBase(const char* name, TransformHierarchyLayout transform_hierarchy_layout = TransformHierarchyLayoutLinked, TransformPropagation transform_propagation = TransformPropagationImmediate, LocalTransformRepresentation local_transform_representation = LocalTransformRepresentationMatrix)
+		: name_(name), scene_graph_(transform_hierarchy_layout, transform_propagation, local_transform_representation) {}
 
 	const char* Name() override { return name_; }
 
@@ -43,7 +44,11 @@ public:
 
 	void OnFixedUpdate(double fixed_delta_time) override {}
 
-	void OnFrameUpdate(double delta_time, double alpha) override {}
+	// Delivers the component set events of the last frame to batch listeners.
+	// Scenes call this before updating their systems.
+	void OnFrameUpdate(double delta_time, double alpha) override {
+		registry_.FlushComponentSetEvents();
+	}
 
 	ecs::EntityID CreateEntity() override {
 		ecs::EntityID entity_id = scene_graph_.CreateEntity();
@@ -51,12 +56,49 @@ public:
 		return entity_id;
 	}
 
+	/* Creates count entities in one scene graph chunk and gives each of them the components Ts.
+	*  See ecs::Registry::SpawnBatch.
+	*/
+	template<class... Ts, class F>
+	std::vector<ecs::EntityID> SpawnBatch(std::size_t count, F&& init) {
+		std::vector<ecs::EntityID> entity_ids = CreateEntityChunk(count);
+		registry_.SpawnBatch<Ts...>(entity_ids.data(), count, init);
+		return entity_ids;
+	}
+
+	// Creates count entities in one scene graph chunk with copies of the components of prefab.
+	template<class... Ts>
+	std::vector<ecs::EntityID> Instantiate(const ecs::Prefab<Ts...>& prefab, std::size_t count) {
+		std::vector<ecs::EntityID> entity_ids = CreateEntityChunk(count);
+		registry_.Instantiate(prefab, entity_ids.data(), count);
+		return entity_ids;
+	}
+
 	void DestroyEntity(ecs::EntityID entity_id) override {
 		registry_.UnregisterEntity(entity_id);
 		scene_graph_.DestroyEntity(entity_id);
 	}
 
+protected:
+	// Updates the transforms that were set during the frame. See SceneGraph::FlushTransforms.
+	void FlushTransforms() {
+		scene_graph_.FlushTransforms();
+	}
+
+	// Scenes with many moving entities can spread the updates over the threads of a pool instead.
+	void ParallelFlushTransforms(ThreadPool& thread_pool = ThreadPool::Shared()) {
+		scene_graph_.ParallelFlushTransforms(thread_pool);
+	}
+
 private:
+	std::vector<ecs::EntityID> CreateEntityChunk(std::size_t count) {
+		std::vector<ecs::EntityID> entity_ids = scene_graph_.CreateEntityChunk(count);
+		for (ecs::EntityID entity_id : entity_ids) {
+			registry_.RegisterEntity(entity_id);
+		}
+		return entity_ids;
+	}
+
 	const char* name_;
 	SceneGraph scene_graph_;
 	ecs::Registry registry_;
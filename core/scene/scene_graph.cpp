@@ -1,18 +1,53 @@
-
 #include "scene_graph.h"
 
-#include <core/transform/transform.h>
+#include <core/transform/affine_transform.h>
 
+#include <algorithm>
+#include <assert.h>
 #include <iostream>
 
 using namespace ecs;
 
-SceneGraph::SceneGraph() {
-	scene_graph_node_pool_ = new SceneGraphNode[MAX_ENTITY_COUNT]();
+const SceneGraph::NodeIndex SceneGraph::kNoNode;
+
+const SceneGraph::TransformIndex SceneGraph::kNoTransform;
+
+// Parallel flushes only hand out ranges of at least this many transforms of a depth level, or groups of at
+// least this many subtrees, and update the rest on the calling thread.
+static const std::size_t kMinParallelFlushTransformCount = 1024;
+static const std::size_t kMinParallelFlushSubtreeCount = 16;
+// Number of levels that parallel flushes of the linked layout split subtrees into, at most, when there are
+// too few subtrees to keep every thread busy.
+static const std::size_t kMaxParallelFlushSplitDepth = 4;
+
+SceneGraph::SceneGraph(TransformHierarchyLayout transform_hierarchy_layout, TransformPropagation transform_propagation, LocalTransformRepresentation local_transform_representation) :
+	transform_hierarchy_layout_(transform_hierarchy_layout),
+	// The depth-sorted layout is only updated by flushes.
+	transform_propagation_(transform_hierarchy_layout == TransformHierarchyLayoutDepthSorted ? TransformPropagationDeferred : transform_propagation),
+	local_transform_representation_(local_transform_representation) {
 	next_pool_index_ = 0;
+	is_transform_order_dirty_ = false;
+	has_dirty_transforms_ = false;
+	transform_events_announcer_count_ = 0;
+
+	// We create the world entity. It is the root of the hierarchy, so it has no parent.
+	const EntityID world_entity_id = entity_allocator_.Allocate();
+	assert(world_entity_id == null_entity_id);
+	entity_to_scene_graph_node_map_.resize(entity_allocator_.Capacity(), kNoNode);
+	const NodeIndex pool_index = AllocateNodeChunk(1);
+	entity_to_scene_graph_node_map_[world_entity_id.index] = pool_index;
+	SceneGraphNode& node = NodeAt(pool_index);
+	node.type = SceneGraphNodeTypeTransform;
+	node.value.transform_node = { world_entity_id, AllocateTransform(pool_index), kNoNode, kNoNode, kNoNode, kNoNode, kNoNode, nullptr };
+	SetNodeWorldTransform(pool_index, transform::IdentityAffineMatrix());
+}
 
-	// We create the world entity
-	CreateEntity(glm::mat4(1.0f), { 0, 0 });
+SceneGraph::~SceneGraph() {
+	for (NodeIndex pool_index = 0; pool_index < next_pool_index_; pool_index++) {
+		if (NodeAt(pool_index).type == SceneGraphNodeTypeTransform) {
+			delete TransformNodeAt(pool_index).transform_events_announcer;
+		}
+	}
 }
 
 EntityID SceneGraph::CreateEntity(glm::mat4 world_matrix, EntityID parent_id)
@@ -26,88 +61,46 @@ std::vector<EntityID> SceneGraph::CreateEntityChunk(std::size_t n, std::vector<g
 	assert(world_matrices.size() <= n);
 	assert(parent_map.size() <= n);
 
-	std::vector<EntityID> entity_ids;
-	for (std::size_t i = 0; i < n; i++) {
-		if (recycled_entity_ids_.empty()) {
-			entity_ids.push_back({ 0, (EntityIndex)entity_to_scene_graph_node_map_.size() });
-			entity_to_scene_graph_node_map_.push_back(-1);
-		}
-		else {
-			EntityID recycled_entity_id = recycled_entity_ids_.front();
-			// We must increase the version number every time this entity id is reused!
-			entity_ids.push_back({ ++recycled_entity_id.version, recycled_entity_id.index });
-			recycled_entity_ids_.pop();
-		}
-	}
+	std::vector<EntityID> entity_ids(n);
+	entity_allocator_.AllocateBatch(entity_ids.data(), n);
+	entity_to_scene_graph_node_map_.resize(entity_allocator_.Capacity(), kNoNode);
 
-	std::map<std::size_t, std::vector<std::size_t>>::iterator iter_begin;
-	if (n == 1) {
-		iter_begin = recycled_chunk_map_.begin();
-	}
-	else {
-		iter_begin = recycled_chunk_map_.lower_bound(n);
-	}
-	
-	std::size_t pool_index;
-	if (iter_begin != recycled_chunk_map_.end()) {
-		const std::size_t min_chunk_size = iter_begin->first;
-		assert(min_chunk_size > 0);
-
-		pool_index = iter_begin->second.back();
-		iter_begin->second.pop_back();
-
-		if (min_chunk_size > n) {
-			// If the minimum chunk size found was greater than n, we will split 
-			recycled_chunk_map_.insert(iter_begin, { min_chunk_size - n, { pool_index + n } });
-		}
-
-		if (iter_begin->second.empty()) {
-			// If there are no more chunks with size == min_chunk_size, erase it from the recycled chunk map.
-			recycled_chunk_map_.erase(iter_begin);
-		}
-	}
-	else {
-		pool_index = next_pool_index_;
-		next_pool_index_ += n;
-	}
+	const NodeIndex pool_index = AllocateNodeChunk(n);
 
 	for (std::size_t i = 0; i < n; i++) {
-		entity_to_scene_graph_node_map_[entity_ids[i].index] = pool_index + i;
+		entity_to_scene_graph_node_map_[entity_ids[i].index] = pool_index + (NodeIndex)i;
 	}
 
 	for (std::size_t i = 0; i < n; i++) {
-		SceneGraphNode& node = scene_graph_node_pool_[pool_index + i];
+		const NodeIndex node_pool_index = pool_index + (NodeIndex)i;
+		SceneGraphNode& node = NodeAt(node_pool_index);
 		node.type = SceneGraphNodeTypeTransform;
-		std::size_t parent_pool_index;
-		if (parent_map[i] < 0) {
-			assert(parent_map[i] >= -((int)n));
-			parent_pool_index = entity_to_scene_graph_node_map_[entity_ids[-parent_map[i] - 1].index];
+		// Entities without a world matrix or parent are placed at the origin,
+		// as children of the world.
+		const int parent = i < parent_map.size() ? parent_map[i] : 0;
+		NodeIndex parent_pool_index;
+		if (parent < 0) {
+			assert(-parent - 1 < (int)i);
+			parent_pool_index = entity_to_scene_graph_node_map_[entity_ids[-parent - 1].index];
 		}
 		else {
-			parent_pool_index = entity_to_scene_graph_node_map_[parent_map[i]];
+			parent_pool_index = entity_to_scene_graph_node_map_[parent];
 		}
-		
-		TransformNode* parent = &scene_graph_node_pool_[parent_pool_index].value.transform_node;
-		TransformNode* prev_sibling = parent->last_child;
+		assert(parent_pool_index != kNoNode);
+
 		node.value.transform_node = 
 		{ 
 			entity_ids[i],
-			transform::InverseTransformedMatrix(parent->world_transform_matrix, world_matrices[i]),
-			world_matrices[i], 
-			parent, 
-			prev_sibling, 
-			nullptr, 
-			nullptr, 
+			AllocateTransform(node_pool_index),
+			kNoNode, 
+			kNoNode, 
+			kNoNode, 
+			kNoNode, 
+			kNoNode, 
 			nullptr 
 		};
-
-		if (prev_sibling) {
-			prev_sibling->next_sibling = &node.value.transform_node;
-		}
-		if (!parent->first_child) {
-			parent->first_child = &node.value.transform_node;
-		}
-		parent->last_child = &node.value.transform_node;
+		AppendChild(parent_pool_index, node_pool_index);
+		SetNodeWorldTransform(node_pool_index, i < world_matrices.size() ? transform::AffineMatrixFromMatrix(world_matrices[i]) : transform::IdentityAffineMatrix());
 	}
 
 	return entity_ids;
@@ -121,206 +114,699 @@ void SceneGraph::DestroyEntity(EntityID entity_id)
 void SceneGraph::DestroyEntityChunk(EntityID entity_id, std::size_t n)
 {
 	assert(entity_id != null_entity_id);
-	const std::size_t chunk_start_pool_index = entity_to_scene_graph_node_map_[entity_id.index];
-
-	std::vector<std::size_t> new_chunk_pool_indices;
-	SceneGraphNode& prev_node = scene_graph_node_pool_[chunk_start_pool_index - 1];
-	if (prev_node.type == SceneGraphNodeTypeRecycled) {
-		// There is an adjacent recycled chunk before.
-		const std::size_t prev_chunk_size = prev_node.value.recycled_node.chunk_size;
-		const std::size_t prev_chunk_rank = prev_node.value.recycled_node.chunk_rank;
-		const std::size_t prev_chunk_pool_index = recycled_chunk_map_[prev_chunk_size][prev_chunk_rank];
-		for (std::size_t i = 0; i < prev_node.value.recycled_node.chunk_size; i++) {
-			new_chunk_pool_indices.push_back(prev_chunk_pool_index + i);
-		}
-		DeleteRecycledChunkWithSwap(prev_chunk_size, prev_chunk_rank);
-	}
+	assert(IsValid(entity_id));
+	const NodeIndex chunk_start_pool_index = entity_to_scene_graph_node_map_[entity_id.index];
 
 	// We officially destroy the entities here
+	std::vector<EntityID> destroyed_entity_ids;
+	destroyed_entity_ids.reserve(n);
 	for (std::size_t i = 0; i < n; i++) {
-		const std::size_t pool_index = chunk_start_pool_index + i;
-		new_chunk_pool_indices.push_back(pool_index);
-		SceneGraphNode& node = scene_graph_node_pool_[pool_index];
+		const NodeIndex pool_index = chunk_start_pool_index + (NodeIndex)i;
+		SceneGraphNode& node = NodeAt(pool_index);
+		assert(node.type == SceneGraphNodeTypeTransform);
+		TransformNode& transform_node = node.value.transform_node;
+
+		// The children are handed over to the parent, keeping their world transformation matrices. Their
+		// local transformation matrices are composed with the destroyed entity's.
+		NodeIndex child_pool_index = transform_node.first_child;
+		while (child_pool_index != kNoNode) {
+			TransformNode& child_transform_node = TransformNodeAt(child_pool_index);
+			const NodeIndex next_child_pool_index = child_transform_node.next_sibling;
+			AppendChild(transform_node.parent, child_pool_index);
+			const TransformIndex child_transform_index = child_transform_node.transform_index;
+			StoreLocalTransform(child_transform_index, transform::AffineTransformedMatrix(LocalTransformMatrix(transform_node.transform_index), LocalTransformMatrix(child_transform_index)));
+			if (local_transform_representation_ == LocalTransformRepresentationTRS) {
+				const transform::AffineMatrix child_world_transform_matrix = world_transform_matrices_[child_transform_index];
+				world_transform_matrices_[child_transform_index] = ComposedWorldTransform(ResolvedWorldTransform(transform_node.parent), child_transform_index);
+				WorldTransformDidChangeWithoutPropagation(child_pool_index, child_world_transform_matrix);
+			}
+			MarkTransformDirty(child_transform_index);
+			child_pool_index = next_child_pool_index;
+		}
 
 		// Handle removal of node from hierarchy.
-		RemoveTransformNodeFromHierarchy(&node.value.transform_node);
+		RemoveTransformNodeFromHierarchy(pool_index);
+
+		if (transform_node.transform_events_announcer) {
+			delete transform_node.transform_events_announcer;
+			transform_events_announcer_count_--;
+		}
+		FreeTransform(transform_node.transform_index);
+		entity_to_scene_graph_node_map_[transform_node.entity_id.index] = kNoNode;
+		destroyed_entity_ids.push_back(transform_node.entity_id);
 
 		// Set node to be recycled
 		node.type = SceneGraphNodeTypeRecycled;
+	}
+	entity_allocator_.FreeBatch(destroyed_entity_ids.data(), destroyed_entity_ids.size());
 
-		// Recycle entity id.
-		recycled_entity_ids_.push(node.value.transform_node.entity_id);
+	RecycleNodeChunk(chunk_start_pool_index, n);
+}
+
+bool SceneGraph::IsValid(ecs::EntityID entity_id) {
+	return entity_allocator_.IsAlive(entity_id);
+}
+
+void SceneGraph::FlushTransforms()
+{
+	if (!has_dirty_transforms_) {
+		return;
 	}
-	
-	SceneGraphNode& next_node = scene_graph_node_pool_[chunk_start_pool_index + n];
-	if (next_node.type == SceneGraphNodeTypeRecycled) {
-		// There is an adjacent recycled chunk after.
-		const std::size_t next_chunk_size = next_node.value.recycled_node.chunk_size;
-		const std::size_t next_chunk_rank = next_node.value.recycled_node.chunk_rank;
-		const std::size_t next_chunk_pool_index = recycled_chunk_map_[next_chunk_size][next_chunk_rank];
-		for (std::size_t i = 0; i < next_node.value.recycled_node.chunk_size; i++) {
-			new_chunk_pool_indices.push_back(next_chunk_pool_index + i);
+	if (transform_hierarchy_layout_ == TransformHierarchyLayoutDepthSorted) {
+		if (is_transform_order_dirty_) {
+			SortTransformsByDepth();
 		}
-		DeleteRecycledChunkWithSwap(next_chunk_size, next_chunk_rank);
-	}
-
-	// Create new chunk, and merge with any adjacent chunks, if any.
-	const std::size_t new_chunk_size = new_chunk_pool_indices.size();
-	std::size_t new_chunk_rank;
-	if (recycled_chunk_map_.find(new_chunk_size) != recycled_chunk_map_.end()) {
-		std::vector<std::size_t>& recycled_chunks = recycled_chunk_map_[new_chunk_size];
-		new_chunk_rank = recycled_chunks.size();
-		recycled_chunks.push_back(new_chunk_pool_indices[0]);
+		PropagateDepthSortedTransforms(nullptr);
 	}
 	else {
-		new_chunk_rank = 0;
-		recycled_chunk_map_[new_chunk_size] = { new_chunk_pool_indices[0] };
-	}
-
-	for (std::size_t pool_index : new_chunk_pool_indices) {
-		scene_graph_node_pool_[pool_index].value.recycled_node = { new_chunk_size, new_chunk_rank };
+		PropagateLinkedTransforms(nullptr);
 	}
 }
 
-bool SceneGraph::IsValid(ecs::EntityID entity_id) {
-	if (entity_id.index >= entity_to_scene_graph_node_map_.size()) {
-		return false;
+void SceneGraph::ParallelFlushTransforms(ThreadPool& thread_pool)
+{
+	if (!has_dirty_transforms_) {
+		return;
+	}
+	if (transform_hierarchy_layout_ == TransformHierarchyLayoutDepthSorted) {
+		if (is_transform_order_dirty_) {
+			SortTransformsByDepth();
+		}
+		PropagateDepthSortedTransforms(&thread_pool);
+	}
+	else {
+		PropagateLinkedTransforms(&thread_pool);
 	}
-	SceneGraph::SceneGraphNode& node = scene_graph_node_pool_[entity_to_scene_graph_node_map_[entity_id.index]];
-	return node.type == SceneGraphNodeTypeTransform && node.value.transform_node.entity_id.version == entity_id.version;
 }
 
 void SceneGraph::AddLifecycleEventsListenerForEntity(EntityTransformEventsListener* listener, ecs::EntityID entity_id) {
 	if (IsValid(entity_id)) {
-		TransformNode& transform_node = scene_graph_node_pool_[entity_to_scene_graph_node_map_[entity_id.index]].value.transform_node;
-		transform_node.transform_events_announcer = new EventAnnouncer<EntityTransformEventsListener>();
+		TransformNode& transform_node = TransformNodeOf(entity_id);
+		if (!transform_node.transform_events_announcer) {
+			transform_node.transform_events_announcer = new EventAnnouncer<EntityTransformEventsListener>();
+			transform_events_announcer_count_++;
+		}
 		transform_node.transform_events_announcer->AddListener(listener);
 	}
 }
 
 void SceneGraph::RemoveLifecycleEventsListenerForEntity(EntityTransformEventsListener* listener, ecs::EntityID entity_id) {
 	if (IsValid(entity_id)) {
-		TransformNode& transform_node = scene_graph_node_pool_[entity_to_scene_graph_node_map_[entity_id.index]].value.transform_node;
+		TransformNode& transform_node = TransformNodeOf(entity_id);
 		if (transform_node.transform_events_announcer) {
 			transform_node.transform_events_announcer->RemoveListener(listener);
 		}
 	}
 }
 
-const glm::mat4& SceneGraph::GetLocalTransform(EntityID entity_id) const
+glm::mat4 SceneGraph::GetLocalTransform(EntityID entity_id) const
 {
-	const std::size_t pool_index = entity_to_scene_graph_node_map_[entity_id.index];
-	return scene_graph_node_pool_[pool_index].value.transform_node.local_transform_matrix;
+	return transform::MatrixFromAffineMatrix(LocalTransformMatrix(TransformNodeOf(entity_id).transform_index));
 }
 
-void SceneGraph::SetLocalTransform(EntityID entity_id, glm::mat4& local_transform_matrix) const
+void SceneGraph::SetLocalTransform(EntityID entity_id, glm::mat4& local_transform_matrix)
 {
-	const std::size_t pool_index = entity_to_scene_graph_node_map_[entity_id.index];
-	TransformNode& transform_node = scene_graph_node_pool_[pool_index].value.transform_node;
-	if (local_transform_matrix != transform_node.local_transform_matrix) {
-		transform_node.local_transform_matrix = local_transform_matrix;
-		const TransformNode* parent_transform_node = transform_node.parent;
-		SetWorldTransformMatrix(&transform_node, transform::TransformedMatrix(transform_node.parent->world_transform_matrix, local_transform_matrix));
-		UpdateDescendantWorldTransformationMatrices(transform_node);
+	const NodeIndex pool_index = entity_to_scene_graph_node_map_[entity_id.index];
+	const TransformIndex transform_index = TransformNodeAt(pool_index).transform_index;
+	const transform::AffineMatrix affine_local_transform_matrix = transform::AffineMatrixFromMatrix(local_transform_matrix);
+	if (affine_local_transform_matrix != LocalTransformMatrix(transform_index)) {
+		StoreLocalTransform(transform_index, affine_local_transform_matrix);
+		LocalTransformDidChange(pool_index);
 	}
 }
 
-const glm::mat4& SceneGraph::GetWorldTransform(EntityID entity_id) const
+transform::TRS SceneGraph::GetLocalTRS(EntityID entity_id) const
 {
-	const std::size_t pool_index = entity_to_scene_graph_node_map_[entity_id.index];
-	return scene_graph_node_pool_[pool_index].value.transform_node.world_transform_matrix;
+	const TransformIndex transform_index = TransformNodeOf(entity_id).transform_index;
+	return local_transform_representation_ == LocalTransformRepresentationTRS ?
+		local_transform_trs_[transform_index] :
+		transform::TRSFromMatrix(local_transform_matrices_[transform_index]);
 }
 
-void SceneGraph::SetWorldTransform(EntityID entity_id, glm::mat4& world_transform_matrix) const
+void SceneGraph::SetLocalTRS(EntityID entity_id, const transform::TRS& local_trs)
 {
-	const std::size_t pool_index = entity_to_scene_graph_node_map_[entity_id.index];
-	TransformNode& transform_node = scene_graph_node_pool_[pool_index].value.transform_node;
-	if (world_transform_matrix != transform_node.world_transform_matrix) {
-		SetWorldTransformMatrix(&transform_node, world_transform_matrix);
-		const TransformNode* parent_transform_node = transform_node.parent;
-		transform_node.local_transform_matrix = transform::InverseTransformedMatrix(transform_node.parent->world_transform_matrix, world_transform_matrix);
-		UpdateDescendantWorldTransformationMatrices(transform_node);
+	const NodeIndex pool_index = entity_to_scene_graph_node_map_[entity_id.index];
+	const TransformIndex transform_index = TransformNodeAt(pool_index).transform_index;
+	if (local_transform_representation_ == LocalTransformRepresentationTRS) {
+		local_transform_trs_[transform_index] = local_trs;
+	}
+	else {
+		local_transform_matrices_[transform_index] = transform::AffineMatrixFromTRS(local_trs);
+	}
+	LocalTransformDidChange(pool_index);
+}
+
+glm::mat4 SceneGraph::GetWorldTransform(EntityID entity_id) const
+{
+	return transform::MatrixFromAffineMatrix(world_transform_matrices_[TransformNodeOf(entity_id).transform_index]);
+}
+
+void SceneGraph::SetWorldTransform(EntityID entity_id, glm::mat4& world_transform_matrix)
+{
+	const NodeIndex pool_index = entity_to_scene_graph_node_map_[entity_id.index];
+	const TransformNode& transform_node = TransformNodeAt(pool_index);
+	const transform::AffineMatrix affine_world_transform_matrix = transform::AffineMatrixFromMatrix(world_transform_matrix);
+	if (affine_world_transform_matrix != world_transform_matrices_[transform_node.transform_index]) {
+		SetNodeWorldTransform(pool_index, affine_world_transform_matrix);
+		if (transform_propagation_ == TransformPropagationDeferred) {
+			MarkTransformDirty(transform_node.transform_index);
+		}
+		else {
+			AnnounceWorldTransformChange(transform_node);
+			UpdateDescendantWorldTransformationMatrices(pool_index);
+		}
 	}
 }
 
 const EntityID& SceneGraph::GetParent(EntityID entity_id) const
 {
-	const std::size_t pool_index = entity_to_scene_graph_node_map_[entity_id.index];
-	TransformNode& transform_node = scene_graph_node_pool_[pool_index].value.transform_node;
-	return transform_node.parent->entity_id;
+	const TransformNode& transform_node = TransformNodeOf(entity_id);
+	return transform_node.parent != kNoNode ? TransformNodeAt(transform_node.parent).entity_id : null_entity_id;
 }
 
-void SceneGraph::SetParent(EntityID entity_id, EntityID parent_id) const
+void SceneGraph::SetParent(EntityID entity_id, EntityID parent_id)
 {
-	const std::size_t pool_index = entity_to_scene_graph_node_map_[entity_id.index];
-	TransformNode& transform_node = scene_graph_node_pool_[pool_index].value.transform_node;
+	const NodeIndex pool_index = entity_to_scene_graph_node_map_[entity_id.index];
+	const transform::AffineMatrix world_transform_matrix = ResolvedWorldTransform(pool_index);
 	// Remove transform node from previous parent
-	RemoveTransformNodeFromHierarchy(&transform_node);
-
-	const std::size_t new_parent_pool_index = entity_to_scene_graph_node_map_[parent_id.index];
-	TransformNode& new_parent_transform_node = scene_graph_node_pool_[new_parent_pool_index].value.transform_node;
+	RemoveTransformNodeFromHierarchy(pool_index);
 
 	// Add transform node to new parent
-	TransformNode* prev_sibling = new_parent_transform_node.last_child;
-	prev_sibling->next_sibling = &transform_node;
-	if (!new_parent_transform_node.first_child) {
-		new_parent_transform_node.first_child = &transform_node;
-	}
-	new_parent_transform_node.last_child = &transform_node;
+	AppendChild(entity_to_scene_graph_node_map_[parent_id.index], pool_index);
 	// The entity's world transformation matrix stays the same when re-parented. However, its local
 	// local transformation matrix is updated to reflect the new parenting.
-	transform_node.local_transform_matrix = transform::InverseTransformedMatrix(new_parent_transform_node.world_transform_matrix, transform_node.world_transform_matrix);
+	SetNodeWorldTransform(pool_index, world_transform_matrix);
+	WorldTransformDidChangeWithoutPropagation(pool_index, world_transform_matrix);
+	// The descendants may have been under dirty transforms, so they are updated at the next flush.
+	MarkTransformDirty(TransformNodeAt(pool_index).transform_index);
+	if (transform_hierarchy_layout_ == TransformHierarchyLayoutDepthSorted) {
+		is_transform_order_dirty_ = true;
+	}
+}
+
+SceneGraph::NodeIndex SceneGraph::AllocateNodeChunk(std::size_t n)
+{
+	// The smallest recycled chunk that fits is split.
+	std::map<std::size_t, std::vector<NodeIndex>>::iterator iter_begin = recycled_chunk_map_.lower_bound(n);
+	if (iter_begin != recycled_chunk_map_.end()) {
+		const std::size_t min_chunk_size = iter_begin->first;
+		assert(min_chunk_size > 0);
+
+		const NodeIndex pool_index = iter_begin->second.back();
+		DeleteRecycledChunkWithSwap(min_chunk_size, iter_begin->second.size() - 1);
+		if (min_chunk_size > n) {
+			// If the minimum chunk size found was greater than n, we will split 
+			AddRecycledChunk(pool_index + (NodeIndex)n, min_chunk_size - n);
+		}
+		return pool_index;
+	}
+
+	const NodeIndex pool_index = next_pool_index_;
+	assert((std::size_t)pool_index + n < (std::size_t)kNoNode);
+	next_pool_index_ += (NodeIndex)n;
+	while (scene_graph_node_pages_.size() * SCENE_GRAPH_NODE_PAGE_SIZE < next_pool_index_) {
+		scene_graph_node_pages_.emplace_back(new SceneGraphNode[SCENE_GRAPH_NODE_PAGE_SIZE]());
+	}
+	return pool_index;
+}
+
+void SceneGraph::RecycleNodeChunk(NodeIndex chunk_start_pool_index, std::size_t n)
+{
+	NodeIndex new_chunk_start_pool_index = chunk_start_pool_index;
+	std::size_t new_chunk_size = n;
+	if (chunk_start_pool_index > 0 && NodeAt(chunk_start_pool_index - 1).type == SceneGraphNodeTypeRecycled) {
+		// There is an adjacent recycled chunk before. Its last node is up to date.
+		const RecycledNode prev_node = NodeAt(chunk_start_pool_index - 1).value.recycled_node;
+		new_chunk_start_pool_index -= (NodeIndex)prev_node.chunk_size;
+		new_chunk_size += prev_node.chunk_size;
+		DeleteRecycledChunkWithSwap(prev_node.chunk_size, prev_node.chunk_rank);
+	}
+	const NodeIndex next_pool_index = chunk_start_pool_index + (NodeIndex)n;
+	if (next_pool_index < next_pool_index_ && NodeAt(next_pool_index).type == SceneGraphNodeTypeRecycled) {
+		// There is an adjacent recycled chunk after. Its first node is up to date.
+		const RecycledNode next_node = NodeAt(next_pool_index).value.recycled_node;
+		new_chunk_size += next_node.chunk_size;
+		DeleteRecycledChunkWithSwap(next_node.chunk_size, next_node.chunk_rank);
+	}
+
+	if (new_chunk_start_pool_index + new_chunk_size == next_pool_index_) {
+		// A chunk at the end of the used nodes is given back to the end of the pool.
+		next_pool_index_ = new_chunk_start_pool_index;
+	}
+	else {
+		AddRecycledChunk(new_chunk_start_pool_index, new_chunk_size);
+	}
+}
+
+void SceneGraph::AddRecycledChunk(NodeIndex chunk_start_pool_index, std::size_t chunk_size)
+{
+	std::vector<NodeIndex>& recycled_chunks = recycled_chunk_map_[chunk_size];
+	const RecycledNode recycled_node = { chunk_size, recycled_chunks.size() };
+	recycled_chunks.push_back(chunk_start_pool_index);
+	NodeAt(chunk_start_pool_index).value.recycled_node = recycled_node;
+	NodeAt(chunk_start_pool_index + (NodeIndex)chunk_size - 1).value.recycled_node = recycled_node;
 }
 
 void SceneGraph::DeleteRecycledChunkWithSwap(std::size_t chunk_size, std::size_t chunk_rank) {
-	std::vector<std::size_t>& recycled_chunks = recycled_chunk_map_[chunk_size];
-	if (recycled_chunks.size() == 1) {
-		recycled_chunk_map_.erase(chunk_rank);
+	std::map<std::size_t, std::vector<NodeIndex>>::iterator recycled_chunks_iter = recycled_chunk_map_.find(chunk_size);
+	std::vector<NodeIndex>& recycled_chunks = recycled_chunks_iter->second;
+	recycled_chunks[chunk_rank] = recycled_chunks.back();
+	recycled_chunks.pop_back();
+	if (chunk_rank < recycled_chunks.size()) {
+		const NodeIndex moved_chunk_pool_index = recycled_chunks[chunk_rank];
+		NodeAt(moved_chunk_pool_index).value.recycled_node.chunk_rank = chunk_rank;
+		NodeAt(moved_chunk_pool_index + (NodeIndex)chunk_size - 1).value.recycled_node.chunk_rank = chunk_rank;
+	}
+	else if (recycled_chunks.empty()) {
+		recycled_chunk_map_.erase(recycled_chunks_iter);
+	}
+}
+
+SceneGraph::TransformIndex SceneGraph::AllocateTransform(NodeIndex pool_index)
+{
+	TransformIndex transform_index;
+	if (!free_transform_indices_.empty()) {
+		transform_index = free_transform_indices_.back();
+		free_transform_indices_.pop_back();
+	}
+	else {
+		transform_index = (TransformIndex)transform_node_indices_.size();
+		if (local_transform_representation_ == LocalTransformRepresentationTRS) {
+			local_transform_trs_.emplace_back();
+		}
+		else {
+			local_transform_matrices_.emplace_back();
+		}
+		world_transform_matrices_.emplace_back();
+		transform_node_indices_.push_back(kNoNode);
+		if (transform_hierarchy_layout_ == TransformHierarchyLayoutDepthSorted) {
+			parent_transform_indices_.push_back(kNoTransform);
+		}
+		if (transform_propagation_ == TransformPropagationDeferred) {
+			transform_dirty_flags_.push_back(0);
+		}
+	}
+	transform_node_indices_[transform_index] = pool_index;
+	if (transform_hierarchy_layout_ == TransformHierarchyLayoutDepthSorted) {
+		// A new transform may come before its parent's.
+		is_transform_order_dirty_ = true;
+	}
+	return transform_index;
+}
+
+void SceneGraph::FreeTransform(TransformIndex transform_index)
+{
+	transform_node_indices_[transform_index] = kNoNode;
+	free_transform_indices_.push_back(transform_index);
+	if (transform_propagation_ == TransformPropagationDeferred) {
+		transform_dirty_flags_[transform_index] = 0;
+	}
+	if (transform_hierarchy_layout_ == TransformHierarchyLayoutDepthSorted) {
+		is_transform_order_dirty_ = true;
+	}
+}
+
+void SceneGraph::StoreLocalTransform(TransformIndex transform_index, const transform::AffineMatrix& local_transform_matrix)
+{
+	if (local_transform_representation_ == LocalTransformRepresentationTRS) {
+		local_transform_trs_[transform_index] = transform::TRSFromMatrix(local_transform_matrix);
+	}
+	else {
+		local_transform_matrices_[transform_index] = local_transform_matrix;
+	}
+}
+
+void SceneGraph::LocalTransformDidChange(NodeIndex pool_index)
+{
+	const TransformNode& transform_node = TransformNodeAt(pool_index);
+	const TransformIndex transform_index = transform_node.transform_index;
+	world_transform_matrices_[transform_index] = transform_node.parent != kNoNode ?
+		ComposedWorldTransform(ResolvedWorldTransform(transform_node.parent), transform_index) :
+		LocalTransformMatrix(transform_index);
+	if (transform_propagation_ == TransformPropagationDeferred) {
+		MarkTransformDirty(transform_index);
+	}
+	else {
+		AnnounceWorldTransformChange(transform_node);
+		UpdateDescendantWorldTransformationMatrices(pool_index);
+	}
+}
+
+void SceneGraph::SetNodeWorldTransform(NodeIndex pool_index, const transform::AffineMatrix& world_transform_matrix)
+{
+	const TransformNode& transform_node = TransformNodeAt(pool_index);
+	const TransformIndex transform_index = transform_node.transform_index;
+	if (transform_node.parent == kNoNode) {
+		StoreLocalTransform(transform_index, world_transform_matrix);
+		world_transform_matrices_[transform_index] = LocalTransformMatrix(transform_index);
+		return;
+	}
+	const transform::AffineMatrix parent_world_transform_matrix = ResolvedWorldTransform(transform_node.parent);
+	StoreLocalTransform(transform_index, transform::AffineInverseTransformedMatrix(parent_world_transform_matrix, world_transform_matrix));
+	// The TRS representation drops the shear of the local transform, so the world transform is the one
+	// the stored local transform produces, which propagations keep.
+	world_transform_matrices_[transform_index] = local_transform_representation_ == LocalTransformRepresentationTRS ?
+		ComposedWorldTransform(parent_world_transform_matrix, transform_index) :
+		world_transform_matrix;
+}
+
+void SceneGraph::WorldTransformDidChangeWithoutPropagation(NodeIndex pool_index, const transform::AffineMatrix& previous_world_transform_matrix)
+{
+	const TransformNode& transform_node = TransformNodeAt(pool_index);
+	if (transform_propagation_ == TransformPropagationImmediate && world_transform_matrices_[transform_node.transform_index] != previous_world_transform_matrix) {
+		AnnounceWorldTransformChange(transform_node);
+		UpdateDescendantWorldTransformationMatrices(pool_index);
+	}
+}
+
+void SceneGraph::MarkTransformDirty(TransformIndex transform_index)
+{
+	if (transform_propagation_ == TransformPropagationImmediate || transform_dirty_flags_[transform_index]) {
+		return;
+	}
+	transform_dirty_flags_[transform_index] = 1;
+	has_dirty_transforms_ = true;
+	if (transform_hierarchy_layout_ == TransformHierarchyLayoutLinked) {
+		dirty_transform_indices_.push_back(transform_index);
+	}
+}
+
+transform::AffineMatrix SceneGraph::ResolvedWorldTransform(NodeIndex pool_index)
+{
+	const TransformIndex transform_index = TransformNodeAt(pool_index).transform_index;
+	if (!has_dirty_transforms_) {
+		return world_transform_matrices_[transform_index];
+	}
+
+	// The world transform of the parent of the highest dirty ancestor is up to date. The world
+	// transforms below it are computed from their local transforms.
+	std::size_t dirty_path_length = 0;
+	for (NodeIndex ancestor_pool_index = pool_index; ancestor_pool_index != kNoNode; ancestor_pool_index = TransformNodeAt(ancestor_pool_index).parent) {
+		node_stack_.push_back(ancestor_pool_index);
+		if (transform_dirty_flags_[TransformNodeAt(ancestor_pool_index).transform_index]) {
+			dirty_path_length = node_stack_.size();
+		}
+	}
+	if (dirty_path_length == 0) {
+		node_stack_.clear();
+		return world_transform_matrices_[transform_index];
+	}
+
+	transform::AffineMatrix world_transform_matrix = dirty_path_length < node_stack_.size() ?
+		world_transform_matrices_[TransformNodeAt(node_stack_[dirty_path_length]).transform_index] :
+		transform::IdentityAffineMatrix();
+	for (std::size_t path_index = dirty_path_length; path_index-- > 0;) {
+		world_transform_matrix = ComposedWorldTransform(world_transform_matrix, TransformNodeAt(node_stack_[path_index]).transform_index);
+	}
+	node_stack_.clear();
+	return world_transform_matrix;
+}
+
+void SceneGraph::UpdateDescendantWorldTransformationMatrices(NodeIndex root_pool_index)
+{
+	// Parents are updated before their children, in depth-first order.
+	node_stack_.push_back(root_pool_index);
+	while (!node_stack_.empty()) {
+		const TransformNode& transform_node = TransformNodeAt(node_stack_.back());
+		node_stack_.pop_back();
+		const transform::AffineMatrix& parent_world_matrix = world_transform_matrices_[transform_node.transform_index];
+		NodeIndex child_pool_index = transform_node.first_child;
+		while (child_pool_index != kNoNode) {
+			const TransformNode& child_transform_node = TransformNodeAt(child_pool_index);
+			const TransformIndex child_transform_index = child_transform_node.transform_index;
+			world_transform_matrices_[child_transform_index] = ComposedWorldTransform(parent_world_matrix, child_transform_index);
+			AnnounceWorldTransformChange(child_transform_node);
+			node_stack_.push_back(child_pool_index);
+			child_pool_index = child_transform_node.next_sibling;
+		}
+	}
+}
+
+void SceneGraph::UpdateNodeWorldTransformationMatrix(NodeIndex pool_index)
+{
+	const TransformNode& transform_node = TransformNodeAt(pool_index);
+	const TransformIndex transform_index = transform_node.transform_index;
+	world_transform_matrices_[transform_index] = transform_node.parent != kNoNode ?
+		ComposedWorldTransform(world_transform_matrices_[TransformNodeAt(transform_node.parent).transform_index], transform_index) :
+		LocalTransformMatrix(transform_index);
+}
+
+void SceneGraph::UpdateSubtreeWorldTransformationMatrices(NodeIndex root_pool_index, std::vector<NodeIndex>& node_stack)
+{
+	// Parents are updated before their children, in depth-first order.
+	node_stack.push_back(root_pool_index);
+	while (!node_stack.empty()) {
+		const NodeIndex pool_index = node_stack.back();
+		node_stack.pop_back();
+		UpdateNodeWorldTransformationMatrix(pool_index);
+		for (NodeIndex child_pool_index = TransformNodeAt(pool_index).first_child; child_pool_index != kNoNode; child_pool_index = TransformNodeAt(child_pool_index).next_sibling) {
+			node_stack.push_back(child_pool_index);
+		}
+	}
+}
+
+void SceneGraph::AnnounceSubtreeWorldTransformChanges(NodeIndex root_pool_index)
+{
+	node_stack_.push_back(root_pool_index);
+	while (!node_stack_.empty()) {
+		const TransformNode& transform_node = TransformNodeAt(node_stack_.back());
+		node_stack_.pop_back();
+		AnnounceWorldTransformChange(transform_node);
+		for (NodeIndex child_pool_index = transform_node.first_child; child_pool_index != kNoNode; child_pool_index = TransformNodeAt(child_pool_index).next_sibling) {
+			node_stack_.push_back(child_pool_index);
+		}
+	}
+}
+
+void SceneGraph::SortTransformsByDepth()
+{
+	const std::size_t transform_count = transform_node_indices_.size() - free_transform_indices_.size();
+	const bool is_trs = local_transform_representation_ == LocalTransformRepresentationTRS;
+	std::vector<transform::AffineMatrix> local_transform_matrices(is_trs ? 0 : transform_count);
+	std::vector<transform::TRS> local_transform_trs(is_trs ? transform_count : 0);
+	std::vector<transform::AffineMatrix> world_transform_matrices(transform_count);
+	std::vector<TransformIndex> parent_transform_indices(transform_count);
+	std::vector<std::uint8_t> transform_dirty_flags(transform_count);
+	std::vector<NodeIndex> transform_node_indices;
+	transform_node_indices.reserve(transform_count);
+
+	// A breadth-first walk from the world visits the nodes by depth. Every parent is given its
+	// new transform index before its children are visited.
+	transform_node_indices.push_back(entity_to_scene_graph_node_map_[null_entity_id.index]);
+	depth_transform_offsets_.clear();
+	depth_transform_offsets_.push_back(0);
+	std::size_t depth_end = 1;
+	for (std::size_t transform_index = 0; transform_index < transform_node_indices.size(); transform_index++) {
+		if (transform_index == depth_end) {
+			// Every node of the previous depth has been visited, so all of the nodes of this depth have been found.
+			depth_transform_offsets_.push_back((TransformIndex)transform_index);
+			depth_end = transform_node_indices.size();
+		}
+		TransformNode& transform_node = TransformNodeAt(transform_node_indices[transform_index]);
+		if (is_trs) {
+			local_transform_trs[transform_index] = local_transform_trs_[transform_node.transform_index];
+		}
+		else {
+			local_transform_matrices[transform_index] = local_transform_matrices_[transform_node.transform_index];
+		}
+		world_transform_matrices[transform_index] = world_transform_matrices_[transform_node.transform_index];
+		transform_dirty_flags[transform_index] = transform_dirty_flags_[transform_node.transform_index];
+		parent_transform_indices[transform_index] = transform_node.parent != kNoNode ? TransformNodeAt(transform_node.parent).transform_index : kNoTransform;
+		transform_node.transform_index = (TransformIndex)transform_index;
+		for (NodeIndex child_pool_index = transform_node.first_child; child_pool_index != kNoNode; child_pool_index = TransformNodeAt(child_pool_index).next_sibling) {
+			transform_node_indices.push_back(child_pool_index);
+		}
+	}
+	assert(transform_node_indices.size() == transform_count);
+	depth_transform_offsets_.push_back((TransformIndex)transform_count);
+
+	local_transform_matrices_.swap(local_transform_matrices);
+	local_transform_trs_.swap(local_transform_trs);
+	world_transform_matrices_.swap(world_transform_matrices);
+	parent_transform_indices_.swap(parent_transform_indices);
+	transform_dirty_flags_.swap(transform_dirty_flags);
+	transform_node_indices_.swap(transform_node_indices);
+	free_transform_indices_.clear();
+	is_transform_order_dirty_ = false;
+}
+
+void SceneGraph::PropagateDepthSortedTransforms(ThreadPool* thread_pool)
+{
+	assert(!is_transform_order_dirty_);
+	const std::size_t transform_count = transform_node_indices_.size();
+
+	// The world is the first transform, and has no parent.
+	if (transform_dirty_flags_[0]) {
+		world_transform_matrices_[0] = LocalTransformMatrix(0);
+	}
+	if (!thread_pool || thread_pool->WorkerCount() == 0) {
+		PropagateDepthSortedTransformRange(1, transform_count);
 	}
 	else {
-		recycled_chunks[chunk_rank] = recycled_chunks.back();
-		recycled_chunks.pop_back();
-		for (std::size_t i = 0; i < chunk_size; i++) {
-			scene_graph_node_pool_[recycled_chunks[chunk_rank] + i].value.recycled_node.chunk_rank = chunk_rank;
+		// The transforms of a depth only depend on those of the depth before.
+		const std::size_t max_task_count = (thread_pool->WorkerCount() + 1) * 4;
+		for (std::size_t depth = 1; depth + 1 < depth_transform_offsets_.size(); depth++) {
+			const std::size_t depth_begin = depth_transform_offsets_[depth];
+			const std::size_t depth_transform_count = depth_transform_offsets_[depth + 1] - depth_begin;
+			const std::size_t task_count = std::min(max_task_count, depth_transform_count / kMinParallelFlushTransformCount);
+			if (task_count <= 1) {
+				PropagateDepthSortedTransformRange(depth_begin, depth_begin + depth_transform_count);
+				continue;
+			}
+			thread_pool->ParallelFor(task_count, [this, depth_begin, depth_transform_count, task_count](std::size_t task_index) {
+				PropagateDepthSortedTransformRange(
+					depth_begin + depth_transform_count * task_index / task_count,
+					depth_begin + depth_transform_count * (task_index + 1) / task_count);
+			});
+		}
+	}
+
+	if (transform_events_announcer_count_ > 0) {
+		for (std::size_t transform_index = 0; transform_index < transform_count; transform_index++) {
+			if (transform_dirty_flags_[transform_index]) {
+				AnnounceWorldTransformChange(TransformNodeAt(transform_node_indices_[transform_index]));
+			}
+		}
+	}
+	std::fill(transform_dirty_flags_.begin(), transform_dirty_flags_.end(), 0);
+	has_dirty_transforms_ = false;
+}
+
+void SceneGraph::PropagateDepthSortedTransformRange(std::size_t transform_begin, std::size_t transform_end)
+{
+	transform::AffineMatrix* const world_transform_matrices = world_transform_matrices_.data();
+	const TransformIndex* const parent_transform_indices = parent_transform_indices_.data();
+	std::uint8_t* const transform_dirty_flags = transform_dirty_flags_.data();
+
+	// Parents come before their children, so their world transforms are up to date by the time the
+	// children's are computed. Children of dirty transforms are marked dirty in turn.
+	for (std::size_t transform_index = transform_begin; transform_index < transform_end; transform_index++) {
+		const TransformIndex parent_transform_index = parent_transform_indices[transform_index];
+		if (transform_dirty_flags[transform_index] | transform_dirty_flags[parent_transform_index]) {
+			world_transform_matrices[transform_index] = ComposedWorldTransform(world_transform_matrices[parent_transform_index], transform_index);
+			transform_dirty_flags[transform_index] = 1;
 		}
 	}
 }
 
-void SceneGraph::UpdateDescendantWorldTransformationMatrices(TransformNode& root_transform_node)
+void SceneGraph::PropagateLinkedTransforms(ThreadPool* thread_pool)
 {
-	std::queue<TransformNode*> bfs_descendant_queue;
-	bfs_descendant_queue.push(&root_transform_node);
-	while (!bfs_descendant_queue.empty()) {
-		const TransformNode* transform_node = bfs_descendant_queue.front();
-		bfs_descendant_queue.pop();
-		const glm::mat4& parent_world_matrix = transform_node->world_transform_matrix;
-		TransformNode* child_transform_node = transform_node->first_child;
-		while (child_transform_node != nullptr) {
-			SetWorldTransformMatrix(child_transform_node, child_transform_node->local_transform_matrix * parent_world_matrix);
-			bfs_descendant_queue.push(child_transform_node);
-			child_transform_node = child_transform_node->next_sibling;
+	// Only the dirty transforms without dirty ancestors are updated, with their subtrees. Those subtrees
+	// are disjoint, and cover every other dirty transform, so every transform is updated at most once.
+	// The world transforms of their parents are up to date.
+	for (TransformIndex transform_index : dirty_transform_indices_) {
+		if (transform_dirty_flags_[transform_index] != 1) {
+			// Freed since it was marked, or already collected, when a freed transform was reused and marked again.
+			continue;
+		}
+		const NodeIndex pool_index = transform_node_indices_[transform_index];
+		bool has_dirty_ancestor = false;
+		for (NodeIndex ancestor_pool_index = TransformNodeAt(pool_index).parent; ancestor_pool_index != kNoNode; ancestor_pool_index = TransformNodeAt(ancestor_pool_index).parent) {
+			if (transform_dirty_flags_[TransformNodeAt(ancestor_pool_index).transform_index]) {
+				has_dirty_ancestor = true;
+				break;
+			}
+		}
+		if (!has_dirty_ancestor) {
+			dirty_root_pool_indices_.push_back(pool_index);
+			transform_dirty_flags_[transform_index] = 2;
+		}
+	}
+	for (TransformIndex transform_index : dirty_transform_indices_) {
+		transform_dirty_flags_[transform_index] = 0;
+	}
+	dirty_transform_indices_.clear();
+	has_dirty_transforms_ = false;
+
+	if (!thread_pool || thread_pool->WorkerCount() == 0) {
+		for (NodeIndex pool_index : dirty_root_pool_indices_) {
+			UpdateSubtreeWorldTransformationMatrices(pool_index, node_stack_);
 		}
 	}
+	else {
+		// When there are too few subtrees to keep every thread busy, the roots of the subtrees are updated
+		// here, and the subtrees of their children are updated instead.
+		const std::size_t max_task_count = (thread_pool->WorkerCount() + 1) * 4;
+		split_root_pool_indices_ = dirty_root_pool_indices_;
+		for (std::size_t split_depth = 0; split_depth < kMaxParallelFlushSplitDepth && !split_root_pool_indices_.empty() &&
+			split_root_pool_indices_.size() < max_task_count * kMinParallelFlushSubtreeCount; split_depth++) {
+			node_stack_.swap(split_root_pool_indices_);
+			split_root_pool_indices_.clear();
+			for (NodeIndex pool_index : node_stack_) {
+				UpdateNodeWorldTransformationMatrix(pool_index);
+				for (NodeIndex child_pool_index = TransformNodeAt(pool_index).first_child; child_pool_index != kNoNode; child_pool_index = TransformNodeAt(child_pool_index).next_sibling) {
+					split_root_pool_indices_.push_back(child_pool_index);
+				}
+			}
+			node_stack_.clear();
+		}
+
+		// Subtrees are handed out in groups, as most of them are small.
+		const std::size_t subtree_count = split_root_pool_indices_.size();
+		const std::size_t task_count = std::max<std::size_t>(std::min(max_task_count, subtree_count / kMinParallelFlushSubtreeCount), 1);
+		if (task_node_stacks_.size() < task_count) {
+			task_node_stacks_.resize(task_count);
+		}
+		thread_pool->ParallelFor(task_count, [this, subtree_count, task_count](std::size_t task_index) {
+			std::vector<NodeIndex>& node_stack = task_node_stacks_[task_index];
+			for (std::size_t subtree_index = subtree_count * task_index / task_count; subtree_index < subtree_count * (task_index + 1) / task_count; subtree_index++) {
+				UpdateSubtreeWorldTransformationMatrices(split_root_pool_indices_[subtree_index], node_stack);
+			}
+		});
+		split_root_pool_indices_.clear();
+	}
+
+	if (transform_events_announcer_count_ > 0) {
+		for (NodeIndex pool_index : dirty_root_pool_indices_) {
+			AnnounceSubtreeWorldTransformChanges(pool_index);
+		}
+	}
+	dirty_root_pool_indices_.clear();
 }
 
-void SceneGraph::RemoveTransformNodeFromHierarchy(TransformNode* transform_node)
+void SceneGraph::AppendChild(NodeIndex parent_pool_index, NodeIndex child_pool_index)
 {
-	TransformNode* prev_sibling = transform_node->previous_sibling;
-	TransformNode* next_sibling = transform_node->next_sibling;
-	TransformNode* parent = transform_node->parent;
-	if (parent->first_child == transform_node) {
-		parent->first_child = next_sibling;
+	TransformNode& parent_node = TransformNodeAt(parent_pool_index);
+	TransformNode& child_node = TransformNodeAt(child_pool_index);
+	const NodeIndex prev_sibling = parent_node.last_child;
+	child_node.parent = parent_pool_index;
+	child_node.previous_sibling = prev_sibling;
+	child_node.next_sibling = kNoNode;
+	if (prev_sibling != kNoNode) {
+		TransformNodeAt(prev_sibling).next_sibling = child_pool_index;
 	}
-	if (parent->last_child == transform_node) {
-		parent->last_child = prev_sibling;
+	else {
+		parent_node.first_child = child_pool_index;
 	}
-	prev_sibling->next_sibling = next_sibling;
-	next_sibling->previous_sibling = prev_sibling;
+	parent_node.last_child = child_pool_index;
 }
 
-void SceneGraph::SetWorldTransformMatrix(TransformNode* transform_node, glm::mat4 new_world_matrix) {
-	transform_node->world_transform_matrix = new_world_matrix;
-	if (transform_node->transform_events_announcer) {
-		transform_node->transform_events_announcer->Announce(&EntityTransformEventsListener::EntityWorldTransformDidChange, transform_node->entity_id, new_world_matrix);
+void SceneGraph::RemoveTransformNodeFromHierarchy(NodeIndex pool_index)
+{
+	TransformNode& transform_node = TransformNodeAt(pool_index);
+	const NodeIndex prev_sibling = transform_node.previous_sibling;
+	const NodeIndex next_sibling = transform_node.next_sibling;
+	TransformNode& parent = TransformNodeAt(transform_node.parent);
+	if (prev_sibling != kNoNode) {
+		TransformNodeAt(prev_sibling).next_sibling = next_sibling;
+	}
+	else {
+		parent.first_child = next_sibling;
+	}
+	if (next_sibling != kNoNode) {
+		TransformNodeAt(next_sibling).previous_sibling = prev_sibling;
+	}
+	else {
+		parent.last_child = prev_sibling;
+	}
+	transform_node.parent = kNoNode;
+	transform_node.previous_sibling = kNoNode;
+	transform_node.next_sibling = kNoNode;
+}
+
+void SceneGraph::AnnounceWorldTransformChange(const TransformNode& transform_node) const
+{
+	if (transform_node.transform_events_announcer) {
+		transform_node.transform_events_announcer->Announce(&EntityTransformEventsListener::EntityWorldTransformDidChange, transform_node.entity_id, transform::MatrixFromAffineMatrix(world_transform_matrices_[transform_node.transform_index]));
 	}
 }
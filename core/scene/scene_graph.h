@@ -1,59 +1,142 @@
 #pragma once
 
-#include <vector>
-#include <queue>
+#include <cstdint>
 #include <map>
+#include <memory>
+#include <vector>
 #include <core/definitions/transform/transform_service.h>
 #include <core/ecs/entity.h>
+#include <core/ecs/entity_allocator.h>
+#include <core/transform/affine_transform.h>
 #include <core/utils/event_announcer.h>
+#include <core/utils/thread_pool.h>
 #include <glm/mat4x4.hpp>
 
-#define MAX_ENTITY_COUNT 4096
+// Number of scene graph nodes in one page of the node pool.
+#ifndef SCENE_GRAPH_NODE_PAGE_SIZE
+#define SCENE_GRAPH_NODE_PAGE_SIZE 4096
+#endif
 
 struct EntityTransformEventsListener {
 	virtual void EntityWorldTransformDidChange(ecs::EntityID entity_id, glm::mat4 new_world_transform) = 0;
 };
 
+/* How the transforms of a scene graph are laid out.
+*/
+enum TransformHierarchyLayout {
+	// Transforms are updated by walking the child links of the scene graph nodes.
+	TransformHierarchyLayoutLinked = 0,
+	// Transforms are kept sorted by depth, so that parents come before their children. Transforms are
+	// always propagated when they are flushed, in one forward pass that updates every dirty transform
+	// and its descendants.
+	TransformHierarchyLayoutDepthSorted,
+};
+
+/* When setting a transform updates the world transforms of the entity's descendants.
+*/
+enum TransformPropagation {
+	// Right away. Only supported by the linked layout.
+	TransformPropagationImmediate = 0,
+	// Setting a transform only marks it dirty. FlushTransforms updates each dirty subtree once.
+	TransformPropagationDeferred,
+};
+
+/* How the local transforms of a scene graph are stored. Transforms are assumed to be affine either way.
+*/
+enum LocalTransformRepresentation {
+	// As matrices.
+	LocalTransformRepresentationMatrix = 0,
+	// As a translation, a rotation and a scale, in 40 bytes rather than 48. Local transforms that are set
+	// are decomposed, so they lose any shear, such as that of a rotated child of a non-uniformly scaled parent.
+	LocalTransformRepresentationTRS,
+};
+
 class SceneGraph : public ITransformService {
 public:
-	SceneGraph();
+	explicit SceneGraph(TransformHierarchyLayout transform_hierarchy_layout = TransformHierarchyLayoutLinked, TransformPropagation transform_propagation = TransformPropagationImmediate, LocalTransformRepresentation local_transform_representation = LocalTransformRepresentationMatrix);
+
+	~SceneGraph();
+
+	SceneGraph(const SceneGraph&) = delete;
+
+	SceneGraph& operator=(const SceneGraph&) = delete;
 
 	/* Creates an entity with given world matrix transformation and parent. If parent_id is 0, the entity's parent is the world.
 	*/
 	ecs::EntityID CreateEntity(glm::mat4 world_matrix = glm::mat4(1.0f), ecs::EntityID parent_id = {});
 
-	/* Each parent_map element, x, that is < 0 is assumed to be referring to the (-x)th entity to be created.
-	*  Otherwise, it is assumed to be referring to an existing entity ID.
+	/* Each parent_map element, x, that is < 0 is assumed to be referring to the (-x)th entity to be created,
+	*  which must come before the entity it is the parent of. Otherwise, it is assumed to be referring to an
+	*  existing entity index. Entities past the end of world_matrices or parent_map get the identity matrix
+	*  and the world as parent.
 	*/
 	std::vector<ecs::EntityID> CreateEntityChunk(std::size_t n, std::vector<glm::mat4> world_matrices = {}, std::vector<int> parent_map = {});
 
 	void DestroyEntity(ecs::EntityID entity_id);
 
+	/* Destroys the n entities of the chunk that starts with entity_id. The children of a destroyed
+	*  entity are given its parent, and keep their world transforms.
+	*/
 	void DestroyEntityChunk(ecs::EntityID entity_id, std::size_t n);
 
 	bool IsValid(ecs::EntityID entity_id);
 
+	TransformHierarchyLayout GetTransformHierarchyLayout() const { return transform_hierarchy_layout_; }
+
+	TransformPropagation GetTransformPropagation() const { return transform_propagation_; }
+
+	LocalTransformRepresentation GetLocalTransformRepresentation() const { return local_transform_representation_; }
+
+	/* Brings the world transforms of the descendants of the entities whose transforms were set up to date,
+	*  and announces their changes. With deferred propagation, until then, an entity's world transform is
+	*  the one it had when its own transform was last set or flushed. Setters always take the transforms
+	*  set before them into account. Scenes call this once per frame, after their systems have moved
+	*  entities and before rendering.
+	*/
+	void FlushTransforms();
+
+	/* Like FlushTransforms, but spreads the updates over the threads of thread_pool. The depth-sorted layout
+	*  updates one depth level at a time, in ranges of transforms. The linked layout updates the subtrees of
+	*  the dirty transforms in groups. Changes are announced on the calling thread.
+	*/
+	void ParallelFlushTransforms(ThreadPool& thread_pool = ThreadPool::Shared());
+
 	void AddLifecycleEventsListenerForEntity(EntityTransformEventsListener* listener, ecs::EntityID entity_id);
 
 	void RemoveLifecycleEventsListenerForEntity(EntityTransformEventsListener* listener, ecs::EntityID entity_id);
 	
-	const glm::mat4& GetLocalTransform(ecs::EntityID entity_id) const override;
+	glm::mat4 GetLocalTransform(ecs::EntityID entity_id) const override;
+
+	void SetLocalTransform(ecs::EntityID entity_id, glm::mat4& local_transform_matrix) override;
+
+	transform::TRS GetLocalTRS(ecs::EntityID entity_id) const;
 
-	void SetLocalTransform(ecs::EntityID entity_id, glm::mat4& local_transform_matrix) const override;
+	void SetLocalTRS(ecs::EntityID entity_id, const transform::TRS& local_trs);
 
 	// Returns the transform of the entity in world space. Can be used to convert
-	// points/directions/transforms in the entity's local space into world space.
-	const glm::mat4& GetWorldTransform(ecs::EntityID entity_id) const override;
+	// points/directions/transforms in the entity's local space into world space. Returned by value, as the
+	// transform arrays are reallocated when entities are created, and reordered by depth-sorted flushes.
+	glm::mat4 GetWorldTransform(ecs::EntityID entity_id) const override;
 
-	void SetWorldTransform(ecs::EntityID entity_id, glm::mat4& world_transform_matrix) const override;
+	void SetWorldTransform(ecs::EntityID entity_id, glm::mat4& world_transform_matrix) override;
 
+	// The parent of the world is null_entity_id.
 	const ecs::EntityID& GetParent(ecs::EntityID entity_id) const override;
 
-	void SetParent(ecs::EntityID entity_id, ecs::EntityID parent_id) const override;
+	void SetParent(ecs::EntityID entity_id, ecs::EntityID parent_id) override;
 
 	//void PerformBlockForEach(std::vector<EntityID> entity_ids, void (*block)(void* context, EntityID entity_id, Transform& transform));
 
 private:
+	// Index of a node in the scene graph node pool.
+	typedef std::uint32_t NodeIndex;
+
+	// Index of a transform in the transform arrays.
+	typedef std::uint32_t TransformIndex;
+
+	static const NodeIndex kNoNode = ~(NodeIndex)0;
+
+	static const TransformIndex kNoTransform = ~(TransformIndex)0;
 
 	// Using a tagged union to save space.
 
@@ -62,24 +145,24 @@ private:
 		SceneGraphNodeTypeTransform,
 	};
 
+	// Only the first and last nodes of a recycled chunk are kept up to date.
 	struct RecycledNode {
 		std::size_t chunk_size;
 		std::size_t chunk_rank;
 	};
 
+	// Nodes are linked by their pool indices, so that the pool can grow.
 	struct TransformNode {
 		// Entity ID
 		ecs::EntityID entity_id;
-		// Relative to parent.
-		glm::mat4 local_transform_matrix;
-		// Relative to world.
-		glm::mat4 world_transform_matrix;
-
-		TransformNode* parent;
-		TransformNode* previous_sibling;
-		TransformNode* next_sibling;
-		TransformNode* first_child;
-		TransformNode* last_child;
+		// Index of the entity's transforms.
+		TransformIndex transform_index;
+
+		NodeIndex parent;
+		NodeIndex previous_sibling;
+		NodeIndex next_sibling;
+		NodeIndex first_child;
+		NodeIndex last_child;
 		EventAnnouncer<EntityTransformEventsListener>* transform_events_announcer;
 	};
 
@@ -91,23 +174,150 @@ private:
 		} value;
 	};
 
-	SceneGraphNode* scene_graph_node_pool_;
-	std::size_t next_pool_index_;
+	const TransformHierarchyLayout transform_hierarchy_layout_;
+
+	const TransformPropagation transform_propagation_;
+
+	const LocalTransformRepresentation local_transform_representation_;
+
+	// The pool grows by a page at a time. Pages are never moved, so nodes keep their addresses.
+	std::vector<std::unique_ptr<SceneGraphNode[]>> scene_graph_node_pages_;
+	// Nodes from this index on have never been used, or have been returned to the end of the pool.
+	NodeIndex next_pool_index_;
 
 	// A "chunk" is an interval of contiguous unused transform nodes.
 
 	// Maps chunk size to vector of recycled chunk start indices.
-	std::map<std::size_t, std::vector<std::size_t>> recycled_chunk_map_;
+	std::map<std::size_t, std::vector<NodeIndex>> recycled_chunk_map_;
 	// Maps Entity index to scene graph node index.
-	std::vector<std::size_t> entity_to_scene_graph_node_map_;
-	// Recycled Entity indices that can be reused.
-	std::queue<ecs::EntityID> recycled_entity_ids_;
+	std::vector<NodeIndex> entity_to_scene_graph_node_map_;
+	// Hands out entity ids and recycles the ids of destroyed entities.
+	ecs::EntityAllocator entity_allocator_;
+
+	// The transforms of the entities are kept in separate arrays, indexed by transform index.
+	// Relative to parent. Only one of them is used, depending on the local transform representation.
+	std::vector<transform::AffineMatrix> local_transform_matrices_;
+	std::vector<transform::TRS> local_transform_trs_;
+	// Relative to world. The matrices are stored without their last row, which is the same for all
+	// affine transforms, and are expanded when they are read through the transform service.
+	std::vector<transform::AffineMatrix> world_transform_matrices_;
+	// Only used by the depth-sorted layout.
+	std::vector<TransformIndex> parent_transform_indices_;
+	// Index of the first transform of every depth, followed by the number of transforms.
+	std::vector<TransformIndex> depth_transform_offsets_;
+	// Only used by deferred propagation. A transform is dirty when its local transform was set, and its
+	// world transform and those of its descendants have not been brought up to date yet.
+	std::vector<std::uint8_t> transform_dirty_flags_;
+	// Transforms that were marked dirty since the last flush, in the linked layout. Some of them may have
+	// been freed since.
+	std::vector<TransformIndex> dirty_transform_indices_;
+	// Dirty transforms without dirty ancestors, collected by a flush of the linked layout.
+	std::vector<NodeIndex> dirty_root_pool_indices_;
+	// Roots of the subtrees that a parallel flush hands out to the threads.
+	std::vector<NodeIndex> split_root_pool_indices_;
+	// Node stacks of the tasks of a parallel flush, kept to be reused by the next one.
+	std::vector<std::vector<NodeIndex>> task_node_stacks_;
+	// Node of every transform, or kNoNode for unused transforms.
+	std::vector<NodeIndex> transform_node_indices_;
+	std::vector<TransformIndex> free_transform_indices_;
+	// Set when entities are added, removed or re-parented, so that the depth-sorted transforms must be sorted again.
+	bool is_transform_order_dirty_;
+	bool has_dirty_transforms_;
+	// Number of nodes with a transform events announcer.
+	std::size_t transform_events_announcer_count_;
+
+	// Nodes whose descendants are being updated, or whose world transforms are being resolved.
+	std::vector<NodeIndex> node_stack_;
+
+	SceneGraphNode& NodeAt(NodeIndex pool_index) const {
+		return scene_graph_node_pages_[pool_index / SCENE_GRAPH_NODE_PAGE_SIZE][pool_index % SCENE_GRAPH_NODE_PAGE_SIZE];
+	}
+
+	TransformNode& TransformNodeAt(NodeIndex pool_index) const {
+		return NodeAt(pool_index).value.transform_node;
+	}
+
+	TransformNode& TransformNodeOf(ecs::EntityID entity_id) const {
+		return TransformNodeAt(entity_to_scene_graph_node_map_[entity_id.index]);
+	}
+
+	// Returns the start of n contiguous unused nodes, reusing a recycled chunk if one is large enough.
+	NodeIndex AllocateNodeChunk(std::size_t n);
+
+	// Returns n nodes to the pool, merging them with the adjacent recycled chunks.
+	void RecycleNodeChunk(NodeIndex chunk_start_pool_index, std::size_t n);
+
+	void AddRecycledChunk(NodeIndex chunk_start_pool_index, std::size_t chunk_size);
 
 	void DeleteRecycledChunkWithSwap(std::size_t chunk_size, std::size_t chunk_rank);
 
-	static void UpdateDescendantWorldTransformationMatrices(TransformNode& root_transform_node);
+	TransformIndex AllocateTransform(NodeIndex pool_index);
+
+	void FreeTransform(TransformIndex transform_index);
+
+	transform::AffineMatrix LocalTransformMatrix(TransformIndex transform_index) const {
+		return local_transform_representation_ == LocalTransformRepresentationTRS ?
+			transform::AffineMatrixFromTRS(local_transform_trs_[transform_index]) :
+			local_transform_matrices_[transform_index];
+	}
+
+	void StoreLocalTransform(TransformIndex transform_index, const transform::AffineMatrix& local_transform_matrix);
+
+	// Returns the world transform of the transform, given its parent's.
+	transform::AffineMatrix ComposedWorldTransform(const transform::AffineMatrix& parent_world_transform_matrix, TransformIndex transform_index) const {
+		return local_transform_representation_ == LocalTransformRepresentationTRS ?
+			transform::AffineTransformedTRS(parent_world_transform_matrix, local_transform_trs_[transform_index]) :
+			transform::AffineTransformedMatrix(parent_world_transform_matrix, local_transform_matrices_[transform_index]);
+	}
+
+	// Brings the world transform of the node up to date after its local transform was set, and propagates
+	// or defers the change.
+	void LocalTransformDidChange(NodeIndex pool_index);
+
+	// Sets the world transform of the node, and computes its local transform from its parent's world transform.
+	// In the TRS representation, the world transform is the one the decomposed local transform produces.
+	void SetNodeWorldTransform(NodeIndex pool_index, const transform::AffineMatrix& world_transform_matrix);
 
-	static void RemoveTransformNodeFromHierarchy(TransformNode* transform_node);
+	// With immediate propagation, announces the change of the world transform of the node and updates its
+	// descendants, if its world transform differs from previous_world_transform_matrix. For the world transforms
+	// that are kept when the hierarchy changes, which the TRS representation may change by dropping shear.
+	void WorldTransformDidChangeWithoutPropagation(NodeIndex pool_index, const transform::AffineMatrix& previous_world_transform_matrix);
 
-	static void SetWorldTransformMatrix(TransformNode* transform_node, glm::mat4 new_world_matrix);
-};
\ No newline at end of file
+	void MarkTransformDirty(TransformIndex transform_index);
+
+	// Returns the world transform the node has once the transforms are flushed, computing it from the local
+	// transforms of its dirty ancestors.
+	transform::AffineMatrix ResolvedWorldTransform(NodeIndex pool_index);
+
+	void UpdateDescendantWorldTransformationMatrices(NodeIndex root_pool_index);
+
+	// Announces the changes of the world transforms of the node and its descendants.
+	void AnnounceSubtreeWorldTransformChanges(NodeIndex root_pool_index);
+
+	// Sorts the transforms of the depth-sorted layout by depth, dropping the unused ones.
+	void SortTransformsByDepth();
+
+	// Updates the dirty transforms of the depth-sorted layout and their descendants, in one pass over the
+	// transforms, or one depth at a time if thread_pool is given.
+	void PropagateDepthSortedTransforms(ThreadPool* thread_pool);
+
+	// Updates transforms [transform_begin, transform_end) of the depth-sorted layout, and marks them dirty
+	// if they were. Their parents must be up to date.
+	void PropagateDepthSortedTransformRange(std::size_t transform_begin, std::size_t transform_end);
+
+	// Updates the subtrees of the dirty transforms of the linked layout that have no dirty ancestors,
+	// spreading them over the threads of thread_pool if it is given.
+	void PropagateLinkedTransforms(ThreadPool* thread_pool);
+
+	// Updates the world transform of the node from its parent's.
+	void UpdateNodeWorldTransformationMatrix(NodeIndex pool_index);
+
+	// Updates the world transforms of the node and its descendants, using node_stack to walk them.
+	void UpdateSubtreeWorldTransformationMatrices(NodeIndex root_pool_index, std::vector<NodeIndex>& node_stack);
+
+	void AppendChild(NodeIndex parent_pool_index, NodeIndex child_pool_index);
+
+	void RemoveTransformNodeFromHierarchy(NodeIndex pool_index);
+
+	void AnnounceWorldTransformChange(const TransformNode& transform_node) const;
+};
@@ -0,0 +1,420 @@
+#include <gtest/gtest.h>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include <core/scene/scene_graph.h>
+#include <core/transform/transform.h>
+
+static glm::mat4 TranslationMatrix(float x, float y, float z)
+{
+    glm::mat4 matrix(1.0f);
+    transform::SetPosition(matrix, glm::vec3(x, y, z));
+    return matrix;
+}
+
+static void ExpectPositionNear(const glm::mat4& matrix, float x, float y, float z)
+{
+    const glm::vec3 position = transform::Position(matrix);
+    EXPECT_NEAR(position.x, x, 1e-4f);
+    EXPECT_NEAR(position.y, y, 1e-4f);
+    EXPECT_NEAR(position.z, z, 1e-4f);
+}
+
+static void TestHierarchy(TransformHierarchyLayout transform_hierarchy_layout, TransformPropagation transform_propagation, LocalTransformRepresentation local_transform_representation = LocalTransformRepresentationMatrix)
+{
+    SceneGraph scene_graph(transform_hierarchy_layout, transform_propagation, local_transform_representation);
+    const ecs::EntityID parent = scene_graph.CreateEntity(TranslationMatrix(1, 0, 0));
+    const ecs::EntityID child = scene_graph.CreateEntity(TranslationMatrix(1, 2, 0), parent);
+    const ecs::EntityID grandchild = scene_graph.CreateEntity(TranslationMatrix(1, 2, 3), child);
+
+    EXPECT_EQ(scene_graph.GetParent(parent), ecs::null_entity_id);
+    EXPECT_EQ(scene_graph.GetParent(child), parent);
+    EXPECT_EQ(scene_graph.GetParent(grandchild), child);
+    ExpectPositionNear(scene_graph.GetLocalTransform(grandchild), 0, 0, 3);
+
+    // Moving the parent moves its descendants.
+    glm::mat4 parent_world_matrix = TranslationMatrix(5, 0, 0);
+    scene_graph.SetWorldTransform(parent, parent_world_matrix);
+    scene_graph.FlushTransforms();
+    ExpectPositionNear(scene_graph.GetWorldTransform(child), 5, 2, 0);
+    ExpectPositionNear(scene_graph.GetWorldTransform(grandchild), 5, 2, 3);
+
+    glm::mat4 child_local_matrix = TranslationMatrix(0, 4, 0);
+    scene_graph.SetLocalTransform(child, child_local_matrix);
+    scene_graph.FlushTransforms();
+    ExpectPositionNear(scene_graph.GetWorldTransform(child), 5, 4, 0);
+    ExpectPositionNear(scene_graph.GetWorldTransform(grandchild), 5, 4, 3);
+
+    // Re-parenting keeps the world transform.
+    scene_graph.SetParent(grandchild, parent);
+    scene_graph.FlushTransforms();
+    EXPECT_EQ(scene_graph.GetParent(grandchild), parent);
+    ExpectPositionNear(scene_graph.GetWorldTransform(grandchild), 5, 4, 3);
+    ExpectPositionNear(scene_graph.GetLocalTransform(grandchild), 0, 4, 3);
+
+    // The children of a destroyed entity are given its parent.
+    scene_graph.SetParent(grandchild, child);
+    scene_graph.DestroyEntity(child);
+    scene_graph.FlushTransforms();
+    EXPECT_FALSE(scene_graph.IsValid(child));
+    EXPECT_EQ(scene_graph.GetParent(grandchild), parent);
+    ExpectPositionNear(scene_graph.GetWorldTransform(grandchild), 5, 4, 3);
+    ExpectPositionNear(scene_graph.GetLocalTransform(grandchild), 0, 4, 3);
+}
+
+TEST(scene_graph_test_suite, hierarchy_test)
+{
+    TestHierarchy(TransformHierarchyLayoutLinked, TransformPropagationImmediate);
+}
+
+TEST(scene_graph_test_suite, deferred_hierarchy_test)
+{
+    TestHierarchy(TransformHierarchyLayoutLinked, TransformPropagationDeferred);
+}
+
+TEST(scene_graph_test_suite, depth_sorted_hierarchy_test)
+{
+    TestHierarchy(TransformHierarchyLayoutDepthSorted, TransformPropagationDeferred);
+}
+
+TEST(scene_graph_test_suite, trs_hierarchy_test)
+{
+    TestHierarchy(TransformHierarchyLayoutLinked, TransformPropagationImmediate, LocalTransformRepresentationTRS);
+}
+
+TEST(scene_graph_test_suite, depth_sorted_trs_hierarchy_test)
+{
+    TestHierarchy(TransformHierarchyLayoutDepthSorted, TransformPropagationDeferred, LocalTransformRepresentationTRS);
+}
+
+static void TestFlush(TransformHierarchyLayout transform_hierarchy_layout, LocalTransformRepresentation local_transform_representation = LocalTransformRepresentationMatrix)
+{
+    // Transforms set in any order between flushes end up as if they had been propagated right away.
+    SceneGraph linked_scene_graph(TransformHierarchyLayoutLinked, TransformPropagationImmediate);
+    SceneGraph deferred_scene_graph(transform_hierarchy_layout, TransformPropagationDeferred, local_transform_representation);
+    std::mt19937 random_engine(22);
+    std::vector<ecs::EntityID> entity_ids = { ecs::null_entity_id };
+    for (int i = 0; i < 2000; i++) {
+        const ecs::EntityID parent_id = entity_ids[random_engine() % entity_ids.size()];
+        const glm::mat4 world_matrix = TranslationMatrix((float)(random_engine() % 100), (float)(random_engine() % 100), 0);
+        const ecs::EntityID entity_id = linked_scene_graph.CreateEntity(world_matrix, parent_id);
+        EXPECT_EQ(deferred_scene_graph.CreateEntity(world_matrix, parent_id), entity_id);
+        entity_ids.push_back(entity_id);
+    }
+
+    for (int frame = 0; frame < 10; frame++) {
+        for (int i = 0; i < 200; i++) {
+            const ecs::EntityID entity_id = entity_ids[1 + random_engine() % (entity_ids.size() - 1)];
+            glm::mat4 matrix = TranslationMatrix((float)(random_engine() % 100), 0, (float)(random_engine() % 100));
+            switch (random_engine() % 3) {
+            case 0:
+                linked_scene_graph.SetLocalTransform(entity_id, matrix);
+                deferred_scene_graph.SetLocalTransform(entity_id, matrix);
+                break;
+            case 1:
+                linked_scene_graph.SetWorldTransform(entity_id, matrix);
+                deferred_scene_graph.SetWorldTransform(entity_id, matrix);
+                break;
+            default:
+                // Parents are chosen among the entities created before, so that there are no cycles.
+                const ecs::EntityID parent_id = entity_ids[random_engine() % (entity_id.index)];
+                linked_scene_graph.SetParent(entity_id, parent_id);
+                deferred_scene_graph.SetParent(entity_id, parent_id);
+                break;
+            }
+        }
+        deferred_scene_graph.FlushTransforms();
+
+        for (ecs::EntityID entity_id : entity_ids) {
+            ASSERT_EQ(deferred_scene_graph.GetParent(entity_id), linked_scene_graph.GetParent(entity_id));
+            const glm::vec3 position = transform::Position(linked_scene_graph.GetWorldTransform(entity_id));
+            ExpectPositionNear(deferred_scene_graph.GetWorldTransform(entity_id), position.x, position.y, position.z);
+            const glm::vec3 local_position = transform::Position(linked_scene_graph.GetLocalTransform(entity_id));
+            ExpectPositionNear(deferred_scene_graph.GetLocalTransform(entity_id), local_position.x, local_position.y, local_position.z);
+        }
+    }
+}
+
+TEST(scene_graph_test_suite, deferred_flush_test)
+{
+    TestFlush(TransformHierarchyLayoutLinked);
+}
+
+TEST(scene_graph_test_suite, depth_sorted_flush_test)
+{
+    TestFlush(TransformHierarchyLayoutDepthSorted);
+}
+
+TEST(scene_graph_test_suite, depth_sorted_trs_flush_test)
+{
+    TestFlush(TransformHierarchyLayoutDepthSorted, LocalTransformRepresentationTRS);
+}
+
+TEST(scene_graph_test_suite, local_trs_test)
+{
+    // Rotated and uniformly scaled transforms end up the same whichever way the local transforms are stored.
+    SceneGraph matrix_scene_graph;
+    SceneGraph trs_scene_graph(TransformHierarchyLayoutLinked, TransformPropagationImmediate, LocalTransformRepresentationTRS);
+    transform::TRS parent_trs;
+    parent_trs.translation = glm::vec3(1, 2, 3);
+    parent_trs.rotation = glm::angleAxis(0.5f, glm::vec3(0, 1, 0));
+    parent_trs.scale = glm::vec3(2, 2, 2);
+    transform::TRS child_trs;
+    child_trs.translation = glm::vec3(0, 0, -1);
+    child_trs.rotation = glm::angleAxis(1.0f, glm::vec3(1, 0, 0));
+    child_trs.scale = glm::vec3(1, 3, 1);
+    for (SceneGraph* scene_graph : { &matrix_scene_graph, &trs_scene_graph }) {
+        const ecs::EntityID parent = scene_graph->CreateEntity();
+        const ecs::EntityID child = scene_graph->CreateEntity(glm::mat4(1.0f), parent);
+        scene_graph->SetLocalTRS(parent, parent_trs);
+        scene_graph->SetLocalTRS(child, child_trs);
+        const glm::mat4 expected_world_matrix = transform::MatrixFromTRS(parent_trs) * transform::MatrixFromTRS(child_trs);
+        const glm::mat4 world_matrix = scene_graph->GetWorldTransform(child);
+        for (int column = 0; column < 4; column++) {
+            for (int row = 0; row < 4; row++) {
+                EXPECT_NEAR(world_matrix[column][row], expected_world_matrix[column][row], 1e-4f);
+            }
+        }
+
+        // The local transform of an entity created with a world transform is computed from its parent's.
+        const ecs::EntityID other_child = scene_graph->CreateEntity(expected_world_matrix, parent);
+        const transform::TRS local_trs = scene_graph->GetLocalTRS(other_child);
+        ExpectPositionNear(transform::MatrixFromTRS(local_trs), 0, 0, -1);
+        EXPECT_NEAR(local_trs.scale.y, 3.0f, 1e-4f);
+    }
+}
+
+static void ExpectLinearPartNear(const glm::mat4& matrix, const glm::mat4& expected_matrix)
+{
+    for (int column = 0; column < 3; column++) {
+        for (int row = 0; row < 3; row++) {
+            EXPECT_NEAR(matrix[column][row], expected_matrix[column][row], 1e-4f) << "column " << column << ", row " << row;
+        }
+    }
+}
+
+static void TestShearedTransforms(TransformHierarchyLayout transform_hierarchy_layout, TransformPropagation transform_propagation, LocalTransformRepresentation local_transform_representation)
+{
+    // A rotated child of a non-uniformly scaled parent has a sheared local transform, which the TRS
+    // representation cannot hold. Whatever world transform it ends up with, moving an ancestor only moves it.
+    SceneGraph scene_graph(transform_hierarchy_layout, transform_propagation, local_transform_representation);
+    glm::mat4 scale_matrix(1.0f);
+    scale_matrix[0][0] = 3.0f;
+    glm::mat4 rotation_matrix(1.0f);
+    rotation_matrix[0][0] = std::cos(0.7f);
+    rotation_matrix[0][1] = std::sin(0.7f);
+    rotation_matrix[1][0] = -std::sin(0.7f);
+    rotation_matrix[1][1] = std::cos(0.7f);
+    const ecs::EntityID root = scene_graph.CreateEntity();
+    const ecs::EntityID parent = scene_graph.CreateEntity(scale_matrix, root);
+    const ecs::EntityID child = scene_graph.CreateEntity(rotation_matrix, parent);
+    const ecs::EntityID sheared_child = scene_graph.CreateEntity(scale_matrix * rotation_matrix, parent);
+    scene_graph.FlushTransforms();
+    if (local_transform_representation == LocalTransformRepresentationMatrix) {
+        ExpectLinearPartNear(scene_graph.GetWorldTransform(child), rotation_matrix);
+    }
+
+    glm::mat4 root_world_matrix = TranslationMatrix(0, 5, 0);
+    const glm::mat4 child_world_matrix = scene_graph.GetWorldTransform(child);
+    scene_graph.SetWorldTransform(root, root_world_matrix);
+    scene_graph.FlushTransforms();
+    ExpectLinearPartNear(scene_graph.GetWorldTransform(child), child_world_matrix);
+    ExpectPositionNear(scene_graph.GetWorldTransform(child), 0, 5, 0);
+
+    // The children of a destroyed entity get its local transform composed with theirs.
+    scene_graph.DestroyEntity(parent);
+    scene_graph.FlushTransforms();
+    const glm::mat4 sheared_child_world_matrix = scene_graph.GetWorldTransform(sheared_child);
+    if (local_transform_representation == LocalTransformRepresentationMatrix) {
+        ExpectLinearPartNear(sheared_child_world_matrix, scale_matrix * rotation_matrix);
+    }
+    root_world_matrix = TranslationMatrix(2, 0, 0);
+    scene_graph.SetWorldTransform(root, root_world_matrix);
+    scene_graph.FlushTransforms();
+    ExpectLinearPartNear(scene_graph.GetWorldTransform(sheared_child), sheared_child_world_matrix);
+    ExpectPositionNear(scene_graph.GetWorldTransform(sheared_child), 2, 0, 0);
+}
+
+TEST(scene_graph_test_suite, sheared_transform_test)
+{
+    TestShearedTransforms(TransformHierarchyLayoutLinked, TransformPropagationImmediate, LocalTransformRepresentationMatrix);
+    TestShearedTransforms(TransformHierarchyLayoutLinked, TransformPropagationImmediate, LocalTransformRepresentationTRS);
+    TestShearedTransforms(TransformHierarchyLayoutLinked, TransformPropagationDeferred, LocalTransformRepresentationTRS);
+    TestShearedTransforms(TransformHierarchyLayoutDepthSorted, TransformPropagationDeferred, LocalTransformRepresentationTRS);
+}
+
+static void TestParallelFlush(TransformHierarchyLayout transform_hierarchy_layout)
+{
+    ThreadPool thread_pool(3);
+    SceneGraph linked_scene_graph(TransformHierarchyLayoutLinked, TransformPropagationImmediate);
+    SceneGraph deferred_scene_graph(transform_hierarchy_layout, TransformPropagationDeferred);
+    std::mt19937 random_engine(24);
+
+    // A few roots with many descendants, so that both the depth levels and the subtrees are split.
+    std::vector<ecs::EntityID> entity_ids;
+    for (int i = 0; i < 8; i++) {
+        const ecs::EntityID root = linked_scene_graph.CreateEntity(TranslationMatrix((float)i, 0, 0));
+        deferred_scene_graph.CreateEntity(TranslationMatrix((float)i, 0, 0));
+        entity_ids.push_back(root);
+        for (int j = 0; j < 500; j++) {
+            const ecs::EntityID child = linked_scene_graph.CreateEntity(TranslationMatrix((float)i, (float)j, 0), root);
+            deferred_scene_graph.CreateEntity(TranslationMatrix((float)i, (float)j, 0), root);
+            entity_ids.push_back(child);
+            for (int k = 0; k < 4; k++) {
+                entity_ids.push_back(linked_scene_graph.CreateEntity(TranslationMatrix((float)i, (float)j, (float)k), child));
+                deferred_scene_graph.CreateEntity(TranslationMatrix((float)i, (float)j, (float)k), child);
+            }
+        }
+    }
+    deferred_scene_graph.ParallelFlushTransforms(thread_pool);
+
+    for (int frame = 0; frame < 4; frame++) {
+        // The first frame moves a single root, the others many entities at every depth.
+        const int moved_entity_count = frame == 0 ? 1 : 5000;
+        for (int i = 0; i < moved_entity_count; i++) {
+            const ecs::EntityID entity_id = entity_ids[frame == 0 ? 0 : random_engine() % entity_ids.size()];
+            glm::mat4 local_matrix = TranslationMatrix((float)(random_engine() % 100), (float)frame, 0);
+            linked_scene_graph.SetLocalTransform(entity_id, local_matrix);
+            deferred_scene_graph.SetLocalTransform(entity_id, local_matrix);
+        }
+        deferred_scene_graph.ParallelFlushTransforms(thread_pool);
+
+        for (ecs::EntityID entity_id : entity_ids) {
+            const glm::vec3 position = transform::Position(linked_scene_graph.GetWorldTransform(entity_id));
+            ExpectPositionNear(deferred_scene_graph.GetWorldTransform(entity_id), position.x, position.y, position.z);
+        }
+    }
+}
+
+TEST(scene_graph_test_suite, parallel_flush_test)
+{
+    TestParallelFlush(TransformHierarchyLayoutLinked);
+}
+
+TEST(scene_graph_test_suite, depth_sorted_parallel_flush_test)
+{
+    TestParallelFlush(TransformHierarchyLayoutDepthSorted);
+}
+
+TEST(scene_graph_test_suite, flush_announces_each_change_once_test)
+{
+    struct CountingListener : EntityTransformEventsListener {
+        void EntityWorldTransformDidChange(ecs::EntityID entity_id, glm::mat4 new_world_transform) override {
+            change_count++;
+            position = transform::Position(new_world_transform);
+        }
+        int change_count = 0;
+        glm::vec3 position;
+    };
+
+    const TransformHierarchyLayout transform_hierarchy_layouts[] = { TransformHierarchyLayoutLinked, TransformHierarchyLayoutDepthSorted };
+    for (TransformHierarchyLayout transform_hierarchy_layout : transform_hierarchy_layouts) {
+        SceneGraph scene_graph(transform_hierarchy_layout, TransformPropagationDeferred);
+        const ecs::EntityID parent = scene_graph.CreateEntity();
+        const ecs::EntityID child = scene_graph.CreateEntity(glm::mat4(1.0f), parent);
+        const ecs::EntityID grandchild = scene_graph.CreateEntity(glm::mat4(1.0f), child);
+        CountingListener listeners[3];
+        scene_graph.AddLifecycleEventsListenerForEntity(&listeners[0], parent);
+        scene_graph.AddLifecycleEventsListenerForEntity(&listeners[1], child);
+        scene_graph.AddLifecycleEventsListenerForEntity(&listeners[2], grandchild);
+        scene_graph.FlushTransforms();
+
+        // Moving every entity of the subtree, children first, updates each of them once.
+        glm::mat4 grandchild_local_matrix = TranslationMatrix(0, 0, 1);
+        scene_graph.SetLocalTransform(grandchild, grandchild_local_matrix);
+        glm::mat4 child_world_matrix = TranslationMatrix(0, 1, 0);
+        scene_graph.SetWorldTransform(child, child_world_matrix);
+        for (int i = 1; i <= 10; i++) {
+            glm::mat4 parent_world_matrix = TranslationMatrix((float)i, 0, 0);
+            scene_graph.SetWorldTransform(parent, parent_world_matrix);
+        }
+        for (const CountingListener& listener : listeners) {
+            EXPECT_EQ(listener.change_count, 0);
+        }
+        scene_graph.FlushTransforms();
+
+        for (const CountingListener& listener : listeners) {
+            EXPECT_EQ(listener.change_count, 1);
+        }
+        EXPECT_NEAR(listeners[0].position.x, 10, 1e-4f);
+        ExpectPositionNear(scene_graph.GetWorldTransform(child), 10, 1, 0);
+        ExpectPositionNear(scene_graph.GetWorldTransform(grandchild), 10, 1, 1);
+    }
+}
+
+static void TestEntityChunkStress(TransformHierarchyLayout transform_hierarchy_layout)
+{
+    struct EntityChunk {
+        std::vector<ecs::EntityID> entity_ids;
+        std::vector<float> positions;
+        bool is_parented_to_first_entity;
+    };
+
+    const std::size_t created_entity_count = 1000000;
+    const std::size_t chunk_sizes[] = { 1, 2, 7, 64, 1000, SCENE_GRAPH_NODE_PAGE_SIZE + 1 };
+
+    SceneGraph scene_graph(transform_hierarchy_layout);
+    std::mt19937 random_engine(21);
+    std::vector<EntityChunk> live_chunks;
+    std::size_t entity_count = 0;
+    while (entity_count < created_entity_count) {
+        EntityChunk chunk;
+        const std::size_t n = chunk_sizes[random_engine() % (sizeof(chunk_sizes) / sizeof(chunk_sizes[0]))];
+        chunk.is_parented_to_first_entity = random_engine() % 2 == 0;
+        std::vector<glm::mat4> world_matrices;
+        std::vector<int> parent_map;
+        for (std::size_t i = 0; i < n; i++) {
+            chunk.positions.push_back((float)(entity_count + i));
+            world_matrices.push_back(TranslationMatrix(chunk.positions.back(), 0, 0));
+            parent_map.push_back(chunk.is_parented_to_first_entity && i > 0 ? -1 : 0);
+        }
+        chunk.entity_ids = scene_graph.CreateEntityChunk(n, world_matrices, parent_map);
+        entity_count += n;
+        live_chunks.push_back(std::move(chunk));
+
+        // Destroys about half of the chunks, in random order, so recycled chunks are split and merged.
+        if (random_engine() % 2 == 0) {
+            const std::size_t destroyed_chunk_index = random_engine() % live_chunks.size();
+            const EntityChunk& destroyed_chunk = live_chunks[destroyed_chunk_index];
+            scene_graph.DestroyEntityChunk(destroyed_chunk.entity_ids[0], destroyed_chunk.entity_ids.size());
+            for (ecs::EntityID entity_id : destroyed_chunk.entity_ids) {
+                ASSERT_FALSE(scene_graph.IsValid(entity_id));
+            }
+            live_chunks[destroyed_chunk_index] = std::move(live_chunks.back());
+            live_chunks.pop_back();
+        }
+    }
+
+    scene_graph.FlushTransforms();
+    for (const EntityChunk& chunk : live_chunks) {
+        for (std::size_t i = 0; i < chunk.entity_ids.size(); i++) {
+            const ecs::EntityID entity_id = chunk.entity_ids[i];
+            ASSERT_TRUE(scene_graph.IsValid(entity_id));
+            ASSERT_EQ(transform::Position(scene_graph.GetWorldTransform(entity_id)).x, chunk.positions[i]);
+            const ecs::EntityID expected_parent = chunk.is_parented_to_first_entity && i > 0 ? chunk.entity_ids[0] : ecs::null_entity_id;
+            ASSERT_EQ(scene_graph.GetParent(entity_id), expected_parent);
+        }
+    }
+
+    for (const EntityChunk& chunk : live_chunks) {
+        scene_graph.DestroyEntityChunk(chunk.entity_ids[0], chunk.entity_ids.size());
+    }
+
+    // Every node has been recycled, so the pool can hand out a chunk of any size again.
+    const std::vector<ecs::EntityID> entity_ids = scene_graph.CreateEntityChunk(3 * SCENE_GRAPH_NODE_PAGE_SIZE, {}, {});
+    for (ecs::EntityID entity_id : entity_ids) {
+        ASSERT_TRUE(scene_graph.IsValid(entity_id));
+        ASSERT_EQ(scene_graph.GetParent(entity_id), ecs::null_entity_id);
+    }
+}
+
+TEST(scene_graph_test_suite, entity_chunk_stress_test)
+{
+    TestEntityChunkStress(TransformHierarchyLayoutLinked);
+}
+
+TEST(scene_graph_test_suite, depth_sorted_entity_chunk_stress_test)
+{
+    TestEntityChunkStress(TransformHierarchyLayoutDepthSorted);
+}
@@ -6,6 +6,7 @@
 #include <core/ecs/system.h>
 #include <core/scene/scene.h>
 #include <core/ecs/entity.h>
+#include <core/ecs/query.h>
 #include <core/transform/transform.h>
 
 #include "rigidbody_component.h"
@@ -25,26 +26,31 @@ public:
 		if (!service_container.TryGetService(transform_service_)) {
 			// TODO: Throw error.
 		}
+
+		component_registry_->AddQuery(&rigidbody_query_);
 	}
 
-	void Cleanup(ServiceContainer service_container) {};
+	void Cleanup(ServiceContainer service_container) {
+		component_registry_->RemoveQuery(&rigidbody_query_);
+	};
 
 	void OnFixedUpdate(double fixed_delta_time)
 	{
-		std::function<void(ecs::EntityID, RigidbodyComponent&)> block =
-			[fixed_delta_time](ecs::EntityID entity_id, RigidbodyComponent& rb) {
-			rb.velocity += gravity * (float)fixed_delta_time;
-			rb.previous_position = rb.position;
-			rb.position += rb.velocity * (float)fixed_delta_time;
-		};
-		component_registry_->EnumerateComponentsWithBlock<RigidbodyComponent>(block);
+		const float dt = (float)fixed_delta_time;
+		rigidbody_query_.ParallelEachChunk([dt](const ecs::EntityID* entity_ids, std::size_t count, RigidbodyComponent* rigidbodies) {
+			for (std::size_t i = 0; i < count; ++i) {
+				RigidbodyComponent& rb = rigidbodies[i];
+				rb.velocity += gravity * dt;
+				rb.previous_position = rb.position;
+				rb.position += rb.velocity * dt;
+			}
+		});
 	}
 
 	void OnFrameUpdate(double delta_time, double alpha)
 	{
 		// Physics interpolation before rendering
-		std::function<void(ecs::EntityID, RigidbodyComponent&)> block =
-			[this, alpha](ecs::EntityID entity_id, RigidbodyComponent& rb) {
+		rigidbody_query_.Each([this, alpha](ecs::EntityID entity_id, RigidbodyComponent& rb) {
 			glm::mat4 transform = transform_service_->GetWorldTransform(entity_id);
 			if (rb.interpolate) {
 				transform::SetPosition(transform, rb.position * (float)alpha + rb.previous_position * (float)(1.0f - alpha));
@@ -53,11 +59,11 @@ public:
 				transform::SetPosition(transform, rb.position);
 			}
 			transform_service_->SetWorldTransform(entity_id, transform);
-		};
-		component_registry_->EnumerateComponentsWithBlock<RigidbodyComponent>(block);
+		});
 	}
 
 private:
 	ecs::Registry* component_registry_;
 	ITransformService* transform_service_;
+	ecs::Query<RigidbodyComponent> rigidbody_query_;
 };
\ No newline at end of file
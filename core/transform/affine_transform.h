@@ -0,0 +1,474 @@
+#pragma once
+
+#include <cmath>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define TRANSFORM_AFFINE_AVX 1
+#define TRANSFORM_AFFINE_SSE2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRANSFORM_AFFINE_SSE2 1
+#endif
+
+#if defined(__FMA__)
+#define TRANSFORM_AFFINE_FMA 1
+#endif
+
+/*
+* Kernels for affine transforms, whose last row is (0, 0, 0, 1), as the
+* transforms of the scene graph are. Composing two of them skips the terms
+* of that row, and inverting one only inverts its 3x3 part, which is far
+* cheaper than a general 4x4 inverse.
+*/
+
+namespace transform {
+	/*
+	* Affine transform as a translation, a rotation and a scale, applied in
+	* order scale, rotation, translation. Takes 40 bytes rather than the 64
+	* of a matrix, but cannot hold shear. The rotation must be a unit
+	* quaternion.
+	*/
+	struct TRS {
+		glm::vec3 translation;
+		glm::quat rotation;
+		glm::vec3 scale;
+	};
+
+	/*
+	* Affine matrix without its last row, stored as its three other rows, so
+	* that each of them fits a SIMD register. Takes 48 bytes rather than the
+	* 64 of a glm::mat4.
+	*/
+	struct AffineMatrix {
+		glm::vec4 rows[3];
+	};
+
+	inline bool operator==(const AffineMatrix& a, const AffineMatrix& b)
+	{
+		return a.rows[0] == b.rows[0] && a.rows[1] == b.rows[1] && a.rows[2] == b.rows[2];
+	}
+
+	inline bool operator!=(const AffineMatrix& a, const AffineMatrix& b)
+	{
+		return !(a == b);
+	}
+
+#if TRANSFORM_AFFINE_SSE2
+	namespace detail {
+		inline __m128 LoadColumn(const glm::mat4& matrix, int column)
+		{
+			return _mm_loadu_ps(&matrix[column][0]);
+		}
+
+		inline void StoreColumn(glm::mat4& matrix, int column, __m128 value)
+		{
+			_mm_storeu_ps(&matrix[column][0], value);
+		}
+
+		inline __m128 LoadRow(const AffineMatrix& matrix, int row)
+		{
+			return _mm_loadu_ps(&matrix.rows[row][0]);
+		}
+
+		inline void StoreRow(AffineMatrix& matrix, int row, __m128 value)
+		{
+			_mm_storeu_ps(&matrix.rows[row][0], value);
+		}
+
+		// The w part of value, with the other parts 0.
+		inline __m128 MaskW(__m128 value)
+		{
+			return _mm_and_ps(value, _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0)));
+		}
+
+		// a * b + c
+		inline __m128 MultiplyAdd(__m128 a, __m128 b, __m128 c)
+		{
+#if TRANSFORM_AFFINE_FMA
+			return _mm_fmadd_ps(a, b, c);
+#else
+			return _mm_add_ps(_mm_mul_ps(a, b), c);
+#endif
+		}
+
+		template<int kLane>
+		inline __m128 Splat(__m128 value)
+		{
+			return _mm_shuffle_ps(value, value, _MM_SHUFFLE(kLane, kLane, kLane, kLane));
+		}
+
+		// Transforms direction by the 3x3 part of the matrix with columns c0, c1 and c2.
+		inline __m128 TransformDirection(__m128 c0, __m128 c1, __m128 c2, __m128 direction)
+		{
+			return MultiplyAdd(c2, Splat<2>(direction), MultiplyAdd(c1, Splat<1>(direction), _mm_mul_ps(c0, Splat<0>(direction))));
+		}
+
+		// Cross product of the xyz parts. The w part is 0.
+		inline __m128 Cross(__m128 a, __m128 b)
+		{
+			const __m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+			const __m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+			const __m128 cross_zxy = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+			return _mm_shuffle_ps(cross_zxy, cross_zxy, _MM_SHUFFLE(3, 0, 2, 1));
+		}
+
+		// Dot product of all four lanes, in every lane.
+		inline __m128 Dot(__m128 a, __m128 b)
+		{
+			const __m128 products = _mm_mul_ps(a, b);
+			const __m128 sums = _mm_add_ps(products, _mm_shuffle_ps(products, products, _MM_SHUFFLE(2, 3, 0, 1)));
+			return _mm_add_ps(sums, _mm_shuffle_ps(sums, sums, _MM_SHUFFLE(1, 0, 3, 2)));
+		}
+
+#if TRANSFORM_AFFINE_AVX
+		// The column in both 128-bit lanes.
+		inline __m256 BroadcastColumn(const glm::mat4& matrix, int column)
+		{
+			const __m128 value = LoadColumn(matrix, column);
+			return _mm256_insertf128_ps(_mm256_castps128_ps256(value), value, 1);
+		}
+
+		inline __m256 MultiplyAdd(__m256 a, __m256 b, __m256 c)
+		{
+#if TRANSFORM_AFFINE_FMA
+			return _mm256_fmadd_ps(a, b, c);
+#else
+			return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+		}
+#endif
+	}
+#endif
+
+	// Returns transform * local_matrix, for affine transform and local_matrix.
+	inline glm::mat4 AffineTransformedMatrix(const glm::mat4& transform, const glm::mat4& local_matrix)
+	{
+		glm::mat4 matrix;
+#if TRANSFORM_AFFINE_AVX
+		// Two columns of local_matrix at a time, one per 128-bit lane.
+		const __m256 c0 = detail::BroadcastColumn(transform, 0);
+		const __m256 c1 = detail::BroadcastColumn(transform, 1);
+		const __m256 c2 = detail::BroadcastColumn(transform, 2);
+		const __m256 c3 = detail::BroadcastColumn(transform, 3);
+		const __m256 l01 = _mm256_loadu_ps(&local_matrix[0][0]);
+		const __m256 l23 = _mm256_loadu_ps(&local_matrix[2][0]);
+		// The w parts of columns 0 and 1 are 0, and that of column 3 is 1.
+		const __m256 m01 = detail::MultiplyAdd(c2, _mm256_permute_ps(l01, _MM_SHUFFLE(2, 2, 2, 2)),
+			detail::MultiplyAdd(c1, _mm256_permute_ps(l01, _MM_SHUFFLE(1, 1, 1, 1)), _mm256_mul_ps(c0, _mm256_permute_ps(l01, _MM_SHUFFLE(0, 0, 0, 0)))));
+		const __m256 m23 = detail::MultiplyAdd(c3, _mm256_permute_ps(l23, _MM_SHUFFLE(3, 3, 3, 3)),
+			detail::MultiplyAdd(c2, _mm256_permute_ps(l23, _MM_SHUFFLE(2, 2, 2, 2)),
+			detail::MultiplyAdd(c1, _mm256_permute_ps(l23, _MM_SHUFFLE(1, 1, 1, 1)), _mm256_mul_ps(c0, _mm256_permute_ps(l23, _MM_SHUFFLE(0, 0, 0, 0))))));
+		_mm256_storeu_ps(&matrix[0][0], m01);
+		_mm256_storeu_ps(&matrix[2][0], m23);
+#elif TRANSFORM_AFFINE_SSE2
+		const __m128 c0 = detail::LoadColumn(transform, 0);
+		const __m128 c1 = detail::LoadColumn(transform, 1);
+		const __m128 c2 = detail::LoadColumn(transform, 2);
+		// The w parts of columns 0 to 2 are 0, and that of column 3 is 1.
+		detail::StoreColumn(matrix, 0, detail::TransformDirection(c0, c1, c2, detail::LoadColumn(local_matrix, 0)));
+		detail::StoreColumn(matrix, 1, detail::TransformDirection(c0, c1, c2, detail::LoadColumn(local_matrix, 1)));
+		detail::StoreColumn(matrix, 2, detail::TransformDirection(c0, c1, c2, detail::LoadColumn(local_matrix, 2)));
+		detail::StoreColumn(matrix, 3, _mm_add_ps(detail::TransformDirection(c0, c1, c2, detail::LoadColumn(local_matrix, 3)), detail::LoadColumn(transform, 3)));
+#else
+		for (int column = 0; column < 4; column++) {
+			for (int row = 0; row < 3; row++) {
+				matrix[column][row] = transform[0][row] * local_matrix[column][0] + transform[1][row] * local_matrix[column][1] + transform[2][row] * local_matrix[column][2];
+			}
+			matrix[column][3] = 0.0f;
+		}
+		for (int row = 0; row < 4; row++) {
+			matrix[3][row] += transform[3][row];
+		}
+#endif
+		return matrix;
+	}
+
+	// Returns the inverse of the affine matrix.
+	inline glm::mat4 AffineInverse(const glm::mat4& matrix)
+	{
+		glm::mat4 inverse;
+#if TRANSFORM_AFFINE_SSE2
+		const __m128 c0 = detail::LoadColumn(matrix, 0);
+		const __m128 c1 = detail::LoadColumn(matrix, 1);
+		const __m128 c2 = detail::LoadColumn(matrix, 2);
+		// The rows of the inverse of the 3x3 part are the cross products of its columns, over its determinant.
+		__m128 r0 = detail::Cross(c1, c2);
+		__m128 r1 = detail::Cross(c2, c0);
+		__m128 r2 = detail::Cross(c0, c1);
+		__m128 r3 = _mm_setzero_ps();
+		const __m128 inverse_determinant = _mm_div_ps(_mm_set1_ps(1.0f), detail::Dot(c0, r0));
+		r0 = _mm_mul_ps(r0, inverse_determinant);
+		r1 = _mm_mul_ps(r1, inverse_determinant);
+		r2 = _mm_mul_ps(r2, inverse_determinant);
+		_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+		detail::StoreColumn(inverse, 0, r0);
+		detail::StoreColumn(inverse, 1, r1);
+		detail::StoreColumn(inverse, 2, r2);
+		// The translation is the inverse of the 3x3 part applied to the negated translation.
+		detail::StoreColumn(inverse, 3, _mm_sub_ps(_mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f), detail::TransformDirection(r0, r1, r2, detail::LoadColumn(matrix, 3))));
+#else
+		// Rows of the inverse of the 3x3 part, as above.
+		const glm::mat4& m = matrix;
+		float rows[3][3];
+		for (int row = 0; row < 3; row++) {
+			const int c1 = (row + 1) % 3, c2 = (row + 2) % 3;
+			rows[row][0] = m[c1][1] * m[c2][2] - m[c1][2] * m[c2][1];
+			rows[row][1] = m[c1][2] * m[c2][0] - m[c1][0] * m[c2][2];
+			rows[row][2] = m[c1][0] * m[c2][1] - m[c1][1] * m[c2][0];
+		}
+		const float inverse_determinant = 1.0f / (matrix[0][0] * rows[0][0] + matrix[0][1] * rows[0][1] + matrix[0][2] * rows[0][2]);
+		for (int column = 0; column < 3; column++) {
+			for (int row = 0; row < 3; row++) {
+				inverse[column][row] = rows[row][column] * inverse_determinant;
+			}
+			inverse[column][3] = 0.0f;
+		}
+		for (int row = 0; row < 3; row++) {
+			inverse[3][row] = -(inverse[0][row] * matrix[3][0] + inverse[1][row] * matrix[3][1] + inverse[2][row] * matrix[3][2]);
+		}
+		inverse[3][3] = 1.0f;
+#endif
+		return inverse;
+	}
+
+	// Transforms the affine matrix to the affine transform's local space.
+	inline glm::mat4 AffineInverseTransformedMatrix(const glm::mat4& transform, const glm::mat4& matrix)
+	{
+		return AffineTransformedMatrix(AffineInverse(transform), matrix);
+	}
+
+	inline glm::mat4 MatrixFromTRS(const TRS& trs)
+	{
+		const glm::quat& q = trs.rotation;
+		const float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+		const float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+		const float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+		glm::mat4 matrix;
+		matrix[0][0] = (1.0f - 2.0f * (yy + zz)) * trs.scale.x;
+		matrix[0][1] = 2.0f * (xy + wz) * trs.scale.x;
+		matrix[0][2] = 2.0f * (xz - wy) * trs.scale.x;
+		matrix[0][3] = 0.0f;
+		matrix[1][0] = 2.0f * (xy - wz) * trs.scale.y;
+		matrix[1][1] = (1.0f - 2.0f * (xx + zz)) * trs.scale.y;
+		matrix[1][2] = 2.0f * (yz + wx) * trs.scale.y;
+		matrix[1][3] = 0.0f;
+		matrix[2][0] = 2.0f * (xz + wy) * trs.scale.z;
+		matrix[2][1] = 2.0f * (yz - wx) * trs.scale.z;
+		matrix[2][2] = (1.0f - 2.0f * (xx + yy)) * trs.scale.z;
+		matrix[2][3] = 0.0f;
+		matrix[3][0] = trs.translation.x;
+		matrix[3][1] = trs.translation.y;
+		matrix[3][2] = trs.translation.z;
+		matrix[3][3] = 1.0f;
+		return matrix;
+	}
+
+	/*
+	* Decomposes the affine matrix, dropping any shear. A reflection is kept
+	* as a negative scale along x. An axis of zero scale gets no rotation.
+	*/
+	inline TRS TRSFromMatrix(const glm::mat4& matrix)
+	{
+		TRS trs;
+		trs.translation = glm::vec3(matrix[3][0], matrix[3][1], matrix[3][2]);
+		float scale[3];
+		for (int column = 0; column < 3; column++) {
+			scale[column] = std::sqrt(matrix[column][0] * matrix[column][0] + matrix[column][1] * matrix[column][1] + matrix[column][2] * matrix[column][2]);
+		}
+		const float determinant =
+			matrix[0][0] * (matrix[1][1] * matrix[2][2] - matrix[2][1] * matrix[1][2]) -
+			matrix[1][0] * (matrix[0][1] * matrix[2][2] - matrix[2][1] * matrix[0][2]) +
+			matrix[2][0] * (matrix[0][1] * matrix[1][2] - matrix[1][1] * matrix[0][2]);
+		if (determinant < 0.0f) {
+			scale[0] = -scale[0];
+		}
+		trs.scale = glm::vec3(scale[0], scale[1], scale[2]);
+		if (scale[0] == 0.0f || scale[1] == 0.0f || scale[2] == 0.0f) {
+			trs.rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+			return trs;
+		}
+
+		// Rotation matrix element r[column][row].
+		float r[3][3];
+		for (int column = 0; column < 3; column++) {
+			for (int row = 0; row < 3; row++) {
+				r[column][row] = matrix[column][row] / scale[column];
+			}
+		}
+		// Derived from the largest of the diagonal of the quaternion's outer product, for precision.
+		const float trace = r[0][0] + r[1][1] + r[2][2];
+		if (trace > 0.0f) {
+			const float s = 0.5f / std::sqrt(trace + 1.0f);
+			trs.rotation = glm::quat(0.25f / s, (r[1][2] - r[2][1]) * s, (r[2][0] - r[0][2]) * s, (r[0][1] - r[1][0]) * s);
+		}
+		else if (r[0][0] > r[1][1] && r[0][0] > r[2][2]) {
+			const float s = 0.5f / std::sqrt(1.0f + r[0][0] - r[1][1] - r[2][2]);
+			trs.rotation = glm::quat((r[1][2] - r[2][1]) * s, 0.25f / s, (r[1][0] + r[0][1]) * s, (r[2][0] + r[0][2]) * s);
+		}
+		else if (r[1][1] > r[2][2]) {
+			const float s = 0.5f / std::sqrt(1.0f + r[1][1] - r[0][0] - r[2][2]);
+			trs.rotation = glm::quat((r[2][0] - r[0][2]) * s, (r[1][0] + r[0][1]) * s, 0.25f / s, (r[2][1] + r[1][2]) * s);
+		}
+		else {
+			const float s = 0.5f / std::sqrt(1.0f + r[2][2] - r[0][0] - r[1][1]);
+			trs.rotation = glm::quat((r[0][1] - r[1][0]) * s, (r[2][0] + r[0][2]) * s, (r[2][1] + r[1][2]) * s, 0.25f / s);
+		}
+		return trs;
+	}
+
+	// Returns transform * MatrixFromTRS(local_trs), for affine transform.
+	inline glm::mat4 AffineTransformedTRS(const glm::mat4& transform, const TRS& local_trs)
+	{
+		return AffineTransformedMatrix(transform, MatrixFromTRS(local_trs));
+	}
+
+	inline AffineMatrix AffineMatrixFromMatrix(const glm::mat4& matrix)
+	{
+		AffineMatrix affine_matrix;
+#if TRANSFORM_AFFINE_SSE2
+		__m128 r0 = detail::LoadColumn(matrix, 0);
+		__m128 r1 = detail::LoadColumn(matrix, 1);
+		__m128 r2 = detail::LoadColumn(matrix, 2);
+		__m128 r3 = detail::LoadColumn(matrix, 3);
+		_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+		detail::StoreRow(affine_matrix, 0, r0);
+		detail::StoreRow(affine_matrix, 1, r1);
+		detail::StoreRow(affine_matrix, 2, r2);
+#else
+		for (int row = 0; row < 3; row++) {
+			affine_matrix.rows[row] = glm::vec4(matrix[0][row], matrix[1][row], matrix[2][row], matrix[3][row]);
+		}
+#endif
+		return affine_matrix;
+	}
+
+	inline glm::mat4 MatrixFromAffineMatrix(const AffineMatrix& affine_matrix)
+	{
+		glm::mat4 matrix;
+#if TRANSFORM_AFFINE_SSE2
+		__m128 c0 = detail::LoadRow(affine_matrix, 0);
+		__m128 c1 = detail::LoadRow(affine_matrix, 1);
+		__m128 c2 = detail::LoadRow(affine_matrix, 2);
+		__m128 c3 = _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f);
+		_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+		detail::StoreColumn(matrix, 0, c0);
+		detail::StoreColumn(matrix, 1, c1);
+		detail::StoreColumn(matrix, 2, c2);
+		detail::StoreColumn(matrix, 3, c3);
+#else
+		for (int column = 0; column < 4; column++) {
+			matrix[column] = glm::vec4(affine_matrix.rows[0][column], affine_matrix.rows[1][column], affine_matrix.rows[2][column], column == 3 ? 1.0f : 0.0f);
+		}
+#endif
+		return matrix;
+	}
+
+	inline AffineMatrix IdentityAffineMatrix()
+	{
+		AffineMatrix affine_matrix;
+		affine_matrix.rows[0] = glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+		affine_matrix.rows[1] = glm::vec4(0.0f, 1.0f, 0.0f, 0.0f);
+		affine_matrix.rows[2] = glm::vec4(0.0f, 0.0f, 1.0f, 0.0f);
+		return affine_matrix;
+	}
+
+	// Returns transform * local_matrix.
+	inline AffineMatrix AffineTransformedMatrix(const AffineMatrix& transform, const AffineMatrix& local_matrix)
+	{
+		AffineMatrix matrix;
+#if TRANSFORM_AFFINE_SSE2
+		// Every row is a combination of the rows of local_matrix, plus the translation of transform.
+		const __m128 l0 = detail::LoadRow(local_matrix, 0);
+		const __m128 l1 = detail::LoadRow(local_matrix, 1);
+		const __m128 l2 = detail::LoadRow(local_matrix, 2);
+		for (int row = 0; row < 3; row++) {
+			const __m128 t = detail::LoadRow(transform, row);
+			detail::StoreRow(matrix, row, _mm_add_ps(detail::TransformDirection(l0, l1, l2, t), detail::MaskW(t)));
+		}
+#else
+		for (int row = 0; row < 3; row++) {
+			const glm::vec4& t = transform.rows[row];
+			for (int column = 0; column < 4; column++) {
+				matrix.rows[row][column] = t[0] * local_matrix.rows[0][column] + t[1] * local_matrix.rows[1][column] + t[2] * local_matrix.rows[2][column];
+			}
+			matrix.rows[row][3] += t[3];
+		}
+#endif
+		return matrix;
+	}
+
+	inline AffineMatrix AffineInverse(const AffineMatrix& matrix)
+	{
+		AffineMatrix inverse;
+#if TRANSFORM_AFFINE_SSE2
+		__m128 c0 = detail::LoadRow(matrix, 0);
+		__m128 c1 = detail::LoadRow(matrix, 1);
+		__m128 c2 = detail::LoadRow(matrix, 2);
+		__m128 translation = _mm_setzero_ps();
+		_MM_TRANSPOSE4_PS(c0, c1, c2, translation);
+		// The rows of the inverse of the 3x3 part are the cross products of its columns, over its determinant.
+		const __m128 inverse_determinant = _mm_div_ps(_mm_set1_ps(1.0f), detail::Dot(c0, detail::Cross(c1, c2)));
+		const __m128 rows[3] = {
+			_mm_mul_ps(detail::Cross(c1, c2), inverse_determinant),
+			_mm_mul_ps(detail::Cross(c2, c0), inverse_determinant),
+			_mm_mul_ps(detail::Cross(c0, c1), inverse_determinant),
+		};
+		// The translation is the inverse of the 3x3 part applied to the negated translation.
+		for (int row = 0; row < 3; row++) {
+			detail::StoreRow(inverse, row, _mm_sub_ps(rows[row], detail::MaskW(detail::Dot(rows[row], translation))));
+		}
+#else
+		const glm::vec4* m = matrix.rows;
+		for (int row = 0; row < 3; row++) {
+			const int c1 = (row + 1) % 3, c2 = (row + 2) % 3;
+			inverse.rows[row] = glm::vec4(
+				m[1][c1] * m[2][c2] - m[2][c1] * m[1][c2],
+				m[2][c1] * m[0][c2] - m[0][c1] * m[2][c2],
+				m[0][c1] * m[1][c2] - m[1][c1] * m[0][c2],
+				0.0f);
+		}
+		const float inverse_determinant = 1.0f / (m[0][0] * inverse.rows[0][0] + m[1][0] * inverse.rows[0][1] + m[2][0] * inverse.rows[0][2]);
+		for (int row = 0; row < 3; row++) {
+			glm::vec4& r = inverse.rows[row];
+			r = glm::vec4(r[0] * inverse_determinant, r[1] * inverse_determinant, r[2] * inverse_determinant, 0.0f);
+			r[3] = -(r[0] * m[0][3] + r[1] * m[1][3] + r[2] * m[2][3]);
+		}
+#endif
+		return inverse;
+	}
+
+	// Transforms the affine matrix to the affine transform's local space.
+	inline AffineMatrix AffineInverseTransformedMatrix(const AffineMatrix& transform, const AffineMatrix& matrix)
+	{
+		return AffineTransformedMatrix(AffineInverse(transform), matrix);
+	}
+
+	inline AffineMatrix AffineMatrixFromTRS(const TRS& trs)
+	{
+		const glm::quat& q = trs.rotation;
+		const float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+		const float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+		const float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+		AffineMatrix affine_matrix;
+		affine_matrix.rows[0] = glm::vec4((1.0f - 2.0f * (yy + zz)) * trs.scale.x, 2.0f * (xy - wz) * trs.scale.y, 2.0f * (xz + wy) * trs.scale.z, trs.translation.x);
+		affine_matrix.rows[1] = glm::vec4(2.0f * (xy + wz) * trs.scale.x, (1.0f - 2.0f * (xx + zz)) * trs.scale.y, 2.0f * (yz - wx) * trs.scale.z, trs.translation.y);
+		affine_matrix.rows[2] = glm::vec4(2.0f * (xz - wy) * trs.scale.x, 2.0f * (yz + wx) * trs.scale.y, (1.0f - 2.0f * (xx + yy)) * trs.scale.z, trs.translation.z);
+		return affine_matrix;
+	}
+
+	inline TRS TRSFromMatrix(const AffineMatrix& affine_matrix)
+	{
+		return TRSFromMatrix(MatrixFromAffineMatrix(affine_matrix));
+	}
+
+	// Returns transform * AffineMatrixFromTRS(local_trs).
+	inline AffineMatrix AffineTransformedTRS(const AffineMatrix& transform, const TRS& local_trs)
+	{
+		return AffineTransformedMatrix(transform, AffineMatrixFromTRS(local_trs));
+	}
+}
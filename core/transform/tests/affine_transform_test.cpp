@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+#include <random>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "../affine_transform.h"
+
+static void ExpectMatrixNear(const glm::mat4& matrix, const glm::mat4& expected_matrix)
+{
+    for (int column = 0; column < 4; column++) {
+        for (int row = 0; row < 4; row++) {
+            EXPECT_NEAR(matrix[column][row], expected_matrix[column][row], 1e-4f) << "column " << column << ", row " << row;
+        }
+    }
+}
+
+static transform::TRS RandomTRS(std::mt19937& random_engine)
+{
+    std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+    glm::vec3 axis(distribution(random_engine), distribution(random_engine), distribution(random_engine) + 2.0f);
+    axis = axis * (1.0f / std::sqrt(axis.x * axis.x + axis.y * axis.y + axis.z * axis.z));
+    transform::TRS trs;
+    trs.translation = glm::vec3(distribution(random_engine) * 10.0f, distribution(random_engine) * 10.0f, distribution(random_engine) * 10.0f);
+    trs.rotation = glm::angleAxis(distribution(random_engine) * 3.0f, axis);
+    trs.scale = glm::vec3(1.5f + distribution(random_engine), 1.5f + distribution(random_engine), 1.5f + distribution(random_engine));
+    return trs;
+}
+
+TEST(affine_transform_test_suite, affine_transformed_matrix_test)
+{
+    std::mt19937 random_engine(25);
+    for (int i = 0; i < 100; i++) {
+        const glm::mat4 transform = transform::MatrixFromTRS(RandomTRS(random_engine));
+        const glm::mat4 local_matrix = transform::MatrixFromTRS(RandomTRS(random_engine));
+        ExpectMatrixNear(transform::AffineTransformedMatrix(transform, local_matrix), transform * local_matrix);
+    }
+}
+
+TEST(affine_transform_test_suite, affine_inverse_test)
+{
+    std::mt19937 random_engine(25);
+    for (int i = 0; i < 100; i++) {
+        const glm::mat4 transform = transform::MatrixFromTRS(RandomTRS(random_engine));
+        const glm::mat4 matrix = transform::MatrixFromTRS(RandomTRS(random_engine));
+        ExpectMatrixNear(transform::AffineInverse(transform), glm::inverse(transform));
+        ExpectMatrixNear(transform::AffineInverseTransformedMatrix(transform, matrix), glm::inverse(transform) * matrix);
+    }
+}
+
+TEST(affine_transform_test_suite, trs_round_trip_test)
+{
+    std::mt19937 random_engine(25);
+    for (int i = 0; i < 100; i++) {
+        const glm::mat4 matrix = transform::MatrixFromTRS(RandomTRS(random_engine));
+        ExpectMatrixNear(transform::MatrixFromTRS(transform::TRSFromMatrix(matrix)), matrix);
+    }
+
+    // A reflection is kept as a negative scale.
+    glm::mat4 reflection(1.0f);
+    reflection[1][1] = -2.0f;
+    const transform::TRS trs = transform::TRSFromMatrix(reflection);
+    EXPECT_LT(trs.scale.x, 0.0f);
+    ExpectMatrixNear(transform::MatrixFromTRS(trs), reflection);
+}
+
+TEST(affine_transform_test_suite, affine_matrix_test)
+{
+    std::mt19937 random_engine(25);
+    for (int i = 0; i < 100; i++) {
+        const transform::TRS transform_trs = RandomTRS(random_engine);
+        const transform::TRS local_trs = RandomTRS(random_engine);
+        const glm::mat4 transform = transform::MatrixFromTRS(transform_trs);
+        const glm::mat4 local_matrix = transform::MatrixFromTRS(local_trs);
+        const transform::AffineMatrix affine_transform = transform::AffineMatrixFromTRS(transform_trs);
+        const transform::AffineMatrix affine_local_matrix = transform::AffineMatrixFromMatrix(local_matrix);
+        ExpectMatrixNear(transform::MatrixFromAffineMatrix(affine_transform), transform);
+        ExpectMatrixNear(transform::MatrixFromAffineMatrix(transform::AffineTransformedMatrix(affine_transform, affine_local_matrix)), transform * local_matrix);
+        ExpectMatrixNear(transform::MatrixFromAffineMatrix(transform::AffineTransformedTRS(affine_transform, local_trs)), transform * local_matrix);
+        ExpectMatrixNear(transform::MatrixFromAffineMatrix(transform::AffineInverse(affine_transform)), glm::inverse(transform));
+        ExpectMatrixNear(transform::MatrixFromAffineMatrix(transform::AffineInverseTransformedMatrix(affine_transform, affine_local_matrix)), glm::inverse(transform) * local_matrix);
+    }
+    ExpectMatrixNear(transform::MatrixFromAffineMatrix(transform::IdentityAffineMatrix()), glm::mat4(1.0f));
+}
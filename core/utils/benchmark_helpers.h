@@ -0,0 +1,227 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <vector>
+
+/*
+* Minimal in-tree benchmark harness. Benchmarks are registered similarly to
+* gtest tests:
+*
+*	BENCHMARK_CASE(suite_name, case_name, 10000, 100000)
+*	{
+*		// Setup for state.N() items...
+*		state.Measure([&]() {
+*			// Work that processes state.N() items.
+*		});
+*	}
+*
+* Every case is run once per listed problem size. The measured block is
+* repeated a few times and the fastest repetition is reported. Cases must be
+* deterministic, i.e. seed their random generators with a constant, so that
+* results are comparable across versions.
+*
+* Command line: [filter] [--repetitions=N] [--json=path]
+* --json writes the results to path as JSON, for tracking regressions:
+*
+*	{ "context": { "date": ..., "build_type": ..., "repetitions": ... },
+*	  "benchmarks": [ { "name": ..., "n": ..., "best_ms": ..., "mean_ms": ...,
+*	                    "items_per_second": ... }, ... ] }
+*/
+
+namespace benchmark_helpers {
+	// Prevents the compiler from optimizing away the computation of value.
+	template<typename T>
+	inline void DoNotOptimize(const T& value)
+	{
+		static volatile unsigned char sink;
+		sink = *reinterpret_cast<const volatile unsigned char*>(&value);
+	}
+
+	class BenchmarkState
+	{
+	public:
+		BenchmarkState(std::size_t n, std::size_t repetitions) : n_(n), repetitions_(repetitions), best_seconds_(0.0), total_seconds_(0.0), measured_repetitions_(0) {}
+
+		// Problem size for this run of the benchmark case.
+		std::size_t N() const
+		{
+			return n_;
+		}
+
+		// Times block repetitions times. Setup may be performed before every
+		// repetition by passing a non-empty setup block, which is not timed.
+		void Measure(std::function<void()> block, std::function<void()> setup = nullptr)
+		{
+			for (std::size_t r = 0; r < repetitions_; ++r) {
+				if (setup) {
+					setup();
+				}
+				const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				block();
+				const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				best_seconds_ = measured_repetitions_ == 0 ? seconds : std::min(best_seconds_, seconds);
+				total_seconds_ += seconds;
+				measured_repetitions_++;
+			}
+		}
+
+		double BestSeconds() const
+		{
+			return best_seconds_;
+		}
+
+		double MeanSeconds() const
+		{
+			return measured_repetitions_ > 0 ? total_seconds_ / measured_repetitions_ : 0.0;
+		}
+
+	private:
+		std::size_t n_;
+		std::size_t repetitions_;
+		double best_seconds_;
+		double total_seconds_;
+		std::size_t measured_repetitions_;
+	};
+
+	typedef void (*BenchmarkFunction)(BenchmarkState&);
+
+	class BenchmarkRegistry
+	{
+	public:
+		static BenchmarkRegistry& GetInstance()
+		{
+			static BenchmarkRegistry registry;
+			return registry;
+		}
+
+		bool Register(const char* name, std::vector<std::size_t> problem_sizes, BenchmarkFunction function)
+		{
+			cases_.push_back({ name, problem_sizes, function });
+			return true;
+		}
+
+		/*
+		* Runs every registered case whose name contains the optional filter
+		* argument, i.e. `ecs_benchmarks archetype_storage`. See the top of this
+		* file for the other arguments.
+		*/
+		int RunAll(int argc, char** argv)
+		{
+			std::string filter;
+			std::string json_path;
+			for (int a_idx = 1; a_idx < argc; ++a_idx) {
+				const std::string argument = argv[a_idx];
+				if (argument.compare(0, 7, "--json=") == 0) {
+					json_path = argument.substr(7);
+				}
+				else if (argument.compare(0, 14, "--repetitions=") == 0) {
+					repetitions_ = std::max(std::atoi(argument.c_str() + 14), 1);
+				}
+				else if (argument.compare(0, 2, "--") == 0) {
+					std::fprintf(stderr, "Unknown argument %s\n", argument.c_str());
+					return 1;
+				}
+				else {
+					filter = argument;
+				}
+			}
+
+			std::vector<BenchmarkResult> results;
+			std::printf("%-56s %10s %12s %12s %14s\n", "benchmark", "n", "best (ms)", "mean (ms)", "items/s");
+			for (const BenchmarkCase& benchmark_case : cases_) {
+				if (benchmark_case.name.find(filter) == std::string::npos) {
+					continue;
+				}
+				for (std::size_t n : benchmark_case.problem_sizes) {
+					BenchmarkState state(n, repetitions_);
+					benchmark_case.function(state);
+					const BenchmarkResult result = {
+						benchmark_case.name,
+						n,
+						state.BestSeconds() * 1000.0,
+						state.MeanSeconds() * 1000.0,
+						state.BestSeconds() > 0.0 ? n / state.BestSeconds() : 0.0
+					};
+					std::printf("%-56s %10zu %12.3f %12.3f %14.0f\n", result.name.c_str(), result.n, result.best_ms, result.mean_ms, result.items_per_second);
+					std::fflush(stdout);
+					results.push_back(result);
+				}
+			}
+			if (!json_path.empty() && !WriteJSON(json_path, results)) {
+				std::fprintf(stderr, "Could not write %s\n", json_path.c_str());
+				return 1;
+			}
+			return 0;
+		}
+
+	private:
+		struct BenchmarkCase {
+			std::string name;
+			std::vector<std::size_t> problem_sizes;
+			BenchmarkFunction function;
+		};
+
+		struct BenchmarkResult {
+			std::string name;
+			std::size_t n;
+			double best_ms;
+			double mean_ms;
+			double items_per_second;
+		};
+
+		bool WriteJSON(const std::string& path, const std::vector<BenchmarkResult>& results) const
+		{
+			std::FILE* file = std::fopen(path.c_str(), "w");
+			if (!file) {
+				return false;
+			}
+			char date[32];
+			const std::time_t now = std::time(nullptr);
+			std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+#ifdef NDEBUG
+			const char* build_type = "release";
+#else
+			const char* build_type = "debug";
+#endif
+			std::fprintf(file, "{\n  \"context\": {\n");
+			std::fprintf(file, "    \"date\": \"%s\",\n", date);
+			std::fprintf(file, "    \"build_type\": \"%s\",\n", build_type);
+			std::fprintf(file, "    \"repetitions\": %zu\n", repetitions_);
+			std::fprintf(file, "  },\n  \"benchmarks\": [");
+			for (std::size_t r_idx = 0; r_idx < results.size(); ++r_idx) {
+				const BenchmarkResult& result = results[r_idx];
+				// Case names are made of identifiers, so they need no escaping.
+				std::fprintf(
+					file,
+					"%s\n    { \"name\": \"%s\", \"n\": %zu, \"best_ms\": %.6f, \"mean_ms\": %.6f, \"items_per_second\": %.1f }",
+					r_idx == 0 ? "" : ",",
+					result.name.c_str(),
+					result.n,
+					result.best_ms,
+					result.mean_ms,
+					result.items_per_second
+				);
+			}
+			std::fprintf(file, "\n  ]\n}\n");
+			return std::fclose(file) == 0;
+		}
+
+		BenchmarkRegistry() : repetitions_(5) {}
+
+		std::vector<BenchmarkCase> cases_;
+		std::size_t repetitions_;
+	};
+}
+
+#define BENCHMARK_CASE(SUITE_NAME, CASE_NAME, ...) \
+	static void SUITE_NAME##_##CASE_NAME(benchmark_helpers::BenchmarkState& state); \
+	static const bool SUITE_NAME##_##CASE_NAME##_registered = benchmark_helpers::BenchmarkRegistry::GetInstance().Register( \
+		#SUITE_NAME "." #CASE_NAME, { __VA_ARGS__ }, &SUITE_NAME##_##CASE_NAME); \
+	static void SUITE_NAME##_##CASE_NAME(benchmark_helpers::BenchmarkState& state)
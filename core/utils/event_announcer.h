@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <vector>
 
 template<typename T>
@@ -15,7 +16,7 @@ public:
 	}
 
 	template<typename F, typename... Args>
-	void Announce(F func, Args... args) {
+	void Announce(F func, const Args&... args) {
 		for (T* listener : listeners_) {
 			(listener->*func)(args...);
 		}
@@ -1,33 +1,47 @@
 #pragma once
 
-#include <map>
-#include <stack>
+#include <algorithm>
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
 #include <vector>
-#include <iostream>
 
-template<typename TKey, typename TValue>
+/*
+* Maps sets of keys, given as sorted vectors, to values, and finds the values
+* of every superset of a key set. Nodes live in a single pool and refer to
+* each other by index. Children are kept in vectors sorted by key, and nodes
+* that are removed are reused by later insertions. Values are allocated
+* separately, so their addresses stay valid until they are removed.
+*
+* With SignatureBits > 0, every node also keeps a bitset of the keys in its
+* subtree. Superset searches skip subtrees that lack one of the keys
+* searched for with a few AND instructions. Keys of SignatureBits or more
+* are allowed, but are not used for skipping.
+*/
+template<typename TKey, typename TValue, std::size_t SignatureBits = 0>
 class SetTrie {
-private:
-	struct SetTrieNode {
-		TKey key;
-		TValue value;
-		bool has_value;
-		std::map<TKey, SetTrieNode> children;
-	};
-
-	SetTrieNode* root_node_;
 public:
 	SetTrie() {
-		root_node_ = new SetTrieNode();
+		nodes_.emplace_back();
 	}
 
-	~SetTrie() {
-		delete root_node_;
-	}
+	SetTrie(const SetTrie&) = delete;
+
+	SetTrie& operator=(const SetTrie&) = delete;
 
 	std::vector<TValue*> GetValuesInOrder()
 	{
-		return FindSuperKeySetValues({});
+		std::vector<TValue*> values;
+		GetValuesInOrder(values);
+		return values;
+	}
+
+	// Fills values with the value of every key set, in lexicographic order of the key sets.
+	void GetValuesInOrder(std::vector<TValue*>& values)
+	{
+		FindSuperKeySetValues({}, values);
 	}
 
 	/*
@@ -41,112 +55,260 @@ public:
 
 	std::vector<TValue*> FindSuperKeySetValues(const std::vector<TKey>& key_set) {
 		std::vector<TValue*> supersets;
-		std::size_t index = 0;
-		std::stack<std::pair<SetTrieNode*, std::map<TKey, SetTrieNode>::iterator>> stack;
-		stack.push(std::make_pair(root_node_, root_node_->children.begin()));
+		FindSuperKeySetValues(key_set, supersets);
+		return supersets;
+	}
+
+	/*
+	* Fills supersets with the values of every key set that is a superset of
+	* key_set, in lexicographic order of the key sets. Does not allocate once
+	* supersets and the internal search stack have grown large enough.
+	*/
+	void FindSuperKeySetValues(const std::vector<TKey>& key_set, std::vector<TValue*>& supersets) {
+		supersets.clear();
+		// The search stack is reused across calls. It is per thread, so that
+		// concurrent searches of the same trie do not interfere.
+		static thread_local std::vector<SearchFrame> stack;
+		stack.clear();
+		stack.push_back({ kRootNodeIndex, 0, 0 });
+		if (SignatureBits > 0) {
+			SuffixSignatures(key_set);
+		}
 		while (!stack.empty()) {
-			SetTrieNode *current_node = stack.top().first;
-			std::map<TKey, SetTrieNode>::iterator children_iter = stack.top().second;
-			// Check if there are no more children OR if the next child's key is larger than the next key we are looking for.
-			// In both cases, we should stop traversing the children of current_node.
-			if (children_iter == current_node->children.end() || (index < key_set.size() && children_iter->second.key > key_set[index])) {
-				stack.pop();
-				if (index > 0 && current_node->key == key_set[index - 1]) {
-					index--;
-				}
+			SearchFrame& frame = stack.back();
+			const SetTrieNode& node = nodes_[frame.node_index];
+			// Stop traversing the children of node once there are no more, or once
+			// their keys are larger than the next key that we are looking for.
+			if (frame.child_position == node.children.size()
+				|| (frame.matched_count < key_set.size() && node.children[frame.child_position].key > key_set[frame.matched_count])) {
+				stack.pop_back();
+				continue;
+			}
+			const ChildLink& child = node.children[frame.child_position++];
+			std::size_t matched_count = frame.matched_count;
+			if (matched_count < key_set.size() && child.key == key_set[matched_count]) {
+				matched_count++;
+			}
+			const SetTrieNode& child_node = nodes_[child.node_index];
+			if (SignatureBits > 0 && !HasSignatureKeys(child_node, matched_count)) {
+				// The keys that are still missing are not in the child's subtree.
+				continue;
 			}
-			else {
-				SetTrieNode *next_node = &children_iter->second;
-				std::advance(stack.top().second, 1);
-				stack.push(std::make_pair(next_node, next_node->children.begin()));
-				if (index < key_set.size() && next_node->key == key_set[index]) {
-					index++;
-				}
-				if (index == key_set.size() && next_node->has_value) {
-					supersets.push_back(&next_node->value);
-				}	
+			if (matched_count == key_set.size() && child_node.value) {
+				supersets.push_back(child_node.value.get());
 			}
+			// May reallocate the stack, so frame must not be used after this.
+			stack.push_back({ child.node_index, 0, matched_count });
 		}
-
-		return supersets;
 	}
 
 	TValue* InsertValueForKeySet(const std::vector<TKey>& key_set, TValue&& value) {
-		TValue temp = value;
-		return InsertValueForKeySet(key_set, temp);
+		return EmplaceValueForKeySet(key_set, std::move(value));
 	}
 
 	TValue* InsertValueForKeySet(const std::vector<TKey>& key_set, const TValue& value) {
-		SetTrieNode *current_node = root_node_;
-		std::size_t index = 0;
-		while (index < key_set.size()) {
-			std::map<TKey, SetTrieNode>::iterator children_iter = current_node->children.find(key_set[index]);
-			if (children_iter == current_node->children.end()) {
-				break;
+		return EmplaceValueForKeySet(key_set, value);
+	}
+
+	// Constructs the value for key_set in place from args.
+	template<typename... TArgs>
+	TValue* EmplaceValueForKeySet(const std::vector<TKey>& key_set, TArgs&&... args) {
+		if (SignatureBits > 0) {
+			SuffixSignatures(key_set);
+		}
+		NodeIndex node_index = kRootNodeIndex;
+		for (std::size_t k_idx = 0; k_idx < key_set.size(); ++k_idx) {
+			NodeIndex child_index = FindChild(node_index, key_set[k_idx]);
+			if (child_index == kNoNodeIndex) {
+				// Allocating may reallocate nodes_, so the parent is looked up after.
+				child_index = AllocateNode(key_set[k_idx]);
+				std::vector<ChildLink>& children = nodes_[node_index].children;
+				children.insert(LowerBoundChild(children, key_set[k_idx]), { key_set[k_idx], child_index });
 			}
-			index++;
-			current_node = &children_iter->second;
+			if (SignatureBits > 0) {
+				// The rest of the key set ends up in the subtree of node.
+				nodes_[node_index].subtree_signature |= SearchSuffixSignatures()[k_idx];
+			}
+			node_index = child_index;
 		}
 
-		if (index == key_set.size() && current_node->has_value) {
+		if (nodes_[node_index].value) {
 			throw std::runtime_error("Trying to insert value for keyset that is already in Set Trie");
 		}
-
-		while (index < key_set.size()) {
-			SetTrieNode new_node;
-			new_node.key = key_set[index];
-			new_node.has_value = false;
-			std::pair<std::map<TKey, SetTrieNode>::iterator, bool> result = current_node->children.insert(std::make_pair(new_node.key, new_node));
-			current_node = &result.first->second;
-			index++;
-		}
-
-		current_node->value = value;
-		current_node->has_value = true;
-		return &current_node->value;
+		nodes_[node_index].value.reset(new TValue(std::forward<TArgs>(args)...));
+		value_count_++;
+		return nodes_[node_index].value.get();
 	}
 
 	void RemoveValueForKeySet(const std::vector<TKey>& key_set) {
-		std::size_t index = 0;
-		std::stack<SetTrieNode*> stack;
-		stack.push(root_node_);
-		while (index < key_set.size()) {
-			std::map<TKey, SetTrieNode>::iterator children_iter = stack.top()->children.find(key_set[index]);
-			if (children_iter == stack.top()->children.end()) {
+		std::vector<NodeIndex>& path = path_;
+		path.clear();
+		path.push_back(kRootNodeIndex);
+		for (const TKey& key : key_set) {
+			const NodeIndex child_index = FindChild(path.back(), key);
+			if (child_index == kNoNodeIndex) {
 				throw std::runtime_error("Keyset cannot be found in Set Trie");
-				return;
 			}
-			index++;
-			stack.push(&children_iter->second);
+			path.push_back(child_index);
 		}
 
-		stack.top()->has_value = false;
+		// Destroys the value.
+		nodes_[path.back()].value.reset();
+		value_count_--;
 
-		// If top node has no children, then we should traverse ancestors to delete any unnecessary nodes
-		while (!stack.top()->has_value && stack.top()->children.empty()) {
-			TKey childKey = stack.top()->key;
-			stack.pop();
-			stack.top()->children.erase(childKey);
+		// If the last node has no children, then we should traverse ancestors to free any unnecessary nodes.
+		// The root node is never freed.
+		while (path.size() > 1 && !nodes_[path.back()].value && nodes_[path.back()].children.empty()) {
+			const NodeIndex node_index = path.back();
+			path.pop_back();
+			std::vector<ChildLink>& siblings = nodes_[path.back()].children;
+			siblings.erase(LowerBoundChild(siblings, nodes_[node_index].key));
+			free_node_indices_.push_back(node_index);
+		}
+		if (SignatureBits > 0) {
+			for (std::size_t p_idx = path.size(); p_idx > 0; --p_idx) {
+				UpdateSubtreeSignature(path[p_idx - 1]);
+			}
 		}
 	}
 
 	bool TryGetValueForKeySet(const std::vector<TKey>& key_set, TValue*& value) {
-		SetTrieNode *current_node = root_node_;
-		std::size_t index = 0;
-		while (index < key_set.size()) {
-			std::map<TKey, SetTrieNode>::iterator children_iter = current_node->children.find(key_set[index]);
-			if (children_iter == current_node->children.end()) {
+		NodeIndex node_index = kRootNodeIndex;
+		for (const TKey& key : key_set) {
+			node_index = FindChild(node_index, key);
+			if (node_index == kNoNodeIndex) {
 				// keyset was not found in set trie.
 				return false;
 			}
-			index++;
-			current_node = &children_iter->second;
 		}
-		if (!current_node->has_value) {
+		if (!nodes_[node_index].value) {
 			// keyset exists in set trie but the corresponding value is not set.
 			return false;
 		}
-		value = &current_node->value;
+		value = nodes_[node_index].value.get();
 		return true;
 	}
-};
\ No newline at end of file
+
+	std::size_t ValueCount() const {
+		return value_count_;
+	}
+
+private:
+	typedef std::uint32_t NodeIndex;
+
+	typedef std::bitset<SignatureBits> Signature;
+
+	static const NodeIndex kRootNodeIndex = 0;
+
+	static const NodeIndex kNoNodeIndex = ~(NodeIndex)0;
+
+	struct ChildLink {
+		TKey key;
+		NodeIndex node_index;
+	};
+
+	struct SetTrieNode {
+		TKey key = TKey();
+		std::unique_ptr<TValue> value;
+		// Sorted by key.
+		std::vector<ChildLink> children;
+		// Keys of the node and of all of its descendants, if signatures are enabled.
+		Signature subtree_signature;
+	};
+
+	struct SearchFrame {
+		NodeIndex node_index;
+		std::size_t child_position;
+		// Number of keys of the searched key set on the path to the node.
+		std::size_t matched_count;
+	};
+
+	std::vector<SetTrieNode> nodes_;
+
+	std::vector<NodeIndex> free_node_indices_;
+
+	std::size_t value_count_ = 0;
+
+	// Scratch space, kept to avoid allocating on every call.
+	std::vector<NodeIndex> path_;
+
+	static typename std::vector<ChildLink>::iterator LowerBoundChild(std::vector<ChildLink>& children, const TKey& key)
+	{
+		return std::lower_bound(children.begin(), children.end(), key, [](const ChildLink& child, const TKey& key) {
+			return child.key < key;
+		});
+	}
+
+	NodeIndex FindChild(NodeIndex node_index, const TKey& key)
+	{
+		std::vector<ChildLink>& children = nodes_[node_index].children;
+		const typename std::vector<ChildLink>::iterator child_iter = LowerBoundChild(children, key);
+		return child_iter != children.end() && child_iter->key == key ? child_iter->node_index : kNoNodeIndex;
+	}
+
+	NodeIndex AllocateNode(const TKey& key)
+	{
+		NodeIndex node_index;
+		if (!free_node_indices_.empty()) {
+			node_index = free_node_indices_.back();
+			free_node_indices_.pop_back();
+		}
+		else {
+			node_index = (NodeIndex)nodes_.size();
+			nodes_.emplace_back();
+		}
+		SetTrieNode& node = nodes_[node_index];
+		node.key = key;
+		node.children.clear();
+		node.subtree_signature.reset();
+		if (SignatureBits > 0 && (std::size_t)key < SignatureBits) {
+			node.subtree_signature.set((std::size_t)key);
+		}
+		return node_index;
+	}
+
+	void UpdateSubtreeSignature(NodeIndex node_index)
+	{
+		SetTrieNode& node = nodes_[node_index];
+		node.subtree_signature.reset();
+		if (node_index != kRootNodeIndex && (std::size_t)node.key < SignatureBits) {
+			node.subtree_signature.set((std::size_t)node.key);
+		}
+		for (const ChildLink& child : node.children) {
+			node.subtree_signature |= nodes_[child.node_index].subtree_signature;
+		}
+	}
+
+	// Signatures of the keys key_set[i..] for every i of the key set that is
+	// being searched for or inserted.
+	static std::vector<Signature>& SearchSuffixSignatures()
+	{
+		static thread_local std::vector<Signature> suffix_signatures;
+		return suffix_signatures;
+	}
+
+	static void SuffixSignatures(const std::vector<TKey>& key_set)
+	{
+		std::vector<Signature>& suffix_signatures = SearchSuffixSignatures();
+		suffix_signatures.assign(key_set.size() + 1, Signature());
+		for (std::size_t k_idx = key_set.size(); k_idx > 0; --k_idx) {
+			suffix_signatures[k_idx - 1] = suffix_signatures[k_idx];
+			if ((std::size_t)key_set[k_idx - 1] < SignatureBits) {
+				suffix_signatures[k_idx - 1].set((std::size_t)key_set[k_idx - 1]);
+			}
+		}
+	}
+
+	// Whether the keys key_set[matched_count..] may be in the subtree of node.
+	static bool HasSignatureKeys(const SetTrieNode& node, std::size_t matched_count)
+	{
+		const Signature& missing_keys = SearchSuffixSignatures()[matched_count];
+		return (node.subtree_signature & missing_keys) == missing_keys;
+	}
+};
+
+template<typename TKey, typename TValue, std::size_t SignatureBits>
+const typename SetTrie<TKey, TValue, SignatureBits>::NodeIndex SetTrie<TKey, TValue, SignatureBits>::kRootNodeIndex;
+
+template<typename TKey, typename TValue, std::size_t SignatureBits>
+const typename SetTrie<TKey, TValue, SignatureBits>::NodeIndex SetTrie<TKey, TValue, SignatureBits>::kNoNodeIndex;
@@ -4,6 +4,8 @@
 #include <vector>
 #include <iostream>
 #include <algorithm>
+#include <memory>
+#include <random>
 
 #include "../set_trie.h"
 #include "../gtest_helpers.h"
@@ -109,3 +111,68 @@ TEST(set_trie_test_suite, value_modification_test)
     ASSERT_TRUE(test_set_trie.TryGetValueForKeySet({ 1, 3 }, node_val_3_modified));
     ASSERT_EQ(*node_val_3_modified, "nose 3");
 }
+
+TEST(set_trie_test_suite, signature_test)
+{
+    // Searches with subtree signatures find the same supersets as without.
+    SetTrie<uint32_t, int> test_set_trie;
+    SetTrie<uint32_t, int, 64> test_signature_set_trie;
+    std::mt19937 generator(1);
+    std::vector<std::vector<uint32_t>> key_sets;
+    for (int i = 0; i < 500; ++i) {
+        std::vector<uint32_t> key_set;
+        for (uint32_t key = 0; key < 80; ++key) {
+            if (generator() % 16 == 0) {
+                key_set.push_back(key);
+            }
+        }
+        int* value;
+        if (!test_set_trie.TryGetValueForKeySet(key_set, value)) {
+            test_set_trie.InsertValueForKeySet(key_set, i);
+            test_signature_set_trie.InsertValueForKeySet(key_set, i);
+            key_sets.push_back(key_set);
+        }
+    }
+    for (std::size_t i = 0; i < key_sets.size(); i += 3) {
+        test_set_trie.RemoveValueForKeySet(key_sets[i]);
+        test_signature_set_trie.RemoveValueForKeySet(key_sets[i]);
+    }
+
+    std::vector<int*> supersets;
+    std::vector<int*> signature_supersets;
+    for (uint32_t key_0 = 0; key_0 < 80; ++key_0) {
+        for (uint32_t key_1 = key_0 + 1; key_1 < 80; key_1 += 7) {
+            test_set_trie.FindSuperKeySetValues({ key_0, key_1 }, supersets);
+            test_signature_set_trie.FindSuperKeySetValues({ key_0, key_1 }, signature_supersets);
+            const std::vector<int> values = _ConvertFrom(supersets);
+            const std::vector<int> signature_values = _ConvertFrom(signature_supersets);
+            ASSERT_CONTAINERS_EQ(values, values.size(), signature_values, signature_values.size());
+        }
+    }
+}
+
+TEST(set_trie_test_suite, value_lifetime_test)
+{
+    const std::shared_ptr<int> value = std::make_shared<int>(0);
+    {
+        SetTrie<uint64_t, std::shared_ptr<int>> test_set_trie;
+        std::shared_ptr<int>* value_1 = test_set_trie.InsertValueForKeySet({ 1, 2 }, value);
+        test_set_trie.InsertValueForKeySet({ 1, 2, 3 }, value);
+        test_set_trie.InsertValueForKeySet({ 2 }, value);
+        ASSERT_EQ(value.use_count(), 4);
+
+        // Values keep their addresses as other values are added and removed.
+        for (uint64_t key = 10; key < 1000; ++key) {
+            test_set_trie.InsertValueForKeySet({ 1, key }, std::shared_ptr<int>());
+        }
+        test_set_trie.RemoveValueForKeySet({ 2 });
+        ASSERT_EQ(value.use_count(), 3);
+        ASSERT_EQ(*value_1, value);
+
+        // Removing a value whose node has children destroys it, too.
+        test_set_trie.RemoveValueForKeySet({ 1, 2 });
+        ASSERT_EQ(value.use_count(), 2);
+        ASSERT_EQ(test_set_trie.ValueCount(), 991);
+    }
+    ASSERT_EQ(value.use_count(), 1);
+}
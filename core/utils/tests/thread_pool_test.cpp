@@ -0,0 +1,52 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+#include "../thread_pool.h"
+
+TEST(thread_pool_test_suite, parallel_for_test)
+{
+    ThreadPool thread_pool(4);
+    std::vector<int> visit_counts(1000, 0);
+    thread_pool.ParallelFor(visit_counts.size(), [&visit_counts](std::size_t task_index) {
+        visit_counts[task_index]++;
+    });
+    for (int visit_count : visit_counts) {
+        ASSERT_EQ(visit_count, 1);
+    }
+
+    // Without workers, every task runs on the calling thread.
+    ThreadPool serial_thread_pool(0);
+    std::size_t task_count = 0;
+    serial_thread_pool.ParallelFor(10, [&task_count](std::size_t task_index) {
+        task_count++;
+    });
+    ASSERT_EQ(task_count, 10);
+}
+
+TEST(thread_pool_test_suite, nested_parallel_for_test)
+{
+    ThreadPool thread_pool(3);
+    std::atomic<std::size_t> task_count(0);
+    thread_pool.ParallelFor(8, [&thread_pool, &task_count](std::size_t outer_task_index) {
+        thread_pool.ParallelFor(8, [&task_count](std::size_t inner_task_index) {
+            task_count++;
+        });
+    });
+    ASSERT_EQ(task_count.load(), 64);
+}
+
+TEST(thread_pool_test_suite, exception_test)
+{
+    ThreadPool thread_pool(2);
+    std::atomic<std::size_t> task_count(0);
+    ASSERT_THROW(thread_pool.ParallelFor(100, [&task_count](std::size_t task_index) {
+        task_count++;
+        if (task_index == 50) {
+            throw std::runtime_error("task failed");
+        }
+    }), std::runtime_error);
+    // The remaining tasks still run.
+    ASSERT_EQ(task_count.load(), 100);
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+* Work-stealing thread pool for data-parallel loops. ParallelFor splits its
+* tasks across per-worker queues. Workers take tasks from the back of their
+* own queue and steal from the front of other queues when theirs runs dry.
+* The calling thread also runs tasks until the loop has finished, so
+* ParallelFor may be called from inside a task.
+*/
+class ThreadPool
+{
+public:
+	// Creates a pool with worker_count threads in addition to the calling thread.
+	explicit ThreadPool(std::size_t worker_count) : queued_task_count_(0), stopping_(false)
+	{
+		// There is always at least one queue, even without workers, so that
+		// ParallelFor can run everything on the calling thread.
+		const std::size_t queue_count = std::max<std::size_t>(worker_count, 1);
+		for (std::size_t q_idx = 0; q_idx < queue_count; ++q_idx) {
+			queues_.emplace_back(new TaskQueue());
+		}
+		for (std::size_t w_idx = 0; w_idx < worker_count; ++w_idx) {
+			workers_.emplace_back(&ThreadPool::WorkerLoop, this, w_idx);
+		}
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(wake_mutex_);
+			stopping_ = true;
+		}
+		wake_condition_.notify_all();
+		for (std::thread& worker : workers_) {
+			worker.join();
+		}
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Pool with one worker per hardware thread, besides the calling thread.
+	static ThreadPool& Shared()
+	{
+		static ThreadPool shared_pool(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+		return shared_pool;
+	}
+
+	std::size_t WorkerCount() const
+	{
+		return workers_.size();
+	}
+
+	/*
+	* Calls task(task_index) for every task_index in [0, task_count), possibly
+	* concurrently, and returns once all calls have finished. If any call
+	* throws, the first exception is rethrown here after the others finish.
+	*/
+	void ParallelFor(std::size_t task_count, const std::function<void(std::size_t task_index)>& task)
+	{
+		if (task_count == 0) {
+			return;
+		}
+		if (workers_.empty() || task_count == 1) {
+			for (std::size_t t_idx = 0; t_idx < task_count; ++t_idx) {
+				task(t_idx);
+			}
+			return;
+		}
+
+		Job job(&task, task_count);
+		// Deal out contiguous runs of tasks, so that each worker starts on
+		// neighbouring data.
+		const std::size_t queue_count = queues_.size();
+		for (std::size_t q_idx = 0; q_idx < queue_count; ++q_idx) {
+			const std::size_t begin = task_count * q_idx / queue_count;
+			const std::size_t end = task_count * (q_idx + 1) / queue_count;
+			if (begin == end) {
+				continue;
+			}
+			std::lock_guard<std::mutex> lock(queues_[q_idx]->mutex);
+			// Pushed in reverse since the owning worker pops from the back.
+			for (std::size_t t_idx = end; t_idx > begin; --t_idx) {
+				queues_[q_idx]->tasks.push_back({ &job, t_idx - 1 });
+			}
+		}
+		{
+			std::lock_guard<std::mutex> lock(wake_mutex_);
+			queued_task_count_ += task_count;
+		}
+		wake_condition_.notify_all();
+
+		// Help out until every task of this job has finished.
+		while (job.remaining_count.load(std::memory_order_acquire) > 0) {
+			if (!TryRunTask(CurrentQueueIndex() % queues_.size())) {
+				std::this_thread::yield();
+			}
+		}
+		if (job.exception) {
+			std::rethrow_exception(job.exception);
+		}
+	}
+
+private:
+	struct Job {
+		Job(const std::function<void(std::size_t)>* task, std::size_t task_count) : task(task), remaining_count(task_count) {}
+
+		const std::function<void(std::size_t)>* task;
+		std::atomic<std::size_t> remaining_count;
+		std::mutex exception_mutex;
+		std::exception_ptr exception;
+	};
+
+	struct Task {
+		Job* job;
+		std::size_t index;
+	};
+
+	struct TaskQueue {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	std::vector<std::unique_ptr<TaskQueue>> queues_;
+	std::vector<std::thread> workers_;
+
+	std::mutex wake_mutex_;
+	std::condition_variable wake_condition_;
+	std::size_t queued_task_count_;
+	bool stopping_;
+
+	// Index of the queue owned by the current thread. Threads that are not
+	// workers of a pool start at queue 0.
+	std::size_t& CurrentQueueIndex()
+	{
+		static thread_local std::size_t queue_index = 0;
+		return queue_index;
+	}
+
+	void WorkerLoop(std::size_t queue_index)
+	{
+		CurrentQueueIndex() = queue_index;
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(wake_mutex_);
+				wake_condition_.wait(lock, [this]() { return stopping_ || queued_task_count_ > 0; });
+				if (stopping_) {
+					return;
+				}
+			}
+			TryRunTask(queue_index);
+		}
+	}
+
+	// Runs one task from the own queue, or steals one from another queue.
+	bool TryRunTask(std::size_t own_queue_index)
+	{
+		Task task;
+		bool found = false;
+		{
+			TaskQueue& own_queue = *queues_[own_queue_index];
+			std::lock_guard<std::mutex> lock(own_queue.mutex);
+			if (!own_queue.tasks.empty()) {
+				task = own_queue.tasks.back();
+				own_queue.tasks.pop_back();
+				found = true;
+			}
+		}
+		for (std::size_t offset = 1; !found && offset < queues_.size(); ++offset) {
+			TaskQueue& victim_queue = *queues_[(own_queue_index + offset) % queues_.size()];
+			std::lock_guard<std::mutex> lock(victim_queue.mutex);
+			if (!victim_queue.tasks.empty()) {
+				task = victim_queue.tasks.front();
+				victim_queue.tasks.pop_front();
+				found = true;
+			}
+		}
+		if (!found) {
+			return false;
+		}
+		{
+			std::lock_guard<std::mutex> lock(wake_mutex_);
+			queued_task_count_--;
+		}
+
+		try {
+			(*task.job->task)(task.index);
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> lock(task.job->exception_mutex);
+			if (!task.job->exception) {
+				task.job->exception = std::current_exception();
+			}
+		}
+		task.job->remaining_count.fetch_sub(1, std::memory_order_acq_rel);
+		return true;
+	}
+};
@@ -1,15 +1,23 @@
 #pragma once
 
+#include <atomic>
+
 class TypeIDMapper
 {
 public:
 	template<typename T>
 	int GetTypeId()
 	{
-		static int type_id = ++next_id_;
+		// Ids are assigned once per type, so the counter is shared by every
+		// mapper. It is atomic since types may be seen first on any thread.
+		static int type_id = ++NextId();
 		return type_id;
 	}
 
 private:
-	int next_id_;
-};
\ No newline at end of file
+	static std::atomic<int>& NextId()
+	{
+		static std::atomic<int> next_id(0);
+		return next_id;
+	}
+};
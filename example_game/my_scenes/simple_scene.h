@@ -11,7 +11,8 @@
 
 class SimpleScene : public SceneBase {
 public:
-	SimpleScene(const char* name) : SceneBase(name) {}
+	// Transforms set by the systems are propagated once per frame, before rendering.
+	SimpleScene(const char* name) : SceneBase(name, TransformHierarchyLayoutLinked, TransformPropagationDeferred) {}
 
 	void OnLoad(ServiceContainer& service_container) override {
 		SceneBase::OnLoad(service_container);
@@ -56,9 +57,11 @@ public:
 		MeshRenderableComponent mesh_rend_component;
 		mesh_rend_component.disabled = false;
 		std::shared_ptr<RenderingPipeline> rp = RenderingPipeline::RenderingPipelineForResourcePath("standard_rendering_pipeline/standard.xml");
-		mesh_rend_component.mesh = Mesh::CreateCubeMeshPrimitive({ rp, false }, glm::vec3(0.0f, 0.0f, 0.0f), 1.0f);
-		mesh_rend_component.material = Material::CreateMaterial({ rp });
 		component_registry->AddComponent<MeshRenderableComponent>(box_entity, mesh_rend_component);
+		RenderMeshComponent render_mesh_component;
+		render_mesh_component.mesh = Mesh::CreateCubeMeshPrimitive({ rp, false }, glm::vec3(0.0f, 0.0f, 0.0f), 1.0f);
+		render_mesh_component.material = Material::CreateMaterial({ rp });
+		component_registry->SetSharedComponent<RenderMeshComponent>(box_entity, render_mesh_component);
 		glm::mat4 box_transform = glm::mat4(1.0f);
 		transform::SetPosition(box_transform, glm::vec3(0.2f, 0.2f, 0));
 		transform_service->SetWorldTransform(box_entity, box_transform);
@@ -93,11 +96,15 @@ public:
 
 	void OnFrameUpdate(double delta_time, double alpha) override 
 	{
+		SceneBase::OnFrameUpdate(delta_time, alpha);
+
 		mesh_transformation_system_.OnFrameUpdate(delta_time, alpha);
 
 		// interpolate physics states to avoid jitter in render
 		rigidbody_system_.OnFrameUpdate(delta_time, alpha);
 
+		FlushTransforms();
+
 		// render
 		rendering_system_.OnFrameUpdate(delta_time, alpha);
 	}